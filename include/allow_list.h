@@ -0,0 +1,170 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+
+#include "json_scanner.h"
+
+// 0: every card switches the relay (no list is fetched or kept)
+#ifndef ALLOW_LIST_ENABLED
+#define ALLOW_LIST_ENABLED 1
+#endif
+
+// Largest list accepted from the server (11 bytes of RAM and flash per tag, twice that while
+// an update is applied)
+#ifndef ALLOW_LIST_MAX_TAGS
+#define ALLOW_LIST_MAX_TAGS 4096
+#endif
+
+// Bloom filter size per tag; 10 bits and 7 hashes give about 1% false positives
+#ifndef ALLOW_LIST_BLOOM_BITS_PER_TAG
+#define ALLOW_LIST_BLOOM_BITS_PER_TAG 10
+#endif
+
+#ifndef ALLOW_LIST_BLOOM_HASHES
+#define ALLOW_LIST_BLOOM_HASHES 7
+#endif
+
+// How often the uploader asks the server for changes while it has nothing else to do
+#ifndef ALLOW_LIST_SYNC_MS
+#define ALLOW_LIST_SYNC_MS 60000
+#endif
+
+// Wait after a failed sync
+#ifndef ALLOW_LIST_RETRY_MS
+#define ALLOW_LIST_RETRY_MS 10000
+#endif
+
+/**
+ * One tag UID, zero padded, so tags compare by size and one memcmp (shorter UIDs sort first).
+ */
+struct AllowTag
+{
+  uint8_t size; // ALLOW_TAG_REMOVE marks a removal in an update
+  uint8_t uid[10];
+};
+
+#define ALLOW_TAG_REMOVE 0x80
+
+/**
+ * Orders tags by size, then UID, for qsort and bsearch; the removal flag of an update is
+ * ignored. Also orders structs that start with an AllowTag.
+ */
+int compareTags(const void *a, const void *b);
+
+/**
+ * Reads a UID written as two hex digits per byte. False if the text is not one.
+ */
+bool parseHexTag(const char *text, size_t length, AllowTag &tag);
+
+class StayLimitsUpdate;
+
+struct AllowListStats
+{
+  uint32_t version;          // list version from the server, 0 = never received
+  uint32_t tags;
+  uint32_t memory_bytes;     // tag array and bloom filter
+  uint32_t lookups;
+  uint32_t hits;             // tags on the list
+  uint32_t bloom_rejects;    // misses answered by the bloom filter alone
+  uint32_t bloom_false_hits; // misses the bloom filter let through to the search
+  uint32_t last_lookup_us;
+  uint32_t max_lookup_us;
+  uint64_t total_lookup_us;  // average = total / lookups
+  uint32_t syncs;            // updates applied
+  uint32_t sync_failures;    // requests or updates that failed
+};
+
+/**
+ * Collects a /api/allow-list response while it streams in:
+ *   {"version": 42, "full": false, "changes": ["+04A1B2C3", "-0411223344556677", ...]}
+ * Each change adds (+) or removes (-) one UID, two hex digits per byte; a tag appears at
+ * most once per update. "full" means the changes are the whole list rather than a delta
+ * from the version that was sent.
+ *
+ * The response may also carry per-card stay limits, handed to limits when it is set:
+ *   "limits": [{"tag": "04A1B2C3", "stay_s": 14400, "expires": 1767225600}, ...]
+ * They are sent in full whenever they change and with every full list (see stay_limits.h).
+ */
+class AllowListUpdate : public JsonHandler
+{
+public:
+  ~AllowListUpdate();
+
+  void value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type) override;
+  void objectEnd(uint8_t depth) override;
+
+  uint32_t version = 0;
+  bool has_version = false;
+  bool full = false;
+  bool overflowed = false; // more changes than ALLOW_LIST_MAX_TAGS, or a malformed one
+  AllowTag *changes = nullptr;
+  size_t count = 0;
+  StayLimitsUpdate *limits = nullptr;
+
+private:
+  size_t capacity = 0;
+};
+
+/**
+ * Tags allowed to switch the relay, decided by the server but looked up locally so the
+ * relay never waits on the network. The tags are kept sorted in RAM behind a bloom filter
+ * and saved to LittleFS, so the list survives a reboot without the server.
+ *
+ * The uploader task fetches versioned deltas (maintain()); a new list is built next to the
+ * old one and swapped in under the lock, so a lookup from loop() only ever holds the lock
+ * for one bloom check and binary search. Until the first list arrives every tag is allowed,
+ * which keeps the device usable against a server without the endpoint.
+ */
+class AllowList
+{
+public:
+  /**
+   * Loads the saved list. Call after LittleFS is mounted (journal.begin()).
+   */
+  void begin();
+
+  /**
+   * True if the tag may switch the relay. Safe to call from loop(); takes a few us.
+   */
+  bool allowed(const uint8_t *uid, uint8_t size);
+
+  /**
+   * Applies an update from the server and saves the result. A full update hands its change
+   * buffer over instead of copying it. Returns false (keeping the current list) if the
+   * update is incomplete or too large.
+   */
+  bool apply(AllowListUpdate &update);
+
+  /**
+   * Uploader task: asks the server for changes every ALLOW_LIST_SYNC_MS.
+   */
+  void maintain(const char *device_UID);
+
+  /**
+   * Uploader task: makes the next maintain() ask the server, e.g. when told the list changed.
+   */
+  void syncSoon() { next_sync_ms = millis(); }
+
+  uint32_t version() const { return current_version; }
+
+  AllowListStats stats();
+  void printStats();
+
+private:
+  bool bloomMayContain(const AllowTag &tag) const;
+  void install(AllowTag *new_tags, uint32_t new_count, uint32_t new_version);
+  void save();
+  void countSync(bool ok);
+
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  AllowTag *tags = nullptr;
+  uint32_t count = 0;
+  uint32_t *bloom = nullptr;
+  uint32_t bloom_mask = 0; // bloom filter bits - 1
+  uint32_t current_version = 0;
+  uint32_t next_sync_ms = 0;
+  AllowListStats counters = {};
+};
+
+extern AllowList allowList;
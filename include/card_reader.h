@@ -0,0 +1,187 @@
+#pragma once
+
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "pcd_bus.h"
+#include "power_manager.h"
+#include "scan_event.h"
+
+// 1: wait for the MFRC522 IRQ line (RxIRq) between wake-ups; 0: poll with WUPA on every loop()
+#ifndef CARD_DETECT_IRQ
+#define CARD_DETECT_IRQ 1
+#endif
+
+// ESP32 pin wired to the IRQ output of the first MFRC522 (see reader_pins in main.cpp)
+#ifndef CARD_IRQ_PIN
+#define CARD_IRQ_PIN 21
+#endif
+
+// Receive timeout of the MFRC522 timer: an unanswered frame (and every HLTA) costs this long.
+// The library sets 25 ms; several readers share the loop, so they get a shorter one.
+#ifndef CARD_TIMEOUT_MS
+#if READER_COUNT > 1
+#define CARD_TIMEOUT_MS 5
+#else
+#define CARD_TIMEOUT_MS 25
+#endif
+#endif
+
+// Longest one reader holds the SPI bus per round: a failed wake-up and select, or select and halt
+#define CARD_SERVICE_MS (2 * CARD_TIMEOUT_MS + 5)
+
+// IRQ mode: upper bound on tap-to-relay latency, for every reader. A card that arrives just
+// after a wake-up is found by the next one, so the wake-up interval is derived from this bound.
+#ifndef CARD_MAX_TAP_LATENCY_MS
+#define CARD_MAX_TAP_LATENCY_MS 150
+#endif
+
+// Time reserved after a card answers for select, relay and light-sleep exit
+#ifndef CARD_LOCK_BUDGET_MS
+#define CARD_LOCK_BUDGET_MS 25
+#endif
+
+// Cards need the field this long after it is switched on before they answer
+#ifndef CARD_FIELD_SETTLE_MS
+#define CARD_FIELD_SETTLE_MS 5
+#endif
+
+// IRQ mode: listen this long after a wake-up, then switch the antenna off until the next one
+// (0 keeps the field on and listens for the whole interval)
+#ifndef CARD_SENSE_WINDOW_MS
+#if POWER_MODE >= 2 && CARD_DETECT_IRQ
+#define CARD_SENSE_WINDOW_MS 3
+#else
+#define CARD_SENSE_WINDOW_MS 0
+#endif
+#endif
+
+// IRQ mode: how often a wake-up is sent into each reader's field. The other readers may each
+// take CARD_SERVICE_MS of the loop before a reader whose card answered is served.
+#ifndef CARD_DETECT_INTERVAL_MS
+#define CARD_DETECT_INTERVAL_MS (CARD_MAX_TAP_LATENCY_MS - CARD_LOCK_BUDGET_MS - (READER_COUNT - 1) * CARD_SERVICE_MS)
+#endif
+
+static_assert(CARD_DETECT_INTERVAL_MS + CARD_LOCK_BUDGET_MS + (READER_COUNT - 1) * CARD_SERVICE_MS <= CARD_MAX_TAP_LATENCY_MS,
+              "card wake-up interval does not fit the tap-to-relay latency bound");
+static_assert(CARD_SENSE_WINDOW_MS == 0 || CARD_FIELD_SETTLE_MS + CARD_SENSE_WINDOW_MS < CARD_DETECT_INTERVAL_MS,
+              "card sense window does not fit the wake-up interval");
+
+struct CardReaderStats
+{
+  uint32_t probes;           // wake-ups sent while no card was locked
+  uint32_t irqs;             // card answers signalled on the IRQ line
+  uint32_t fallback_hits;    // card answers found in ComIrqReg at the end of a window without an IRQ
+  uint32_t presence_checks;  // checks of a locked card
+  uint32_t detections;       // cards locked
+  uint32_t max_probe_gap_ms; // longest time between wake-ups (bounds the detection latency)
+  uint32_t last_detect_us;   // IRQ (or poll) to card locked, last card
+  uint32_t max_detect_us;
+  uint64_t total_detect_us;  // average = total / detections
+  uint32_t last_tap_ms;      // previous empty wake-up to card locked (worst case tap-to-relay), last card
+  uint32_t max_tap_ms;
+  uint32_t over_budget;      // cards whose worst case exceeded CARD_MAX_TAP_LATENCY_MS
+};
+
+enum CardReaderAction : uint8_t
+{
+  CARD_NONE,     // nothing to do yet
+  CARD_ANSWERED, // a new card answered a wake-up and is ready to be selected
+  CARD_CHECK     // the locked card was woken for its presence check and can be selected
+};
+
+/**
+ * Card detection for one MFRC522, stepped by the reader array without blocking. In IRQ mode
+ * the reader is armed with a WUPA and the RxIRq interrupt enabled; the array sleeps until a
+ * card answers or some reader's next wake-up is due. The MFRC522 has no autonomous field
+ * detector, so a wake-up still has to be sent every CARD_DETECT_INTERVAL_MS, but that is
+ * a few SPI frames instead of a busy loop. RxIRq is also read at the end of each listen
+ * window, so an answer is found even if the IRQ line is not wired (irq_pin -1) or an edge
+ * was missed. A locked card is checked at the interval its presence tracker asks for
+ * (see presence_tracker.h).
+ *
+ * With CARD_SENSE_WINDOW_MS the antenna is only on for the settle time and a short listen
+ * window per wake-up. The field is switched on ahead of a wake-up or presence check, so
+ * settling does not hold up the other readers.
+ *
+ * The registers of a wake-up, the IRQ bits and the antenna go through a PcdBus (see
+ * pcd_bus.h): batched, at PCD_SPI_HZ, and without rewriting configuration that is already set.
+ */
+class CardReader
+{
+public:
+  /**
+   * Call after rfid.PCD_Init(), from the task that runs loop(). ss_pin: the chip select given
+   * to PCD_Init(); irq_pin -1: not wired.
+   */
+  void begin(MFRC522 &rfid, uint8_t ss_pin, int8_t irq_pin, uint8_t index);
+
+  /**
+   * Advances detection (no card locked) or the presence check (card locked). Only the WUPA
+   * of a presence check or a polling-mode wake-up waits for the air interface.
+   */
+  CardReaderAction step(bool locked);
+
+  /**
+   * Milliseconds until step() has something to do; 0 means call it now.
+   */
+  uint32_t idleTime(bool locked);
+
+  /**
+   * Call after the select (and halt) that followed CARD_ANSWERED or CARD_CHECK; check_ms is
+   * the time until the next presence check if a card is locked.
+   */
+  void serviced(bool locked, uint32_t check_ms);
+
+  /**
+   * Call once PICC_Select() locked a card; records the detection latency.
+   */
+  void cardLocked();
+
+  /**
+   * esp_timer time (truncated to 32 bits) at which the last card answered.
+   */
+  uint32_t detectedAt() const { return (uint32_t)detected_us; }
+
+  CardReaderStats stats() const { return counters; }
+  PcdBusStats busStats() const { return bus.stats(); }
+  void printStats();
+
+private:
+  enum DetectState : uint8_t
+  {
+    DETECT_IDLE,     // waiting for the next wake-up
+    DETECT_SETTLING, // field switched on, waiting for cards to power up
+    DETECT_LISTENING // WUPA sent, waiting for an answer
+  };
+
+  static void IRAM_ATTR onIrq(void *arg);
+
+  CardReaderAction answered(bool from_irq);
+  MFRC522::StatusCode wakeup();
+  void arm();
+  void clearIrq();
+  void powerField(bool on);
+  void countProbe();
+
+  MFRC522 *rfid = nullptr;
+  PcdBus bus;
+  TaskHandle_t task = nullptr;
+  uint8_t index = 0;
+  DetectState state = DETECT_IDLE;
+  uint32_t next_wake_ms = 0;
+  uint32_t settled_ms = 0;
+  uint32_t armed_ms = 0;
+  uint32_t listen_ms = CARD_DETECT_INTERVAL_MS;
+  uint32_t last_probe_ms = 0;
+  uint32_t next_check_ms = 0;
+  int64_t detected_us = 0;
+  int64_t sensed_us = 0;
+  bool field_on = true;
+  volatile bool irq_pending = false;
+  volatile int64_t irq_us = 0;
+  CardReaderStats counters = {};
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+/*
+ * Device-wide settings shared by the firmware modules. They point into the configuration
+ * loaded by configStore.begin() (config_store.h); the factory defaults are in main.cpp.
+ */
+
+// Server Credentials
+extern const char *client_key;
+extern const char *client_secret;
+
+// Server Addresses
+extern const char *request_token_address;
+extern const char *send_data_address;
+extern const char *send_data_batch_address;
+extern const char *allow_list_address;
+extern const char *config_address;
+
+// MQTT broker for UPLOAD_TRANSPORT_MQTT (see push_channel.h)
+extern const char *mqtt_broker_host;
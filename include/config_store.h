@@ -0,0 +1,133 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "json_scanner.h"
+#include "wifi_connection.h"
+
+// Access points kept in the configuration (tried in order)
+#ifndef CONFIG_MAX_NETWORKS
+#define CONFIG_MAX_NETWORKS 4
+#endif
+
+// How often the uploader asks the server for a newer configuration while it has nothing else to do
+#ifndef CONFIG_SYNC_MS
+#define CONFIG_SYNC_MS 600000
+#endif
+
+// Wait after a failed sync
+#ifndef CONFIG_RETRY_MS
+#define CONFIG_RETRY_MS 60000
+#endif
+
+struct NetworkConfig
+{
+  char ssid[33];
+  char password[65];
+};
+
+/**
+ * Everything that differs between deployments. Fixed-size strings so the whole struct is one
+ * NVS blob, read once at boot.
+ */
+struct DeviceConfig
+{
+  uint32_t version; // 0 = the factory defaults, never updated
+  char client_key[48];
+  char client_secret[48];
+  char server[64];    // base URL of the API, e.g. "http://13.250.246.54"
+  char mqtt_host[64]; // broker for UPLOAD_TRANSPORT_MQTT
+  int32_t gmt_offset_s;
+  int32_t daylight_offset_s;
+  uint8_t network_count;
+  NetworkConfig networks[CONFIG_MAX_NETWORKS];
+};
+
+struct ConfigStats
+{
+  uint32_t version;
+  bool from_nvs;         // false: the factory defaults
+  uint32_t load_us;      // NVS read and endpoint setup at boot
+  uint32_t updates;      // newer configurations saved
+  uint32_t rejected;     // updates that were incomplete or not newer
+  uint32_t sync_failures;
+};
+
+/**
+ * Collects a configuration from /api/config or the MQTT config command as it streams in:
+ *   {"version": 7, "client_key": .., "client_secret": .., "server": "http://..",
+ *    "mqtt_host": .., "gmt_offset_s": 28800, "daylight_offset_s": 0,
+ *    "networks": [{"ssid": .., "password": ..}, ...]}
+ * Members left out keep their current value; "networks", when present, replaces the list.
+ */
+class ConfigUpdate : public JsonHandler
+{
+public:
+  /**
+   * Starts from the current configuration.
+   */
+  explicit ConfigUpdate(const DeviceConfig &base) : config(base) {}
+
+  void value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type) override;
+  void objectEnd(uint8_t depth) override;
+
+  DeviceConfig config;
+  bool has_version = false;
+  bool overflowed = false; // a string or the network list did not fit
+
+private:
+  bool networks_seen = false;
+};
+
+/**
+ * Runtime configuration: credentials, server endpoints, access points and time zone, loaded
+ * once at boot from NVS (or the factory defaults in main.cpp) into RAM, so nothing is parsed
+ * again on the scan or reconnect path. The globals in config.h point into it.
+ *
+ * A newer version from the server is saved to NVS and takes effect with a restart once no
+ * relay is on and every queued scan is in the journal on flash; the running values never
+ * change under the tasks that use them.
+ */
+class ConfigStore
+{
+public:
+  /**
+   * Loads the saved configuration, or defaults if there is none (or it is from an
+   * incompatible firmware). Call first in setup(); defaults must stay valid.
+   */
+  void begin(const DeviceConfig &defaults);
+
+  const DeviceConfig &get() const { return config; }
+
+  /**
+   * The access points as WiFiConnection takes them.
+   */
+  const WiFiNetwork *networks() const { return wifi_networks; }
+  size_t networkCount() const { return config.network_count; }
+
+  /**
+   * Saves an update if it is newer than the running configuration and schedules the restart.
+   * Returns false (changing nothing) otherwise.
+   */
+  bool apply(const ConfigUpdate &update);
+
+  /**
+   * Uploader task: asks the server for a newer configuration every CONFIG_SYNC_MS, and
+   * restarts into a saved one when it is safe.
+   */
+  void maintain(const char *device_UID);
+
+  ConfigStats stats() const { return counters; }
+  void printStats();
+
+private:
+  void publish();
+
+  DeviceConfig config = {};
+  WiFiNetwork wifi_networks[CONFIG_MAX_NETWORKS] = {};
+  bool restart_pending = false;
+  uint32_t next_sync_ms = 0;
+  ConfigStats counters = {};
+};
+
+extern ConfigStore configStore;
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Bitwise CRC-32 (IEEE), small records only so no lookup table is needed. Pass the previous
+ * result to continue a CRC over several buffers.
+ */
+inline uint32_t crc32(const void *data, size_t length, uint32_t previous = 0)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint32_t crc = ~previous;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "event_serializer.h"
+#include "json_scanner.h"
+#include "scan_event.h"
+
+// Most events packed into one batch POST (also the journal replay chunk)
+#ifndef BATCH_MAX_EVENTS
+#define BATCH_MAX_EVENTS 16
+#endif
+
+// How long a fresh event may wait for more events to share its POST (0 = send right away)
+#ifndef BATCH_MAX_WAIT_MS
+#define BATCH_MAX_WAIT_MS 0
+#endif
+
+// Payload buffer for a full batch: credentials plus up to ~160 bytes per event
+#define BATCH_BUFFER_SIZE (384 + BATCH_MAX_EVENTS * 160)
+
+/**
+ * Server verdict for one event of a batch.
+ */
+enum BatchAck : uint8_t
+{
+  BATCH_ACK_NONE,     // not acknowledged, send again later
+  BATCH_ACK_OK,       // stored by the server
+  BATCH_ACK_REJECTED  // refused as invalid, do not send again
+};
+
+/**
+ * Writes the /api/send-data/batch request for records[0..count) into out:
+ *
+ *   {"client_key": .., "client_secret": .., "receiver_serial_no": .., "receiver_token": ..,
+ *    "events": [{"seq": 12, "tag_serial_no": .., "scan_time": .., "scan_type": .., "reader": ..}, ...]}
+ *
+ * "seq" is the journal sequence number; the server uses it with receiver_serial_no to
+ * acknowledge events and to drop duplicates of a resent batch.
+ * Returns the payload length, or 0 if it does not fit into out_size.
+ */
+size_t serializeEventBatch(const ReceiverCredentials &credentials, const JournalRecord *records, size_t count, char *out, size_t out_size);
+
+/**
+ * One event as a message of its own, the members of an "events" entry above:
+ *
+ *   {"seq": 12, "tag_serial_no": .., "scan_time": .., "scan_type": .., "reader": ..}
+ *
+ * Used where the connection already identifies the receiver (MQTT, see push_channel.h).
+ * Returns the payload length, or 0 if it does not fit into out_size.
+ */
+size_t writeScanMessage(const JournalRecord &record, char *out, size_t out_size);
+
+/**
+ * Reads the per-event acknowledgements of a batch response as it streams in:
+ *
+ *   {"results": [{"seq": 12, "status": "ok"}, {"seq": 13, "status": "rejected"}, ...]}
+ *
+ * acks[i] is set for records[i]; events missing from the response stay BATCH_ACK_NONE.
+ */
+class BatchAckParser : public JsonHandler
+{
+public:
+  BatchAckParser(const JournalRecord *records, size_t count, BatchAck *acks);
+
+  void value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type) override;
+  void objectEnd(uint8_t depth) override;
+
+private:
+  const JournalRecord *records;
+  size_t count;
+  BatchAck *acks;
+  uint32_t seq = 0;
+  bool has_seq = false;
+  BatchAck status = BATCH_ACK_NONE;
+};
+
+/**
+ * Same as BatchAckParser for a response that is already in memory.
+ * Returns false if the response could not be parsed.
+ */
+bool parseBatchAcks(const char *response, size_t length, const JournalRecord *records, size_t count, BatchAck *acks);
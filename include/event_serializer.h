@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scan_event.h"
+
+// Enough for one /api/send-data or /api/request-token payload with a 256 character token
+#define SEND_DATA_BUFFER_SIZE 640
+
+/**
+ * Fields shared by every request a receiver sends.
+ */
+struct ReceiverCredentials
+{
+  const char *client_key;
+  const char *client_secret;
+  const char *device_UID;
+  const char *token;
+};
+
+/**
+ * Writes compact JSON straight into a caller-provided buffer, without building a document
+ * first. The payloads have a fixed schema, so nothing needs to be allocated.
+ */
+class JsonWriter
+{
+public:
+  JsonWriter(char *buffer, size_t size) : out(buffer), size(size) {}
+
+  void beginObject(const char *key = nullptr);
+  void endObject();
+  void beginArray(const char *key);
+  void endArray();
+  void field(const char *key, const char *value); // nullptr is written as null
+  void field(const char *key, uint32_t value);
+
+  /**
+   * Nul-terminates the output. Returns its length, or 0 if it did not fit.
+   */
+  size_t finish();
+
+private:
+  void separator();
+  void key(const char *name);
+  void raw(char c);
+  void raw(const char *text);
+  void string(const char *text);
+
+  char *out;
+  size_t size;
+  size_t pos = 0;
+  bool overflow = false;
+  bool first = true; // no member written yet in the current container
+};
+
+/**
+ * "Entry", "Exit", "Denied" or "Expired", as the server expects scan_type.
+ */
+const char *scanTypeName(uint8_t type);
+
+/**
+ * Writes a UID as the tag serial the server knows (see getUIDString() in earlier builds: two
+ * hex digits per byte, plus an extra leading zero for bytes below 0x10). Returns the length.
+ */
+size_t formatTag(char *out, size_t size, const uint8_t *uid, uint8_t uid_size);
+
+/**
+ * Writes epoch as local time, "%m-%d-%Y %H:%M:%S", or "" if it is 0 (time not known).
+ * Returns the length.
+ */
+size_t formatScanTime(char *out, size_t size, uint32_t epoch);
+
+/**
+ * {"client_key": .., "client_secret": .., "serial_no": ..} for /api/request-token.
+ * Returns the payload length, or 0 if it does not fit into size.
+ */
+size_t writeTokenRequest(char *out, size_t size, const char *client_key, const char *client_secret, const char *device_UID);
+
+/**
+ * The /api/send-data payload, same fields and order as the former JsonDocument version,
+ * plus "reader" when reader >= 0. Returns the payload length, or 0 if it does not fit into size.
+ */
+size_t writeSendData(char *out, size_t size, const ReceiverCredentials &credentials,
+                     const char *tag_serial_no, const char *scan_time, const char *scan_type, int reader = -1);
+
+/**
+ * The /api/send-data payload for a scan event, formatted here; "reader" is only sent with
+ * READER_COUNT > 1, so single-reader payloads stay as they were.
+ */
+size_t writeSendData(char *out, size_t size, const ReceiverCredentials &credentials, const ScanEvent &event);
+
+/**
+ * The /api/allow-list request: the credentials and the list version the receiver holds.
+ * /api/config takes the same request with the configuration version.
+ * Returns the payload length, or 0 if it does not fit into size.
+ */
+size_t writeAllowListRequest(char *out, size_t size, const ReceiverCredentials &credentials, uint32_t version);
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <freertos/FreeRTOS.h>
+
+// 1: record what the readers and the server answered to LittleFS, for replay on the host
+// (tools/replay). Off in production builds.
+#ifndef FIELD_TRACE
+#define FIELD_TRACE 0
+#endif
+
+// Records are collected in RAM and appended to the file by the uploader task
+#ifndef FIELD_TRACE_BUFFER_SIZE
+#define FIELD_TRACE_BUFFER_SIZE 2048
+#endif
+
+#ifndef FIELD_TRACE_FLUSH_MS
+#define FIELD_TRACE_FLUSH_MS 1000
+#endif
+
+// Recording stops once the file is this large
+#ifndef FIELD_TRACE_MAX_BYTES
+#define FIELD_TRACE_MAX_BYTES 262144
+#endif
+
+#define FIELD_TRACE_PATH "/field.trc"
+#define FIELD_TRACE_MAGIC "HMF1"
+
+/**
+ * Record kinds. A record is one byte kind << 4 | reader (or endpoint), the time since the
+ * previous record in us as a varint, then:
+ *   FIELD_ANSWER  status         a card answered a detection wake-up (IRQ, register or poll)
+ *   FIELD_WAKE    status         the wake-up of a presence check
+ *   FIELD_SELECT  status, size, uid[size]
+ *   FIELD_HTTP    zigzag varint HTTP code (or HTTPClient error), varint duration in us
+ * Empty detection wake-ups are not recorded: a reader with no record due has no card.
+ */
+enum FieldRecordKind : uint8_t
+{
+  FIELD_ANSWER = 1,
+  FIELD_WAKE,
+  FIELD_SELECT,
+  FIELD_HTTP
+};
+
+/**
+ * Endpoint of a FIELD_HTTP record.
+ */
+enum FieldEndpoint : uint8_t
+{
+  FIELD_ENDPOINT_OTHER,
+  FIELD_ENDPOINT_TOKEN,
+  FIELD_ENDPOINT_SEND_DATA,
+  FIELD_ENDPOINT_BATCH,
+  FIELD_ENDPOINT_ALLOW_LIST,
+  FIELD_ENDPOINT_CONFIG
+};
+
+/**
+ * The endpoint a request path (or URL) ends in.
+ */
+FieldEndpoint fieldEndpoint(const char *url);
+
+struct FieldTraceStats
+{
+  uint32_t records;
+  uint32_t bytes;   // written to the file
+  uint32_t dropped; // records lost to a full buffer or file
+};
+
+/**
+ * Field recorder: the outcome of every reader transfer the card state machine acts on, and of
+ * every HTTP request, with its time, in a compact binary file (FIELD_TRACE_PATH). Replaying
+ * it through the host fakes reproduces a field incident without the hardware. Recording is a
+ * few stores under a spinlock from loop() or the uploader task; the uploader task writes the
+ * file. Everything compiles away without FIELD_TRACE.
+ */
+class FieldTrace
+{
+public:
+  /**
+   * Starts a new file (the previous one is kept as FIELD_TRACE_PATH ".old"). Call after
+   * LittleFS is mounted (journal.begin()).
+   */
+  void begin();
+
+  void answer(uint8_t reader, MFRC522::StatusCode status)
+  {
+#if FIELD_TRACE
+    recordStatus(FIELD_ANSWER, reader, status);
+#endif
+  }
+
+  void wake(uint8_t reader, MFRC522::StatusCode status)
+  {
+#if FIELD_TRACE
+    recordStatus(FIELD_WAKE, reader, status);
+#endif
+  }
+
+  void select(uint8_t reader, MFRC522::StatusCode status, const MFRC522::Uid &uid)
+  {
+#if FIELD_TRACE
+    recordSelect(reader, status, uid);
+#endif
+  }
+
+  void http(const char *url, int code, uint32_t duration_us)
+  {
+#if FIELD_TRACE
+    recordHttp(url, code, duration_us);
+#endif
+  }
+
+  /**
+   * Uploader task: appends the collected records to the file every FIELD_TRACE_FLUSH_MS.
+   */
+  void maintain();
+
+  /**
+   * Writes the file to Serial as hex, for tools/replay (which takes the dump as it is).
+   */
+  void dump();
+
+  FieldTraceStats stats() const { return counters; }
+
+private:
+  void recordStatus(FieldRecordKind kind, uint8_t reader, MFRC522::StatusCode status);
+  void recordSelect(uint8_t reader, MFRC522::StatusCode status, const MFRC522::Uid &uid);
+  void recordHttp(const char *url, int code, uint32_t duration_us);
+  void append(FieldRecordKind kind, uint8_t low, const uint8_t *payload, size_t length);
+  void flush();
+
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  bool recording = false;
+  int64_t last_us = 0;
+  uint8_t buffer[FIELD_TRACE ? FIELD_TRACE_BUFFER_SIZE : 1];
+  size_t used = 0;
+  uint32_t flushed_ms = 0;
+  FieldTraceStats counters = {};
+};
+
+extern FieldTrace fieldTrace;
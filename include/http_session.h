@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <WiFiClient.h>
+
+#include "json_scanner.h"
+
+// Response timeout for one request on the shared connection
+#ifndef HTTP_TIMEOUT_MS
+#define HTTP_TIMEOUT_MS 5000
+#endif
+
+#ifndef HTTP_CONNECT_TIMEOUT_MS
+#define HTTP_CONNECT_TIMEOUT_MS 3000
+#endif
+
+struct HttpSessionStats
+{
+  uint32_t requests;         // POSTs attempted
+  uint32_t reused;           // requests that went out on an already open connection
+  uint32_t connects;         // new TCP connections opened
+  uint32_t reconnects;       // retries after the server had closed an idle connection
+  uint32_t errors;           // requests that ended without an HTTP status
+  uint64_t body_bytes;       // request bodies sent
+  uint32_t last_latency_us;  // POST + response body, last request
+  uint32_t max_latency_us;
+  uint64_t total_latency_us; // average = total / requests
+};
+
+/**
+ * One long-lived HTTP/1.1 keep-alive connection to the server, shared by RequestToken(),
+ * SendData() and SendBatch(). A connection dropped by the server is reopened transparently.
+ * Not thread-safe: only the uploader task sends requests after setup().
+ */
+class HttpSession
+{
+public:
+  /**
+   * POSTs a body (JSON unless content_type says otherwise) to url. The response body is
+   * streamed into response as it arrives (nullptr discards it), so it is never buffered as a whole.
+   * Returns the HTTP status code, or a negative HTTPClient error code.
+   */
+  int post(const char *url, const char *body, size_t length, Stream *response = nullptr,
+           const char *content_type = "application/json");
+
+  /**
+   * Same, feeding the response body to a JSON scanner.
+   */
+  int post(const char *url, const char *body, size_t length, JsonScanner &response,
+           const char *content_type = "application/json");
+
+  /**
+   * Closes the connection, e.g. when WiFi went down.
+   */
+  void close();
+
+  HttpSessionStats stats() const { return counters; }
+  void printStats();
+
+private:
+  int send(const char *url, const char *body, size_t length, Stream *response, const char *content_type);
+
+  WiFiClient client;
+  HTTPClient http;
+  bool configured = false;
+  HttpSessionStats counters = {};
+};
+
+extern HttpSession httpSession;
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Receives the values found by JsonScanner.
+ */
+class JsonHandler
+{
+public:
+  enum ValueType : uint8_t
+  {
+    STRING,
+    NUMBER,
+    LITERAL // true, false or null
+  };
+
+  /**
+   * A scalar value. depth is 1 for members of the root object; key is the member name
+   * ("" inside arrays). value is nul-terminated and may be truncated to the scanner buffer.
+   */
+  virtual void value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type) = 0;
+
+  /**
+   * The object that held members at depth has been closed.
+   */
+  virtual void objectEnd(uint8_t depth) {}
+
+  virtual ~JsonHandler() {}
+};
+
+/**
+ * Streaming JSON reader for server responses. Bytes can be fed in any chunk size as they
+ * arrive from the socket; only scalar values are reported and nothing is allocated, so a
+ * response never has to be held in memory as a whole.
+ */
+class JsonScanner
+{
+public:
+  /**
+   * value_buffer holds one value at a time; longer strings are truncated.
+   */
+  JsonScanner(JsonHandler &handler, char *value_buffer, size_t value_size);
+
+  /**
+   * Consumes the next part of the document. Returns false once a syntax error was seen.
+   */
+  bool feed(const char *data, size_t length);
+
+  /**
+   * True when a complete top-level value has been read.
+   */
+  bool complete() const { return state == DONE; }
+  bool failed() const { return state == ERROR; }
+
+private:
+  enum State : uint8_t
+  {
+    VALUE,        // expecting a value
+    KEY_OR_END,   // after '{'
+    KEY,          // after ',' in an object
+    COLON,        // after a key
+    STRING,
+    STRING_ESCAPE,
+    STRING_UNICODE,
+    NUMBER,
+    LITERAL,
+    AFTER_VALUE,  // expecting ',' or a closing bracket
+    DONE,
+    ERROR
+  };
+
+  static const uint8_t MAX_DEPTH = 16;
+
+  bool step(char c);
+  void append(char c);
+  void endValue(JsonHandler::ValueType type);
+  void push(bool object);
+  bool inObject() const { return depth > 0 && (objects & (1u << (depth - 1))); }
+
+  JsonHandler &handler;
+  char *buffer;
+  size_t buffer_size;
+  size_t length = 0;
+
+  char key[32];
+  bool reading_key = false;
+  uint16_t unicode = 0;
+  uint8_t unicode_digits = 0;
+
+  State state = VALUE;
+  uint8_t depth = 0;
+  uint16_t objects = 0; // bit n set when the container at depth n + 1 is an object
+};
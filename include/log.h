@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_VERBOSE 5
+
+// Messages above this level are compiled out, arguments included (set in platformio.ini)
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// 1: messages are queued and written to Serial by a low-priority task instead of the caller
+#ifndef LOG_ASYNC
+#define LOG_ASYNC 0
+#endif
+
+// Queued output that has not been written yet; further messages are dropped when it is full
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 2048
+#endif
+
+// Longest message, longer ones are truncated
+#ifndef LOG_LINE_SIZE
+#define LOG_LINE_SIZE 192
+#endif
+
+#ifndef LOG_TASK_CORE
+#define LOG_TASK_CORE 0
+#endif
+
+/**
+ * printf-style log line with a timestamp and level prefix; use the LOG_* macros below so
+ * disabled levels cost nothing.
+ */
+void logPrintf(uint8_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Starts the output task when LOG_ASYNC is set. Messages logged before are queued.
+ */
+void logBegin();
+
+/**
+ * Messages dropped because the queue was full (LOG_ASYNC).
+ */
+uint32_t logDropped();
+
+#define LOG_DISCARD(...) \
+  do                     \
+  {                      \
+  } while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logPrintf(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_DISCARD()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logPrintf(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_DISCARD()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logPrintf(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_DISCARD()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logPrintf(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_DISCARD()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_VERBOSE
+#define LOG_VERBOSE(...) logPrintf(LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#else
+#define LOG_VERBOSE(...) LOG_DISCARD()
+#endif
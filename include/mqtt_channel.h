@@ -0,0 +1,107 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+// Largest packet read from the broker (pushed allow list updates); longer ones are skipped
+#ifndef MQTT_RX_BUFFER_SIZE
+#define MQTT_RX_BUFFER_SIZE 2048
+#endif
+
+// Largest packet sent: topic plus one scan message
+#ifndef MQTT_TX_BUFFER_SIZE
+#define MQTT_TX_BUFFER_SIZE 512
+#endif
+
+#ifndef MQTT_KEEPALIVE_S
+#define MQTT_KEEPALIVE_S 30
+#endif
+
+#ifndef MQTT_CONNECT_TIMEOUT_MS
+#define MQTT_CONNECT_TIMEOUT_MS 3000
+#endif
+
+/**
+ * Receives what the broker sends on an MqttChannel.
+ */
+class MqttHandler
+{
+public:
+  virtual ~MqttHandler() {}
+
+  /**
+   * The broker acknowledged the QoS 1 publish with this packet id.
+   */
+  virtual void acked(uint16_t packet_id) = 0;
+
+  /**
+   * A message arrived on a subscribed topic. Both are only valid during the call.
+   */
+  virtual void message(const char *topic, const uint8_t *payload, size_t length) = 0;
+};
+
+struct MqttChannelStats
+{
+  uint32_t connects;   // sessions established
+  uint32_t failures;   // connection attempts refused or timed out, and sessions lost
+  uint32_t published;  // PUBLISH packets sent
+  uint32_t acked;      // PUBACKs received
+  uint32_t received;   // PUBLISH packets received
+  uint32_t skipped;    // received packets larger than MQTT_RX_BUFFER_SIZE
+};
+
+/**
+ * Minimal MQTT 3.1.1 client: one clean session over a WiFiClient, QoS 1 publishes without
+ * waiting for their acknowledgement (any number may be in flight), QoS 1 subscriptions and
+ * keep-alive pings. Nothing is retransmitted here; the caller resends what was not acked
+ * after a reconnect. Never blocks except in connect(). Not thread-safe: only the uploader
+ * task uses it.
+ */
+class MqttChannel
+{
+public:
+  /**
+   * Opens the TCP connection and the session; blocks for up to MQTT_CONNECT_TIMEOUT_MS.
+   * The strings are only used during the call.
+   */
+  bool connect(const char *host, uint16_t port, const char *client_id, const char *username, const char *password);
+
+  bool connected();
+  void close();
+
+  /**
+   * Subscribes to a topic filter with QoS 1. The SUBACK is not waited for.
+   */
+  bool subscribe(const char *filter);
+
+  /**
+   * Sends a QoS 1 PUBLISH. Returns its packet id, or 0 if it could not be sent.
+   */
+  uint16_t publish(const char *topic, const uint8_t *payload, size_t length);
+
+  /**
+   * Reads everything the broker has sent and hands it to handler, and pings the broker when
+   * the keep-alive is due. Closes the session when the broker stops answering.
+   */
+  void poll(MqttHandler &handler);
+
+  MqttChannelStats stats() const { return counters; }
+
+private:
+  bool send(uint8_t header, size_t length);
+  void dispatch(uint8_t header, const uint8_t *body, size_t length, MqttHandler &handler);
+  uint16_t nextPacketId();
+
+  WiFiClient client;
+  bool session = false;
+  uint8_t tx[MQTT_TX_BUFFER_SIZE];
+  uint8_t rx[MQTT_RX_BUFFER_SIZE];
+  size_t rx_used = 0;
+  size_t rx_skip = 0;    // bytes left of a packet too large for rx
+  uint16_t packet_id = 0;
+  uint32_t last_sent_ms = 0;
+  uint32_t last_heard_ms = 0;
+  uint32_t ping_sent_ms = 0;
+  bool ping_pending = false;
+  MqttChannelStats counters = {};
+};
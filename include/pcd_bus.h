@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include <MFRC522.h>
+
+// SPI clock of the transfers made here; the MFRC522 takes up to 10 MHz. The library's own
+// transfers (select, halt, the blocking wake-up) keep MFRC522_SPICLOCK.
+#ifndef PCD_SPI_HZ
+#define PCD_SPI_HZ 10000000
+#endif
+
+// 0: every write goes to the chip, even when the register already holds the value
+#ifndef PCD_SHADOW_REGISTERS
+#define PCD_SHADOW_REGISTERS 1
+#endif
+
+// Writes queued before flush() has to send them
+#define PCD_BUS_QUEUE 16
+
+struct PcdBusStats
+{
+  uint32_t transactions; // times the bus was taken (each holds one or more frames)
+  uint32_t frames;       // chip select cycles
+  uint32_t bytes;        // bytes clocked, address bytes included
+  uint32_t skipped;      // writes left out because the register already held the value
+  uint64_t busy_us;      // time spent in the transactions
+};
+
+/**
+ * Register access to one MFRC522 for the card detection hot path, next to the library (which
+ * takes the bus once per register). Writes are queued and sent by flush() under one bus
+ * transaction, one 2-byte frame each (the chip applies all data bytes of a frame to its first
+ * address); several registers are read in a single frame. Flush before handing the chip back
+ * to the library.
+ *
+ * The configuration registers that only PCD_Init() and this code write (not the library's
+ * frame exchanges used here: wake-up, select, halt) are shadowed, so writing the value one
+ * already holds costs nothing. Call begin() again after anything resets the chip.
+ */
+class PcdBus
+{
+public:
+  /**
+   * Call after PCD_Init(): forgets the shadowed values.
+   */
+  void begin(uint8_t ss_pin);
+
+  void write(MFRC522::PCD_Register reg, uint8_t value);
+  void setBits(MFRC522::PCD_Register reg, uint8_t mask);
+  void clearBits(MFRC522::PCD_Register reg, uint8_t mask);
+
+  /**
+   * Sends the queued writes.
+   */
+  void flush();
+
+  /**
+   * Reads one register, or count registers in one frame; queued writes go first.
+   */
+  uint8_t read(MFRC522::PCD_Register reg);
+  void read(const MFRC522::PCD_Register *regs, uint8_t *values, uint8_t count);
+
+  PcdBusStats stats() const { return counters; }
+
+private:
+  static bool shadowed(MFRC522::PCD_Register reg);
+  void sendQueued();
+  uint8_t current(MFRC522::PCD_Register reg);
+
+  uint8_t ss = 0;
+  uint8_t queue[2 * PCD_BUS_QUEUE];
+  uint8_t queued = 0; // bytes in queue
+  uint8_t shadow[0x40] = {};
+  uint64_t shadow_valid = 0; // one bit per register address
+  PcdBusStats counters = {};
+};
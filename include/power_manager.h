@@ -0,0 +1,109 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// 0: always awake, 1: WiFi modem sleep, 2: modem sleep and light sleep between card checks
+#ifndef POWER_MODE
+#define POWER_MODE 2
+#endif
+
+// Lowest CPU clock for frequency scaling; 80 MHz keeps the APB clock (SPI, UART) unchanged
+#ifndef POWER_MIN_CPU_MHZ
+#define POWER_MIN_CPU_MHZ 80
+#endif
+
+// Shorter waits are not worth a manual light sleep
+#ifndef POWER_MIN_SLEEP_MS
+#define POWER_MIN_SLEEP_MS 5
+#endif
+
+// Nominal currents (mA) used for the average current estimate
+#ifndef POWER_ACTIVE_MA
+#define POWER_ACTIVE_MA 45.0f // CPU running, WiFi in modem sleep
+#endif
+
+#ifndef POWER_IDLE_MA
+#define POWER_IDLE_MA 22.0f // CPU clock running in the idle task
+#endif
+
+#ifndef POWER_LIGHT_SLEEP_MA
+#define POWER_LIGHT_SLEEP_MA 1.5f // including the WiFi beacon wake-ups
+#endif
+
+#ifndef POWER_FIELD_MA
+#define POWER_FIELD_MA 20.0f // MFRC522 with the antenna driver on
+#endif
+
+#ifndef POWER_READER_IDLE_MA
+#define POWER_READER_IDLE_MA 7.0f // MFRC522 with the antenna off
+#endif
+
+// Wake-up latency histogram: time past the requested wake-up, upper bounds in us
+#define POWER_WAKE_BUCKETS 8
+static const uint32_t power_wake_bucket_us[POWER_WAKE_BUCKETS - 1] = {100, 250, 500, 1000, 2000, 5000, 10000};
+
+struct PowerStats
+{
+  uint64_t elapsed_us;    // since begin()
+  uint64_t idle_us;       // loop() blocked with the CPU clock running
+  uint64_t sleep_us;      // loop() blocked in (or eligible for) light sleep
+  uint64_t field_us;      // MFRC522 antennas on, summed over the readers
+  uint32_t sleeps;        // manual light sleeps
+  uint32_t waits;         // timed waits that ran to the end
+  uint32_t max_wake_us;   // worst time past the requested wake-up
+  uint32_t wake_histogram[POWER_WAKE_BUCKETS];
+};
+
+/**
+ * Puts the ESP32 to sleep while loop() waits for the next card check.
+ *
+ * Automatic light sleep (esp_pm with tickless idle) is used when the core was built with it:
+ * every wait() then simply blocks and the idle task sleeps, with WiFi kept associated through
+ * modem sleep. Cores built without tickless idle (the stock Arduino core) light sleep
+ * manually instead, but only while WiFi is offline since a manual light sleep drops the association.
+ * It also stops the uploader task on the other core, so a wait is only slept while the
+ * uploader has journaled every event and when it ends before the next reconnect attempt
+ * (the wait before an attempt runs awake). A reconnect then starts as it would awake, late
+ * by at most the light sleep wake-up time (the histogram below, typically under 1 ms).
+ *
+ * The current figure is an estimate from time spent in each state and the nominal currents
+ * above; the uploader task and WiFi transmit bursts are not modelled.
+ */
+class PowerManager
+{
+public:
+  /**
+   * Call after wifiConnection.begin().
+   */
+  void begin();
+
+  /**
+   * Blocks for up to ms. With wake_on_notify the wait ends early when the task is notified
+   * (card reader IRQ); returns true in that case.
+   */
+  bool wait(uint32_t ms, bool wake_on_notify);
+
+  /**
+   * A card reader switched its antenna on or off.
+   */
+  void fieldChanged(bool on);
+
+  bool autoLightSleep() const { return auto_light_sleep; }
+
+  PowerStats stats();
+  float averageCurrent(const PowerStats &s);
+  void printStats();
+
+private:
+  bool manualSleepAllowed(uint32_t ms);
+  void recordWake(uint32_t late_us);
+
+  bool auto_light_sleep = false;
+  int64_t begin_us = 0;
+  int64_t field_since_us = 0;
+  uint8_t fields_on = 0;
+  PowerStats counters = {};
+};
+
+extern PowerManager powerManager;
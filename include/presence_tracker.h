@@ -0,0 +1,114 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "card_reader.h"
+
+// Presence checks remembered for the removal decision (M, at most 32)
+#ifndef PRESENCE_WINDOW
+#define PRESENCE_WINDOW 5
+#endif
+
+// Missed checks within the window that confirm the card is gone (N; 1 unlocks on the first miss)
+#ifndef PRESENCE_MISSES
+#define PRESENCE_MISSES 3
+#endif
+
+// Answered checks in a row that clear a suspected removal again (hysteresis)
+#ifndef PRESENCE_RECOVER_HITS
+#define PRESENCE_RECOVER_HITS 3
+#endif
+
+// Check interval for the first PRESENCE_SETTLE_MS of a stay (or after a flap), while the card
+// is still being seated, then once it has stayed that long. Polling mode checks on every loop().
+#ifndef PRESENCE_SETTLE_MS
+#define PRESENCE_SETTLE_MS 5000
+#endif
+
+#ifndef PRESENCE_FAST_MS
+#if CARD_DETECT_IRQ
+#define PRESENCE_FAST_MS 100
+#else
+#define PRESENCE_FAST_MS 0
+#endif
+#endif
+
+#ifndef PRESENCE_SLOW_MS
+#if CARD_DETECT_IRQ
+#define PRESENCE_SLOW_MS 400
+#else
+#define PRESENCE_SLOW_MS 0
+#endif
+#endif
+
+// Check interval while a miss is being confirmed or cleared
+#ifndef PRESENCE_CONFIRM_MS
+#if CARD_DETECT_IRQ
+#define PRESENCE_CONFIRM_MS 20
+#else
+#define PRESENCE_CONFIRM_MS 0
+#endif
+#endif
+
+static_assert(PRESENCE_WINDOW >= 1 && PRESENCE_WINDOW <= 32, "presence window must hold 1 to 32 checks");
+static_assert(PRESENCE_MISSES >= 1 && PRESENCE_MISSES <= PRESENCE_WINDOW, "presence misses must fit the window");
+
+enum PresenceVerdict : uint8_t
+{
+  PRESENCE_HELD,    // the card is there
+  PRESENCE_SUSPECT, // the card missed a recent check; it stays locked until confirmed either way
+  PRESENCE_GONE     // removal confirmed: end the stay
+};
+
+struct PresenceStats
+{
+  uint32_t checks;          // presence checks of a locked card
+  uint32_t misses;          // checks the card did not answer
+  uint32_t stays;           // cards locked
+  uint32_t removals;        // removals confirmed, one per stay
+  uint32_t flaps;           // suspected removals the card recovered from
+  uint32_t suppressed;      // Exit and Entry events the misses would have caused without debouncing
+  uint64_t present_ms;      // time cards stayed locked (ended stays), for the flap rate
+  uint32_t last_confirm_ms; // first miss to confirmed removal, last removal
+  uint32_t max_confirm_ms;
+};
+
+/**
+ * Debounces the presence checks of one reader so an RF glitch does not end a stay: a locked
+ * card is only given up after PRESENCE_MISSES of the last PRESENCE_WINDOW checks went
+ * unanswered, and a suspected removal is only cleared after PRESENCE_RECOVER_HITS answers in
+ * a row. Checks are frequent right after a card is locked, slower once it has settled and
+ * fastest while a miss is being confirmed, so a real removal is still noticed quickly.
+ */
+class PresenceTracker
+{
+public:
+  /**
+   * A card was locked: starts a stay.
+   */
+  void locked();
+
+  /**
+   * Result of a presence check of the locked card.
+   */
+  PresenceVerdict checked(bool answered);
+
+  /**
+   * Milliseconds until the next presence check is due.
+   */
+  uint32_t interval() const;
+
+  PresenceStats stats() const { return counters; }
+  void printStats(uint8_t reader);
+
+private:
+  uint32_t history = 0;    // one bit per check, newest in bit 0, 1 = missed
+  uint8_t hits_in_row = 0;
+  uint8_t miss_runs = 0;   // separate runs of misses since the suspicion started
+  bool suspect = false;
+  bool last_missed = false;
+  uint32_t locked_ms = 0;
+  uint32_t steady_ms = 0;  // start of the current stretch without misses
+  uint32_t first_miss_ms = 0;
+  PresenceStats counters = {};
+};
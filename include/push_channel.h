@@ -0,0 +1,129 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mqtt_channel.h"
+#include "scan_event.h"
+
+// Broker port for UPLOAD_TRANSPORT_MQTT (the host is mqtt_broker_host in config.h)
+#ifndef MQTT_PORT
+#define MQTT_PORT 1883
+#endif
+
+// Topics are <prefix>/<receiver serial>/scan (published) and <prefix>/<receiver serial>/cmd/<command>
+#ifndef MQTT_TOPIC_PREFIX
+#define MQTT_TOPIC_PREFIX "hotel"
+#endif
+
+// Scan messages published before the first of them has to be acknowledged
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 8
+#endif
+
+// A publish not acknowledged this long drops the session; the journal sends it again
+#ifndef MQTT_ACK_TIMEOUT_MS
+#define MQTT_ACK_TIMEOUT_MS 5000
+#endif
+
+// Wait after a failed connection attempt
+#ifndef MQTT_RETRY_MS
+#define MQTT_RETRY_MS 5000
+#endif
+
+// How often the uploader reads the broker connection while online (acks, pushed commands)
+#ifndef MQTT_POLL_MS
+#define MQTT_POLL_MS 10
+#endif
+
+struct PushChannelStats
+{
+  uint32_t published;      // scan messages sent
+  uint32_t acked;          // of those, acknowledged by the broker
+  uint32_t resent;         // sent again after a lost session
+  uint32_t timeouts;       // sessions dropped for a missing acknowledgement
+  uint32_t max_inflight;   // most messages waiting for their ack at once
+  uint32_t last_ack_us;    // publish to acknowledgement, last message
+  uint32_t max_ack_us;
+  uint64_t total_ack_us;   // average = total / acked
+  uint32_t commands;       // commands pushed by the server
+  uint32_t relay_offs;     // of those, remote relay off
+  uint32_t allow_list_pushes;
+};
+
+/**
+ * Persistent publish/subscribe connection to the server's MQTT broker, used instead of the
+ * HTTP POSTs with UPLOAD_TRANSPORT_MQTT. The receiver authenticates once per session with
+ * client_key / client_secret, so scan messages carry neither credentials nor a token.
+ *
+ * Scan events are published with QoS 1 straight from the journal head, up to
+ * MQTT_MAX_INFLIGHT at a time, without waiting for each acknowledgement; the journal is only
+ * consumed up to the first event not acknowledged yet, so a lost session sends the rest again
+ * (the server drops duplicates by receiver and "seq", as for batches).
+ *
+ * The server pushes commands on <prefix>/<serial>/cmd/<command>:
+ *   relay-off   payload: reader index, or empty for all readers
+ *   allow-list  payload: an /api/allow-list response, applied as is; empty asks for a sync
+ *   config      payload: an /api/config response (see config_store.h)
+ */
+class PushChannel : public MqttHandler
+{
+public:
+  /**
+   * device_UID must stay valid.
+   */
+  void begin(const char *device_UID);
+
+  /**
+   * Uploader task, while online: (re)connects, reads acknowledgements and commands and drops
+   * a session whose acknowledgements stopped. Returns true while the session is up.
+   */
+  bool maintain();
+
+  /**
+   * records are the head of the journal: publishes those not in flight yet, as far as the
+   * window allows.
+   */
+  void publish(const JournalRecord *records, size_t count);
+
+  /**
+   * Events at the head of the journal the broker has acknowledged, in order.
+   */
+  size_t acknowledged() const;
+
+  size_t inFlight() const { return inflight_count; }
+
+  /**
+   * The first count events were removed from the journal.
+   */
+  void consumed(size_t count);
+
+  void acked(uint16_t packet_id) override;
+  void message(const char *topic, const uint8_t *payload, size_t length) override;
+
+  PushChannelStats stats() const { return counters; }
+  void printStats();
+
+private:
+  struct InFlight
+  {
+    uint32_t seq;
+    uint16_t packet_id;
+    bool acked;
+    int64_t sent_us;
+  };
+
+  void command(const char *name, const uint8_t *payload, size_t length);
+
+  const char *device_UID = nullptr;
+  char scan_topic[64] = "";
+  char command_prefix[64] = ""; // <prefix>/<serial>/cmd/
+  MqttChannel mqtt;
+  uint32_t retry_at_ms = 0;
+  bool retrying = false;
+  InFlight inflight[MQTT_MAX_INFLIGHT];
+  size_t inflight_count = 0;
+  uint32_t published_seq = 0; // highest seq published so far (+1), to count resends
+  PushChannelStats counters = {};
+};
+
+extern PushChannel pushChannel;
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <Arduino.h>
+#include <MFRC522.h>
+
+#include "card_reader.h"
+#include "presence_tracker.h"
+#include "scan_event.h"
+#include "timer_wheel.h"
+
+// Power-on (application start) to the relays restored after a reset, and to the first card
+// detection; going over is logged as a warning.
+#ifndef BOOT_RELAY_BUDGET_MS
+#define BOOT_RELAY_BUDGET_MS 50
+#endif
+
+#ifndef BOOT_SCAN_BUDGET_MS
+#define BOOT_SCAN_BUDGET_MS 500
+#endif
+
+// Resolution of stay limits (see stay_limits.h): a relay goes off up to this much, and under
+// a second more, after the stay ends
+#ifndef STAY_TICK_MS
+#define STAY_TICK_MS 1000
+#endif
+
+/**
+ * Wiring of one MFRC522. SPI clock and data lines are shared, each reader has its own
+ * chip select, reset and IRQ line (irq -1: not wired, the answer is read from the register).
+ */
+struct ReaderPins
+{
+  uint8_t ss;
+  uint8_t rst;
+  int8_t irq;
+  uint8_t ssr; // relay switched while a card is locked on this reader
+};
+
+/**
+ * A card locked on, or removed from, one reader, or whose stay ran out.
+ */
+struct ReaderEvent
+{
+  uint8_t reader;
+  bool locked;               // true: card locked, false: locked card gone
+  bool allowed;              // the card is on the allow list (its relay is or was on)
+  bool expired;              // the card is still there, but its stay is over and the relay went off
+  MFRC522::Uid uid;          // the locked card (also set when it was removed)
+  MFRC522::StatusCode status; // PICC_Select() result
+};
+
+struct ReaderArrayStats
+{
+  uint64_t idle_us;    // time loop() spent waiting for the readers
+  uint64_t elapsed_us; // time since begin()
+  uint32_t releases;   // relays switched off remotely while their card was still there
+  uint32_t expired;    // relays switched off at the end of a stay limit
+  uint32_t stay_checks; // stay timers that fired (a limit is looked up again each time)
+  uint32_t restored;   // locked cards taken over from before the last reset
+  uint32_t restore_us; // power-on to the relays back in their state
+  uint32_t first_poll_us; // power-on to the first card detection
+};
+
+/**
+ * Drives READER_COUNT MFRC522 readers on one SPI bus from loop(). Each reader keeps its own
+ * detection state (see card_reader.h); poll() steps them all, serves at most one reader per
+ * call and otherwise sleeps until the earliest reader has something to do. A reader whose
+ * card answered is served before presence checks, round robin between readers, so one busy
+ * door cannot starve another. A reader holds the bus for at most CARD_SERVICE_MS per call,
+ * which the wake-up interval in card_reader.h accounts for.
+ *
+ * The relay of a reader is switched here, right after the select that locked the card or
+ * confirmed its removal and only for a card on the allow list, so its latency does not depend
+ * on what loop() does with the event. A presence check the card misses only ends the stay
+ * once the presence tracker confirms it, so an RF glitch neither chatters the relay nor
+ * produces an extra Exit/Entry pair.
+ *
+ * A card with a stay limit (see stay_limits.h) gets a timer on a timing wheel when it locks;
+ * when it fires the limit is looked up again, and if the stay is over the relay goes off and
+ * poll() reports it (expired). A card whose entitlement is already over locks as not allowed.
+ * A stay restored after a reset counts from the reset.
+ */
+class ReaderArray
+{
+public:
+  /**
+   * Call after SPI.begin(), from the task that runs loop(), and as early in setup() as that
+   * allows: after a reset other than a power cycle the locked cards, and the relays they
+   * switched, are restored from RTC memory before the readers are initialised. Their presence
+   * checks then confirm the cards (or end the stays) as usual.
+   */
+  void begin(const ReaderPins *pins);
+
+  /**
+   * Steps the readers; returns true when a card was locked or removed or its stay ran out (see
+   * event), false otherwise.
+   */
+  bool poll(ReaderEvent &event);
+
+  /**
+   * Switches the relay of a reader off while its card stays in the field (remote relay off).
+   * The stay then ends without an Exit event, the server having ended it. Safe to call from
+   * any task; the loop task does it on its next poll().
+   */
+  void release(uint8_t reader);
+
+  bool isLocked(uint8_t reader) const { return locked[reader]; }
+  bool anyRelayOn() const;
+
+  CardReaderStats stats(uint8_t reader) const { return card[reader].stats(); }
+  PresenceStats presenceStats(uint8_t reader) const { return presence[reader].stats(); }
+  PcdBusStats busStats(uint8_t reader) const { return card[reader].busStats(); }
+  ReaderArrayStats stats();
+  void printStats();
+
+private:
+  bool service(uint8_t reader, ReaderEvent &event);
+  void releaseRequested();
+  bool restore();
+  void retain(uint8_t reader);
+  bool stayDue(ReaderEvent &event);
+  void scheduleStay(uint8_t reader, int32_t left_s);
+  static void stayTimerFired(WheelTimer &timer, void *arg);
+
+  const ReaderPins *pins = nullptr;
+  MFRC522 rfid[READER_COUNT];
+  CardReader card[READER_COUNT];
+  PresenceTracker presence[READER_COUNT];
+  bool locked[READER_COUNT] = {};
+  bool allowed[READER_COUNT] = {}; // the locked card switched the relay on
+  uint8_t next = 0; // first reader to look at in the next poll()
+  TaskHandle_t loop_task = nullptr;
+  portMUX_TYPE release_lock = portMUX_INITIALIZER_UNLOCKED;
+  volatile uint32_t release_requests = 0; // one bit per reader
+  TimerWheel stays;                // STAY_TICK_MS ticks of esp_timer time
+  WheelTimer stay_timer[READER_COUNT];
+  int64_t stay_started_us[READER_COUNT] = {};
+  uint32_t stays_due = 0;          // one bit per reader whose limit is to be checked
+  uint32_t stay_generation = 0;    // stay limits the running stays were checked against
+  int64_t begin_us = 0;
+  ReaderArrayStats counters = {};
+};
+
+// Wiring of the readers, defined in main.cpp
+extern const ReaderPins reader_pins[READER_COUNT];
+
+extern ReaderArray readers;
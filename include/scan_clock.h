@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <sys/time.h>
+
+struct ScanClockStats
+{
+  uint32_t syncs;         // SNTP synchronisations
+  uint32_t first_sync_ms; // boot to the first synchronisation, 0 until then
+  int32_t last_step_ms;   // correction applied by the last synchronisation
+};
+
+/**
+ * Wall clock for scan events. Scans are stamped with the monotonic esp_timer time, which
+ * runs from boot whether or not the time is known; the epoch is derived from the offset
+ * between the two that each SNTP synchronisation records. Events captured before the first
+ * synchronisation are therefore back-dated correctly once it happens, as long as it happens
+ * in the same boot.
+ *
+ * Only SNTP is trusted: the system time kept over a reset is not, since nothing says
+ * whether it was ever right.
+ */
+class ScanClock
+{
+public:
+  /**
+   * Call from the SNTP time sync callback with the time it set.
+   */
+  void synced(const struct timeval *now);
+
+  bool isSynced() const { return synced_at_us != 0; }
+
+  /**
+   * esp_timer time of the first synchronisation of this boot, 0 until then.
+   */
+  int64_t firstSyncUs() const { return synced_at_us; }
+
+  /**
+   * Seconds since 1970 (UTC) at an esp_timer time of this boot, or 0 if the clock has not
+   * been synchronised yet.
+   */
+  uint32_t epochAt(int64_t monotonic_us);
+
+  ScanClockStats stats() const { return counters; }
+  void printStats();
+
+private:
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  int64_t offset_us = 0;        // epoch us - esp_timer us
+  volatile int64_t synced_at_us = 0;
+  ScanClockStats counters = {};
+};
+
+extern ScanClock scanClock;
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+// MFRC522 readers on the shared SPI bus, one door or relay each (pins in main.cpp)
+#ifndef READER_COUNT
+#define READER_COUNT 1
+#endif
+
+enum ScanType : uint8_t
+{
+  SCAN_ENTRY, // card locked and on the allow list: relay on
+  SCAN_EXIT,  // that card removed: relay off
+  SCAN_DENIED, // card locked but not on the allow list, or its entitlement is over: relay stays off
+  SCAN_EXPIRED // card still there but its stay limit ran out: relay off (see stay_limits.h)
+};
+
+// Clock readings before this (2020-01-01) mean the time has not been set yet
+#define SCAN_EPOCH_VALID_AFTER 1577836800UL
+
+/**
+ * One card scan as handed from the RFID loop to the uploader, in binary form: the UID, time
+ * and type are only turned into text when a request is written (see event_serializer.h).
+ * Plain data so it can be copied into a FreeRTOS queue and written to flash as is.
+ */
+struct ScanEvent
+{
+  int64_t captured_us; // esp_timer time at capture: monotonic, only meaningful in the boot that captured it
+  uint32_t epoch;      // seconds since 1970 (UTC), 0 until the clock is synced (see scan_clock.h)
+  uint8_t uid[10];     // card UID as read (MFRC522::Uid::uidByte)
+  uint8_t uid_size;    // 4, 7 or 10
+  uint8_t type;        // ScanType
+  uint8_t reader;      // index of the reader that saw the card
+};
+
+static_assert(sizeof(ScanEvent) == 32, "ScanEvent is stored in the journal; keep its layout");
+
+/**
+ * A scan event with its journal sequence number, as stored in flash and sent in batches.
+ */
+struct JournalRecord
+{
+  uint32_t seq;     // journal sequence number, increases by one per record
+  uint32_t crc;     // CRC-32 over seq and event, detects records torn by a power loss
+  ScanEvent event;
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "scan_event.h"
+
+// Records per segment file; a full segment of 40-byte records fits one 4 KB flash sector
+#ifndef JOURNAL_SEGMENT_RECORDS
+#define JOURNAL_SEGMENT_RECORDS 100
+#endif
+
+// Oldest segments are discarded beyond this many (64 * 100 = 6400 events offline)
+#ifndef JOURNAL_MAX_SEGMENTS
+#define JOURNAL_MAX_SEGMENTS 64
+#endif
+
+// Appended records are kept in RAM and written together once this many are pending ...
+#ifndef JOURNAL_WRITE_BATCH
+#define JOURNAL_WRITE_BATCH 16
+#endif
+
+// ... or once the oldest pending record is this old
+#ifndef JOURNAL_FLUSH_MS
+#define JOURNAL_FLUSH_MS 5000
+#endif
+
+// Sequence numbers are reserved in the cursor file this many at a time, so a reboot never
+// reuses one that went out from RAM; up to this many are skipped per boot
+#ifndef JOURNAL_SEQ_BLOCK
+#define JOURNAL_SEQ_BLOCK 256
+#endif
+
+struct JournalStats
+{
+  uint32_t backlog;     // records not yet consumed (flash + RAM)
+  uint32_t unflushed;   // records only held in RAM
+  uint32_t segments;    // segment files on flash
+  uint32_t flushes;     // batched flash writes
+  uint32_t flushed;     // records written to flash
+  uint32_t overflowed;  // records lost because the journal was full
+  uint32_t corrupt;     // torn/corrupt records skipped during replay
+};
+
+/**
+ * Append-only store-and-forward journal for scan events on LittleFS.
+ *
+ * Records live in numbered segment files under /journal. New records are buffered in RAM
+ * and written in batches; records delivered before a flush never touch flash. A small cursor
+ * file remembers how far replay got, and fully replayed segments are deleted, so the files
+ * rotate through the filesystem and LittleFS spreads the wear. Every record carries a CRC so a
+ * record torn by a power loss is skipped instead of replayed. The cursor file also reserves
+ * sequence numbers ahead of use, so they keep rising across reboots even when every record
+ * was delivered from RAM.
+ *
+ * Not thread-safe: only the uploader task uses it after setup().
+ */
+class ScanJournal
+{
+public:
+  /**
+   * Mounts LittleFS and recovers the backlog left by the previous boot.
+   */
+  bool begin();
+
+  /**
+   * Adds an event to the end of the journal (buffered, see flush()).
+   */
+  void append(const ScanEvent &event);
+
+  /**
+   * Copies up to max of the oldest unconsumed records into out, in order.
+   * Returns the number of records copied.
+   */
+  size_t peek(JournalRecord *out, size_t max);
+
+  /**
+   * Marks the count oldest records (as returned by peek()) as delivered.
+   */
+  void consume(size_t count);
+
+  /**
+   * Writes buffered records to flash. maintain() calls this according to
+   * JOURNAL_WRITE_BATCH / JOURNAL_FLUSH_MS.
+   */
+  void flush();
+  void maintain();
+
+  size_t backlog() const { return stored_count + pending_count; }
+
+  /**
+   * Sequence number of the first record appended in this boot; older records were captured
+   * in an earlier boot (their capture time means nothing now).
+   */
+  uint32_t bootSeq() const { return boot_seq; }
+
+  JournalStats stats() const;
+
+private:
+  bool readRecord(File &file, JournalRecord &record);
+  void openNextSegment();
+  void dropOldestSegment();
+  void saveCursor();
+  uint32_t segmentRecords(uint32_t segment);
+
+  bool mounted = false;
+
+  // Flash part: segments first_segment..last_segment, replay position read_segment/read_index.
+  uint32_t first_segment = 0;
+  uint32_t last_segment = 0;
+  uint32_t last_segment_records = 0;
+  uint32_t read_segment = 0;
+  uint32_t read_index = 0;
+  uint32_t stored_count = 0;
+
+  // RAM part: records appended since the last flush, oldest first.
+  JournalRecord pending[JOURNAL_WRITE_BATCH];
+  size_t pending_count = 0;
+  uint32_t pending_since_ms = 0;
+
+  uint32_t next_seq = 0;
+  uint32_t seq_limit = 0; // reserved on flash: next_seq may go up to here without a cursor write
+  uint32_t boot_seq = 0;
+  JournalStats counters = {};
+};
+
+extern ScanJournal journal;
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "event_batch.h"
+
+/**
+ * Requests a receiver token from /api/request-token.
+ * Returns a pointer to a static buffer holding the token, or nullptr on failure.
+ * When the server reports a lifetime ("expires_in", seconds) it is written to expires_in_s,
+ * otherwise expires_in_s is set to 0.
+ */
+const char *RequestToken(const char *device_UID, uint32_t *expires_in_s = nullptr);
+
+/**
+ * Posts one scan event to /api/send-data, as MessagePack when compact is set (see wire_format.h).
+ * Returns the HTTP status code, or a negative HTTPClient error code when the request failed.
+ */
+int SendData(const char *device_UID, const char *token, const ScanEvent &event, bool compact = false);
+
+/**
+ * Posts records[0..count) to /api/send-data/batch in one request and fills acks[] from the
+ * per-event results; compact sends the binary batch layout instead of JSON.
+ * Returns the HTTP status code, or a negative HTTPClient error code.
+ * A 404 means the server has no batch endpoint.
+ */
+int SendBatch(const char *device_UID, const char *token, const JournalRecord *records, size_t count, BatchAck *acks,
+              bool compact = false);
+
+/**
+ * Asks /api/allow-list for the changes since version, streaming the response into update.
+ * Returns the HTTP status code, or a negative HTTPClient error code. A 404 means the server
+ * has no allow list endpoint.
+ */
+int FetchAllowList(const char *device_UID, const char *token, uint32_t version, JsonHandler &update);
+
+/**
+ * Asks /api/config for a configuration newer than version (see config_store.h), streaming the
+ * response into update. Returns the HTTP status code, or a negative HTTPClient error code.
+ * A 404 means the server has no config endpoint.
+ */
+int FetchConfig(const char *device_UID, const char *token, uint32_t version, JsonHandler &update);
+
+/**
+ * True when the server refused the receiver token (the token must be requested again).
+ */
+inline bool isTokenRejected(int http_code)
+{
+  return http_code == 401 || http_code == 403;
+}
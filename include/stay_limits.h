@@ -0,0 +1,110 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+
+#include "allow_list.h"
+#include "json_scanner.h"
+
+// Cards with a time limit kept on the device (20 bytes each)
+#ifndef STAY_LIMITS_MAX
+#define STAY_LIMITS_MAX 256
+#endif
+
+// While the clock is not synced an expiry date cannot be checked: look again this often (s)
+#ifndef STAY_RECHECK_S
+#define STAY_RECHECK_S 60
+#endif
+
+// No limit on the stay
+#define STAY_UNLIMITED INT32_MAX
+
+/**
+ * Entitlement of one card.
+ */
+struct StayLimit
+{
+  AllowTag tag;
+  uint32_t stay_s;  // longest stay from the card going in, 0 = no limit
+  uint32_t expires; // UTC seconds after which the card is refused and a stay cut off, 0 = never
+};
+
+struct StayLimitsStats
+{
+  uint32_t limits;
+  uint32_t lookups;
+  uint32_t limited; // lookups that found a limit
+  uint32_t updates; // tables saved
+};
+
+/**
+ * Collects the "limits" member of an /api/allow-list response (see AllowListUpdate):
+ *   "limits": [{"tag": "04A1B2C3", "stay_s": 14400, "expires": 1767225600}, ...]
+ * When present, or with a full allow list, it replaces the whole table; a card without an
+ * entry has no limit.
+ */
+class StayLimitsUpdate
+{
+public:
+  ~StayLimitsUpdate();
+
+  /**
+   * A member of one entry (depth 3 of the response).
+   */
+  void value(const char *key, const char *value, size_t length, JsonHandler::ValueType type);
+  void entryEnd();
+
+  bool seen = false;
+  bool overflowed = false; // more than STAY_LIMITS_MAX entries, or a malformed one
+  StayLimit *limits = nullptr;
+  size_t count = 0;
+
+private:
+  StayLimit entry = {};
+};
+
+/**
+ * Per-card stay limits from the server, cached in RAM and on LittleFS so they hold without
+ * the network. ReaderArray asks at every lock how long the stay may last and cuts the relay
+ * off when the time is up (see reader_array.h); the allow list sync keeps the table current.
+ */
+class StayLimits
+{
+public:
+  /**
+   * Loads the saved table. Call after LittleFS is mounted (journal.begin()).
+   */
+  void begin();
+
+  /**
+   * Seconds the stay of a card that went in elapsed_s ago has left (<= 0: over, or the card
+   * has expired), STAY_UNLIMITED without a limit. With an expiry date and no clock yet, at
+   * most STAY_RECHECK_S. Safe to call from loop().
+   */
+  int32_t remaining(const uint8_t *uid, uint8_t size, uint32_t elapsed_s);
+
+  /**
+   * Uploader task: installs and saves a new table if it differs from the current one.
+   */
+  void apply(StayLimitsUpdate &update);
+
+  /**
+   * Changes whenever a new table is installed, so running stays can be checked again.
+   */
+  uint32_t generation() const { return installed; }
+
+  StayLimitsStats stats();
+  void printStats();
+
+private:
+  void install(StayLimit *new_limits, uint32_t new_count);
+  void save();
+
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  StayLimit *limits = nullptr;
+  uint32_t count = 0;
+  volatile uint32_t installed = 0;
+  StayLimitsStats counters = {};
+};
+
+extern StayLimits stayLimits;
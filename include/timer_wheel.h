@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Slots per level as a power of two, and levels: 64 slots and 4 levels cover 2^24 ticks
+// (194 days of 1 s ticks) in 256 list heads
+#ifndef TIMER_WHEEL_BITS
+#define TIMER_WHEEL_BITS 6
+#endif
+
+#ifndef TIMER_WHEEL_LEVELS
+#define TIMER_WHEEL_LEVELS 4
+#endif
+
+class WheelTimer;
+
+typedef void (*WheelCallback)(WheelTimer &timer, void *arg);
+
+/**
+ * One deadline; owned by the caller and linked into the wheel while scheduled, so the wheel
+ * never allocates.
+ */
+class WheelTimer
+{
+public:
+  WheelTimer(WheelCallback callback = nullptr, void *arg = nullptr) : callback(callback), arg(arg) {}
+
+  bool scheduled() const { return wheel_prev != nullptr; }
+  uint32_t expires() const { return expires_tick; }
+
+private:
+  friend class TimerWheel;
+
+  WheelCallback callback;
+  void *arg;
+  uint32_t expires_tick = 0;
+  WheelTimer *next = nullptr;
+  WheelTimer **wheel_prev = nullptr; // the pointer that points here (a slot head or the previous next)
+};
+
+struct TimerWheelStats
+{
+  uint32_t pending;
+  uint32_t max_pending;
+  uint32_t fired;
+  uint32_t cascaded; // timers moved down a level
+};
+
+/**
+ * Hierarchical timing wheel: scheduling and cancelling are O(1), and so is a tick, apart from
+ * moving the timers of one higher-level slot down every 2^TIMER_WHEEL_BITS ticks (each timer
+ * moves at most TIMER_WHEEL_LEVELS - 1 times). Deadlines further out than the wheel covers
+ * fire at its end; the callback can check and schedule again. Not thread safe: schedule,
+ * cancel and advance from one task; callbacks run inside advance() and may schedule again.
+ */
+class TimerWheel
+{
+public:
+  /**
+   * Starts counting at tick now.
+   */
+  void begin(uint32_t now);
+
+  /**
+   * (Re)schedules timer to fire ticks after the current tick (0 counts as 1).
+   */
+  void schedule(WheelTimer &timer, uint32_t ticks);
+  void cancel(WheelTimer &timer);
+
+  /**
+   * Fires every timer due by tick now, in tick order.
+   */
+  void advance(uint32_t now);
+
+  uint32_t now() const { return current; }
+  bool empty() const { return counters.pending == 0; }
+  TimerWheelStats stats() const { return counters; }
+
+private:
+  static const uint32_t SLOTS = 1u << TIMER_WHEEL_BITS;
+  static const uint32_t MASK = SLOTS - 1;
+
+  void insert(WheelTimer &timer);
+  void unlink(WheelTimer &timer);
+  void cascade(uint8_t level);
+
+  WheelTimer *slots[TIMER_WHEEL_LEVELS][SLOTS] = {};
+  uint32_t current = 0;
+  TimerWheelStats counters = {};
+};
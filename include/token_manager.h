@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Lifetime assumed for a receiver token when the server does not send "expires_in"
+#ifndef TOKEN_DEFAULT_TTL_S
+#define TOKEN_DEFAULT_TTL_S 3600
+#endif
+
+// How long before expiry the token is refreshed in the background
+#ifndef TOKEN_REFRESH_MARGIN_S
+#define TOKEN_REFRESH_MARGIN_S 300
+#endif
+
+// Wait between failed refresh attempts so an offline server is not hammered
+#ifndef TOKEN_RETRY_INTERVAL_MS
+#define TOKEN_RETRY_INTERVAL_MS 10000
+#endif
+
+// Keep the token in NVS so it survives a reboot (set to 0 to keep it in RAM only)
+#ifndef TOKEN_PERSIST
+#define TOKEN_PERSIST 1
+#endif
+
+/**
+ * Keeps the receiver token returned by /api/request-token so a scan does not have to
+ * request a new one. The token is refreshed by maintain() shortly before it expires and
+ * is only requested in-line when none is cached or the server rejected the cached one.
+ * Not thread-safe: only the uploader task uses it after setup().
+ */
+class TokenManager
+{
+public:
+  /**
+   * Loads a persisted token (if any). device_UID must stay valid for the lifetime of the manager.
+   */
+  void begin(const char *device_UID);
+
+  /**
+   * Returns the cached token, requesting one from the server if none is available.
+   * Returns nullptr when no token could be obtained.
+   */
+  const char *get();
+
+  /**
+   * Background upkeep: refreshes the token once it is close to expiry.
+   * Called by the uploader task while its queue is empty.
+   */
+  void maintain();
+
+  /**
+   * Drops the cached token, e.g. after /api/send-data rejected it.
+   */
+  void invalidate();
+
+  bool valid() const { return token[0] != '\0'; }
+
+private:
+  bool refresh();
+  void persist(uint32_t ttl_s);
+
+  const char *device_UID = nullptr;
+  char token[256] = "";
+  uint32_t obtained_ms = 0;   // millis() when the token was stored
+  uint32_t ttl_ms = 0;        // lifetime from obtained_ms, 0 = unknown (refresh as soon as possible)
+  uint32_t last_attempt_ms = 0;
+  bool attempted = false;
+};
+
+extern TokenManager tokenManager;
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+// 0 compiles every trace call out
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Trace points kept in the RAM ring buffer (12 bytes each)
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 256
+#endif
+
+// 4 buckets per power of two: percentiles are reported within 25%
+#define TRACE_HISTOGRAM_BUCKETS 124
+
+enum TracePoint : uint8_t
+{
+  TRACE_CARD_WAKE,      // a card answered a wake-up (arg: reader << 8, +1 = found without an IRQ)
+  TRACE_CARD_SELECT,    // PICC_Select() finished (arg: reader << 8 | status code)
+  TRACE_RELAY_ON,       // SSR switched on (arg: reader)
+  TRACE_RELAY_OFF,      // SSR switched off (arg: reader)
+  TRACE_TOKEN_FETCH,    // token request started
+  TRACE_TOKEN_DONE,     // token request finished (arg: 1 = got a token)
+  TRACE_SERIALIZE,      // request payload written (arg: bytes)
+  TRACE_POST,           // POST started (arg: bytes)
+  TRACE_RESPONSE,       // response read (arg: HTTP status or HTTPClient error)
+  TRACE_POINTS
+};
+
+enum TraceSpan : uint8_t
+{
+  SPAN_WAKE_TO_RELAY, // card answered -> SSR on
+  SPAN_SELECT,        // PICC_Select() of a new card
+  SPAN_TOKEN_FETCH,   // RequestToken() round trip
+  SPAN_SERIALIZE,     // writing one request payload
+  SPAN_POST,          // POST and response body
+  SPAN_SCAN_TO_ACK,   // scan captured -> server accepted it (ms resolution)
+  TRACE_SPANS
+};
+
+enum TraceCounter : uint8_t
+{
+  COUNT_SCANS,    // cards locked
+  COUNT_POSTS,    // requests sent
+  COUNT_RETRIES,  // token retries, reconnects and replays after a back-off
+  COUNT_FAILURES, // requests without a 2xx response
+  TRACE_COUNTERS
+};
+
+struct TraceRecord
+{
+  uint32_t us;   // esp_timer time, wraps after 71 minutes
+  int32_t arg;
+  uint8_t point; // TracePoint
+  uint8_t core;
+};
+
+struct TraceHistogram
+{
+  uint32_t count;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint32_t buckets[TRACE_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Lightweight tracing: timestamped trace points in a RAM ring buffer, latency histograms for
+ * the scan-to-relay-to-server path and a few counters. Recording is a timer read and a few
+ * stores under a spinlock, callable from loop() and the uploader task alike; nothing is
+ * formatted or printed until a dump is requested.
+ *
+ * Timestamps come from esp_timer rather than the CPU cycle counter: each core has its own
+ * cycle counter and its rate follows the CPU clock, which frequency scaling changes.
+ */
+class Tracer
+{
+public:
+  static uint32_t now() { return (uint32_t)esp_timer_get_time(); }
+
+  /**
+   * Records a trace point; returns its timestamp for a later span().
+   */
+  uint32_t mark(TracePoint point, int32_t arg = 0)
+  {
+#if TRACE_ENABLED
+    return record(point, arg);
+#else
+    return 0;
+#endif
+  }
+
+  /**
+   * Adds the time since start_us (from now() or mark()) to a span histogram.
+   */
+  void span(TraceSpan span, uint32_t start_us)
+  {
+#if TRACE_ENABLED
+    sample(span, now() - start_us);
+#endif
+  }
+
+  /**
+   * Adds a measured duration to a span histogram.
+   */
+  void sample(TraceSpan span, uint32_t duration_us)
+  {
+#if TRACE_ENABLED
+    addSample(span, duration_us);
+#endif
+  }
+
+  void count(TraceCounter counter)
+  {
+#if TRACE_ENABLED
+    portENTER_CRITICAL(&lock);
+    counters[counter]++;
+    portEXIT_CRITICAL(&lock);
+#endif
+  }
+
+  /**
+   * Percentile (0..100) of a span in us, from the histogram buckets.
+   */
+  uint32_t percentile(TraceSpan span, uint8_t percent);
+
+  /**
+   * Prints the span percentiles, counters and heap low-water mark.
+   */
+  void printStats();
+
+  /**
+   * Prints the trace points in the ring buffer, oldest first.
+   */
+  void printTrace();
+
+  /**
+   * Writes the summary as a JSON object (for a heartbeat). Returns its length, or 0 if it
+   * does not fit.
+   */
+  size_t writeJson(char *out, size_t size);
+
+private:
+  uint32_t record(TracePoint point, int32_t arg);
+  void addSample(TraceSpan span, uint32_t duration_us);
+
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  TraceRecord ring[TRACE_BUFFER_SIZE] = {};
+  uint32_t written = 0;
+  TraceHistogram histograms[TRACE_SPANS] = {};
+  uint32_t counters[TRACE_COUNTERS] = {};
+};
+
+extern Tracer tracer;
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "event_batch.h"
+#include "scan_event.h"
+#include "scan_journal.h"
+#include "wire_format.h"
+
+struct ReaderEvent;
+
+// Number of scan events that can wait for upload before new ones are dropped
+#ifndef UPLOAD_QUEUE_LENGTH
+#define UPLOAD_QUEUE_LENGTH 32
+#endif
+
+// The Arduino loop() runs on core 1, so the network work goes to core 0
+#ifndef UPLOADER_CORE
+#define UPLOADER_CORE 0
+#endif
+
+#ifndef UPLOADER_STACK_SIZE
+#define UPLOADER_STACK_SIZE 8192
+#endif
+
+#ifndef UPLOADER_PRIORITY
+#define UPLOADER_PRIORITY 1
+#endif
+
+// How scan events reach the server: HTTP POSTs to send_data_address / send_data_batch_address,
+// or QoS 1 messages to the MQTT broker at mqtt_broker_host (see push_channel.h)
+#define UPLOAD_TRANSPORT_HTTP 0
+#define UPLOAD_TRANSPORT_MQTT 1
+
+#ifndef UPLOAD_TRANSPORT
+#define UPLOAD_TRANSPORT UPLOAD_TRANSPORT_HTTP
+#endif
+
+// Send journal replay through /api/send-data/batch (falls back to single posts on a 404)
+#ifndef UPLOAD_BATCH
+#define UPLOAD_BATCH 1
+#endif
+
+// Wait after a failed send before the journal is replayed again
+#ifndef UPLOAD_RETRY_MS
+#define UPLOAD_RETRY_MS 5000
+#endif
+
+// After going online, hold events captured before the clock was synced this long for the
+// first SNTP sync so they can be back-dated; past that they are sent without a time
+#ifndef UPLOAD_CLOCK_WAIT_MS
+#define UPLOAD_CLOCK_WAIT_MS 30000
+#endif
+
+// How often the uploader prints its statistics; 0 leaves them to the 's' console command, as
+// the report goes straight to Serial whatever the LOG_LEVEL (the debug env sets 60000)
+#ifndef UPLOADER_STATS_INTERVAL_MS
+#define UPLOADER_STATS_INTERVAL_MS 0
+#endif
+
+struct UploaderStats
+{
+  uint32_t enqueued;         // events accepted into the queue
+  uint32_t dropped;          // events rejected because the queue was full
+  uint32_t sent;             // events the server accepted
+  uint32_t failed;           // send attempts that failed (the event stays in the journal)
+  uint32_t discarded;        // events the server refused as invalid (removed from the journal)
+  uint32_t backdated;        // events captured before the clock was synced, sent with their time
+  uint32_t undated;          // events sent without a time (no sync in time, or from an earlier boot)
+  uint32_t queue_depth;      // events currently waiting
+  uint32_t max_queue_depth;  // high-water mark of the queue
+  uint32_t last_latency_ms;  // capture to server response, last event
+  uint32_t max_latency_ms;
+  uint64_t total_latency_ms; // sum over all delivered events (average = total / sent)
+};
+
+/**
+ * Runs the HTTP upload on its own FreeRTOS task so the RFID/SSR loop never waits on the network.
+ * Every scan takes the same path, whichever reader event it came from:
+ *
+ *   capture (loop(): capture() builds a binary ScanEvent, enqueue() never blocks)
+ *   -> queue -> journal (uploader task: the journal numbers the event and keeps it in flash)
+ *   -> enrich (events captured before the clock was synced get their epoch, see scan_clock.h)
+ *   -> serialize (JSON, or with WIRE_COMPACT MessagePack / the binary batch) -> send
+ *
+ * The journal is replayed in order whenever WiFi is up, up to BATCH_MAX_EVENTS events per POST,
+ * or with UPLOAD_TRANSPORT_MQTT published over the push channel, several messages in flight.
+ */
+class Uploader
+{
+public:
+  /**
+   * Creates the event queue and starts the upload task. device_UID must stay valid.
+   */
+  bool begin(const char *device_UID);
+
+  /**
+   * Turns a card locked on or removed from a reader into its scan event and queues it: Entry
+   * or Denied for a locked card, Exit once an allowed card is removed (a denied card has no
+   * stay to end). Returns false only if the event was dropped. Safe to call from loop().
+   */
+  bool capture(const ReaderEvent &event);
+
+  /**
+   * Queues an event for upload. Returns false (and counts a drop) if the queue is full.
+   * Safe to call from loop(); never blocks.
+   */
+  bool enqueue(const ScanEvent &event);
+
+  /**
+   * True when every queued event is in the journal, so stopping the task loses nothing.
+   */
+  bool idle();
+
+  /**
+   * Uploader task: appends every queued event to the journal, waiting up to wait for the
+   * first one. Also used before a restart so no captured scan is lost.
+   */
+  void journalQueued(TickType_t wait = 0);
+
+  UploaderStats stats();
+  void printStats();
+
+private:
+  static void taskEntry(void *arg);
+  void run();
+  void drain();
+  void backdate(JournalRecord *records, size_t count);
+  bool waitingForClock();
+  size_t drainBatch(const JournalRecord *records, size_t count);
+  size_t drainSingly(const JournalRecord *records, size_t count);
+  void drainPushed();
+  int upload(const ScanEvent &event);
+  bool compactRefused(int send_code);
+  uint32_t batchWindowRemaining();
+  void backOff();
+  void countDelivered(const JournalRecord &record);
+  void countDiscarded();
+  void countFailed(uint32_t events);
+
+  const char *device_UID = nullptr;
+  QueueHandle_t queue = nullptr;
+  TaskHandle_t task = nullptr;
+  uint32_t retry_at_ms = 0;
+  bool backing_off = false;
+  uint32_t window_start_ms = 0;
+  uint32_t online_since_ms = 0;
+  bool was_online = false;
+  bool batch_supported = UPLOAD_BATCH;
+  bool compact = WIRE_COMPACT;       // send the compact encodings
+  bool compact_confirmed = false;    // the server has accepted one
+  portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+  uint32_t unjournaled = 0; // queued events not yet appended to the journal
+  UploaderStats counters = {};
+};
+
+extern Uploader uploader;
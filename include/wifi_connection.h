@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Give up on one connection attempt after this long
+#ifndef WIFI_CONNECT_TIMEOUT_MS
+#define WIFI_CONNECT_TIMEOUT_MS 10000
+#endif
+
+// Wait between attempts, doubled after every full round over the networks
+#ifndef WIFI_BACKOFF_MIN_MS
+#define WIFI_BACKOFF_MIN_MS 500
+#endif
+
+#ifndef WIFI_BACKOFF_MAX_MS
+#define WIFI_BACKOFF_MAX_MS 30000
+#endif
+
+struct WiFiNetwork
+{
+  const char *ssid;
+  const char *password;
+};
+
+struct WiFiConnectionStats
+{
+  uint32_t attempts;           // WiFi.begin() calls
+  uint32_t fast_attempts;      // attempts with the cached BSSID/channel (no scan)
+  uint32_t disconnects;        // connection losses
+  uint32_t reconnects;         // connections restored after a loss
+  uint32_t last_reconnect_ms;  // loss to IP address, last outage
+  uint32_t max_reconnect_ms;
+  uint64_t total_reconnect_ms; // average = total / reconnects
+};
+
+/**
+ * Event-driven WiFi connection manager. The WiFi event callbacks only record what happened;
+ * update() runs the connect/backoff state machine from loop() and never blocks, so card
+ * detection and the relay keep running during an outage.
+ *
+ * Networks are tried in order with exponential backoff. The BSSID and channel of the last
+ * successful connection are kept in NVS so a reconnect can skip the scan.
+ */
+class WiFiConnection
+{
+public:
+  /**
+   * Registers the WiFi events and starts the first connection attempt.
+   * networks must stay valid.
+   */
+  void begin(const WiFiNetwork *networks, size_t count);
+
+  /**
+   * Advances the state machine. Call from loop().
+   */
+  void update();
+
+  bool connected() const { return state == CONNECTED; }
+
+  /**
+   * Not connected and not in the middle of an attempt (waiting for the next retry).
+   */
+  bool offline() const { return state == WAITING || state == IDLE; }
+
+  /**
+   * Milliseconds until the next attempt while offline (UINT32_MAX without networks), 0 otherwise.
+   */
+  uint32_t retryIn() const;
+
+  WiFiConnectionStats stats() const { return counters; }
+  void printStats();
+
+private:
+  enum State
+  {
+    IDLE,
+    CONNECTING,
+    CONNECTED,
+    WAITING
+  };
+
+  static void onStationConnected(WiFiEvent_t event, WiFiEventInfo_t info);
+  static void onGotIP(WiFiEvent_t event, WiFiEventInfo_t info);
+  static void onStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info);
+
+  void startAttempt();
+  void failAttempt();
+  void connectionUp();
+  void loadCache();
+  void saveCache();
+
+  const WiFiNetwork *networks = nullptr;
+  size_t network_count = 0;
+  size_t network_index = 0;
+
+  State state = IDLE;
+  uint32_t attempt_started_ms = 0;
+  uint32_t retry_at_ms = 0;
+  uint32_t backoff_ms = WIFI_BACKOFF_MIN_MS;
+  uint32_t outage_started_ms = 0;
+  bool in_outage = false;
+  bool attempt_fast = false;
+  bool skip_cache = false;
+
+  // Last good access point, for connecting without a scan.
+  bool cache_valid = false;
+  uint8_t cache_network = 0;
+  uint8_t cache_bssid[6] = {};
+  int32_t cache_channel = 0;
+
+  // Set by the event callbacks (WiFi event task), consumed by update().
+  volatile bool event_got_ip = false;
+  volatile bool event_disconnected = false;
+  volatile uint8_t disconnect_reason = 0;
+
+  WiFiConnectionStats counters = {};
+};
+
+extern WiFiConnection wifiConnection;
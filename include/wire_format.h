@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "event_serializer.h"
+#include "scan_event.h"
+
+// Offer the compact encodings below instead of JSON. The server picks by Content-Type; one
+// that refuses the first compact request is sent JSON from then on (see Uploader).
+#ifndef WIRE_COMPACT
+#define WIRE_COMPACT 0
+#endif
+
+#define WIRE_CONTENT_JSON "application/json"
+#define WIRE_CONTENT_MSGPACK "application/msgpack"
+#define WIRE_CONTENT_BATCH "application/vnd.hotel-monitoring.scan-batch"
+
+// Binary batch: "HMB" and the layout version
+#define WIRE_BATCH_MAGIC "HMB1"
+#define WIRE_BATCH_HEADER_SIZE 5
+#define WIRE_BATCH_EVENT_SIZE 22
+
+/**
+ * Writes MessagePack into a caller-provided buffer, the counterpart of JsonWriter for the
+ * compact encoding. Maps are written with their member count up front.
+ */
+class MsgPackWriter
+{
+public:
+  MsgPackWriter(uint8_t *buffer, size_t size) : out(buffer), size(size) {}
+
+  void beginMap(uint16_t members);
+  void field(const char *key, const char *value); // nullptr is written as nil
+  void field(const char *key, uint32_t value);
+  void nil(const char *key);
+
+  /**
+   * Returns the output length, or 0 if it did not fit.
+   */
+  size_t finish();
+
+private:
+  void raw(uint8_t byte);
+  void raw(const void *data, size_t length);
+  void bigEndian(uint32_t value, uint8_t bytes);
+  void string(const char *text);
+  void integer(uint32_t value);
+
+  uint8_t *out;
+  size_t size;
+  size_t pos = 0;
+  bool overflow = false;
+};
+
+/**
+ * The /api/send-data payload as a MessagePack map with the JSON field names. Values are
+ * typed: scan_time is seconds since 1970 (UTC, not the local time text of the JSON payload)
+ * or nil when the time is not known. Returns the payload length, or 0 if it does not fit.
+ */
+size_t packSendData(uint8_t *out, size_t size, const ReceiverCredentials &credentials, const ScanEvent &event);
+
+/**
+ * The /api/send-data/batch request for records[0..count) in the fixed binary layout, for
+ * journal replay. Integers are little-endian:
+ *
+ *   "HMB1", u8 event count,
+ *   client_key, client_secret, receiver_serial_no, receiver_token: u8 length + bytes each,
+ *   per event (22 bytes): u32 seq, u32 epoch (UTC, 0 = not known), u8 scan type, u8 reader,
+ *                         u8 uid size, u8 reserved, uid[10] (zero padded)
+ *
+ * The response is the JSON of BatchAckParser. Returns the payload length, or 0 if it does
+ * not fit into out_size.
+ */
+size_t packEventBatch(const ReceiverCredentials &credentials, const JournalRecord *records, size_t count, uint8_t *out, size_t out_size);
@@ -0,0 +1,443 @@
+#include "allow_list.h"
+
+#include <LittleFS.h>
+#include <esp_timer.h>
+#include <stdlib.h>
+
+#include "crc32.h"
+#include "log.h"
+#include "server_api.h"
+#include "stay_limits.h"
+#include "token_manager.h"
+
+AllowList allowList;
+
+static const char *ALLOW_LIST_PATH = "/allow_list.bin";
+static const char *ALLOW_LIST_TEMP_PATH = "/allow_list.tmp";
+static const uint32_t ALLOW_LIST_MAGIC = 0x57414C31; // "1LAW"
+
+struct AllowListHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t crc; // over the tags
+};
+
+int compareTags(const void *a, const void *b)
+{
+  const AllowTag *x = static_cast<const AllowTag *>(a);
+  const AllowTag *y = static_cast<const AllowTag *>(b);
+  int sizes = (x->size & ~ALLOW_TAG_REMOVE) - (y->size & ~ALLOW_TAG_REMOVE);
+  return sizes != 0 ? sizes : memcmp(x->uid, y->uid, sizeof(x->uid));
+}
+
+static AllowTag makeTag(const uint8_t *uid, uint8_t size)
+{
+  AllowTag tag = {};
+  tag.size = size > sizeof(tag.uid) ? sizeof(tag.uid) : size;
+  memcpy(tag.uid, uid, tag.size);
+  return tag;
+}
+
+/**
+ * Two independent hashes of the tag; the bloom filter probes h1 + i * h2.
+ */
+static void hashTag(const AllowTag &tag, uint32_t &h1, uint32_t &h2)
+{
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&tag);
+  for (size_t i = 0; i < sizeof(AllowTag); i++)
+    h = (h ^ bytes[i]) * 16777619u;
+  h1 = h;
+
+  // murmur3 finalizer, forced odd so every probe lands on a different bit
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  h2 = h | 1;
+}
+
+bool parseHexTag(const char *text, size_t length, AllowTag &tag)
+{
+  if (length == 0 || length % 2 != 0 || length / 2 > sizeof(tag.uid))
+    return false;
+
+  tag = {};
+  tag.size = length / 2;
+  for (size_t i = 0; i < length; i++)
+  {
+    char c = text[i];
+    uint8_t digit;
+    if (c >= '0' && c <= '9')
+      digit = c - '0';
+    else if (c >= 'A' && c <= 'F')
+      digit = c - 'A' + 10;
+    else if (c >= 'a' && c <= 'f')
+      digit = c - 'a' + 10;
+    else
+      return false;
+    tag.uid[i / 2] = tag.uid[i / 2] << 4 | digit;
+  }
+  return true;
+}
+
+AllowListUpdate::~AllowListUpdate()
+{
+  free(changes);
+}
+
+void AllowListUpdate::value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type)
+{
+  if (depth == 1 && strcmp(key, "version") == 0 && type == NUMBER)
+  {
+    version = strtoul(value, nullptr, 10);
+    has_version = true;
+  }
+  else if (depth == 1 && strcmp(key, "full") == 0 && type == LITERAL)
+  {
+    full = strcmp(value, "true") == 0;
+  }
+  else if (depth == 2 && type == STRING && (value[0] == '+' || value[0] == '-') && !overflowed)
+  {
+    if (count == capacity)
+    {
+      // Grow in steps so a large list does not need its final size up front.
+      size_t grown = capacity == 0 ? 64 : capacity * 2;
+      if (grown > ALLOW_LIST_MAX_TAGS)
+        grown = ALLOW_LIST_MAX_TAGS;
+      AllowTag *grown_changes = count < grown ? (AllowTag *)realloc(changes, grown * sizeof(AllowTag)) : nullptr;
+      if (grown_changes == nullptr)
+      {
+        overflowed = true;
+        return;
+      }
+      changes = grown_changes;
+      capacity = grown;
+    }
+
+    if (!parseHexTag(value + 1, length - 1, changes[count]))
+    {
+      overflowed = true;
+      return;
+    }
+    if (value[0] == '-')
+      changes[count].size |= ALLOW_TAG_REMOVE;
+    count++;
+  }
+  else if (depth == 3 && limits != nullptr)
+  {
+    limits->value(key, value, length, type);
+  }
+}
+
+void AllowListUpdate::objectEnd(uint8_t depth)
+{
+  if (depth == 3 && limits != nullptr)
+    limits->entryEnd();
+}
+
+void AllowList::begin()
+{
+#if ALLOW_LIST_ENABLED
+  File file = LittleFS.open(ALLOW_LIST_PATH, FILE_READ);
+  if (!file)
+  {
+    LOG_INFO("Allow list: none saved, all tags allowed until the server sends one");
+    return;
+  }
+
+  AllowListHeader header;
+  AllowTag *loaded = nullptr;
+  bool valid = file.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+               header.magic == ALLOW_LIST_MAGIC && header.count <= ALLOW_LIST_MAX_TAGS;
+  if (valid && header.count > 0)
+  {
+    loaded = (AllowTag *)malloc(header.count * sizeof(AllowTag));
+    size_t bytes = header.count * sizeof(AllowTag);
+    valid = loaded != nullptr && file.read(reinterpret_cast<uint8_t *>(loaded), bytes) == bytes &&
+            crc32(loaded, bytes) == header.crc;
+  }
+  file.close();
+
+  if (!valid)
+  {
+    LOG_WARN("Allow list: saved list is corrupt, waiting for the server");
+    free(loaded);
+    return;
+  }
+
+  install(loaded, header.count, header.version);
+  LOG_INFO("Allow list: version %u, %u tags", header.version, header.count);
+#endif
+}
+
+bool AllowList::allowed(const uint8_t *uid, uint8_t size)
+{
+#if ALLOW_LIST_ENABLED
+  int64_t start_us = esp_timer_get_time();
+  AllowTag tag = makeTag(uid, size);
+
+  portENTER_CRITICAL(&lock);
+  bool allow;
+  if (current_version == 0)
+  {
+    allow = true;
+  }
+  else if (count == 0)
+  {
+    // The server sent an empty list (tags is nullptr then).
+    allow = false;
+  }
+  else if (!bloomMayContain(tag))
+  {
+    allow = false;
+    counters.bloom_rejects++;
+  }
+  else
+  {
+    allow = bsearch(&tag, tags, count, sizeof(AllowTag), compareTags) != nullptr;
+    if (!allow)
+      counters.bloom_false_hits++;
+  }
+
+  uint32_t took_us = (uint32_t)(esp_timer_get_time() - start_us);
+  counters.lookups++;
+  if (allow)
+    counters.hits++;
+  counters.last_lookup_us = took_us;
+  counters.total_lookup_us += took_us;
+  if (took_us > counters.max_lookup_us)
+    counters.max_lookup_us = took_us;
+  portEXIT_CRITICAL(&lock);
+
+  return allow;
+#else
+  return true;
+#endif
+}
+
+bool AllowList::apply(AllowListUpdate &update)
+{
+  if (!update.has_version || update.overflowed)
+  {
+    countSync(false);
+    return false;
+  }
+  if (!update.full && update.version == current_version && update.count == 0)
+    return true;
+
+  AllowTag *merged;
+  size_t merged_count = 0;
+
+  if (update.full)
+  {
+    // The change buffer becomes the list: sort it and drop duplicates in place.
+    merged = update.changes;
+    update.changes = nullptr;
+    if (update.count > 0)
+      qsort(merged, update.count, sizeof(AllowTag), compareTags);
+    for (size_t i = 0; i < update.count; i++)
+    {
+      if (!(merged[i].size & ALLOW_TAG_REMOVE) && (merged_count == 0 || compareTags(&merged[merged_count - 1], &merged[i]) != 0))
+        merged[merged_count++] = merged[i];
+    }
+  }
+  else
+  {
+    // Delta: tags named in it are dropped, its adds appended, then the result is sorted once.
+    merged = (AllowTag *)malloc(max((size_t)1, (count + update.count) * sizeof(AllowTag)));
+    if (merged == nullptr)
+    {
+      countSync(false);
+      return false;
+    }
+
+    if (update.count > 0)
+      qsort(update.changes, update.count, sizeof(AllowTag), compareTags);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (update.count == 0 || bsearch(&tags[i], update.changes, update.count, sizeof(AllowTag), compareTags) == nullptr)
+        merged[merged_count++] = tags[i];
+    }
+    for (size_t i = 0; i < update.count; i++)
+    {
+      if (!(update.changes[i].size & ALLOW_TAG_REMOVE))
+        merged[merged_count++] = update.changes[i];
+    }
+    qsort(merged, merged_count, sizeof(AllowTag), compareTags);
+  }
+
+  if (merged_count > ALLOW_LIST_MAX_TAGS)
+  {
+    LOG_WARN("Allow list: %u tags is more than the %u that fit", (unsigned)merged_count, ALLOW_LIST_MAX_TAGS);
+    free(merged);
+    countSync(false);
+    return false;
+  }
+
+  install(merged, merged_count, update.version);
+  save();
+  countSync(true);
+  LOG_INFO("Allow list: version %u, %u tags (%s, %u changes)", update.version, (unsigned)merged_count,
+           update.full ? "full" : "delta", (unsigned)update.count);
+  return true;
+}
+
+void AllowList::maintain(const char *device_UID)
+{
+#if ALLOW_LIST_ENABLED
+  if ((int32_t)(millis() - next_sync_ms) < 0)
+    return;
+
+  const char *token = tokenManager.get();
+  if (token == nullptr)
+  {
+    next_sync_ms = millis() + ALLOW_LIST_RETRY_MS;
+    return;
+  }
+
+  StayLimitsUpdate limits;
+  AllowListUpdate update;
+  update.limits = &limits;
+  int code = FetchAllowList(device_UID, token, current_version, update);
+  if (isTokenRejected(code))
+    tokenManager.invalidate();
+
+  bool applied = code >= 200 && code < 300 && apply(update);
+  if (applied && (limits.seen || update.full))
+    stayLimits.apply(limits);
+  if (code == 404)
+    LOG_DEBUG("Allow list: no endpoint on the server");
+  else if (!applied && (code < 200 || code >= 300))
+    countSync(false);
+  next_sync_ms = millis() + (applied || code == 404 ? ALLOW_LIST_SYNC_MS : ALLOW_LIST_RETRY_MS);
+#endif
+}
+
+AllowListStats AllowList::stats()
+{
+  portENTER_CRITICAL(&lock);
+  AllowListStats copy = counters;
+  copy.version = current_version;
+  copy.tags = count;
+  copy.memory_bytes = count * sizeof(AllowTag) + (bloom != nullptr ? (bloom_mask + 1) / 8 : 0);
+  portEXIT_CRITICAL(&lock);
+  return copy;
+}
+
+void AllowList::printStats()
+{
+  AllowListStats s = stats();
+  Serial.printf("Allow list: version %u, %u tags, %u bytes, %u lookups (%u allowed), %u bloom rejects, %u bloom false hits, lookup last %u us, avg %u us, max %u us, %u syncs, %u failed\n",
+                s.version, s.tags, s.memory_bytes, s.lookups, s.hits, s.bloom_rejects, s.bloom_false_hits,
+                s.last_lookup_us, s.lookups ? (uint32_t)(s.total_lookup_us / s.lookups) : 0, s.max_lookup_us, s.syncs,
+                s.sync_failures);
+}
+
+/**
+ * False only if the tag is certainly not on the list; without a filter (out of heap when the
+ * list was installed) every tag goes on to the search.
+ */
+bool AllowList::bloomMayContain(const AllowTag &tag) const
+{
+  if (bloom == nullptr)
+    return true;
+
+  uint32_t h1, h2;
+  hashTag(tag, h1, h2);
+  for (uint8_t i = 0; i < ALLOW_LIST_BLOOM_HASHES; i++)
+  {
+    uint32_t bit = (h1 + i * h2) & bloom_mask;
+    if ((bloom[bit / 32] & (1u << (bit % 32))) == 0)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Counts a sync; stats() reads the counters from other tasks under the lock.
+ */
+void AllowList::countSync(bool ok)
+{
+  portENTER_CRITICAL(&lock);
+  if (ok)
+    counters.syncs++;
+  else
+    counters.sync_failures++;
+  portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * Builds the bloom filter for a sorted tag array and swaps both in; the old ones are freed.
+ */
+void AllowList::install(AllowTag *new_tags, uint32_t new_count, uint32_t new_version)
+{
+  // Power of two bits so a probe is a mask, at least ALLOW_LIST_BLOOM_BITS_PER_TAG per tag.
+  uint32_t bits = 64;
+  while (bits < new_count * ALLOW_LIST_BLOOM_BITS_PER_TAG)
+    bits *= 2;
+  uint32_t *new_bloom = (uint32_t *)calloc(bits / 32, sizeof(uint32_t));
+  uint32_t new_mask = bits - 1;
+  if (new_bloom == nullptr)
+  {
+    // Every lookup goes to the search instead (see bloomMayContain()).
+    LOG_WARN("Allow list: no heap for the bloom filter, searching every lookup");
+    new_mask = 0;
+  }
+  else
+  {
+    for (uint32_t t = 0; t < new_count; t++)
+    {
+      uint32_t h1, h2;
+      hashTag(new_tags[t], h1, h2);
+      for (uint8_t i = 0; i < ALLOW_LIST_BLOOM_HASHES; i++)
+      {
+        uint32_t bit = (h1 + i * h2) & new_mask;
+        new_bloom[bit / 32] |= 1u << (bit % 32);
+      }
+    }
+  }
+
+  portENTER_CRITICAL(&lock);
+  AllowTag *old_tags = tags;
+  uint32_t *old_bloom = bloom;
+  tags = new_tags;
+  count = new_count;
+  bloom = new_bloom;
+  bloom_mask = new_mask;
+  current_version = new_version;
+  portEXIT_CRITICAL(&lock);
+
+  free(old_tags);
+  free(old_bloom);
+}
+
+/**
+ * Writes the list to a temporary file and renames it over the saved one, so a power loss
+ * leaves either the old or the new list.
+ */
+void AllowList::save()
+{
+  AllowListHeader header = {ALLOW_LIST_MAGIC, current_version, count, crc32(tags, count * sizeof(AllowTag))};
+
+  File file = LittleFS.open(ALLOW_LIST_TEMP_PATH, FILE_WRITE);
+  if (!file)
+  {
+    LOG_WARN("Allow list: cannot save");
+    return;
+  }
+  size_t bytes = count * sizeof(AllowTag);
+  bool written = file.write(reinterpret_cast<const uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+                 file.write(reinterpret_cast<const uint8_t *>(tags), bytes) == bytes;
+  file.close();
+
+  if (!written || !LittleFS.rename(ALLOW_LIST_TEMP_PATH, ALLOW_LIST_PATH))
+  {
+    LOG_WARN("Allow list: save failed");
+    LittleFS.remove(ALLOW_LIST_TEMP_PATH);
+  }
+}
@@ -0,0 +1,315 @@
+#include "card_reader.h"
+
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+
+#include "field_trace.h"
+#include "log.h"
+#include "trace.h"
+
+void CardReader::begin(MFRC522 &rfid, uint8_t ss_pin, int8_t irq_pin, uint8_t index)
+{
+  this->rfid = &rfid;
+  bus.begin(ss_pin);
+  this->index = index;
+  task = xTaskGetCurrentTaskHandle();
+  last_probe_ms = millis();
+  next_wake_ms = millis();
+  sensed_us = esp_timer_get_time();
+  powerManager.fieldChanged(field_on); // PCD_Init() switched the antenna on
+
+#if CARD_DETECT_IRQ
+  // Without the IRQ line the answer is read from ComIrqReg shortly after each wake-up.
+  listen_ms = CARD_SENSE_WINDOW_MS > 0 ? CARD_SENSE_WINDOW_MS : irq_pin >= 0 ? CARD_DETECT_INTERVAL_MS : CARD_FIELD_SETTLE_MS;
+  if (irq_pin >= 0)
+  {
+    // IRQ pin active low (IRqInv), open drain, only the receiver interrupt routed to it.
+    pinMode(irq_pin, INPUT_PULLUP);
+    bus.write(MFRC522::ComIEnReg, 0xA0);
+    bus.write(MFRC522::ComIrqReg, 0x7F);
+    bus.flush();
+    attachInterruptArg(digitalPinToInterrupt(irq_pin), onIrq, this, FALLING);
+#if POWER_MODE >= 2
+    // A card answering during a light sleep wakes the chip.
+    gpio_wakeup_enable((gpio_num_t)irq_pin, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+#endif
+  }
+  LOG_INFO("Card reader %u: IRQ %s%d, wake-up every %u ms (%u ms listen window)", index,
+           irq_pin >= 0 ? "on GPIO " : "not wired ", irq_pin, CARD_DETECT_INTERVAL_MS, listen_ms);
+#else
+  LOG_INFO("Card reader %u: polling", index);
+#endif
+}
+
+CardReaderAction CardReader::step(bool locked)
+{
+  uint32_t now = millis();
+
+  if (locked)
+  {
+    if (!field_on && (int32_t)(now - (next_check_ms - CARD_FIELD_SETTLE_MS)) >= 0)
+      powerField(true);
+    if (!field_on || (int32_t)(now - next_check_ms) < 0 || (int32_t)(now - settled_ms) < 0)
+      return CARD_NONE;
+
+#if CARD_DETECT_IRQ
+    // The last select answer left RxIRq set, which would hold the IRQ line (and the sleep wake-up) low.
+    // Sent with the wake-up's writes.
+    clearIrq();
+#endif
+    // The transfers below raise RxIRq as well; serviced() clears it.
+    state = DETECT_IDLE;
+    counters.presence_checks++;
+    last_probe_ms = millis();
+    sensed_us = esp_timer_get_time();
+    fieldTrace.wake(index, wakeup());
+    return CARD_CHECK;
+  }
+
+#if CARD_DETECT_IRQ
+  switch (state)
+  {
+  case DETECT_IDLE:
+    if (!field_on)
+    {
+      if ((int32_t)(now - (next_wake_ms - CARD_FIELD_SETTLE_MS)) < 0)
+        return CARD_NONE;
+      powerField(true);
+      state = DETECT_SETTLING;
+      return CARD_NONE;
+    }
+    if ((int32_t)(now - next_wake_ms) < 0)
+      return CARD_NONE;
+    arm();
+    return CARD_NONE;
+
+  case DETECT_SETTLING:
+    if ((int32_t)(now - settled_ms) < 0 || (int32_t)(now - next_wake_ms) < 0)
+      return CARD_NONE;
+    arm();
+    return CARD_NONE;
+
+  case DETECT_LISTENING:
+    if (irq_pending)
+      return answered(true);
+    if (now - armed_ms < listen_ms)
+      return CARD_NONE;
+    // Missed edge or no IRQ line: the answer is still flagged in the register.
+    if (bus.read(MFRC522::ComIrqReg) & 0x20)
+      return answered(false);
+
+    // Nothing in the field: wait for the next wake-up.
+    sensed_us = esp_timer_get_time();
+    if (CARD_SENSE_WINDOW_MS > 0)
+      powerField(false);
+    state = DETECT_IDLE;
+    next_wake_ms = armed_ms + CARD_DETECT_INTERVAL_MS;
+    return CARD_NONE;
+  }
+  return CARD_NONE;
+#else
+  countProbe();
+  detected_us = esp_timer_get_time();
+  MFRC522::StatusCode result = wakeup();
+  if (result == MFRC522::STATUS_OK || result == MFRC522::STATUS_COLLISION)
+  {
+    fieldTrace.answer(index, result);
+    tracer.mark(TRACE_CARD_WAKE, index << 8);
+    return CARD_ANSWERED;
+  }
+  sensed_us = esp_timer_get_time();
+  return CARD_NONE;
+#endif
+}
+
+uint32_t CardReader::idleTime(bool locked)
+{
+  int32_t due;
+  if (locked)
+    due = field_on ? max((int32_t)(next_check_ms - millis()), (int32_t)(settled_ms - millis()))
+                   : (int32_t)(next_check_ms - CARD_FIELD_SETTLE_MS - millis());
+#if CARD_DETECT_IRQ
+  else if (state == DETECT_LISTENING)
+    due = irq_pending ? 0 : (int32_t)(armed_ms + listen_ms - millis());
+  else if (state == DETECT_SETTLING)
+    due = max((int32_t)(next_wake_ms - millis()), (int32_t)(settled_ms - millis()));
+  else
+    due = (int32_t)(next_wake_ms - (field_on ? 0 : CARD_FIELD_SETTLE_MS) - millis());
+#else
+  else
+    due = 0;
+#endif
+  return due > 0 ? due : 0;
+}
+
+void CardReader::serviced(bool locked, uint32_t check_ms)
+{
+#if CARD_DETECT_IRQ
+  clearIrq();
+  bus.flush();
+#endif
+  state = DETECT_IDLE;
+  if (locked)
+  {
+    next_check_ms = millis() + check_ms;
+    if (CARD_SENSE_WINDOW_MS > 0)
+      powerField(false);
+  }
+  else
+  {
+    // Card gone or not locked: start looking again right away.
+    next_wake_ms = millis();
+  }
+}
+
+void CardReader::cardLocked()
+{
+  uint32_t latency_us = (uint32_t)(esp_timer_get_time() - detected_us);
+  counters.detections++;
+  counters.last_detect_us = latency_us;
+  counters.total_detect_us += latency_us;
+  if (latency_us > counters.max_detect_us)
+    counters.max_detect_us = latency_us;
+
+  // The card may have arrived right after the last wake-up that found nothing.
+  uint32_t tap_ms = (uint32_t)((esp_timer_get_time() - sensed_us) / 1000);
+  counters.last_tap_ms = tap_ms;
+  if (tap_ms > counters.max_tap_ms)
+    counters.max_tap_ms = tap_ms;
+  if (tap_ms > CARD_MAX_TAP_LATENCY_MS)
+    counters.over_budget++;
+}
+
+void CardReader::printStats()
+{
+  CardReaderStats s = counters;
+  Serial.printf("Card reader %u: %u probes, %u IRQs, %u register hits, %u presence checks, probe gap max %u ms, detect last %u us, avg %u us, max %u us\n",
+                index, s.probes, s.irqs, s.fallback_hits, s.presence_checks, s.max_probe_gap_ms, s.last_detect_us,
+                s.detections ? (uint32_t)(s.total_detect_us / s.detections) : 0, s.max_detect_us);
+  PcdBusStats bus_stats = bus.stats();
+  uint32_t cycles = s.probes + s.presence_checks;
+  Serial.printf("Card reader %u: SPI at %u kHz, %u bytes in %u frames and %u transactions, %u writes skipped, %u us; per wake-up %.1f bytes, %.1f us\n",
+                index, PCD_SPI_HZ / 1000, bus_stats.bytes, bus_stats.frames, bus_stats.transactions, bus_stats.skipped,
+                (uint32_t)bus_stats.busy_us, cycles ? (float)bus_stats.bytes / cycles : 0.0f,
+                cycles ? (float)bus_stats.busy_us / cycles : 0.0f);
+  Serial.printf("Card reader %u: tap-to-relay worst case last %u ms, max %u ms, %u over the %u ms bound\n", index,
+                s.last_tap_ms, s.max_tap_ms, s.over_budget, CARD_MAX_TAP_LATENCY_MS);
+}
+
+void IRAM_ATTR CardReader::onIrq(void *arg)
+{
+  CardReader *reader = static_cast<CardReader *>(arg);
+  reader->irq_us = esp_timer_get_time();
+  reader->irq_pending = true;
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(reader->task, &woken);
+  if (woken)
+    portYIELD_FROM_ISR();
+}
+
+/**
+ * A card answered the armed wake-up and is waiting to be selected.
+ */
+CardReaderAction CardReader::answered(bool from_irq)
+{
+  state = DETECT_IDLE;
+  if (from_irq)
+  {
+    counters.irqs++;
+    detected_us = irq_us;
+  }
+  else
+  {
+    counters.fallback_hits++;
+    detected_us = esp_timer_get_time();
+  }
+  clearIrq();
+  bus.flush();
+  fieldTrace.answer(index, MFRC522::STATUS_OK);
+  tracer.mark(TRACE_CARD_WAKE, index << 8 | (from_irq ? 0 : 1));
+  return CARD_ANSWERED;
+}
+
+/**
+ * Wakes up all cards in the field, including halted ones (WUPA). STATUS_OK or
+ * STATUS_COLLISION: a card answered.
+ */
+MFRC522::StatusCode CardReader::wakeup()
+{
+  byte bufferATQA[2];
+  byte bufferSize = sizeof(bufferATQA);
+
+  // Reset baud rates and ModWidthReg (free while they hold these values)
+  bus.write(MFRC522::TxModeReg, 0x00);
+  bus.write(MFRC522::RxModeReg, 0x00);
+  bus.write(MFRC522::ModWidthReg, 0x26);
+  bus.flush();
+
+  return rfid->PICC_WakeupA(bufferATQA, &bufferSize);
+}
+
+/**
+ * Starts a WUPA transceive without waiting for it; a card that answers raises RxIRq. One bus
+ * transaction; the configuration writes are skipped once the registers hold their values.
+ */
+void CardReader::arm()
+{
+  bus.write(MFRC522::CommandReg, MFRC522::PCD_Idle);
+  clearIrq();
+
+  bus.write(MFRC522::FIFOLevelReg, 0x80);
+  bus.write(MFRC522::TxModeReg, 0x00);
+  bus.write(MFRC522::RxModeReg, 0x00);
+  bus.write(MFRC522::ModWidthReg, 0x26);
+  bus.write(MFRC522::CollReg, 0x00); // ValuesAfterColl off; the other bits are read-only
+  bus.write(MFRC522::FIFODataReg, MFRC522::PICC_CMD_WUPA);
+  bus.write(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+  bus.write(MFRC522::BitFramingReg, 0x87); // StartSend, 7-bit short frame
+  bus.flush();
+
+  state = DETECT_LISTENING;
+  armed_ms = millis();
+  countProbe();
+}
+
+/**
+ * Clears the interrupt bits, releasing the IRQ line, once the bus is flushed. Notifications
+ * raised by the transfers are left to the reader array's wait, which other readers share; a
+ * stale one only ends a wait early.
+ */
+void CardReader::clearIrq()
+{
+  bus.write(MFRC522::ComIrqReg, 0x7F);
+  irq_pending = false;
+}
+
+/**
+ * Switches the antenna; a card needs the field for CARD_FIELD_SETTLE_MS before it answers,
+ * which step() waits out without blocking.
+ */
+void CardReader::powerField(bool on)
+{
+  if (on == field_on)
+    return;
+
+  if (on)
+    bus.setBits(MFRC522::TxControlReg, 0x03);
+  else
+    bus.clearBits(MFRC522::TxControlReg, 0x03);
+  bus.flush();
+  field_on = on;
+  powerManager.fieldChanged(on);
+
+  if (on)
+    settled_ms = millis() + CARD_FIELD_SETTLE_MS;
+}
+
+void CardReader::countProbe()
+{
+  uint32_t gap = millis() - last_probe_ms;
+  if (gap > counters.max_probe_gap_ms)
+    counters.max_probe_gap_ms = gap;
+  last_probe_ms = millis();
+  counters.probes++;
+}
@@ -0,0 +1,219 @@
+#include "config_store.h"
+
+#include <Preferences.h>
+#include <esp_timer.h>
+
+#include "config.h"
+#include "log.h"
+#include "reader_array.h"
+#include "scan_journal.h"
+#include "server_api.h"
+#include "token_manager.h"
+#include "uploader.h"
+
+ConfigStore configStore;
+
+// Set by ConfigStore::begin(), see config.h.
+const char *client_key = "";
+const char *client_secret = "";
+const char *request_token_address = "";
+const char *send_data_address = "";
+const char *send_data_batch_address = "";
+const char *allow_list_address = "";
+const char *config_address = "";
+const char *mqtt_broker_host = "";
+
+static char request_token_url[96];
+static char send_data_url[96];
+static char send_data_batch_url[96];
+static char allow_list_url[96];
+static char config_url[96];
+
+/**
+ * Copies a JSON string into a fixed field; false if it had to be cut.
+ */
+static bool copyField(char *field, size_t size, const char *value, size_t length)
+{
+  strlcpy(field, value, size);
+  return length < size;
+}
+
+void ConfigUpdate::value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type)
+{
+  // {"networks": [ {"ssid": .., "password": ..} ]} puts the network members at depth 3.
+  if (depth == 3 && type == STRING && (strcmp(key, "ssid") == 0 || strcmp(key, "password") == 0))
+  {
+    if (!networks_seen)
+    {
+      networks_seen = true;
+      config.network_count = 0;
+      memset(config.networks, 0, sizeof(config.networks));
+    }
+    if (config.network_count >= CONFIG_MAX_NETWORKS)
+    {
+      overflowed = true;
+      return;
+    }
+    NetworkConfig &network = config.networks[config.network_count];
+    bool fits = key[0] == 's' ? copyField(network.ssid, sizeof(network.ssid), value, length)
+                              : copyField(network.password, sizeof(network.password), value, length);
+    overflowed = overflowed || !fits;
+    return;
+  }
+
+  if (depth != 1)
+    return;
+
+  bool fits = true;
+  if (strcmp(key, "version") == 0 && type == NUMBER)
+  {
+    config.version = strtoul(value, nullptr, 10);
+    has_version = true;
+  }
+  else if (strcmp(key, "gmt_offset_s") == 0 && type == NUMBER)
+    config.gmt_offset_s = strtol(value, nullptr, 10);
+  else if (strcmp(key, "daylight_offset_s") == 0 && type == NUMBER)
+    config.daylight_offset_s = strtol(value, nullptr, 10);
+  else if (type != STRING)
+    return;
+  else if (strcmp(key, "client_key") == 0)
+    fits = copyField(config.client_key, sizeof(config.client_key), value, length);
+  else if (strcmp(key, "client_secret") == 0)
+    fits = copyField(config.client_secret, sizeof(config.client_secret), value, length);
+  else if (strcmp(key, "server") == 0)
+    fits = copyField(config.server, sizeof(config.server), value, length);
+  else if (strcmp(key, "mqtt_host") == 0)
+    fits = copyField(config.mqtt_host, sizeof(config.mqtt_host), value, length);
+  overflowed = overflowed || !fits;
+}
+
+void ConfigUpdate::objectEnd(uint8_t depth)
+{
+  if (depth == 3 && networks_seen && config.network_count < CONFIG_MAX_NETWORKS &&
+      config.networks[config.network_count].ssid[0] != '\0')
+    config.network_count++;
+}
+
+void ConfigStore::begin(const DeviceConfig &defaults)
+{
+  uint32_t start_us = esp_timer_get_time();
+  config = defaults;
+
+  // A blob of another size was written by a firmware with a different layout: use the defaults.
+  Preferences prefs;
+  if (prefs.begin("config", true))
+  {
+    counters.from_nvs = prefs.getBytesLength("blob") == sizeof(DeviceConfig) &&
+                        prefs.getBytes("blob", &config, sizeof(DeviceConfig)) == sizeof(DeviceConfig);
+    prefs.end();
+  }
+  if (!counters.from_nvs)
+    config = defaults;
+  if (config.network_count > CONFIG_MAX_NETWORKS)
+    config.network_count = CONFIG_MAX_NETWORKS;
+
+  publish();
+  counters.version = config.version;
+  counters.load_us = esp_timer_get_time() - start_us;
+  LOG_INFO("Config version %u (%s) loaded in %u us", config.version, counters.from_nvs ? "NVS" : "defaults",
+           counters.load_us);
+}
+
+/**
+ * Points the globals of config.h at the running configuration.
+ */
+void ConfigStore::publish()
+{
+  client_key = config.client_key;
+  client_secret = config.client_secret;
+  mqtt_broker_host = config.mqtt_host;
+
+  snprintf(request_token_url, sizeof(request_token_url), "%s/api/request-token", config.server);
+  snprintf(send_data_url, sizeof(send_data_url), "%s/api/send-data", config.server);
+  snprintf(send_data_batch_url, sizeof(send_data_batch_url), "%s/api/send-data/batch", config.server);
+  snprintf(allow_list_url, sizeof(allow_list_url), "%s/api/allow-list", config.server);
+  snprintf(config_url, sizeof(config_url), "%s/api/config", config.server);
+  request_token_address = request_token_url;
+  send_data_address = send_data_url;
+  send_data_batch_address = send_data_batch_url;
+  allow_list_address = allow_list_url;
+  config_address = config_url;
+
+  for (uint8_t i = 0; i < config.network_count; i++)
+    wifi_networks[i] = {config.networks[i].ssid, config.networks[i].password};
+}
+
+bool ConfigStore::apply(const ConfigUpdate &update)
+{
+  const DeviceConfig &next = update.config;
+  if (!update.has_version || next.version <= config.version)
+    return false;
+
+  if (update.overflowed || next.server[0] == '\0' || next.network_count == 0)
+  {
+    LOG_WARN("Config version %u rejected", next.version);
+    counters.rejected++;
+    return false;
+  }
+
+  Preferences prefs;
+  if (!prefs.begin("config", false) || prefs.putBytes("blob", &next, sizeof(DeviceConfig)) != sizeof(DeviceConfig))
+  {
+    LOG_ERROR("Config version %u could not be saved", next.version);
+    counters.sync_failures++;
+    return false;
+  }
+  prefs.end();
+
+  LOG_INFO("Config version %u saved, restarting when idle", next.version);
+  counters.updates++;
+  restart_pending = true;
+  return true;
+}
+
+void ConfigStore::maintain(const char *device_UID)
+{
+  if (restart_pending)
+  {
+    if (readers.anyRelayOn())
+      return;
+    // Scans still in the upload queue would be lost with the RAM.
+    uploader.journalQueued();
+    if (!uploader.idle())
+      return;
+    journal.flush();
+    LOG_INFO("Restarting into the new config");
+    ESP.restart();
+  }
+
+  if ((int32_t)(millis() - next_sync_ms) < 0)
+    return;
+
+  const char *token = tokenManager.get();
+  if (token == nullptr)
+  {
+    next_sync_ms = millis() + CONFIG_RETRY_MS;
+    return;
+  }
+
+  ConfigUpdate update(config);
+  int code = FetchConfig(device_UID, token, config.version, update);
+  if (isTokenRejected(code))
+    tokenManager.invalidate();
+
+  if (code >= 200 && code < 300)
+    apply(update);
+  else if (code == 404)
+    LOG_DEBUG("Config: no endpoint on the server");
+  else
+    counters.sync_failures++;
+  next_sync_ms = millis() + (code == 404 || (code >= 200 && code < 300) ? CONFIG_SYNC_MS : CONFIG_RETRY_MS);
+}
+
+void ConfigStore::printStats()
+{
+  ConfigStats s = counters;
+  Serial.printf("Config: version %u (%s), loaded in %u us, %u updates, %u rejected, %u sync failures%s\n",
+                s.version, s.from_nvs ? "NVS" : "defaults", s.load_us, s.updates, s.rejected, s.sync_failures,
+                restart_pending ? ", restart pending" : "");
+}
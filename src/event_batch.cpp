@@ -0,0 +1,104 @@
+#include "event_batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void writeEvent(JsonWriter &json, const JournalRecord &record)
+{
+  const ScanEvent &event = record.event;
+  char tag[32];
+  char scan_time[20];
+  formatTag(tag, sizeof(tag), event.uid, event.uid_size);
+  formatScanTime(scan_time, sizeof(scan_time), event.epoch);
+
+  json.beginObject();
+  json.field("seq", record.seq);
+  json.field("tag_serial_no", tag);
+  json.field("scan_time", scan_time);
+  json.field("scan_type", scanTypeName(event.type));
+  if (READER_COUNT > 1)
+    json.field("reader", (uint32_t)event.reader);
+  json.endObject();
+}
+
+size_t serializeEventBatch(const ReceiverCredentials &credentials, const JournalRecord *records, size_t count, char *out, size_t out_size)
+{
+  JsonWriter json(out, out_size);
+  json.beginObject();
+  json.field("client_key", credentials.client_key);
+  json.field("client_secret", credentials.client_secret);
+  json.field("receiver_serial_no", credentials.device_UID);
+  json.field("receiver_token", credentials.token);
+
+  json.beginArray("events");
+  for (size_t i = 0; i < count; i++)
+    writeEvent(json, records[i]);
+  json.endArray();
+
+  json.endObject();
+  return json.finish();
+}
+
+size_t writeScanMessage(const JournalRecord &record, char *out, size_t out_size)
+{
+  JsonWriter json(out, out_size);
+  writeEvent(json, record);
+  return json.finish();
+}
+
+BatchAckParser::BatchAckParser(const JournalRecord *records, size_t count, BatchAck *acks)
+    : records(records), count(count), acks(acks)
+{
+  for (size_t i = 0; i < count; i++)
+    acks[i] = BATCH_ACK_NONE;
+}
+
+void BatchAckParser::value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type)
+{
+  // {"results": [ {"seq": .., "status": ..} ]} puts the members at depth 3.
+  if (depth != 3)
+    return;
+
+  if (strcmp(key, "seq") == 0 && type == NUMBER)
+  {
+    seq = strtoul(value, nullptr, 10);
+    has_seq = true;
+  }
+  else if (strcmp(key, "status") == 0 && type == STRING)
+  {
+    if (strcmp(value, "ok") == 0 || strcmp(value, "duplicate") == 0)
+      status = BATCH_ACK_OK;
+    else if (strcmp(value, "rejected") == 0)
+      status = BATCH_ACK_REJECTED;
+  }
+}
+
+void BatchAckParser::objectEnd(uint8_t depth)
+{
+  if (depth != 3)
+    return;
+
+  if (has_seq && count > 0)
+  {
+    // Journal records are normally consecutive, so the offset finds the record directly.
+    size_t index = seq - records[0].seq;
+    if (index >= count || records[index].seq != seq)
+    {
+      for (index = 0; index < count && records[index].seq != seq; index++)
+        ;
+    }
+    if (index < count)
+      acks[index] = status;
+  }
+
+  has_seq = false;
+  status = BATCH_ACK_NONE;
+}
+
+bool parseBatchAcks(const char *response, size_t length, const JournalRecord *records, size_t count, BatchAck *acks)
+{
+  char value[32];
+  BatchAckParser parser(records, count, acks);
+  JsonScanner scanner(parser, value, sizeof(value));
+  return scanner.feed(response, length) && scanner.complete();
+}
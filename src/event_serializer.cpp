@@ -0,0 +1,222 @@
+#include "event_serializer.h"
+
+#include <time.h>
+
+void JsonWriter::separator()
+{
+  if (!first)
+    raw(',');
+  first = false;
+}
+
+void JsonWriter::key(const char *name)
+{
+  separator();
+  if (name)
+  {
+    string(name);
+    raw(':');
+  }
+}
+
+void JsonWriter::beginObject(const char *name)
+{
+  key(name);
+  raw('{');
+  first = true;
+}
+
+void JsonWriter::endObject()
+{
+  raw('}');
+  first = false;
+}
+
+void JsonWriter::beginArray(const char *name)
+{
+  key(name);
+  raw('[');
+  first = true;
+}
+
+void JsonWriter::endArray()
+{
+  raw(']');
+  first = false;
+}
+
+void JsonWriter::field(const char *name, const char *value)
+{
+  key(name);
+  if (value)
+    string(value);
+  else
+    raw("null");
+}
+
+void JsonWriter::field(const char *name, uint32_t value)
+{
+  key(name);
+
+  char digits[11];
+  size_t count = 0;
+  do
+  {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+
+  while (count > 0)
+    raw(digits[--count]);
+}
+
+size_t JsonWriter::finish()
+{
+  if (overflow || pos >= size)
+  {
+    if (size > 0)
+      out[0] = '\0';
+    return 0;
+  }
+  out[pos] = '\0';
+  return pos;
+}
+
+void JsonWriter::raw(char c)
+{
+  // Keep one byte for the terminator.
+  if (pos + 1 < size)
+    out[pos++] = c;
+  else
+    overflow = true;
+}
+
+void JsonWriter::raw(const char *text)
+{
+  while (*text)
+    raw(*text++);
+}
+
+void JsonWriter::string(const char *text)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  raw('"');
+  for (; *text; text++)
+  {
+    unsigned char c = *text;
+    if (c == '"' || c == '\\')
+    {
+      raw('\\');
+      raw((char)c);
+    }
+    else if (c < 0x20)
+    {
+      raw("\\u00");
+      raw(hex[c >> 4]);
+      raw(hex[c & 0x0F]);
+    }
+    else
+    {
+      raw((char)c);
+    }
+  }
+  raw('"');
+}
+
+const char *scanTypeName(uint8_t type)
+{
+  switch (type)
+  {
+  case SCAN_EXIT:
+    return "Exit";
+  case SCAN_DENIED:
+    return "Denied";
+  case SCAN_EXPIRED:
+    return "Expired";
+  default:
+    return "Entry";
+  }
+}
+
+size_t formatTag(char *out, size_t size, const uint8_t *uid, uint8_t uid_size)
+{
+  static const char hex[] = "0123456789ABCDEF";
+
+  size_t pos = 0;
+  for (uint8_t i = 0; i < uid_size && pos + 3 < size; i++)
+  {
+    if (uid[i] < 0x10)
+      out[pos++] = '0';
+    out[pos++] = hex[uid[i] >> 4];
+    out[pos++] = hex[uid[i] & 0x0F];
+  }
+  if (size > 0)
+    out[pos] = '\0';
+  return pos;
+}
+
+size_t formatScanTime(char *out, size_t size, uint32_t epoch)
+{
+  if (size == 0)
+    return 0;
+  out[0] = '\0';
+  if (epoch == 0)
+    return 0;
+
+  time_t seconds = epoch;
+  struct tm local;
+  localtime_r(&seconds, &local);
+  return strftime(out, size, "%m-%d-%Y %H:%M:%S", &local);
+}
+
+size_t writeTokenRequest(char *out, size_t size, const char *client_key, const char *client_secret, const char *device_UID)
+{
+  JsonWriter json(out, size);
+  json.beginObject();
+  json.field("client_key", client_key);
+  json.field("client_secret", client_secret);
+  json.field("serial_no", device_UID);
+  json.endObject();
+  return json.finish();
+}
+
+size_t writeSendData(char *out, size_t size, const ReceiverCredentials &credentials,
+                     const char *tag_serial_no, const char *scan_time, const char *scan_type, int reader)
+{
+  JsonWriter json(out, size);
+  json.beginObject();
+  json.field("client_key", credentials.client_key);
+  json.field("client_secret", credentials.client_secret);
+  json.field("receiver_serial_no", credentials.device_UID);
+  json.field("receiver_token", credentials.token);
+  json.field("tag_serial_no", tag_serial_no);
+  json.field("scan_time", scan_time);
+  json.field("scan_type", scan_type);
+  if (reader >= 0)
+    json.field("reader", (uint32_t)reader);
+  json.endObject();
+  return json.finish();
+}
+
+size_t writeSendData(char *out, size_t size, const ReceiverCredentials &credentials, const ScanEvent &event)
+{
+  char tag[32];
+  char scan_time[20];
+  formatTag(tag, sizeof(tag), event.uid, event.uid_size);
+  formatScanTime(scan_time, sizeof(scan_time), event.epoch);
+  return writeSendData(out, size, credentials, tag, scan_time, scanTypeName(event.type), READER_COUNT > 1 ? event.reader : -1);
+}
+
+size_t writeAllowListRequest(char *out, size_t size, const ReceiverCredentials &credentials, uint32_t version)
+{
+  JsonWriter json(out, size);
+  json.beginObject();
+  json.field("client_key", credentials.client_key);
+  json.field("client_secret", credentials.client_secret);
+  json.field("receiver_serial_no", credentials.device_UID);
+  json.field("receiver_token", credentials.token);
+  json.field("version", version);
+  json.endObject();
+  return json.finish();
+}
@@ -0,0 +1,181 @@
+#include "field_trace.h"
+
+#include <LittleFS.h>
+#include <esp_timer.h>
+
+#include "log.h"
+
+FieldTrace fieldTrace;
+
+/**
+ * LEB128: 7 bits per byte, least significant first. Returns the bytes written (at most 10).
+ */
+static size_t putVarint(uint8_t *out, uint64_t value)
+{
+  size_t length = 0;
+  do
+  {
+    uint8_t digit = value & 0x7F;
+    value >>= 7;
+    out[length++] = digit | (value > 0 ? 0x80 : 0);
+  } while (value > 0);
+  return length;
+}
+
+FieldEndpoint fieldEndpoint(const char *url)
+{
+  // Longest suffix first: the batch path ends in the send-data one.
+  static const struct
+  {
+    const char *path;
+    FieldEndpoint endpoint;
+  } endpoints[] = {
+      {"/api/send-data/batch", FIELD_ENDPOINT_BATCH},
+      {"/api/send-data", FIELD_ENDPOINT_SEND_DATA},
+      {"/api/request-token", FIELD_ENDPOINT_TOKEN},
+      {"/api/allow-list", FIELD_ENDPOINT_ALLOW_LIST},
+      {"/api/config", FIELD_ENDPOINT_CONFIG},
+  };
+
+  size_t length = strlen(url);
+  for (const auto &candidate : endpoints)
+  {
+    size_t path_length = strlen(candidate.path);
+    if (length >= path_length && strcmp(url + length - path_length, candidate.path) == 0)
+      return candidate.endpoint;
+  }
+  return FIELD_ENDPOINT_OTHER;
+}
+
+void FieldTrace::begin()
+{
+#if FIELD_TRACE
+  LittleFS.remove(FIELD_TRACE_PATH ".old");
+  LittleFS.rename(FIELD_TRACE_PATH, FIELD_TRACE_PATH ".old");
+  File file = LittleFS.open(FIELD_TRACE_PATH, "w");
+  if (!file)
+  {
+    LOG_ERROR("Field trace: cannot create %s", FIELD_TRACE_PATH);
+    return;
+  }
+  file.write(reinterpret_cast<const uint8_t *>(FIELD_TRACE_MAGIC), 4);
+  file.close();
+
+  // Times count from boot, so a replay starts the readers at the same point.
+  portENTER_CRITICAL(&lock);
+  last_us = 0;
+  recording = true;
+  portEXIT_CRITICAL(&lock);
+  counters.bytes = 4;
+  flushed_ms = millis();
+  LOG_INFO("Field trace: recording to %s", FIELD_TRACE_PATH);
+#endif
+}
+
+void FieldTrace::recordStatus(FieldRecordKind kind, uint8_t reader, MFRC522::StatusCode status)
+{
+  uint8_t payload = status;
+  append(kind, reader, &payload, 1);
+}
+
+void FieldTrace::recordSelect(uint8_t reader, MFRC522::StatusCode status, const MFRC522::Uid &uid)
+{
+  uint8_t payload[2 + sizeof(uid.uidByte)];
+  uint8_t size = status == MFRC522::STATUS_OK ? min(uid.size, (byte)sizeof(uid.uidByte)) : 0;
+  payload[0] = status;
+  payload[1] = size;
+  memcpy(payload + 2, uid.uidByte, size);
+  append(FIELD_SELECT, reader, payload, 2 + size);
+}
+
+void FieldTrace::recordHttp(const char *url, int code, uint32_t duration_us)
+{
+  uint8_t payload[20];
+  uint32_t zigzag = ((uint32_t)code << 1) ^ (uint32_t)(code >> 31);
+  size_t length = putVarint(payload, zigzag);
+  length += putVarint(payload + length, duration_us);
+  append(FIELD_HTTP, fieldEndpoint(url), payload, length);
+}
+
+void FieldTrace::append(FieldRecordKind kind, uint8_t low, const uint8_t *payload, size_t length)
+{
+  uint8_t head[11];
+  portENTER_CRITICAL(&lock);
+  if (!recording)
+  {
+    portEXIT_CRITICAL(&lock);
+    return;
+  }
+
+  int64_t now_us = esp_timer_get_time();
+  head[0] = kind << 4 | (low & 0x0F);
+  size_t head_length = 1 + putVarint(head + 1, now_us - last_us);
+  if (used + head_length + length > sizeof(buffer) || counters.bytes + used + head_length + length > FIELD_TRACE_MAX_BYTES)
+  {
+    counters.dropped++;
+  }
+  else
+  {
+    memcpy(buffer + used, head, head_length);
+    memcpy(buffer + used + head_length, payload, length);
+    used += head_length + length;
+    last_us = now_us;
+    counters.records++;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void FieldTrace::maintain()
+{
+#if FIELD_TRACE
+  if (used > 0 && (millis() - flushed_ms >= FIELD_TRACE_FLUSH_MS || used > sizeof(buffer) / 2))
+    flush();
+#endif
+}
+
+/**
+ * Moves the collected records out under the lock, then appends them without holding it.
+ */
+void FieldTrace::flush()
+{
+  static uint8_t pending[sizeof(buffer)];
+  portENTER_CRITICAL(&lock);
+  size_t length = used;
+  memcpy(pending, buffer, length);
+  used = 0;
+  portEXIT_CRITICAL(&lock);
+  flushed_ms = millis();
+
+  File file = LittleFS.open(FIELD_TRACE_PATH, "a");
+  if (!file || file.write(pending, length) != length)
+  {
+    LOG_WARN("Field trace: write failed, recording stopped");
+    portENTER_CRITICAL(&lock);
+    recording = false;
+    portEXIT_CRITICAL(&lock);
+    return;
+  }
+  counters.bytes += length;
+}
+
+void FieldTrace::dump()
+{
+#if FIELD_TRACE
+  flush();
+  File file = LittleFS.open(FIELD_TRACE_PATH, "r");
+  if (!file)
+    return;
+
+  Serial.printf("--- field trace %u bytes ---\n", (unsigned)file.size());
+  uint8_t chunk[32];
+  size_t length;
+  while ((length = file.read(chunk, sizeof(chunk))) > 0)
+  {
+    for (size_t i = 0; i < length; i++)
+      Serial.printf("%02x", chunk[i]);
+    Serial.println();
+  }
+  Serial.println("--- end of field trace ---");
+  Serial.printf("Field trace: %u records, %u bytes, %u dropped\n", counters.records, counters.bytes, counters.dropped);
+#endif
+}
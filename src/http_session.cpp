@@ -0,0 +1,125 @@
+#include "http_session.h"
+
+#include "field_trace.h"
+#include "trace.h"
+
+HttpSession httpSession;
+
+/**
+ * Write-only Stream that hands the bytes to a JSON scanner (or drops them).
+ */
+class ScannerStream : public Stream
+{
+public:
+  explicit ScannerStream(JsonScanner *scanner) : scanner(scanner) {}
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    if (scanner)
+      scanner->feed(reinterpret_cast<const char *>(buffer), size);
+    return size;
+  }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override {}
+
+private:
+  JsonScanner *scanner;
+};
+
+int HttpSession::post(const char *url, const char *body, size_t length, JsonScanner &response, const char *content_type)
+{
+  ScannerStream sink(&response);
+  return post(url, body, length, &sink, content_type);
+}
+
+int HttpSession::post(const char *url, const char *body, size_t length, Stream *response, const char *content_type)
+{
+  if (!configured)
+  {
+    // Keep the TCP connection open after end() as long as the server allows it.
+    http.setReuse(true);
+    http.setTimeout(HTTP_TIMEOUT_MS);
+    http.setConnectTimeout(HTTP_CONNECT_TIMEOUT_MS);
+    configured = true;
+  }
+
+  counters.requests++;
+  counters.body_bytes += length;
+  tracer.count(COUNT_POSTS);
+  bool reused = client.connected();
+  uint32_t start_us = micros();
+  uint32_t trace_us = tracer.mark(TRACE_POST, length);
+
+  int code = send(url, body, length, response, content_type);
+
+  // The server may have closed the idle connection; retry once on a fresh one.
+  if (code < 0 && reused)
+  {
+    counters.reconnects++;
+    tracer.count(COUNT_RETRIES);
+    close();
+    reused = false;
+    code = send(url, body, length, response, content_type);
+  }
+
+  uint32_t latency_us = micros() - start_us;
+  tracer.mark(TRACE_RESPONSE, code);
+  tracer.span(SPAN_POST, trace_us);
+  if (code < 200 || code >= 300)
+    tracer.count(COUNT_FAILURES);
+  counters.last_latency_us = latency_us;
+  counters.total_latency_us += latency_us;
+  if (latency_us > counters.max_latency_us)
+    counters.max_latency_us = latency_us;
+
+  if (reused)
+    counters.reused++;
+  else
+    counters.connects++;
+
+  if (code < 0)
+  {
+    counters.errors++;
+    close();
+  }
+
+  return code;
+}
+
+int HttpSession::send(const char *url, const char *body, size_t length, Stream *response, const char *content_type)
+{
+  uint32_t start_us = micros();
+  http.begin(client, url);
+  http.addHeader("Content-Type", content_type);
+
+  int code = http.POST(reinterpret_cast<uint8_t *>(const_cast<char *>(body)), length);
+
+  // Read the whole body so the next request starts on a clean connection.
+  if (code > 0)
+  {
+    ScannerStream discard(nullptr);
+    http.writeToStream(response ? response : &discard);
+  }
+
+  // With reuse enabled end() leaves the connection open if the server sent keep-alive.
+  http.end();
+  fieldTrace.http(url, code, micros() - start_us);
+  return code;
+}
+
+void HttpSession::close()
+{
+  client.stop();
+}
+
+void HttpSession::printStats()
+{
+  HttpSessionStats s = stats();
+  uint32_t reuse_pct = s.requests ? s.reused * 100 / s.requests : 0;
+  Serial.printf("HTTP: %u requests (%u bytes/request), %u reused (%u%%), %u connects, %u reconnects, %u errors, latency last %u us, avg %u us, max %u us\n",
+                s.requests, s.requests ? (uint32_t)(s.body_bytes / s.requests) : 0, s.reused, reuse_pct, s.connects, s.reconnects, s.errors,
+                s.last_latency_us, s.requests ? (uint32_t)(s.total_latency_us / s.requests) : 0, s.max_latency_us);
+}
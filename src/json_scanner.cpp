@@ -0,0 +1,289 @@
+#include "json_scanner.h"
+
+#include <string.h>
+
+JsonScanner::JsonScanner(JsonHandler &handler, char *value_buffer, size_t value_size)
+    : handler(handler), buffer(value_buffer), buffer_size(value_size)
+{
+  key[0] = '\0';
+  if (buffer_size > 0)
+    buffer[0] = '\0';
+}
+
+bool JsonScanner::feed(const char *data, size_t length)
+{
+  for (size_t i = 0; i < length && state != ERROR; i++)
+  {
+    // A number or literal ends at the first character that is not part of it;
+    // that character is then read again as structure.
+    if (!step(data[i]))
+      step(data[i]);
+  }
+  return state != ERROR;
+}
+
+void JsonScanner::append(char c)
+{
+  char *target = reading_key ? key : buffer;
+  size_t size = reading_key ? sizeof(key) : buffer_size;
+  if (length + 1 < size)
+  {
+    target[length] = c;
+    target[length + 1] = '\0';
+  }
+  length++;
+}
+
+void JsonScanner::endValue(JsonHandler::ValueType type)
+{
+  size_t stored = length < buffer_size ? length : buffer_size - 1;
+  buffer[stored] = '\0';
+  handler.value(depth, inObject() ? key : "", buffer, stored, type);
+  length = 0;
+  state = depth == 0 ? DONE : AFTER_VALUE;
+}
+
+void JsonScanner::push(bool object)
+{
+  if (depth == MAX_DEPTH)
+  {
+    state = ERROR;
+    return;
+  }
+  if (object)
+    objects |= 1u << depth;
+  else
+    objects &= ~(1u << depth);
+  depth++;
+}
+
+/**
+ * Returns false when c was not consumed and has to be stepped again.
+ */
+bool JsonScanner::step(char c)
+{
+  bool space = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+
+  switch (state)
+  {
+  case VALUE:
+    if (space)
+      return true;
+    length = 0;
+    reading_key = false;
+    if (c == '{')
+    {
+      push(true);
+      if (state != ERROR)
+        state = KEY_OR_END;
+    }
+    else if (c == '[')
+    {
+      push(false);
+      if (state != ERROR)
+        state = VALUE;
+    }
+    else if (c == ']' && depth > 0 && !inObject())
+    {
+      // Empty array
+      depth--;
+      state = depth == 0 ? DONE : AFTER_VALUE;
+    }
+    else if (c == '"')
+    {
+      state = STRING;
+    }
+    else if (c == '-' || (c >= '0' && c <= '9'))
+    {
+      append(c);
+      state = NUMBER;
+    }
+    else if (c == 't' || c == 'f' || c == 'n')
+    {
+      append(c);
+      state = LITERAL;
+    }
+    else
+    {
+      state = ERROR;
+    }
+    return true;
+
+  case KEY_OR_END:
+  case KEY:
+    if (space)
+      return true;
+    if (c == '"')
+    {
+      reading_key = true;
+      length = 0;
+      key[0] = '\0';
+      state = STRING;
+    }
+    else if (c == '}' && state == KEY_OR_END)
+    {
+      handler.objectEnd(depth);
+      depth--;
+      state = depth == 0 ? DONE : AFTER_VALUE;
+    }
+    else
+    {
+      state = ERROR;
+    }
+    return true;
+
+  case COLON:
+    if (space)
+      return true;
+    state = c == ':' ? VALUE : ERROR;
+    return true;
+
+  case STRING:
+    if (c == '\\')
+    {
+      state = STRING_ESCAPE;
+    }
+    else if (c == '"')
+    {
+      if (reading_key)
+      {
+        reading_key = false;
+        length = 0;
+        state = COLON;
+      }
+      else
+      {
+        endValue(JsonHandler::STRING);
+      }
+    }
+    else
+    {
+      append(c);
+    }
+    return true;
+
+  case STRING_ESCAPE:
+    state = STRING;
+    switch (c)
+    {
+    case 'b':
+      append('\b');
+      break;
+    case 'f':
+      append('\f');
+      break;
+    case 'n':
+      append('\n');
+      break;
+    case 'r':
+      append('\r');
+      break;
+    case 't':
+      append('\t');
+      break;
+    case 'u':
+      unicode = 0;
+      unicode_digits = 0;
+      state = STRING_UNICODE;
+      break;
+    default:
+      append(c); // \" \\ \/
+      break;
+    }
+    return true;
+
+  case STRING_UNICODE:
+  {
+    uint8_t digit;
+    if (c >= '0' && c <= '9')
+      digit = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      digit = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      digit = c - 'A' + 10;
+    else
+    {
+      state = ERROR;
+      return true;
+    }
+    unicode = (unicode << 4) | digit;
+    if (++unicode_digits == 4)
+    {
+      // The fields we read are ASCII; encode the code point as UTF-8 anyway (no surrogate pairs).
+      if (unicode < 0x80)
+      {
+        append((char)unicode);
+      }
+      else if (unicode < 0x800)
+      {
+        append((char)(0xC0 | (unicode >> 6)));
+        append((char)(0x80 | (unicode & 0x3F)));
+      }
+      else
+      {
+        append((char)(0xE0 | (unicode >> 12)));
+        append((char)(0x80 | ((unicode >> 6) & 0x3F)));
+        append((char)(0x80 | (unicode & 0x3F)));
+      }
+      state = STRING;
+    }
+    return true;
+  }
+
+  case NUMBER:
+    if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+    {
+      append(c);
+      return true;
+    }
+    endValue(JsonHandler::NUMBER);
+    return false;
+
+  case LITERAL:
+    if (c >= 'a' && c <= 'z')
+    {
+      append(c);
+      return true;
+    }
+    if (strcmp(buffer, "true") != 0 && strcmp(buffer, "false") != 0 && strcmp(buffer, "null") != 0)
+    {
+      state = ERROR;
+      return true;
+    }
+    endValue(JsonHandler::LITERAL);
+    return false;
+
+  case AFTER_VALUE:
+    if (space)
+      return true;
+    if (c == ',')
+    {
+      state = inObject() ? KEY : VALUE;
+    }
+    else if (c == '}' && inObject())
+    {
+      handler.objectEnd(depth);
+      depth--;
+      state = depth == 0 ? DONE : AFTER_VALUE;
+    }
+    else if (c == ']' && !inObject())
+    {
+      depth--;
+      state = depth == 0 ? DONE : AFTER_VALUE;
+    }
+    else
+    {
+      state = ERROR;
+    }
+    return true;
+
+  case DONE:
+    // Trailing whitespace is fine, anything else is not.
+    if (!space)
+      state = ERROR;
+    return true;
+
+  default:
+    return true;
+  }
+}
@@ -0,0 +1,108 @@
+#include "log.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+static const char level_letters[] = "-EWIDV";
+
+#if LOG_ASYNC
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static char queued[LOG_BUFFER_SIZE];
+static size_t head = 0; // next byte to write
+static size_t tail = 0; // next byte to send
+static size_t used = 0;
+static uint32_t dropped = 0;
+static TaskHandle_t task = nullptr;
+
+/**
+ * Sends the queued bytes, one contiguous chunk at a time so the lock is never held while
+ * the UART blocks.
+ */
+static void logTask(void *arg)
+{
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+
+    for (;;)
+    {
+      portENTER_CRITICAL(&lock);
+      size_t chunk = min(used, LOG_BUFFER_SIZE - tail);
+      size_t start = tail;
+      portEXIT_CRITICAL(&lock);
+      if (chunk == 0)
+        break;
+
+      Serial.write(reinterpret_cast<const uint8_t *>(&queued[start]), chunk);
+
+      portENTER_CRITICAL(&lock);
+      tail = (tail + chunk) % LOG_BUFFER_SIZE;
+      used -= chunk;
+      portEXIT_CRITICAL(&lock);
+    }
+  }
+}
+
+static void emit(const char *line, size_t length)
+{
+  portENTER_CRITICAL(&lock);
+  if (used + length > LOG_BUFFER_SIZE)
+  {
+    dropped++;
+    portEXIT_CRITICAL(&lock);
+    return;
+  }
+  for (size_t i = 0; i < length; i++)
+  {
+    queued[head] = line[i];
+    head = (head + 1) % LOG_BUFFER_SIZE;
+  }
+  used += length;
+  portEXIT_CRITICAL(&lock);
+
+  if (task != nullptr)
+    xTaskNotifyGive(task);
+}
+
+void logBegin()
+{
+  if (task == nullptr)
+    xTaskCreatePinnedToCore(logTask, "log", 3072, nullptr, 0, &task, LOG_TASK_CORE);
+}
+
+uint32_t logDropped()
+{
+  return dropped;
+}
+#else
+static void emit(const char *line, size_t length)
+{
+  Serial.write(reinterpret_cast<const uint8_t *>(line), length);
+}
+
+void logBegin()
+{
+}
+
+uint32_t logDropped()
+{
+  return 0;
+}
+#endif
+
+void logPrintf(uint8_t level, const char *format, ...)
+{
+  char line[LOG_LINE_SIZE];
+  int prefix = snprintf(line, sizeof(line), "[%7lu][%c] ", (unsigned long)millis(), level_letters[level < 6 ? level : 0]);
+
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line + prefix, sizeof(line) - prefix - 1, format, args);
+  va_end(args);
+
+  if (length < 0)
+    length = 0;
+  length = min(prefix + length, (int)sizeof(line) - 2);
+  line[length++] = '\n';
+  emit(line, length);
+}
@@ -0,0 +1,306 @@
+#include "mqtt_channel.h"
+
+#include "log.h"
+
+// Packet bodies are written at tx + MQTT_HEADER_ROOM; the fixed header goes right in front.
+#define MQTT_HEADER_ROOM 5
+
+enum MqttPacket : uint8_t
+{
+  MQTT_CONNECT = 0x10,
+  MQTT_CONNACK = 0x20,
+  MQTT_PUBLISH = 0x30,
+  MQTT_PUBACK = 0x40,
+  MQTT_SUBSCRIBE = 0x82, // with the reserved flags the spec requires
+  MQTT_SUBACK = 0x90,
+  MQTT_PINGREQ = 0xC0,
+  MQTT_PINGRESP = 0xD0,
+  MQTT_DISCONNECT = 0xE0
+};
+
+/**
+ * Writes a u16 length-prefixed string at body[at]; returns the position after it, or 0 if
+ * it does not fit.
+ */
+static size_t putString(uint8_t *body, size_t size, size_t at, const char *text)
+{
+  size_t length = strlen(text);
+  if (length > 0xFFFF || 2 + length > size - at)
+    return 0;
+  body[at] = length >> 8;
+  body[at + 1] = length;
+  memcpy(body + at + 2, text, length);
+  return at + 2 + length;
+}
+
+bool MqttChannel::connect(const char *host, uint16_t port, const char *client_id, const char *username, const char *password)
+{
+  close();
+  if (!client.connect(host, port, MQTT_CONNECT_TIMEOUT_MS))
+  {
+    counters.failures++;
+    return false;
+  }
+  client.setNoDelay(true);
+
+  static const uint8_t variable_header[] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0xC2, MQTT_KEEPALIVE_S >> 8, MQTT_KEEPALIVE_S & 0xFF};
+  uint8_t *body = tx + MQTT_HEADER_ROOM;
+  size_t size = sizeof(tx) - MQTT_HEADER_ROOM;
+  memcpy(body, variable_header, sizeof(variable_header));
+  size_t at = sizeof(variable_header);
+  at = putString(body, size, at, client_id);
+  at = at ? putString(body, size, at, username) : 0;
+  at = at ? putString(body, size, at, password) : 0;
+  if (at == 0 || !send(MQTT_CONNECT, at))
+  {
+    counters.failures++;
+    close();
+    return false;
+  }
+
+  // CONNACK: 0x20, 2, session present, return code
+  uint8_t connack[4];
+  size_t got = 0;
+  uint32_t start_ms = millis();
+  while (got < sizeof(connack) && millis() - start_ms < MQTT_CONNECT_TIMEOUT_MS && client.connected())
+  {
+    if (client.available() > 0)
+      got += client.read(connack + got, sizeof(connack) - got);
+    else
+      delay(1);
+  }
+  if (got < sizeof(connack) || connack[0] != MQTT_CONNACK || connack[3] != 0)
+  {
+    LOG_WARN("MQTT: broker refused the session (%s, code %d)", got < sizeof(connack) ? "no answer" : "refused",
+             got == sizeof(connack) ? connack[3] : -1);
+    counters.failures++;
+    close();
+    return false;
+  }
+
+  session = true;
+  rx_used = 0;
+  rx_skip = 0;
+  ping_pending = false;
+  last_heard_ms = millis();
+  counters.connects++;
+  return true;
+}
+
+bool MqttChannel::connected()
+{
+  return session && client.connected();
+}
+
+void MqttChannel::close()
+{
+  if (session && client.connected())
+    send(MQTT_DISCONNECT, 0);
+  session = false;
+  client.stop();
+}
+
+bool MqttChannel::subscribe(const char *filter)
+{
+  uint8_t *body = tx + MQTT_HEADER_ROOM;
+  size_t size = sizeof(tx) - MQTT_HEADER_ROOM;
+  uint16_t id = nextPacketId();
+  body[0] = id >> 8;
+  body[1] = id;
+  size_t at = putString(body, size - 1, 2, filter);
+  if (at == 0)
+    return false;
+  body[at++] = 1; // QoS 1
+  return send(MQTT_SUBSCRIBE, at);
+}
+
+uint16_t MqttChannel::publish(const char *topic, const uint8_t *payload, size_t length)
+{
+  if (!connected())
+    return 0;
+
+  uint8_t *body = tx + MQTT_HEADER_ROOM;
+  size_t size = sizeof(tx) - MQTT_HEADER_ROOM;
+  size_t at = putString(body, size, 0, topic);
+  if (at == 0 || 2 + length > size - at)
+    return 0;
+  uint16_t id = nextPacketId();
+  body[at] = id >> 8;
+  body[at + 1] = id;
+  memcpy(body + at + 2, payload, length);
+
+  if (!send(MQTT_PUBLISH | 0x02, at + 2 + length)) // QoS 1
+    return 0;
+  counters.published++;
+  return id;
+}
+
+void MqttChannel::poll(MqttHandler &handler)
+{
+  if (!session)
+    return;
+  if (!client.connected())
+  {
+    LOG_WARN("MQTT: connection lost");
+    counters.failures++;
+    close();
+    return;
+  }
+
+  int available;
+  while (session && (available = client.available()) > 0)
+  {
+    last_heard_ms = millis();
+    if (rx_skip > 0)
+    {
+      uint8_t scratch[64];
+      rx_skip -= client.read(scratch, min((size_t)available, min(rx_skip, sizeof(scratch))));
+      continue;
+    }
+    rx_used += client.read(rx + rx_used, min((size_t)available, sizeof(rx) - rx_used));
+
+    // Hand over every complete packet: header byte, 1-4 bytes remaining length, body.
+    while (session && rx_used >= 2)
+    {
+      size_t length = 0;
+      size_t at = 1;
+      bool complete = false;
+      for (uint8_t shift = 0; at < rx_used && at <= 4; shift += 7)
+      {
+        uint8_t digit = rx[at++];
+        length |= (size_t)(digit & 0x7F) << shift;
+        if (!(digit & 0x80))
+        {
+          complete = true;
+          break;
+        }
+      }
+      if (!complete)
+      {
+        if (at > 4)
+        {
+          LOG_WARN("MQTT: malformed packet from the broker");
+          counters.failures++;
+          close();
+        }
+        break;
+      }
+
+      size_t total = at + length;
+      if (total > sizeof(rx))
+      {
+        counters.skipped++;
+        rx_skip = total - rx_used;
+        rx_used = 0;
+        break;
+      }
+      if (rx_used < total)
+        break;
+
+      dispatch(rx[0], rx + at, length, handler);
+      memmove(rx, rx + total, rx_used - total);
+      rx_used -= total;
+    }
+  }
+
+  if (!session)
+    return;
+  uint32_t keepalive_ms = MQTT_KEEPALIVE_S * 1000;
+  if (ping_pending && millis() - ping_sent_ms > keepalive_ms / 2)
+  {
+    LOG_WARN("MQTT: broker stopped answering");
+    counters.failures++;
+    close();
+  }
+  else if (!ping_pending && millis() - last_sent_ms > keepalive_ms / 2 && send(MQTT_PINGREQ, 0))
+  {
+    ping_pending = true;
+    ping_sent_ms = millis();
+  }
+}
+
+void MqttChannel::dispatch(uint8_t header, const uint8_t *body, size_t length, MqttHandler &handler)
+{
+  switch (header & 0xF0)
+  {
+  case MQTT_PUBACK:
+    if (length >= 2)
+    {
+      counters.acked++;
+      handler.acked(body[0] << 8 | body[1]);
+    }
+    break;
+
+  case MQTT_PUBLISH:
+  {
+    uint8_t qos = (header >> 1) & 0x03;
+    size_t topic_length = length >= 2 ? body[0] << 8 | body[1] : 0;
+    size_t at = 2 + topic_length + (qos > 0 ? 2 : 0);
+    char topic[128];
+    if (length < at || topic_length >= sizeof(topic))
+      break;
+    memcpy(topic, body + 2, topic_length);
+    topic[topic_length] = '\0';
+    counters.received++;
+
+    // Acknowledge first: the handler may take a while (an allow list update is saved to flash).
+    if (qos > 0)
+    {
+      uint8_t *ack = tx + MQTT_HEADER_ROOM;
+      ack[0] = body[at - 2];
+      ack[1] = body[at - 1];
+      send(MQTT_PUBACK, 2);
+    }
+    handler.message(topic, body + at, length - at);
+    break;
+  }
+
+  case MQTT_PINGRESP:
+    ping_pending = false;
+    break;
+
+  case MQTT_SUBACK:
+    if (length >= 3 && body[2] == 0x80)
+      LOG_WARN("MQTT: broker refused a subscription");
+    break;
+
+  default:
+    break;
+  }
+}
+
+bool MqttChannel::send(uint8_t header, size_t length)
+{
+  // Remaining length, 7 bits per byte, least significant first.
+  uint8_t encoded[4];
+  size_t digits = 0;
+  size_t rest = length;
+  do
+  {
+    uint8_t digit = rest % 128;
+    rest /= 128;
+    encoded[digits++] = digit | (rest > 0 ? 0x80 : 0);
+  } while (rest > 0 && digits < sizeof(encoded));
+
+  uint8_t *start = tx + MQTT_HEADER_ROOM - 1 - digits;
+  start[0] = header;
+  memcpy(start + 1, encoded, digits);
+  size_t total = 1 + digits + length;
+  if (client.write(start, total) != total)
+  {
+    counters.failures++;
+    session = false;
+    client.stop();
+    return false;
+  }
+  last_sent_ms = millis();
+  return true;
+}
+
+uint16_t MqttChannel::nextPacketId()
+{
+  // 0 is not a valid packet id.
+  if (++packet_id == 0)
+    packet_id = 1;
+  return packet_id;
+}
@@ -0,0 +1,151 @@
+#include "pcd_bus.h"
+
+#include <SPI.h>
+#include <esp_timer.h>
+
+void PcdBus::begin(uint8_t ss_pin)
+{
+  ss = ss_pin;
+  queued = 0;
+  shadow_valid = 0;
+}
+
+/**
+ * Registers nothing but PCD_Init() and this code changes: the wake-up's baud rates and
+ * modulation width, the antenna drivers, ValuesAfterColl (the library only ever clears it)
+ * and the interrupt routing.
+ */
+bool PcdBus::shadowed(MFRC522::PCD_Register reg)
+{
+#if PCD_SHADOW_REGISTERS
+  switch (reg)
+  {
+  case MFRC522::TxModeReg:
+  case MFRC522::RxModeReg:
+  case MFRC522::ModWidthReg:
+  case MFRC522::TxControlReg:
+  case MFRC522::CollReg:
+  case MFRC522::ComIEnReg:
+    return true;
+  default:
+    return false;
+  }
+#else
+  return false;
+#endif
+}
+
+void PcdBus::write(MFRC522::PCD_Register reg, uint8_t value)
+{
+  uint8_t address = reg >> 1;
+  if (shadowed(reg))
+  {
+    if ((shadow_valid & (1ULL << address)) && shadow[address] == value)
+    {
+      counters.skipped++;
+      return;
+    }
+    shadow[address] = value;
+    shadow_valid |= 1ULL << address;
+  }
+
+  if (queued == sizeof(queue))
+    flush();
+  queue[queued++] = reg & 0x7E;
+  queue[queued++] = value;
+}
+
+void PcdBus::setBits(MFRC522::PCD_Register reg, uint8_t mask)
+{
+  write(reg, current(reg) | mask);
+}
+
+void PcdBus::clearBits(MFRC522::PCD_Register reg, uint8_t mask)
+{
+  write(reg, current(reg) & ~mask);
+}
+
+void PcdBus::flush()
+{
+  if (queued == 0)
+    return;
+
+  int64_t start_us = esp_timer_get_time();
+  SPI.beginTransaction(SPISettings(PCD_SPI_HZ, MSBFIRST, SPI_MODE0));
+  sendQueued();
+  SPI.endTransaction();
+  counters.transactions++;
+  counters.busy_us += esp_timer_get_time() - start_us;
+}
+
+uint8_t PcdBus::read(MFRC522::PCD_Register reg)
+{
+  uint8_t value;
+  read(&reg, &value, 1);
+  return value;
+}
+
+/**
+ * One frame: each byte clocks out the next address and in the value of the one before, a
+ * trailing 0 ends the read.
+ */
+void PcdBus::read(const MFRC522::PCD_Register *regs, uint8_t *values, uint8_t count)
+{
+  uint8_t tx[PCD_BUS_QUEUE + 1];
+  uint8_t rx[PCD_BUS_QUEUE + 1];
+  if (count > PCD_BUS_QUEUE)
+    count = PCD_BUS_QUEUE;
+  for (uint8_t i = 0; i < count; i++)
+    tx[i] = 0x80 | (regs[i] & 0x7E);
+  tx[count] = 0;
+
+  // Queued writes share the transaction.
+  int64_t start_us = esp_timer_get_time();
+  SPI.beginTransaction(SPISettings(PCD_SPI_HZ, MSBFIRST, SPI_MODE0));
+  sendQueued();
+  digitalWrite(ss, LOW);
+  SPI.transferBytes(tx, rx, count + 1);
+  digitalWrite(ss, HIGH);
+  SPI.endTransaction();
+
+  counters.transactions++;
+  counters.frames++;
+  counters.bytes += count + 1;
+  counters.busy_us += esp_timer_get_time() - start_us;
+
+  memcpy(values, rx + 1, count);
+}
+
+/**
+ * Sends the queued writes, one frame each. Call inside a transaction.
+ */
+void PcdBus::sendQueued()
+{
+  for (uint8_t i = 0; i < queued; i += 2)
+  {
+    digitalWrite(ss, LOW);
+    SPI.writeBytes(queue + i, 2);
+    digitalWrite(ss, HIGH);
+  }
+  counters.frames += queued / 2;
+  counters.bytes += queued;
+  queued = 0;
+}
+
+/**
+ * Value of a register for a read-modify-write: the shadow if it holds one.
+ */
+uint8_t PcdBus::current(MFRC522::PCD_Register reg)
+{
+  uint8_t address = reg >> 1;
+  if (shadowed(reg) && (shadow_valid & (1ULL << address)))
+    return shadow[address];
+
+  uint8_t value = read(reg);
+  if (shadowed(reg))
+  {
+    shadow[address] = value;
+    shadow_valid |= 1ULL << address;
+  }
+  return value;
+}
@@ -0,0 +1,160 @@
+#include "power_manager.h"
+
+#include <WiFi.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "log.h"
+#include "scan_event.h"
+#include "uploader.h"
+#include "wifi_connection.h"
+
+PowerManager powerManager;
+
+void PowerManager::begin()
+{
+  begin_us = esp_timer_get_time();
+  // Antenna time before begin() is not part of the elapsed time.
+  counters.field_us = 0;
+  field_since_us = begin_us;
+
+#if POWER_MODE >= 1
+  WiFi.setSleep(WIFI_PS_MIN_MODEM);
+#else
+  WiFi.setSleep(false);
+#endif
+
+#if POWER_MODE >= 2
+  esp_pm_config_esp32_t pm_config = {};
+  pm_config.max_freq_mhz = getCpuFrequencyMhz();
+  pm_config.min_freq_mhz = POWER_MIN_CPU_MHZ;
+  pm_config.light_sleep_enable = true;
+  auto_light_sleep = esp_pm_configure(&pm_config) == ESP_OK;
+  if (!auto_light_sleep)
+  {
+    // No tickless idle in this core: keep frequency scaling, sleep manually while offline.
+    pm_config.light_sleep_enable = false;
+    esp_pm_configure(&pm_config);
+  }
+  LOG_INFO("Power: modem sleep, %s light sleep", auto_light_sleep ? "automatic" : "manual (offline only)");
+#else
+  LOG_INFO("Power: %s", POWER_MODE >= 1 ? "modem sleep" : "always awake");
+#endif
+}
+
+bool PowerManager::wait(uint32_t ms, bool wake_on_notify)
+{
+  int64_t start_us = esp_timer_get_time();
+  bool notified = false;
+  bool slept = false;
+
+  if (manualSleepAllowed(ms))
+  {
+    Serial.flush();
+    esp_sleep_enable_timer_wakeup((uint64_t)ms * 1000);
+    esp_light_sleep_start();
+    slept = true;
+    counters.sleeps++;
+    // The IRQ edge is not latched during sleep; the wake-up cause stands in for it.
+    bool woke_on_irq = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO;
+    bool pending = ulTaskNotifyTake(pdTRUE, 0) > 0;
+    notified = wake_on_notify && (woke_on_irq || pending);
+  }
+  else if (wake_on_notify)
+  {
+    notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms)) > 0;
+  }
+  else if (ms > 0)
+  {
+    vTaskDelay(pdMS_TO_TICKS(ms));
+  }
+
+  int64_t took_us = esp_timer_get_time() - start_us;
+  if (slept || auto_light_sleep)
+    counters.sleep_us += took_us;
+  else
+    counters.idle_us += took_us;
+
+  if (!notified && ms > 0)
+    recordWake(took_us > (int64_t)ms * 1000 ? (uint32_t)(took_us - (int64_t)ms * 1000) : 0);
+
+  return notified;
+}
+
+void PowerManager::fieldChanged(bool on)
+{
+  int64_t now_us = esp_timer_get_time();
+  counters.field_us += (now_us - field_since_us) * fields_on;
+  fields_on += on ? 1 : -1;
+  field_since_us = now_us;
+}
+
+PowerStats PowerManager::stats()
+{
+  PowerStats copy = counters;
+  int64_t now_us = esp_timer_get_time();
+  copy.elapsed_us = now_us - begin_us;
+  copy.field_us += (now_us - field_since_us) * fields_on;
+  return copy;
+}
+
+float PowerManager::averageCurrent(const PowerStats &s)
+{
+  if (s.elapsed_us == 0)
+    return 0;
+
+  float elapsed = s.elapsed_us;
+  float sleep = min((float)s.sleep_us, elapsed);
+  float idle = min((float)s.idle_us, elapsed - sleep);
+  float active = elapsed - sleep - idle;
+  float field = min((float)s.field_us, elapsed * READER_COUNT);
+
+  float esp32_ma = (active * POWER_ACTIVE_MA + idle * POWER_IDLE_MA + sleep * POWER_LIGHT_SLEEP_MA) / elapsed;
+  float reader_ma = (field * POWER_FIELD_MA + (elapsed * READER_COUNT - field) * POWER_READER_IDLE_MA) / elapsed;
+  return esp32_ma + reader_ma;
+}
+
+void PowerManager::printStats()
+{
+  PowerStats s = stats();
+  float elapsed = s.elapsed_us ? (float)s.elapsed_us : 1;
+  Serial.printf("Power: est. %.1f mA avg, light sleep %.1f%% (%u manual), idle %.1f%%, field on %.1f%%, wake-up late max %u us\n",
+                averageCurrent(s), 100.0f * s.sleep_us / elapsed, s.sleeps, 100.0f * s.idle_us / elapsed,
+                100.0f * s.field_us / elapsed / READER_COUNT, s.max_wake_us);
+
+  Serial.print("Power: wake-up latency");
+  for (int i = 0; i < POWER_WAKE_BUCKETS; i++)
+  {
+    if (i < POWER_WAKE_BUCKETS - 1)
+      Serial.printf(" <%uus:%u", power_wake_bucket_us[i], s.wake_histogram[i]);
+    else
+      Serial.printf(" >=%uus:%u", power_wake_bucket_us[i - 1], s.wake_histogram[i]);
+  }
+  Serial.println();
+}
+
+bool PowerManager::manualSleepAllowed(uint32_t ms)
+{
+#if POWER_MODE >= 2
+  // A manual light sleep stops both cores and drops the WiFi association: only while offline,
+  // with the uploader done journaling and the sleep over before the next reconnect attempt.
+  return !auto_light_sleep && ms >= POWER_MIN_SLEEP_MS && wifiConnection.offline() &&
+         ms < wifiConnection.retryIn() && uploader.idle();
+#else
+  return false;
+#endif
+}
+
+void PowerManager::recordWake(uint32_t late_us)
+{
+  int bucket = 0;
+  while (bucket < POWER_WAKE_BUCKETS - 1 && late_us >= power_wake_bucket_us[bucket])
+    bucket++;
+
+  counters.waits++;
+  counters.wake_histogram[bucket]++;
+  if (late_us > counters.max_wake_us)
+    counters.max_wake_us = late_us;
+}
@@ -0,0 +1,79 @@
+#include "presence_tracker.h"
+
+#define PRESENCE_WINDOW_MASK (PRESENCE_WINDOW == 32 ? UINT32_MAX : (1u << PRESENCE_WINDOW) - 1)
+
+void PresenceTracker::locked()
+{
+  history = 0;
+  hits_in_row = 0;
+  miss_runs = 0;
+  suspect = false;
+  last_missed = false;
+  locked_ms = millis();
+  steady_ms = locked_ms;
+  counters.stays++;
+}
+
+PresenceVerdict PresenceTracker::checked(bool answered)
+{
+  uint32_t now = millis();
+  counters.checks++;
+  history = (history << 1 | (answered ? 0 : 1)) & PRESENCE_WINDOW_MASK;
+
+  if (!answered)
+  {
+    counters.misses++;
+    if (!suspect)
+    {
+      suspect = true;
+      miss_runs = 0;
+      first_miss_ms = now;
+    }
+    // Without debouncing every run of misses would have ended the stay and started a new one.
+    if (!last_missed)
+      miss_runs++;
+    last_missed = true;
+    hits_in_row = 0;
+
+    if (__builtin_popcount(history) < PRESENCE_MISSES)
+      return PRESENCE_SUSPECT;
+
+    // The last run is the real removal; the ones before it were glitches.
+    uint32_t confirm_ms = now - first_miss_ms;
+    counters.removals++;
+    counters.suppressed += 2 * (miss_runs - 1);
+    counters.present_ms += now - locked_ms;
+    counters.last_confirm_ms = confirm_ms;
+    if (confirm_ms > counters.max_confirm_ms)
+      counters.max_confirm_ms = confirm_ms;
+    suspect = false;
+    return PRESENCE_GONE;
+  }
+
+  last_missed = false;
+  if (suspect && ++hits_in_row >= PRESENCE_RECOVER_HITS)
+  {
+    counters.flaps++;
+    counters.suppressed += 2 * miss_runs;
+    suspect = false;
+    history = 0;
+    steady_ms = now;
+  }
+  return suspect ? PRESENCE_SUSPECT : PRESENCE_HELD;
+}
+
+uint32_t PresenceTracker::interval() const
+{
+  if (suspect)
+    return PRESENCE_CONFIRM_MS;
+  return millis() - steady_ms < PRESENCE_SETTLE_MS ? PRESENCE_FAST_MS : PRESENCE_SLOW_MS;
+}
+
+void PresenceTracker::printStats(uint8_t reader)
+{
+  PresenceStats s = counters;
+  float hours = s.present_ms / 3600000.0f;
+  Serial.printf("Presence %u: %u stays, %u removals, %u checks (%u missed), %u flaps (%.1f per card hour), %u events suppressed, confirm last %u ms, max %u ms\n",
+                reader, s.stays, s.removals, s.checks, s.misses, s.flaps, hours > 0 ? s.flaps / hours : 0.0f,
+                s.suppressed, s.last_confirm_ms, s.max_confirm_ms);
+}
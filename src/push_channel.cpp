@@ -0,0 +1,189 @@
+#include "push_channel.h"
+
+#include "allow_list.h"
+#include "config.h"
+#include "config_store.h"
+#include "event_batch.h"
+#include "json_scanner.h"
+#include "log.h"
+#include "reader_array.h"
+
+PushChannel pushChannel;
+
+void PushChannel::begin(const char *device_UID)
+{
+  this->device_UID = device_UID;
+  snprintf(scan_topic, sizeof(scan_topic), "%s/%s/scan", MQTT_TOPIC_PREFIX, device_UID);
+  snprintf(command_prefix, sizeof(command_prefix), "%s/%s/cmd/", MQTT_TOPIC_PREFIX, device_UID);
+}
+
+bool PushChannel::maintain()
+{
+  if (!mqtt.connected())
+  {
+    // A new session starts without anything in flight; the journal still holds it all.
+    inflight_count = 0;
+    if (retrying && (int32_t)(millis() - retry_at_ms) < 0)
+      return false;
+
+    if (!mqtt.connect(mqtt_broker_host, MQTT_PORT, device_UID, client_key, client_secret))
+    {
+      LOG_WARN("MQTT: cannot reach the broker at %s:%u", mqtt_broker_host, MQTT_PORT);
+      retrying = true;
+      retry_at_ms = millis() + MQTT_RETRY_MS;
+      return false;
+    }
+    retrying = false;
+
+    char filter[sizeof(command_prefix) + 1];
+    snprintf(filter, sizeof(filter), "%s+", command_prefix);
+    mqtt.subscribe(filter);
+    LOG_INFO("MQTT: connected to %s:%u", mqtt_broker_host, MQTT_PORT);
+  }
+
+  mqtt.poll(*this);
+
+  if (inflight_count > 0 && esp_timer_get_time() - inflight[0].sent_us > (int64_t)MQTT_ACK_TIMEOUT_MS * 1000)
+  {
+    LOG_WARN("MQTT: no acknowledgement for %u ms, reconnecting", MQTT_ACK_TIMEOUT_MS);
+    counters.timeouts++;
+    mqtt.close();
+    inflight_count = 0;
+  }
+  return mqtt.connected();
+}
+
+void PushChannel::publish(const JournalRecord *records, size_t count)
+{
+  // The window is the journal head; anything else means the journal changed under it.
+  for (size_t i = 0; i < inflight_count && i < count; i++)
+  {
+    if (inflight[i].seq != records[i].seq)
+    {
+      inflight_count = 0;
+      break;
+    }
+  }
+
+  while (inflight_count < count && inflight_count < MQTT_MAX_INFLIGHT)
+  {
+    const JournalRecord &record = records[inflight_count];
+    char payload[MQTT_TX_BUFFER_SIZE - sizeof(scan_topic) - 8];
+    size_t length = writeScanMessage(record, payload, sizeof(payload));
+    uint16_t packet_id = length ? mqtt.publish(scan_topic, reinterpret_cast<const uint8_t *>(payload), length) : 0;
+    if (packet_id == 0)
+      break;
+
+    inflight[inflight_count++] = {record.seq, packet_id, false, esp_timer_get_time()};
+    counters.published++;
+    if (record.seq < published_seq)
+      counters.resent++;
+    else
+      published_seq = record.seq + 1;
+  }
+
+  if (inflight_count > counters.max_inflight)
+    counters.max_inflight = inflight_count;
+}
+
+size_t PushChannel::acknowledged() const
+{
+  size_t count = 0;
+  while (count < inflight_count && inflight[count].acked)
+    count++;
+  return count;
+}
+
+void PushChannel::consumed(size_t count)
+{
+  count = min(count, inflight_count);
+  memmove(inflight, inflight + count, (inflight_count - count) * sizeof(InFlight));
+  inflight_count -= count;
+}
+
+void PushChannel::acked(uint16_t packet_id)
+{
+  for (size_t i = 0; i < inflight_count; i++)
+  {
+    if (inflight[i].packet_id != packet_id || inflight[i].acked)
+      continue;
+
+    inflight[i].acked = true;
+    uint32_t ack_us = (uint32_t)(esp_timer_get_time() - inflight[i].sent_us);
+    counters.acked++;
+    counters.last_ack_us = ack_us;
+    counters.total_ack_us += ack_us;
+    if (ack_us > counters.max_ack_us)
+      counters.max_ack_us = ack_us;
+    return;
+  }
+}
+
+void PushChannel::message(const char *topic, const uint8_t *payload, size_t length)
+{
+  size_t prefix_length = strlen(command_prefix);
+  if (strncmp(topic, command_prefix, prefix_length) == 0)
+    command(topic + prefix_length, payload, length);
+}
+
+void PushChannel::command(const char *name, const uint8_t *payload, size_t length)
+{
+  counters.commands++;
+
+  if (strcmp(name, "relay-off") == 0)
+  {
+    counters.relay_offs++;
+    char text[8];
+    size_t copied = min(length, sizeof(text) - 1);
+    memcpy(text, payload, copied);
+    text[copied] = '\0';
+
+    int reader = copied > 0 ? atoi(text) : -1;
+    LOG_INFO("MQTT: relay off for %s", copied > 0 ? text : "all readers");
+    for (uint8_t i = 0; i < READER_COUNT; i++)
+    {
+      if (reader < 0 || reader == i)
+        readers.release(i);
+    }
+  }
+  else if (strcmp(name, "allow-list") == 0)
+  {
+    counters.allow_list_pushes++;
+    if (length == 0)
+    {
+      allowList.syncSoon();
+      return;
+    }
+
+    AllowListUpdate update;
+    char value[32];
+    JsonScanner scanner(update, value, sizeof(value));
+    scanner.feed(reinterpret_cast<const char *>(payload), length);
+    if (!scanner.complete() || !allowList.apply(update))
+      LOG_WARN("MQTT: pushed allow list not applied");
+  }
+  else if (strcmp(name, "config") == 0)
+  {
+    // Saved now, applied by configStore.maintain() with a restart.
+    ConfigUpdate update(configStore.get());
+    char value[72];
+    JsonScanner scanner(update, value, sizeof(value));
+    scanner.feed(reinterpret_cast<const char *>(payload), length);
+    if (!scanner.complete() || !configStore.apply(update))
+      LOG_WARN("MQTT: pushed config not applied");
+  }
+  else
+  {
+    LOG_WARN("MQTT: unknown command %s", name);
+  }
+}
+
+void PushChannel::printStats()
+{
+  PushChannelStats s = counters;
+  MqttChannelStats m = mqtt.stats();
+  Serial.printf("MQTT: %u sessions (%u failures), %u published (%u resent), %u acked, in flight max %u/%u, ack last %u us, avg %u us, max %u us, %u timeouts, %u commands (%u relay off, %u allow list)\n",
+                m.connects, m.failures, s.published, s.resent, s.acked, s.max_inflight, MQTT_MAX_INFLIGHT, s.last_ack_us,
+                s.acked ? (uint32_t)(s.total_ack_us / s.acked) : 0, s.max_ack_us, s.timeouts, s.commands, s.relay_offs,
+                s.allow_list_pushes);
+}
@@ -0,0 +1,391 @@
+#include "reader_array.h"
+
+#include <esp_attr.h>
+#include <esp_system.h>
+
+#include "allow_list.h"
+#include "crc32.h"
+#include "field_trace.h"
+#include "log.h"
+#include "stay_limits.h"
+#include "trace.h"
+
+ReaderArray readers;
+
+#define RETAINED_READERS_MAGIC 0x524C5931 // "RLY1"
+
+/**
+ * Lock state in RTC slow memory, which keeps its content through a brownout, watchdog or
+ * software reset (but not a power cycle), so a reset with a guest's card in the slot does not
+ * switch the room off.
+ */
+struct RetainedReaders
+{
+  uint32_t magic;
+  uint32_t crc; // over readers
+  struct
+  {
+    uint8_t locked;
+    uint8_t allowed;
+    uint8_t uid_size;
+    uint8_t uid[10];
+  } readers[READER_COUNT];
+};
+
+RTC_NOINIT_ATTR static RetainedReaders retained;
+
+void ReaderArray::begin(const ReaderPins *pins)
+{
+  this->pins = pins;
+  begin_us = esp_timer_get_time();
+  loop_task = xTaskGetCurrentTaskHandle();
+
+  // Relays first: they do not wait for the readers (each PCD_Init() takes tens of ms).
+  bool restored = restore();
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    pinMode(pins[i].ssr, OUTPUT);
+    digitalWrite(pins[i].ssr, allowed[i] ? HIGH : LOW);
+  }
+  counters.restore_us = esp_timer_get_time();
+
+  // Restored stays count from here; the first poll() looks their limits up.
+  stays.begin(esp_timer_get_time() / (STAY_TICK_MS * 1000));
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    stay_timer[i] = WheelTimer(stayTimerFired, this);
+    stay_started_us[i] = counters.restore_us;
+    if (locked[i] && allowed[i])
+      stays_due |= 1u << i;
+  }
+
+  // Deselect every reader before talking to the first, or an uninitialised one would answer too.
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    pinMode(pins[i].ss, OUTPUT);
+    digitalWrite(pins[i].ss, HIGH);
+  }
+
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    rfid[i].PCD_Init(pins[i].ss, pins[i].rst);
+    // Receive timeout in 25 us timer ticks (TPrescaler from PCD_Init()).
+    uint16_t reload = CARD_TIMEOUT_MS * 40;
+    rfid[i].PCD_WriteRegister(MFRC522::TReloadRegH, reload >> 8);
+    rfid[i].PCD_WriteRegister(MFRC522::TReloadRegL, reload & 0xFF);
+    rfid[i].uid.size = locked[i] ? retained.readers[i].uid_size : 0;
+    memcpy(rfid[i].uid.uidByte, retained.readers[i].uid, rfid[i].uid.size);
+
+    card[i].begin(rfid[i], pins[i].ss, pins[i].irq, i);
+    if (locked[i])
+      presence[i].locked();
+  }
+  if (restored)
+  {
+    LOG_INFO("Reset (reason %d): %u locked cards restored, relays back %u us after power-on", esp_reset_reason(),
+             counters.restored, counters.restore_us);
+    if (counters.restore_us > BOOT_RELAY_BUDGET_MS * 1000)
+      LOG_WARN("Relays restored over the %u ms budget", BOOT_RELAY_BUDGET_MS);
+  }
+  LOG_INFO("Card readers: %u, %u ms receive timeout", READER_COUNT, CARD_TIMEOUT_MS);
+  LOG_INFO("Presence: removal after %u of %u missed checks, %u answers clear a miss, checks every %u ms (%u ms for the first %u ms, %u ms while confirming)",
+           PRESENCE_MISSES, PRESENCE_WINDOW, PRESENCE_RECOVER_HITS, PRESENCE_SLOW_MS, PRESENCE_FAST_MS,
+           PRESENCE_SETTLE_MS, PRESENCE_CONFIRM_MS);
+}
+
+bool ReaderArray::poll(ReaderEvent &event)
+{
+  if (counters.first_poll_us == 0)
+  {
+    counters.first_poll_us = esp_timer_get_time();
+    LOG_INFO("First card detection %u ms after power-on", counters.first_poll_us / 1000);
+    if (counters.first_poll_us > BOOT_SCAN_BUDGET_MS * 1000)
+      LOG_WARN("First card detection over the %u ms budget", BOOT_SCAN_BUDGET_MS);
+  }
+
+  if (release_requests != 0)
+    releaseRequested();
+
+  // Stay timers, and every running stay again when the server changed the limits.
+  stays.advance(esp_timer_get_time() / (STAY_TICK_MS * 1000));
+  if (stayLimits.generation() != stay_generation)
+  {
+    stay_generation = stayLimits.generation();
+    for (uint8_t i = 0; i < READER_COUNT; i++)
+    {
+      if (locked[i] && allowed[i])
+        stays_due |= 1u << i;
+    }
+  }
+  if (stays_due != 0 && stayDue(event))
+    return true;
+
+  // New cards first, then presence checks; both round robin from the reader after the last one served.
+  for (uint8_t pass = 0; pass < 2; pass++)
+  {
+    for (uint8_t n = 0; n < READER_COUNT; n++)
+    {
+      uint8_t i = (next + n) % READER_COUNT;
+      if (locked[i] != (pass == 1))
+        continue;
+      if (card[i].step(locked[i]) == CARD_NONE)
+        continue;
+
+      next = (i + 1) % READER_COUNT;
+      return service(i, event);
+    }
+  }
+
+  // Nothing due: sleep until the earliest reader needs the bus, or a card answers.
+  uint32_t idle_ms = UINT32_MAX;
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+    idle_ms = min(idle_ms, card[i].idleTime(locked[i]));
+  if (!stays.empty())
+    idle_ms = min(idle_ms, (uint32_t)(STAY_TICK_MS - (esp_timer_get_time() / 1000) % STAY_TICK_MS));
+  if (idle_ms > 0)
+  {
+    int64_t start_us = esp_timer_get_time();
+    powerManager.wait(idle_ms, CARD_DETECT_IRQ);
+    counters.idle_us += esp_timer_get_time() - start_us;
+  }
+  return false;
+}
+
+void ReaderArray::release(uint8_t reader)
+{
+  if (reader >= READER_COUNT)
+    return;
+  portENTER_CRITICAL(&release_lock);
+  release_requests |= 1u << reader;
+  portEXIT_CRITICAL(&release_lock);
+  // Wakes poll() when it waits for a card IRQ.
+  if (loop_task != nullptr)
+    xTaskNotifyGive(loop_task);
+}
+
+void ReaderArray::releaseRequested()
+{
+  portENTER_CRITICAL(&release_lock);
+  uint32_t requests = release_requests;
+  release_requests = 0;
+  portEXIT_CRITICAL(&release_lock);
+
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    if (!(requests & (1u << i)) || !locked[i] || !allowed[i])
+      continue;
+    allowed[i] = false;
+    digitalWrite(pins[i].ssr, LOW);
+    stays.cancel(stay_timer[i]);
+    retain(i);
+    tracer.mark(TRACE_RELAY_OFF, i);
+    counters.releases++;
+    LOG_INFO("Reader %u: relay switched off remotely", i);
+  }
+}
+
+bool ReaderArray::anyRelayOn() const
+{
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    if (locked[i] && allowed[i])
+      return true;
+  }
+  return false;
+}
+
+ReaderArrayStats ReaderArray::stats()
+{
+  ReaderArrayStats copy = counters;
+  copy.elapsed_us = esp_timer_get_time() - begin_us;
+  return copy;
+}
+
+void ReaderArray::printStats()
+{
+  ReaderArrayStats s = stats();
+  float busy = s.elapsed_us ? 100.0f * (s.elapsed_us - s.idle_us) / s.elapsed_us : 0;
+  Serial.printf("Card readers: %u, %s, loop busy %.1f%%, %u relays switched off remotely, %u at the end of a stay (%u stay checks)\n",
+                READER_COUNT, CARD_DETECT_IRQ ? "IRQ" : "polling", busy, s.releases, s.expired, s.stay_checks);
+  Serial.printf("Boot: %u locked cards restored, relays set %u us and first detection %u ms after power-on (budgets %u/%u ms)\n",
+                s.restored, s.restore_us, s.first_poll_us / 1000, BOOT_RELAY_BUDGET_MS, BOOT_SCAN_BUDGET_MS);
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    card[i].printStats();
+    presence[i].printStats(i);
+  }
+}
+
+/**
+ * Selects the card that answered (or the locked one, for a presence check), switches the
+ * relay and halts the card again. Returns true if the card was locked or its removal confirmed.
+ */
+bool ReaderArray::service(uint8_t reader, ReaderEvent &event)
+{
+  MFRC522 &r = rfid[reader];
+  bool was_locked = locked[reader];
+
+  // Ask for the locked card (if uid.size > 0) or for any card if none was locked.
+  // (Even if there was some error in the wake up procedure, attempt to contact the locked card.
+  // This serves as a double-check to confirm removals.)
+  uint32_t select_us = Tracer::now();
+  MFRC522::StatusCode result = r.PICC_Select(&r.uid, 8 * r.uid.size);
+  uint32_t select_took_us = Tracer::now() - select_us;
+  fieldTrace.select(reader, result, r.uid);
+  if (!locked[reader] || result != MFRC522::STATUS_OK)
+    tracer.mark(TRACE_CARD_SELECT, reader << 8 | result);
+
+  event.reader = reader;
+  event.status = result;
+  event.uid = r.uid;
+  event.expired = false;
+
+  if (!locked[reader] && result == MFRC522::STATUS_OK)
+  {
+    locked[reader] = true;
+    allowed[reader] = allowList.allowed(r.uid.uidByte, r.uid.size);
+    int32_t stay_s = allowed[reader] ? stayLimits.remaining(r.uid.uidByte, r.uid.size, 0) : 0;
+    if (stay_s <= 0)
+      allowed[reader] = false;
+    if (allowed[reader])
+    {
+      digitalWrite(pins[reader].ssr, HIGH);
+      tracer.mark(TRACE_RELAY_ON, reader);
+      tracer.span(SPAN_WAKE_TO_RELAY, card[reader].detectedAt());
+      stay_started_us[reader] = esp_timer_get_time();
+      scheduleStay(reader, stay_s);
+    }
+    tracer.sample(SPAN_SELECT, select_took_us);
+    tracer.count(COUNT_SCANS);
+    card[reader].cardLocked();
+    presence[reader].locked();
+  }
+  else if (locked[reader] && presence[reader].checked(result == MFRC522::STATUS_OK) == PRESENCE_GONE)
+  {
+    locked[reader] = false;
+    if (allowed[reader])
+    {
+      digitalWrite(pins[reader].ssr, LOW);
+      tracer.mark(TRACE_RELAY_OFF, reader);
+    }
+    stays.cancel(stay_timer[reader]);
+    r.uid.size = 0;
+  }
+  else if (!locked[reader])
+  {
+    // Clear locked card data just in case some data was retrieved in the select procedure
+    // but an error prevented locking.
+    r.uid.size = 0;
+  }
+  if (locked[reader] != was_locked)
+    retain(reader);
+  event.locked = locked[reader];
+  event.allowed = allowed[reader];
+
+  r.PICC_HaltA();
+  card[reader].serviced(locked[reader], presence[reader].interval());
+  return locked[reader] != was_locked;
+}
+
+/**
+ * Takes the lock state over from before a reset, if RTC memory still holds it; otherwise
+ * starts it afresh. Returns whether it was restored.
+ */
+bool ReaderArray::restore()
+{
+  bool valid = esp_reset_reason() != ESP_RST_POWERON && retained.magic == RETAINED_READERS_MAGIC &&
+               retained.crc == crc32(retained.readers, sizeof(retained.readers));
+  if (!valid)
+  {
+    memset(&retained, 0, sizeof(retained));
+    retained.magic = RETAINED_READERS_MAGIC;
+    retained.crc = crc32(retained.readers, sizeof(retained.readers));
+    return false;
+  }
+
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    if (!retained.readers[i].locked || retained.readers[i].uid_size > sizeof(retained.readers[i].uid))
+      continue;
+    locked[i] = true;
+    allowed[i] = retained.readers[i].allowed;
+    counters.restored++;
+  }
+  return true;
+}
+
+/**
+ * Records a reader's lock state in RTC memory (a few stores, on every lock, removal and release).
+ */
+void ReaderArray::retain(uint8_t reader)
+{
+  auto &entry = retained.readers[reader];
+  entry.locked = locked[reader];
+  entry.allowed = allowed[reader];
+  entry.uid_size = locked[reader] ? min(rfid[reader].uid.size, (byte)sizeof(entry.uid)) : 0;
+  memcpy(entry.uid, rfid[reader].uid.uidByte, entry.uid_size);
+  retained.crc = crc32(retained.readers, sizeof(retained.readers));
+}
+
+/**
+ * Looks the limits of the stays whose timers fired up again: schedules the next check, or
+ * switches the relay off and reports the first stay that is over (the others stay due).
+ */
+bool ReaderArray::stayDue(ReaderEvent &event)
+{
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    if (!(stays_due & (1u << i)))
+      continue;
+    stays_due &= ~(1u << i);
+    if (!locked[i] || !allowed[i])
+      continue;
+
+    counters.stay_checks++;
+    uint32_t elapsed_s = (esp_timer_get_time() - stay_started_us[i]) / 1000000;
+    int32_t left_s = stayLimits.remaining(rfid[i].uid.uidByte, rfid[i].uid.size, elapsed_s);
+    if (left_s > 0)
+    {
+      scheduleStay(i, left_s);
+      continue;
+    }
+
+    allowed[i] = false;
+    digitalWrite(pins[i].ssr, LOW);
+    retain(i);
+    tracer.mark(TRACE_RELAY_OFF, i);
+    counters.expired++;
+
+    event.reader = i;
+    event.locked = true;
+    event.allowed = false;
+    event.expired = true;
+    event.uid = rfid[i].uid;
+    event.status = MFRC522::STATUS_OK;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Sets the stay timer of a reader to the first tick after left_s seconds from now (none for
+ * an unlimited stay).
+ */
+void ReaderArray::scheduleStay(uint8_t reader, int32_t left_s)
+{
+  if (left_s == STAY_UNLIMITED)
+  {
+    stays.cancel(stay_timer[reader]);
+    return;
+  }
+  const int64_t tick_us = STAY_TICK_MS * 1000;
+  int64_t deadline_us = esp_timer_get_time() + (int64_t)left_s * 1000000;
+  uint32_t deadline_tick = (deadline_us + tick_us - 1) / tick_us;
+  stays.schedule(stay_timer[reader], deadline_tick - stays.now());
+}
+
+void ReaderArray::stayTimerFired(WheelTimer &timer, void *arg)
+{
+  ReaderArray &self = *static_cast<ReaderArray *>(arg);
+  self.stays_due |= 1u << (&timer - self.stay_timer);
+}
@@ -0,0 +1,39 @@
+#include "scan_clock.h"
+
+#include "log.h"
+
+ScanClock scanClock;
+
+void ScanClock::synced(const struct timeval *now)
+{
+  int64_t monotonic_us = esp_timer_get_time();
+  int64_t offset = (int64_t)now->tv_sec * 1000000 + now->tv_usec - monotonic_us;
+
+  portENTER_CRITICAL(&lock);
+  int32_t step_ms = synced_at_us != 0 ? (int32_t)((offset - offset_us) / 1000) : 0;
+  offset_us = offset;
+  if (synced_at_us == 0)
+  {
+    synced_at_us = monotonic_us;
+    counters.first_sync_ms = (uint32_t)(monotonic_us / 1000);
+  }
+  counters.syncs++;
+  counters.last_step_ms = step_ms;
+  portEXIT_CRITICAL(&lock);
+
+  LOG_INFO("Clock: synchronised, step %d ms", step_ms);
+}
+
+uint32_t ScanClock::epochAt(int64_t monotonic_us)
+{
+  portENTER_CRITICAL(&lock);
+  int64_t epoch_us = synced_at_us != 0 ? offset_us + monotonic_us : 0;
+  portEXIT_CRITICAL(&lock);
+  return epoch_us > 0 ? (uint32_t)(epoch_us / 1000000) : 0;
+}
+
+void ScanClock::printStats()
+{
+  ScanClockStats s = counters;
+  Serial.printf("Clock: %u syncs, first %u ms after boot, last step %d ms\n", s.syncs, s.first_sync_ms, s.last_step_ms);
+}
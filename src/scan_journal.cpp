@@ -0,0 +1,378 @@
+#include "scan_journal.h"
+
+#include <LittleFS.h>
+
+#include "crc32.h"
+#include "log.h"
+
+ScanJournal journal;
+
+static const char *JOURNAL_DIR = "/journal";
+static const char *CURSOR_PATH = "/journal/cursor";
+
+struct JournalCursor
+{
+  uint32_t segment;
+  uint32_t index;
+  uint32_t seq_limit; // sequence numbers below this may have been used
+  uint32_t crc;
+};
+
+static void segmentPath(char *path, size_t size, uint32_t segment)
+{
+  snprintf(path, size, "%s/%08lu.log", JOURNAL_DIR, (unsigned long)segment);
+}
+
+static uint32_t recordCrc(const JournalRecord &record)
+{
+  return crc32(&record.event, sizeof(record.event), crc32(&record.seq, sizeof(record.seq)));
+}
+
+bool ScanJournal::begin()
+{
+  if (!LittleFS.begin(true))
+  {
+    LOG_ERROR("Journal: LittleFS mount failed, events are kept in RAM only");
+    return false;
+  }
+  mounted = true;
+
+  if (!LittleFS.exists(JOURNAL_DIR))
+    LittleFS.mkdir(JOURNAL_DIR);
+
+  // Sequence numbers up to the reserved limit may have gone out from RAM without reaching
+  // flash, so numbering goes on from there rather than from the newest stored record.
+  JournalCursor cursor;
+  bool have_cursor = false;
+  File file = LittleFS.open(CURSOR_PATH, FILE_READ);
+  if (file)
+  {
+    have_cursor = file.read(reinterpret_cast<uint8_t *>(&cursor), sizeof(cursor)) == sizeof(cursor) &&
+                  cursor.crc == crc32(&cursor, offsetof(JournalCursor, crc));
+    file.close();
+  }
+  if (have_cursor)
+    next_seq = seq_limit = cursor.seq_limit;
+
+  // Find the oldest and newest segment left by the previous boot.
+  bool found = false;
+  File dir = LittleFS.open(JOURNAL_DIR);
+  for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile())
+  {
+    const char *name = strrchr(entry.name(), '/');
+    name = name ? name + 1 : entry.name();
+
+    char *end;
+    uint32_t segment = strtoul(name, &end, 10);
+    if (end == name || strcmp(end, ".log") != 0)
+      continue;
+
+    if (!found || segment < first_segment)
+      first_segment = segment;
+    if (!found || segment > last_segment)
+      last_segment = segment;
+    found = true;
+  }
+  dir.close();
+
+  if (!found)
+  {
+    boot_seq = next_seq;
+    return true;
+  }
+
+  // Restore the replay position; fall back to the oldest segment if the cursor is missing or stale.
+  read_segment = first_segment;
+  read_index = 0;
+  if (have_cursor && cursor.segment >= first_segment && cursor.segment <= last_segment)
+  {
+    read_segment = cursor.segment;
+    read_index = cursor.index;
+  }
+
+  stored_count = 0;
+  for (uint32_t segment = read_segment; segment <= last_segment; segment++)
+  {
+    uint32_t records = segmentRecords(segment);
+    uint32_t start = segment == read_segment ? min(read_index, records) : 0;
+    stored_count += records - start;
+  }
+  last_segment_records = segmentRecords(last_segment);
+
+  // Continue the sequence after the newest record.
+  char path[32];
+  segmentPath(path, sizeof(path), last_segment);
+  file = LittleFS.open(path, FILE_READ);
+  if (file)
+  {
+    bool torn = file.size() % sizeof(JournalRecord) != 0;
+    JournalRecord record;
+    if (last_segment_records > 0 && file.seek((last_segment_records - 1) * sizeof(JournalRecord)) && readRecord(file, record))
+      next_seq = max(next_seq, record.seq + 1);
+    file.close();
+
+    // Never append behind a partially written record.
+    if (torn)
+      openNextSegment();
+  }
+
+  boot_seq = next_seq;
+  LOG_INFO("Journal: %u events waiting in %u segments", stored_count, last_segment - first_segment + 1);
+  return true;
+}
+
+void ScanJournal::append(const ScanEvent &event)
+{
+  if (pending_count == JOURNAL_WRITE_BATCH)
+    flush();
+
+  // Not mounted (or flash write failed): keep the newest events in RAM.
+  if (pending_count == JOURNAL_WRITE_BATCH)
+  {
+    memmove(&pending[0], &pending[1], (JOURNAL_WRITE_BATCH - 1) * sizeof(JournalRecord));
+    pending_count--;
+    counters.overflowed++;
+  }
+
+  if (pending_count == 0)
+    pending_since_ms = millis();
+
+  // Reserve the next block of sequence numbers before using the first of them.
+  if (mounted && next_seq >= seq_limit)
+  {
+    seq_limit = next_seq + JOURNAL_SEQ_BLOCK;
+    saveCursor();
+  }
+
+  JournalRecord &record = pending[pending_count++];
+  record.seq = next_seq++;
+  record.event = event;
+  record.crc = recordCrc(record);
+}
+
+size_t ScanJournal::peek(JournalRecord *out, size_t max)
+{
+  size_t count = 0;
+  uint32_t segment = read_segment;
+  uint32_t index = read_index;
+  uint32_t remaining = stored_count;
+
+  while (count < max && remaining > 0 && segment <= last_segment)
+  {
+    uint32_t records = segment == last_segment ? last_segment_records : segmentRecords(segment);
+    if (index >= records)
+    {
+      segment++;
+      index = 0;
+      continue;
+    }
+
+    char path[32];
+    segmentPath(path, sizeof(path), segment);
+    File file = LittleFS.open(path, FILE_READ);
+    if (!file || !file.seek(index * sizeof(JournalRecord)))
+      break;
+
+    while (count < max && index < records)
+    {
+      if (!readRecord(file, out[count]))
+      {
+        file.close();
+        if (count > 0)
+          return count;
+
+        // The oldest record is corrupt: skip it and start over.
+        counters.corrupt++;
+        consume(1);
+        return peek(out, max);
+      }
+      count++;
+      index++;
+      remaining--;
+    }
+    file.close();
+  }
+
+  // RAM records follow once every flash record is included.
+  if (remaining == 0)
+  {
+    for (size_t i = 0; i < pending_count && count < max; i++)
+      out[count++] = pending[i];
+  }
+
+  return count;
+}
+
+void ScanJournal::consume(size_t count)
+{
+  bool moved = false;
+
+  while (count > 0 && stored_count > 0)
+  {
+    uint32_t records = read_segment == last_segment ? last_segment_records : segmentRecords(read_segment);
+    uint32_t step = min((uint32_t)count, records > read_index ? records - read_index : 0);
+    read_index += step;
+    stored_count -= step;
+    count -= step;
+    moved = true;
+
+    if (read_index >= records && read_segment < last_segment)
+    {
+      // Segment fully replayed: delete it so its blocks are free for new writes.
+      char path[32];
+      segmentPath(path, sizeof(path), read_segment);
+      LittleFS.remove(path);
+      read_segment++;
+      read_index = 0;
+      first_segment = read_segment;
+    }
+    else if (step == 0)
+    {
+      break;
+    }
+  }
+
+  if (moved)
+    saveCursor();
+
+  // Delivered before they were flushed: these never reach flash.
+  size_t from_ram = min(count, pending_count);
+  if (from_ram > 0)
+  {
+    memmove(&pending[0], &pending[from_ram], (pending_count - from_ram) * sizeof(JournalRecord));
+    pending_count -= from_ram;
+    pending_since_ms = millis();
+  }
+}
+
+void ScanJournal::flush()
+{
+  if (!mounted || pending_count == 0)
+    return;
+
+  size_t written = 0;
+  while (written < pending_count)
+  {
+    if (last_segment_records >= JOURNAL_SEGMENT_RECORDS)
+      openNextSegment();
+
+    size_t chunk = min(pending_count - written, (size_t)(JOURNAL_SEGMENT_RECORDS - last_segment_records));
+
+    char path[32];
+    segmentPath(path, sizeof(path), last_segment);
+    File file = LittleFS.open(path, FILE_APPEND);
+    if (!file)
+      break;
+
+    size_t bytes = file.write(reinterpret_cast<const uint8_t *>(&pending[written]), chunk * sizeof(JournalRecord));
+    file.close();
+
+    size_t records = bytes / sizeof(JournalRecord);
+    last_segment_records += records;
+    stored_count += records;
+    written += records;
+    counters.flushed += records;
+
+    if (records < chunk)
+    {
+      // Short write (flash full or failing): continue in a fresh segment next time.
+      LOG_ERROR("Journal: flash write failed");
+      openNextSegment();
+      break;
+    }
+  }
+
+  if (written > 0)
+  {
+    counters.flushes++;
+    memmove(&pending[0], &pending[written], (pending_count - written) * sizeof(JournalRecord));
+    pending_count -= written;
+    pending_since_ms = millis();
+  }
+}
+
+void ScanJournal::maintain()
+{
+  if (pending_count > 0 && millis() - pending_since_ms >= JOURNAL_FLUSH_MS)
+    flush();
+}
+
+JournalStats ScanJournal::stats() const
+{
+  JournalStats copy = counters;
+  copy.backlog = backlog();
+  copy.unflushed = pending_count;
+  copy.segments = stored_count > 0 || last_segment_records > 0 ? last_segment - first_segment + 1 : 0;
+  return copy;
+}
+
+bool ScanJournal::readRecord(File &file, JournalRecord &record)
+{
+  return file.read(reinterpret_cast<uint8_t *>(&record), sizeof(record)) == sizeof(record) &&
+         record.crc == recordCrc(record);
+}
+
+void ScanJournal::openNextSegment()
+{
+  uint32_t previous = last_segment;
+  last_segment++;
+  last_segment_records = 0;
+
+  // The previous segment may already be fully replayed.
+  if (read_segment == previous && stored_count == 0)
+  {
+    char path[32];
+    segmentPath(path, sizeof(path), previous);
+    LittleFS.remove(path);
+    first_segment = read_segment = last_segment;
+    read_index = 0;
+    saveCursor();
+  }
+
+  while (last_segment - first_segment + 1 > JOURNAL_MAX_SEGMENTS)
+    dropOldestSegment();
+}
+
+void ScanJournal::dropOldestSegment()
+{
+  uint32_t records = segmentRecords(first_segment);
+  uint32_t lost = first_segment == read_segment ? (records > read_index ? records - read_index : 0) : records;
+  stored_count -= min(lost, stored_count);
+  counters.overflowed += lost;
+
+  char path[32];
+  segmentPath(path, sizeof(path), first_segment);
+  LittleFS.remove(path);
+  first_segment++;
+
+  if (read_segment < first_segment)
+  {
+    read_segment = first_segment;
+    read_index = 0;
+    saveCursor();
+  }
+}
+
+void ScanJournal::saveCursor()
+{
+  JournalCursor cursor = {read_segment, read_index, seq_limit, 0};
+  cursor.crc = crc32(&cursor, offsetof(JournalCursor, crc));
+
+  File file = LittleFS.open(CURSOR_PATH, FILE_WRITE);
+  if (!file)
+    return;
+  file.write(reinterpret_cast<const uint8_t *>(&cursor), sizeof(cursor));
+  file.close();
+}
+
+uint32_t ScanJournal::segmentRecords(uint32_t segment)
+{
+  char path[32];
+  segmentPath(path, sizeof(path), segment);
+  File file = LittleFS.open(path, FILE_READ);
+  if (!file)
+    return 0;
+  uint32_t records = file.size() / sizeof(JournalRecord);
+  file.close();
+  return records;
+}
@@ -0,0 +1,202 @@
+#include "server_api.h"
+
+#include "config.h"
+#include "event_serializer.h"
+#include "http_session.h"
+#include "json_scanner.h"
+#include "log.h"
+#include "trace.h"
+#include "wire_format.h"
+
+/**
+ * Pulls "token" and "expires_in" out of the /api/request-token response.
+ */
+class TokenResponse : public JsonHandler
+{
+public:
+  char token[256] = "";
+  uint32_t expires_in_s = 0;
+
+  void value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type) override
+  {
+    if (depth != 1)
+      return;
+    if (strcmp(key, "token") == 0 && type == STRING)
+      strlcpy(token, value, sizeof(token));
+    else if (strcmp(key, "expires_in") == 0 && type == NUMBER)
+      expires_in_s = strtoul(value, nullptr, 10);
+  }
+};
+
+// Request payloads are written here; only the uploader task talks to the server.
+static char payload[BATCH_BUFFER_SIZE > SEND_DATA_BUFFER_SIZE ? BATCH_BUFFER_SIZE : SEND_DATA_BUFFER_SIZE];
+
+const char *RequestToken(const char *device_UID, uint32_t *expires_in_s)
+{
+  if (expires_in_s)
+    *expires_in_s = 0;
+
+  // Create the JSON payload
+  uint32_t start_us = Tracer::now();
+  size_t length = writeTokenRequest(payload, sizeof(payload), client_key, client_secret, device_UID);
+  tracer.span(SPAN_SERIALIZE, start_us);
+  tracer.mark(TRACE_SERIALIZE, length);
+
+  // The payloads carry client_secret and the token, so only their size is logged.
+  LOG_DEBUG("Requesting token (%u bytes)", (unsigned)length);
+
+  // Send HTTP POST request on the shared connection, parsing the response as it arrives
+  TokenResponse token_response;
+  char value[sizeof(token_response.token)];
+  JsonScanner scanner(token_response, value, sizeof(value));
+  int http_request_response_code = httpSession.post(request_token_address, payload, length, scanner);
+
+  // Check the server response
+  if (http_request_response_code > 0)
+  {
+    LOG_DEBUG("Token response code: %d", http_request_response_code);
+
+    if (scanner.complete() && token_response.token[0] != '\0')
+    {
+      LOG_INFO("Got receiver token, expires in %u s", (unsigned)token_response.expires_in_s);
+
+      if (expires_in_s)
+        *expires_in_s = token_response.expires_in_s;
+
+      static char token_buffer[256];
+      strlcpy(token_buffer, token_response.token, sizeof(token_buffer));
+      return token_buffer;
+    }
+    else
+    {
+      LOG_WARN("Failed to parse token response (HTTP %d)", http_request_response_code);
+    }
+  }
+  else
+  {
+    LOG_WARN("Token request failed: %d", http_request_response_code);
+  }
+  return nullptr;
+}
+
+int SendData(const char *device_UID, const char *token, const ScanEvent &event, bool compact)
+{
+  ReceiverCredentials credentials = {client_key, client_secret, device_UID, token};
+  uint32_t start_us = Tracer::now();
+  size_t length = compact ? packSendData(reinterpret_cast<uint8_t *>(payload), sizeof(payload), credentials, event)
+                          : writeSendData(payload, sizeof(payload), credentials, event);
+  tracer.span(SPAN_SERIALIZE, start_us);
+  tracer.mark(TRACE_SERIALIZE, length);
+  if (length == 0)
+  {
+    LOG_ERROR("Scan payload does not fit the buffer");
+    return -1;
+  }
+
+  LOG_DEBUG("Sending %s scan from reader %u (%u bytes%s)", scanTypeName(event.type), event.reader, (unsigned)length,
+            compact ? ", MessagePack" : "");
+
+  // Send HTTP POST request on the shared connection; the response body is only shown in verbose builds
+  Stream *response = LOG_LEVEL >= LOG_LEVEL_VERBOSE ? &Serial : nullptr;
+  int http_send_response_code = httpSession.post(send_data_address, payload, length, response,
+                                                 compact ? WIRE_CONTENT_MSGPACK : WIRE_CONTENT_JSON);
+
+  // Check the server response
+  if (http_send_response_code > 0)
+    LOG_DEBUG("Send data response code: %d", http_send_response_code);
+  else
+    LOG_WARN("Send data failed: %d", http_send_response_code);
+
+  return http_send_response_code;
+}
+
+int SendBatch(const char *device_UID, const char *token, const JournalRecord *records, size_t count, BatchAck *acks,
+              bool compact)
+{
+  // Also clears acks[]
+  BatchAckParser ack_parser(records, count, acks);
+
+  ReceiverCredentials credentials = {client_key, client_secret, device_UID, token};
+  uint32_t start_us = Tracer::now();
+  size_t length = compact ? packEventBatch(credentials, records, count, reinterpret_cast<uint8_t *>(payload), sizeof(payload))
+                          : serializeEventBatch(credentials, records, count, payload, sizeof(payload));
+  tracer.span(SPAN_SERIALIZE, start_us);
+  tracer.mark(TRACE_SERIALIZE, length);
+  if (length == 0)
+  {
+    LOG_ERROR("Batch payload does not fit the buffer");
+    return -1;
+  }
+
+  LOG_DEBUG("Sending batch of %u events (%u bytes%s)", (unsigned)count, (unsigned)length, compact ? ", binary" : "");
+
+  // Send HTTP POST request on the shared connection, reading the acks as they arrive
+  char value[32];
+  JsonScanner scanner(ack_parser, value, sizeof(value));
+  int http_batch_response_code = httpSession.post(send_data_batch_address, payload, length, scanner,
+                                                  compact ? WIRE_CONTENT_BATCH : WIRE_CONTENT_JSON);
+
+  // Check the server response
+  if (http_batch_response_code > 0)
+  {
+    LOG_DEBUG("Batch response code: %d", http_batch_response_code);
+
+    if (http_batch_response_code >= 200 && http_batch_response_code < 300 && !scanner.complete())
+    {
+      LOG_WARN("Failed to parse batch response");
+    }
+  }
+  else
+  {
+    LOG_WARN("Batch send failed: %d", http_batch_response_code);
+  }
+
+  return http_batch_response_code;
+}
+
+int FetchAllowList(const char *device_UID, const char *token, uint32_t version, JsonHandler &update)
+{
+  ReceiverCredentials credentials = {client_key, client_secret, device_UID, token};
+  size_t length = writeAllowListRequest(payload, sizeof(payload), credentials, version);
+
+  LOG_DEBUG("Requesting allow list changes since version %u (%u bytes)", (unsigned)version, (unsigned)length);
+
+  // The list can hold thousands of tags, so it is parsed as it arrives rather than buffered.
+  char value[32];
+  JsonScanner scanner(update, value, sizeof(value));
+  int http_allow_list_response_code = httpSession.post(allow_list_address, payload, length, scanner);
+
+  // Check the server response
+  if (http_allow_list_response_code >= 200 && http_allow_list_response_code < 300 && !scanner.complete())
+  {
+    LOG_WARN("Failed to parse allow list response");
+    return -1;
+  }
+  if (http_allow_list_response_code <= 0)
+    LOG_WARN("Allow list request failed: %d", http_allow_list_response_code);
+
+  return http_allow_list_response_code;
+}
+
+int FetchConfig(const char *device_UID, const char *token, uint32_t version, JsonHandler &update)
+{
+  ReceiverCredentials credentials = {client_key, client_secret, device_UID, token};
+  size_t length = writeAllowListRequest(payload, sizeof(payload), credentials, version);
+
+  LOG_DEBUG("Requesting a config newer than version %u", (unsigned)version);
+
+  // Room for the longest string of a configuration (a WiFi password).
+  char value[72];
+  JsonScanner scanner(update, value, sizeof(value));
+  int http_config_response_code = httpSession.post(config_address, payload, length, scanner);
+
+  if (http_config_response_code >= 200 && http_config_response_code < 300 && !scanner.complete())
+  {
+    LOG_WARN("Failed to parse config response");
+    return -1;
+  }
+  if (http_config_response_code <= 0)
+    LOG_WARN("Config request failed: %d", http_config_response_code);
+
+  return http_config_response_code;
+}
@@ -0,0 +1,225 @@
+#include "stay_limits.h"
+
+#include <LittleFS.h>
+#include <esp_timer.h>
+#include <stdlib.h>
+
+#include "crc32.h"
+#include "log.h"
+#include "scan_clock.h"
+
+StayLimits stayLimits;
+
+static const char *STAY_LIMITS_PATH = "/stay_limits.bin";
+static const char *STAY_LIMITS_TEMP_PATH = "/stay_limits.tmp";
+static const uint32_t STAY_LIMITS_MAGIC = 0x59415431; // "1TAY"
+
+struct StayLimitsHeader
+{
+  uint32_t magic;
+  uint32_t count;
+  uint32_t crc; // over the limits
+};
+
+StayLimitsUpdate::~StayLimitsUpdate()
+{
+  free(limits);
+}
+
+void StayLimitsUpdate::value(const char *key, const char *value, size_t length, JsonHandler::ValueType type)
+{
+  seen = true;
+  if (strcmp(key, "tag") == 0 && type == JsonHandler::STRING)
+  {
+    if (!parseHexTag(value, length, entry.tag))
+      overflowed = true;
+  }
+  else if (strcmp(key, "stay_s") == 0 && type == JsonHandler::NUMBER)
+  {
+    entry.stay_s = strtoul(value, nullptr, 10);
+  }
+  else if (strcmp(key, "expires") == 0 && type == JsonHandler::NUMBER)
+  {
+    entry.expires = strtoul(value, nullptr, 10);
+  }
+}
+
+void StayLimitsUpdate::entryEnd()
+{
+  StayLimit done = entry;
+  entry = {};
+  if (overflowed)
+    return;
+  if (done.tag.size == 0 || count == STAY_LIMITS_MAX)
+  {
+    overflowed = true;
+    return;
+  }
+  if (done.stay_s == 0 && done.expires == 0)
+    return;
+
+  // Small enough to take the largest table at once instead of growing it.
+  if (limits == nullptr)
+  {
+    limits = (StayLimit *)calloc(STAY_LIMITS_MAX, sizeof(StayLimit));
+    if (limits == nullptr)
+    {
+      overflowed = true;
+      return;
+    }
+  }
+  limits[count++] = done;
+}
+
+void StayLimits::begin()
+{
+  File file = LittleFS.open(STAY_LIMITS_PATH, FILE_READ);
+  if (!file)
+    return;
+
+  StayLimitsHeader header;
+  StayLimit *loaded = nullptr;
+  bool valid = file.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+               header.magic == STAY_LIMITS_MAGIC && header.count > 0 && header.count <= STAY_LIMITS_MAX;
+  if (valid)
+  {
+    loaded = (StayLimit *)malloc(header.count * sizeof(StayLimit));
+    size_t bytes = header.count * sizeof(StayLimit);
+    valid = loaded != nullptr && file.read(reinterpret_cast<uint8_t *>(loaded), bytes) == bytes &&
+            crc32(loaded, bytes) == header.crc;
+  }
+  file.close();
+
+  if (!valid)
+  {
+    LOG_WARN("Stay limits: saved table is corrupt, waiting for the server");
+    free(loaded);
+    return;
+  }
+
+  install(loaded, header.count);
+  LOG_INFO("Stay limits: %u cards", header.count);
+}
+
+int32_t StayLimits::remaining(const uint8_t *uid, uint8_t size, uint32_t elapsed_s)
+{
+  StayLimit key = {};
+  key.tag.size = size > sizeof(key.tag.uid) ? sizeof(key.tag.uid) : size;
+  memcpy(key.tag.uid, uid, key.tag.size);
+
+  portENTER_CRITICAL(&lock);
+  // No table yet, or an empty one: limits is nullptr then.
+  const StayLimit *found = count > 0 ? (const StayLimit *)bsearch(&key, limits, count, sizeof(StayLimit), compareTags) : nullptr;
+  StayLimit limit = found != nullptr ? *found : key;
+  counters.lookups++;
+  if (found != nullptr)
+    counters.limited++;
+  portEXIT_CRITICAL(&lock);
+
+  int64_t left = STAY_UNLIMITED;
+  if (limit.stay_s > 0)
+    left = (int64_t)limit.stay_s - elapsed_s;
+  if (limit.expires > 0)
+  {
+    uint32_t now = scanClock.epochAt(esp_timer_get_time());
+    int64_t until_expiry = now != 0 ? (int64_t)limit.expires - now : STAY_RECHECK_S;
+    if (until_expiry < left)
+      left = until_expiry;
+  }
+  return left < INT32_MIN ? INT32_MIN : (int32_t)left;
+}
+
+void StayLimits::apply(StayLimitsUpdate &update)
+{
+  if (update.overflowed)
+  {
+    LOG_WARN("Stay limits: malformed or more than %u entries, keeping the current table", STAY_LIMITS_MAX);
+    return;
+  }
+
+  if (update.count > 0)
+    qsort(update.limits, update.count, sizeof(StayLimit), compareTags);
+  bool same;
+  portENTER_CRITICAL(&lock);
+  same = update.count == count && (count == 0 || memcmp(update.limits, limits, count * sizeof(StayLimit)) == 0);
+  portEXIT_CRITICAL(&lock);
+  if (same)
+    return;
+
+  // Hand the buffer over, trimmed to the entries it holds.
+  if (update.count == 0)
+  {
+    free(update.limits);
+    update.limits = nullptr;
+  }
+  else
+  {
+    StayLimit *trimmed = (StayLimit *)realloc(update.limits, update.count * sizeof(StayLimit));
+    if (trimmed != nullptr)
+      update.limits = trimmed;
+  }
+  install(update.limits, update.count);
+  update.limits = nullptr;
+  save();
+  portENTER_CRITICAL(&lock);
+  counters.updates++;
+  portEXIT_CRITICAL(&lock);
+  LOG_INFO("Stay limits: %u cards", (unsigned)update.count);
+}
+
+StayLimitsStats StayLimits::stats()
+{
+  portENTER_CRITICAL(&lock);
+  StayLimitsStats copy = counters;
+  copy.limits = count;
+  portEXIT_CRITICAL(&lock);
+  return copy;
+}
+
+void StayLimits::printStats()
+{
+  StayLimitsStats s = stats();
+  Serial.printf("Stay limits: %u cards, %u lookups (%u limited), %u updates\n", s.limits, s.lookups, s.limited, s.updates);
+}
+
+void StayLimits::install(StayLimit *new_limits, uint32_t new_count)
+{
+  portENTER_CRITICAL(&lock);
+  StayLimit *old_limits = limits;
+  limits = new_limits;
+  count = new_count;
+  installed++;
+  portEXIT_CRITICAL(&lock);
+
+  free(old_limits);
+}
+
+/**
+ * Same as the allow list: a temporary file renamed over the saved one.
+ */
+void StayLimits::save()
+{
+  if (count == 0)
+  {
+    LittleFS.remove(STAY_LIMITS_PATH);
+    return;
+  }
+
+  StayLimitsHeader header = {STAY_LIMITS_MAGIC, count, crc32(limits, count * sizeof(StayLimit))};
+  File file = LittleFS.open(STAY_LIMITS_TEMP_PATH, FILE_WRITE);
+  if (!file)
+  {
+    LOG_WARN("Stay limits: cannot save");
+    return;
+  }
+  size_t bytes = count * sizeof(StayLimit);
+  bool written = file.write(reinterpret_cast<const uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+                 file.write(reinterpret_cast<const uint8_t *>(limits), bytes) == bytes;
+  file.close();
+
+  if (!written || !LittleFS.rename(STAY_LIMITS_TEMP_PATH, STAY_LIMITS_PATH))
+  {
+    LOG_WARN("Stay limits: save failed");
+    LittleFS.remove(STAY_LIMITS_TEMP_PATH);
+  }
+}
@@ -0,0 +1,98 @@
+#include "timer_wheel.h"
+
+static_assert(TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS < 32, "the wheel has to cover less than 2^32 ticks");
+
+void TimerWheel::begin(uint32_t now)
+{
+  current = now;
+}
+
+void TimerWheel::schedule(WheelTimer &timer, uint32_t ticks)
+{
+  if (timer.scheduled())
+    cancel(timer);
+
+  const uint32_t range = 1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+  if (ticks == 0)
+    ticks = 1;
+  if (ticks >= range)
+    ticks = range - 1;
+  timer.expires_tick = current + ticks;
+  insert(timer);
+
+  counters.pending++;
+  if (counters.pending > counters.max_pending)
+    counters.max_pending = counters.pending;
+}
+
+void TimerWheel::cancel(WheelTimer &timer)
+{
+  if (!timer.scheduled())
+    return;
+  unlink(timer);
+  counters.pending--;
+}
+
+void TimerWheel::advance(uint32_t now)
+{
+  while ((int32_t)(now - current) > 0)
+  {
+    current++;
+
+    // Each time a level wraps, the next level's slot for the new period is spread out below.
+    for (uint8_t level = 1; level < TIMER_WHEEL_LEVELS && ((current >> (TIMER_WHEEL_BITS * (level - 1))) & MASK) == 0;
+         level++)
+      cascade(level);
+
+    WheelTimer **head = &slots[0][current & MASK];
+    while (*head != nullptr)
+    {
+      WheelTimer &timer = **head;
+      unlink(timer);
+      counters.pending--;
+      counters.fired++;
+      timer.callback(timer, timer.arg);
+    }
+  }
+}
+
+/**
+ * Links the timer into the slot of the lowest level whose span reaches its tick.
+ */
+void TimerWheel::insert(WheelTimer &timer)
+{
+  uint32_t delta = timer.expires_tick - current;
+  uint8_t level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1u << (TIMER_WHEEL_BITS * (level + 1))))
+    level++;
+
+  WheelTimer **head = &slots[level][(timer.expires_tick >> (TIMER_WHEEL_BITS * level)) & MASK];
+  timer.next = *head;
+  if (timer.next != nullptr)
+    timer.next->wheel_prev = &timer.next;
+  *head = &timer;
+  timer.wheel_prev = head;
+}
+
+void TimerWheel::unlink(WheelTimer &timer)
+{
+  *timer.wheel_prev = timer.next;
+  if (timer.next != nullptr)
+    timer.next->wheel_prev = timer.wheel_prev;
+  timer.next = nullptr;
+  timer.wheel_prev = nullptr;
+}
+
+void TimerWheel::cascade(uint8_t level)
+{
+  WheelTimer **head = &slots[level][(current >> (TIMER_WHEEL_BITS * level)) & MASK];
+  WheelTimer *timer = *head;
+  *head = nullptr;
+  while (timer != nullptr)
+  {
+    WheelTimer *next = timer->next;
+    insert(*timer);
+    counters.cascaded++;
+    timer = next;
+  }
+}
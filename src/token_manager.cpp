@@ -0,0 +1,125 @@
+#include "token_manager.h"
+
+#include <time.h>
+#if TOKEN_PERSIST
+#include <Preferences.h>
+#endif
+
+#include "log.h"
+#include "server_api.h"
+#include "trace.h"
+
+TokenManager tokenManager;
+
+// Epoch values below this mean the clock has not been set by NTP yet
+static const time_t VALID_EPOCH = 1700000000;
+
+// Longest lifetime tracked with millis() arithmetic (about 24 days)
+static const uint32_t MAX_TTL_S = 2000000;
+
+void TokenManager::begin(const char *device_UID)
+{
+  this->device_UID = device_UID;
+
+#if TOKEN_PERSIST
+  Preferences prefs;
+  if (!prefs.begin("token", true))
+    return;
+
+  size_t len = prefs.getString("value", token, sizeof(token));
+  time_t expires_at = (time_t)prefs.getULong64("expires_at", 0);
+  prefs.end();
+
+  if (len == 0)
+  {
+    token[0] = '\0';
+    return;
+  }
+
+  // The remaining lifetime is only known if the clock is already set; otherwise keep using
+  // the token but refresh it at the first chance (a rejection also forces a refresh).
+  obtained_ms = millis();
+  time_t now = time(nullptr);
+  ttl_ms = 0;
+  if (now > VALID_EPOCH && expires_at > now)
+    ttl_ms = (uint32_t)min((time_t)MAX_TTL_S, expires_at - now) * 1000UL;
+
+  LOG_INFO("Loaded receiver token from NVS");
+#endif
+}
+
+const char *TokenManager::get()
+{
+  if (!valid())
+    refresh();
+
+  return valid() ? token : nullptr;
+}
+
+void TokenManager::maintain()
+{
+  if (device_UID == nullptr)
+    return;
+
+  uint32_t now = millis();
+
+  if (attempted && now - last_attempt_ms < TOKEN_RETRY_INTERVAL_MS)
+    return;
+
+  // Short-lived tokens are refreshed at half their lifetime instead of the full margin.
+  uint32_t margin_ms = min((uint32_t)(TOKEN_REFRESH_MARGIN_S * 1000UL), ttl_ms / 2);
+  bool due = !valid() || ttl_ms == 0 || now - obtained_ms >= ttl_ms - margin_ms;
+
+  if (due)
+    refresh();
+}
+
+void TokenManager::invalidate()
+{
+  token[0] = '\0';
+  ttl_ms = 0;
+  // A rejected token is replaced right away, do not wait for the retry interval.
+  attempted = false;
+}
+
+bool TokenManager::refresh()
+{
+  attempted = true;
+  last_attempt_ms = millis();
+
+  uint32_t ttl_s = 0;
+  uint32_t start_us = tracer.mark(TRACE_TOKEN_FETCH);
+  const char *received = RequestToken(device_UID, &ttl_s);
+  tracer.mark(TRACE_TOKEN_DONE, received != nullptr);
+  tracer.span(SPAN_TOKEN_FETCH, start_us);
+  if (received == nullptr)
+    return false;
+
+  if (ttl_s == 0)
+    ttl_s = TOKEN_DEFAULT_TTL_S;
+  if (ttl_s > MAX_TTL_S)
+    ttl_s = MAX_TTL_S;
+
+  strncpy(token, received, sizeof(token) - 1);
+  token[sizeof(token) - 1] = '\0';
+  obtained_ms = millis();
+  ttl_ms = ttl_s * 1000UL;
+  attempted = false;
+
+  persist(ttl_s);
+  return true;
+}
+
+void TokenManager::persist(uint32_t ttl_s)
+{
+#if TOKEN_PERSIST
+  Preferences prefs;
+  if (!prefs.begin("token", false))
+    return;
+
+  time_t now = time(nullptr);
+  prefs.putString("value", token);
+  prefs.putULong64("expires_at", now > VALID_EPOCH ? (uint64_t)(now + ttl_s) : 0);
+  prefs.end();
+#endif
+}
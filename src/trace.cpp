@@ -0,0 +1,148 @@
+#include "trace.h"
+
+#include "event_serializer.h"
+
+Tracer tracer;
+
+static const char *const point_names[TRACE_POINTS] = {
+    "card wake", "card select", "relay on", "relay off", "token fetch", "token done", "serialize", "POST", "response"};
+
+static const char *const span_names[TRACE_SPANS] = {
+    "wake_to_relay", "select", "token_fetch", "serialize", "post", "scan_to_ack"};
+
+static const char *const counter_names[TRACE_COUNTERS] = {"scans", "posts", "retries", "failures"};
+
+/**
+ * Values below 8 us get a bucket each, above that every power of two is split in four.
+ */
+static uint8_t bucketOf(uint32_t us)
+{
+  if (us < 8)
+    return us;
+  uint8_t msb = 31 - __builtin_clz(us);
+  return (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+}
+
+static uint32_t bucketUpperBound(uint8_t bucket)
+{
+  if (bucket < 8)
+    return bucket;
+  uint8_t msb = bucket / 4 + 1;
+  uint32_t lower = (uint32_t)(4 + bucket % 4) << (msb - 2);
+  return lower + ((1UL << (msb - 2)) - 1);
+}
+
+uint32_t Tracer::record(TracePoint point, int32_t arg)
+{
+  uint32_t us = now();
+
+  portENTER_CRITICAL(&lock);
+  TraceRecord &r = ring[written % TRACE_BUFFER_SIZE];
+  r.us = us;
+  r.arg = arg;
+  r.point = point;
+  r.core = xPortGetCoreID();
+  written++;
+  portEXIT_CRITICAL(&lock);
+
+  return us;
+}
+
+void Tracer::addSample(TraceSpan span, uint32_t duration_us)
+{
+  TraceHistogram &h = histograms[span];
+
+  portENTER_CRITICAL(&lock);
+  h.count++;
+  h.total_us += duration_us;
+  if (duration_us > h.max_us)
+    h.max_us = duration_us;
+  h.buckets[bucketOf(duration_us)]++;
+  portEXIT_CRITICAL(&lock);
+}
+
+uint32_t Tracer::percentile(TraceSpan span, uint8_t percent)
+{
+  TraceHistogram &h = histograms[span];
+  uint32_t result = 0;
+
+  portENTER_CRITICAL(&lock);
+  // Rank of the sample at the percentile, rounded up (p100 is the largest sample).
+  uint32_t rank = (uint32_t)(((uint64_t)h.count * percent + 99) / 100);
+  uint32_t seen = 0;
+  for (uint8_t bucket = 0; rank > 0 && bucket < TRACE_HISTOGRAM_BUCKETS; bucket++)
+  {
+    seen += h.buckets[bucket];
+    if (seen >= rank)
+    {
+      result = min(bucketUpperBound(bucket), h.max_us);
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&lock);
+
+  return result;
+}
+
+void Tracer::printStats()
+{
+  for (uint8_t span = 0; span < TRACE_SPANS; span++)
+  {
+    TraceHistogram &h = histograms[span];
+    if (h.count == 0)
+      continue;
+    Serial.printf("Trace: %-13s n %u, p50 %u us, p99 %u us, max %u us, avg %u us\n", span_names[span], h.count,
+                  percentile((TraceSpan)span, 50), percentile((TraceSpan)span, 99), h.max_us,
+                  (uint32_t)(h.total_us / h.count));
+  }
+
+  Serial.printf("Trace: %u scans, %u posts, %u retries, %u failures, heap free %u, low-water %u\n",
+                counters[COUNT_SCANS], counters[COUNT_POSTS], counters[COUNT_RETRIES], counters[COUNT_FAILURES],
+                ESP.getFreeHeap(), ESP.getMinFreeHeap());
+}
+
+void Tracer::printTrace()
+{
+  portENTER_CRITICAL(&lock);
+  uint32_t end = written;
+  portEXIT_CRITICAL(&lock);
+
+  uint32_t start = end > TRACE_BUFFER_SIZE ? end - TRACE_BUFFER_SIZE : 0;
+  uint32_t previous_us = 0;
+  Serial.printf("Trace: %u points (%u recorded)\n", end - start, end);
+
+  for (uint32_t i = start; i < end; i++)
+  {
+    // Copy one record at a time so the lock is never held while printing.
+    portENTER_CRITICAL(&lock);
+    TraceRecord r = ring[i % TRACE_BUFFER_SIZE];
+    bool overwritten = written - i > TRACE_BUFFER_SIZE;
+    portEXIT_CRITICAL(&lock);
+    if (overwritten)
+      continue;
+
+    Serial.printf("%10u us %+9d  core %u  %-11s %d\n", r.us, i == start ? 0 : (int32_t)(r.us - previous_us), r.core,
+                  r.point < TRACE_POINTS ? point_names[r.point] : "?", r.arg);
+    previous_us = r.us;
+  }
+}
+
+size_t Tracer::writeJson(char *out, size_t size)
+{
+  JsonWriter json(out, size);
+  json.beginObject();
+  for (uint8_t span = 0; span < TRACE_SPANS; span++)
+  {
+    json.beginObject(span_names[span]);
+    json.field("n", histograms[span].count);
+    json.field("p50_us", percentile((TraceSpan)span, 50));
+    json.field("p99_us", percentile((TraceSpan)span, 99));
+    json.field("max_us", histograms[span].max_us);
+    json.endObject();
+  }
+  for (uint8_t counter = 0; counter < TRACE_COUNTERS; counter++)
+    json.field(counter_names[counter], counters[counter]);
+  json.field("heap_min", ESP.getMinFreeHeap());
+  json.endObject();
+  return json.finish();
+}
@@ -0,0 +1,479 @@
+#include "uploader.h"
+
+#include <WiFi.h>
+
+#include "allow_list.h"
+#include "config_store.h"
+#include "field_trace.h"
+#include "http_session.h"
+#include "log.h"
+#include "power_manager.h"
+#include "push_channel.h"
+#include "reader_array.h"
+#include "scan_clock.h"
+#include "server_api.h"
+#include "stay_limits.h"
+#include "token_manager.h"
+#include "trace.h"
+#include "wifi_connection.h"
+
+Uploader uploader;
+
+bool Uploader::begin(const char *device_UID)
+{
+  this->device_UID = device_UID;
+  pushChannel.begin(device_UID);
+
+  queue = xQueueCreate(UPLOAD_QUEUE_LENGTH, sizeof(ScanEvent));
+  if (queue == nullptr)
+  {
+    LOG_ERROR("Uploader: failed to create queue");
+    return false;
+  }
+
+  if (xTaskCreatePinnedToCore(taskEntry, "uploader", UPLOADER_STACK_SIZE, this, UPLOADER_PRIORITY, &task, UPLOADER_CORE) != pdPASS)
+  {
+    LOG_ERROR("Uploader: failed to start task");
+    return false;
+  }
+
+  return true;
+}
+
+bool Uploader::capture(const ReaderEvent &reader_event)
+{
+  if (!reader_event.locked && !reader_event.allowed)
+    return true;
+
+  ScanEvent event = {};
+  event.uid_size = min(reader_event.uid.size, (byte)sizeof(event.uid));
+  memcpy(event.uid, reader_event.uid.uidByte, event.uid_size);
+  event.type = !reader_event.locked    ? SCAN_EXIT
+               : reader_event.expired ? SCAN_EXPIRED
+               : reader_event.allowed ? SCAN_ENTRY
+                                      : SCAN_DENIED;
+  event.reader = reader_event.reader;
+  event.captured_us = esp_timer_get_time();
+  event.epoch = scanClock.epochAt(event.captured_us);
+
+  if (enqueue(event))
+    return true;
+  LOG_WARN("Upload queue full, %s scan dropped", scanTypeName(event.type));
+  return false;
+}
+
+bool Uploader::enqueue(const ScanEvent &event)
+{
+  bool queued = queue != nullptr && xQueueSend(queue, &event, 0) == pdTRUE;
+
+  portENTER_CRITICAL(&stats_lock);
+  if (queued)
+  {
+    counters.enqueued++;
+    unjournaled++;
+    uint32_t depth = uxQueueMessagesWaiting(queue);
+    if (depth > counters.max_queue_depth)
+      counters.max_queue_depth = depth;
+  }
+  else
+  {
+    counters.dropped++;
+  }
+  portEXIT_CRITICAL(&stats_lock);
+
+  return queued;
+}
+
+bool Uploader::idle()
+{
+  portENTER_CRITICAL(&stats_lock);
+  bool done = unjournaled == 0;
+  portEXIT_CRITICAL(&stats_lock);
+  return done;
+}
+
+void Uploader::journalQueued(TickType_t wait)
+{
+  ScanEvent event;
+  while (xQueueReceive(queue, &event, wait) == pdTRUE)
+  {
+    if (journal.backlog() == 0)
+      window_start_ms = millis();
+    journal.append(event);
+    portENTER_CRITICAL(&stats_lock);
+    unjournaled--;
+    portEXIT_CRITICAL(&stats_lock);
+    wait = 0;
+  }
+}
+
+UploaderStats Uploader::stats()
+{
+  portENTER_CRITICAL(&stats_lock);
+  UploaderStats copy = counters;
+  portEXIT_CRITICAL(&stats_lock);
+
+  copy.queue_depth = queue != nullptr ? uxQueueMessagesWaiting(queue) : 0;
+  return copy;
+}
+
+void Uploader::printStats()
+{
+  UploaderStats s = stats();
+  Serial.printf("Uploader: queued %u, dropped %u, sent %u (%u back-dated, %u without a time), failed %u, discarded %u, depth %u (max %u/%u), latency last %u ms, avg %u ms, max %u ms\n",
+                s.enqueued, s.dropped, s.sent, s.backdated, s.undated, s.failed, s.discarded, s.queue_depth,
+                s.max_queue_depth, UPLOAD_QUEUE_LENGTH, s.last_latency_ms, s.sent ? (uint32_t)(s.total_latency_ms / s.sent) : 0,
+                s.max_latency_ms);
+
+  JournalStats j = journal.stats();
+  Serial.printf("Journal: backlog %u (%u in RAM), segments %u, flushes %u (%u records), overflowed %u, corrupt %u\n",
+                j.backlog, j.unflushed, j.segments, j.flushes, j.flushed, j.overflowed, j.corrupt);
+
+  httpSession.printStats();
+  configStore.printStats();
+  if (UPLOAD_TRANSPORT == UPLOAD_TRANSPORT_MQTT)
+    pushChannel.printStats();
+  wifiConnection.printStats();
+  readers.printStats();
+  allowList.printStats();
+  stayLimits.printStats();
+  scanClock.printStats();
+  powerManager.printStats();
+  tracer.printStats();
+}
+
+void Uploader::taskEntry(void *arg)
+{
+  static_cast<Uploader *>(arg)->run();
+}
+
+void Uploader::run()
+{
+  uint32_t last_report_ms = millis();
+
+  for (;;)
+  {
+    bool online = WiFi.status() == WL_CONNECTED;
+    if (online && !was_online)
+      online_since_ms = millis();
+    was_online = online;
+    if (backing_off && (int32_t)(millis() - retry_at_ms) >= 0)
+      backing_off = false;
+
+    // Do not sleep longer than the batch window while there is a backlog that can be sent,
+    // and look for the clock every so often while holding events for it.
+    TickType_t wait = pdMS_TO_TICKS(1000);
+    if (online && !backing_off && journal.backlog() > 0)
+      wait = pdMS_TO_TICKS(waitingForClock() ? 100 : batchWindowRemaining());
+#if UPLOAD_TRANSPORT == UPLOAD_TRANSPORT_MQTT
+    // Acknowledgements and commands arrive on the broker connection at any time.
+    if (online)
+      wait = pdMS_TO_TICKS(waitingForClock() ? 100 : MQTT_POLL_MS);
+#endif
+
+    journalQueued(wait);
+
+#if UPLOAD_TRANSPORT == UPLOAD_TRANSPORT_MQTT
+    if (online)
+      pushChannel.maintain();
+#endif
+
+    if (online && !backing_off && journal.backlog() > 0)
+    {
+      if (batchWindowRemaining() == 0 && !waitingForClock())
+        drain();
+    }
+    else if (online)
+    {
+      // Nothing to send: keep the receiver token fresh so the next scan does not wait for it,
+      // and pick up allow list and configuration changes.
+      tokenManager.maintain();
+      allowList.maintain(device_UID);
+      configStore.maintain(device_UID);
+    }
+
+    journal.maintain();
+    fieldTrace.maintain();
+
+    // On-demand dumps from the serial console: 't' prints the trace buffer, 's' the statistics,
+    // 'f' the field trace (FIELD_TRACE builds).
+    while (Serial.available() > 0)
+    {
+      int command = Serial.read();
+      if (command == 't')
+        tracer.printTrace();
+      else if (command == 's')
+        printStats();
+      else if (command == 'f')
+        fieldTrace.dump();
+    }
+
+    if (UPLOADER_STATS_INTERVAL_MS > 0 && millis() - last_report_ms >= UPLOADER_STATS_INTERVAL_MS)
+    {
+      last_report_ms = millis();
+      printStats();
+    }
+  }
+}
+
+uint32_t Uploader::batchWindowRemaining()
+{
+  if (journal.backlog() >= BATCH_MAX_EVENTS)
+    return 0;
+
+  uint32_t window_ms = BATCH_MAX_WAIT_MS;
+  uint32_t waited = millis() - window_start_ms;
+  return waited >= window_ms ? 0 : window_ms - waited;
+}
+
+/**
+ * True while events captured before the clock was synced should wait for the first sync.
+ */
+bool Uploader::waitingForClock()
+{
+  return !scanClock.isSynced() && millis() - online_since_ms < UPLOAD_CLOCK_WAIT_MS;
+}
+
+void Uploader::drain()
+{
+  if (UPLOAD_TRANSPORT == UPLOAD_TRANSPORT_MQTT)
+  {
+    drainPushed();
+    return;
+  }
+
+  JournalRecord records[BATCH_MAX_EVENTS];
+  size_t count = journal.peek(records, BATCH_MAX_EVENTS);
+  backdate(records, count);
+
+  size_t done = batch_supported ? drainBatch(records, count) : drainSingly(records, count);
+  journal.consume(done);
+}
+
+/**
+ * MQTT: consumes what the broker acknowledged and tops the in-flight window up from the
+ * journal. Never waits for an acknowledgement.
+ */
+void Uploader::drainPushed()
+{
+  // Nothing to consume and the window is full: leave the journal alone until an ack comes.
+  if (pushChannel.acknowledged() == 0 && pushChannel.inFlight() >= min(journal.backlog(), (size_t)MQTT_MAX_INFLIGHT))
+    return;
+
+  JournalRecord records[MQTT_MAX_INFLIGHT];
+  size_t count = journal.peek(records, MQTT_MAX_INFLIGHT);
+  backdate(records, count);
+
+  size_t done = min(pushChannel.acknowledged(), count);
+  for (size_t i = 0; i < done; i++)
+    countDelivered(records[i]);
+  journal.consume(done);
+  pushChannel.consumed(done);
+
+  pushChannel.publish(records + done, count - done);
+}
+
+/**
+ * Gives events captured in this boot before the clock was synced their time, from the
+ * monotonic capture time. Only the copies about to be sent change; the journal keeps 0.
+ */
+void Uploader::backdate(JournalRecord *records, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    ScanEvent &event = records[i].event;
+    if (event.epoch == 0 && records[i].seq >= journal.bootSeq())
+      event.epoch = scanClock.epochAt(event.captured_us);
+  }
+}
+
+size_t Uploader::drainBatch(const JournalRecord *records, size_t count)
+{
+  BatchAck acks[BATCH_MAX_EVENTS];
+
+  // No token (the token request failed): send nothing, the events stay in the journal.
+  const char *token = tokenManager.get();
+  if (token == nullptr)
+  {
+    countFailed(count);
+    backOff();
+    return 0;
+  }
+  int send_code = SendBatch(device_UID, token, records, count, acks, compact);
+
+  // The server refused the cached token: get a new one and retry once.
+  if (isTokenRejected(send_code))
+  {
+    tracer.count(COUNT_RETRIES);
+    tokenManager.invalidate();
+    token = tokenManager.get();
+    if (token != nullptr)
+      send_code = SendBatch(device_UID, token, records, count, acks, compact);
+  }
+
+  if (token != nullptr && compactRefused(send_code))
+    send_code = SendBatch(device_UID, token, records, count, acks, false);
+
+  if (send_code == 404)
+  {
+    LOG_WARN("Uploader: no batch endpoint on the server, sending events one by one");
+    batch_supported = false;
+    return drainSingly(records, count);
+  }
+
+  if (send_code >= 400 && send_code < 500 && !isTokenRejected(send_code))
+  {
+    // The whole batch was refused: send the events one by one to find the invalid one.
+    return drainSingly(records, count);
+  }
+
+  if (send_code < 200 || send_code >= 300)
+  {
+    countFailed(count);
+    backOff();
+    return 0;
+  }
+
+  // The journal is consumed in order, so stop at the first event without a verdict;
+  // anything after it is sent again and deduplicated by the server using "seq".
+  size_t done = 0;
+  while (done < count && acks[done] != BATCH_ACK_NONE)
+  {
+    if (acks[done] == BATCH_ACK_OK)
+      countDelivered(records[done]);
+    else
+      countDiscarded();
+    done++;
+  }
+
+  if (done < count)
+  {
+    countFailed(count - done);
+    backOff();
+  }
+
+  return done;
+}
+
+size_t Uploader::drainSingly(const JournalRecord *records, size_t count)
+{
+  size_t done = 0;
+  while (done < count)
+  {
+    int send_code = upload(records[done].event);
+    if (send_code >= 200 && send_code < 300)
+    {
+      countDelivered(records[done]);
+      done++;
+    }
+    else if (send_code >= 400 && send_code < 500 && !isTokenRejected(send_code))
+    {
+      // Retrying a request the server considers invalid would block the journal forever.
+      countDiscarded();
+      done++;
+    }
+    else
+    {
+      // Network or server error: keep the event and try again later, in order.
+      countFailed(1);
+      backOff();
+      break;
+    }
+  }
+
+  return done;
+}
+
+int Uploader::upload(const ScanEvent &event)
+{
+  // No token: send nothing; drainSingly() keeps the event and backs off.
+  const char *token = tokenManager.get();
+  if (token == nullptr)
+    return -1;
+  int send_code = SendData(device_UID, token, event, compact);
+
+  // The server refused the cached token: get a new one and retry once.
+  if (isTokenRejected(send_code))
+  {
+    tracer.count(COUNT_RETRIES);
+    tokenManager.invalidate();
+    token = tokenManager.get();
+    if (token != nullptr)
+      send_code = SendData(device_UID, token, event, compact);
+  }
+
+  if (token != nullptr && compactRefused(send_code))
+    send_code = SendData(device_UID, token, event, false);
+
+  return send_code;
+}
+
+/**
+ * Content negotiation for the compact encodings: a 415, or any other refusal before the
+ * server has accepted one, means it only takes JSON. Without the check an event the server
+ * cannot read would be discarded as invalid. Returns true if the request must go again as JSON.
+ */
+bool Uploader::compactRefused(int send_code)
+{
+  if (!compact)
+    return false;
+  if (send_code >= 200 && send_code < 300)
+  {
+    compact_confirmed = true;
+    return false;
+  }
+
+  bool refused = send_code == 415 ||
+                 (!compact_confirmed && send_code >= 400 && send_code < 500 && send_code != 404 && !isTokenRejected(send_code));
+  if (refused)
+  {
+    LOG_WARN("Uploader: server refused the compact encoding (HTTP %d), sending JSON", send_code);
+    compact = false;
+  }
+  return refused;
+}
+
+void Uploader::backOff()
+{
+  backing_off = true;
+  retry_at_ms = millis() + UPLOAD_RETRY_MS;
+  tracer.count(COUNT_RETRIES);
+}
+
+void Uploader::countDelivered(const JournalRecord &record)
+{
+  // Events replayed after a reboot carry a capture time from the previous boot.
+  bool this_boot = record.seq >= journal.bootSeq();
+  uint32_t latency_ms = (uint32_t)((esp_timer_get_time() - record.event.captured_us) / 1000);
+  if (this_boot)
+    tracer.sample(SPAN_SCAN_TO_ACK, latency_ms * 1000);
+
+  portENTER_CRITICAL(&stats_lock);
+  counters.sent++;
+  if (record.event.epoch == 0)
+    counters.undated++;
+  else if (this_boot && (!scanClock.isSynced() || record.event.captured_us < scanClock.firstSyncUs()))
+    counters.backdated++;
+  if (this_boot)
+  {
+    counters.last_latency_ms = latency_ms;
+    counters.total_latency_ms += latency_ms;
+    if (latency_ms > counters.max_latency_ms)
+      counters.max_latency_ms = latency_ms;
+  }
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void Uploader::countDiscarded()
+{
+  portENTER_CRITICAL(&stats_lock);
+  counters.discarded++;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void Uploader::countFailed(uint32_t events)
+{
+  portENTER_CRITICAL(&stats_lock);
+  counters.failed += events;
+  portEXIT_CRITICAL(&stats_lock);
+}
@@ -0,0 +1,215 @@
+#include "wifi_connection.h"
+
+#include <Preferences.h>
+
+#include "log.h"
+
+WiFiConnection wifiConnection;
+
+void WiFiConnection::begin(const WiFiNetwork *networks, size_t count)
+{
+  this->networks = networks;
+  network_count = count;
+
+  // The state machine decides when to reconnect, and the config does not need to hit flash.
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false);
+  WiFi.mode(WIFI_STA);
+
+  WiFi.onEvent(onStationConnected, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_CONNECTED);
+  WiFi.onEvent(onGotIP, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  WiFi.onEvent(onStationDisconnected, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+
+  loadCache();
+  if (cache_valid && cache_network < network_count)
+    network_index = cache_network;
+
+  if (network_count > 0)
+    startAttempt();
+}
+
+void WiFiConnection::update()
+{
+  if (event_got_ip)
+  {
+    event_got_ip = false;
+    event_disconnected = false;
+    if (state == CONNECTING)
+      connectionUp();
+  }
+
+  if (event_disconnected)
+  {
+    event_disconnected = false;
+    if (state == CONNECTED)
+    {
+      LOG_WARN("WiFi lost connection. Reason: %u", (unsigned)disconnect_reason);
+      counters.disconnects++;
+      in_outage = true;
+      outage_started_ms = millis();
+      // Try the same access point right away, the backoff starts if that fails.
+      state = WAITING;
+      retry_at_ms = millis();
+    }
+    else if (state == CONNECTING)
+    {
+      failAttempt();
+    }
+  }
+
+  switch (state)
+  {
+  case CONNECTING:
+    if (millis() - attempt_started_ms >= WIFI_CONNECT_TIMEOUT_MS)
+      failAttempt();
+    break;
+
+  case WAITING:
+    if ((int32_t)(millis() - retry_at_ms) >= 0)
+      startAttempt();
+    break;
+
+  default:
+    break;
+  }
+}
+
+uint32_t WiFiConnection::retryIn() const
+{
+  if (state == IDLE)
+    return UINT32_MAX;
+  if (state != WAITING)
+    return 0;
+  int32_t left = (int32_t)(retry_at_ms - millis());
+  return left > 0 ? left : 0;
+}
+
+void WiFiConnection::printStats()
+{
+  WiFiConnectionStats s = stats();
+  Serial.printf("WiFi: %s, %u attempts (%u fast), %u disconnects, %u reconnects, reconnect last %u ms, avg %u ms, max %u ms\n",
+                connected() ? "connected" : "down", s.attempts, s.fast_attempts, s.disconnects, s.reconnects,
+                s.last_reconnect_ms, s.reconnects ? (uint32_t)(s.total_reconnect_ms / s.reconnects) : 0, s.max_reconnect_ms);
+}
+
+void WiFiConnection::onStationConnected(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+  LOG_INFO("Connected to AP successfully!");
+}
+
+void WiFiConnection::onGotIP(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+  wifiConnection.event_got_ip = true;
+}
+
+void WiFiConnection::onStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+  wifiConnection.disconnect_reason = info.wifi_sta_disconnected.reason;
+  wifiConnection.event_disconnected = true;
+}
+
+void WiFiConnection::startAttempt()
+{
+  const WiFiNetwork &network = networks[network_index];
+  attempt_fast = !skip_cache && cache_valid && cache_network == network_index;
+  skip_cache = false;
+
+  event_got_ip = false;
+  event_disconnected = false;
+
+  LOG_INFO("Connecting to %s%s", network.ssid, attempt_fast ? " (cached AP)" : "");
+  if (attempt_fast)
+    WiFi.begin(network.ssid, network.password, cache_channel, cache_bssid);
+  else
+    WiFi.begin(network.ssid, network.password);
+
+  counters.attempts++;
+  if (attempt_fast)
+    counters.fast_attempts++;
+
+  state = CONNECTING;
+  attempt_started_ms = millis();
+}
+
+void WiFiConnection::failAttempt()
+{
+  WiFi.disconnect();
+  state = WAITING;
+
+  if (attempt_fast)
+  {
+    // The access point may have moved channel: scan for the same network next.
+    skip_cache = true;
+    retry_at_ms = millis() + WIFI_BACKOFF_MIN_MS;
+    return;
+  }
+
+  network_index = (network_index + 1) % network_count;
+  retry_at_ms = millis() + backoff_ms;
+
+  // Every network failed once: wait longer before the next round.
+  if (network_index == 0 || network_count == 1)
+    backoff_ms = min((uint32_t)WIFI_BACKOFF_MAX_MS, backoff_ms * 2);
+}
+
+void WiFiConnection::connectionUp()
+{
+  state = CONNECTED;
+  backoff_ms = WIFI_BACKOFF_MIN_MS;
+
+  IPAddress ip = WiFi.localIP();
+  LOG_INFO("WiFi connected, IP address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+
+  if (in_outage)
+  {
+    uint32_t reconnect_ms = millis() - outage_started_ms;
+    in_outage = false;
+    counters.reconnects++;
+    counters.last_reconnect_ms = reconnect_ms;
+    counters.total_reconnect_ms += reconnect_ms;
+    if (reconnect_ms > counters.max_reconnect_ms)
+      counters.max_reconnect_ms = reconnect_ms;
+    LOG_INFO("Reconnected in %u ms", reconnect_ms);
+  }
+
+  saveCache();
+}
+
+void WiFiConnection::loadCache()
+{
+  Preferences prefs;
+  if (!prefs.begin("wifi", true))
+    return;
+
+  cache_valid = prefs.getBytes("bssid", cache_bssid, sizeof(cache_bssid)) == sizeof(cache_bssid);
+  cache_channel = prefs.getInt("channel", 0);
+  cache_network = prefs.getUChar("network", 0);
+  prefs.end();
+
+  cache_valid = cache_valid && cache_channel > 0;
+}
+
+void WiFiConnection::saveCache()
+{
+  const uint8_t *bssid = WiFi.BSSID();
+  int32_t channel = WiFi.channel();
+  if (bssid == nullptr || channel <= 0)
+    return;
+
+  // Only write NVS when the access point changed.
+  if (cache_valid && cache_network == network_index && cache_channel == channel && memcmp(cache_bssid, bssid, sizeof(cache_bssid)) == 0)
+    return;
+
+  memcpy(cache_bssid, bssid, sizeof(cache_bssid));
+  cache_channel = channel;
+  cache_network = network_index;
+  cache_valid = true;
+
+  Preferences prefs;
+  if (!prefs.begin("wifi", false))
+    return;
+  prefs.putBytes("bssid", cache_bssid, sizeof(cache_bssid));
+  prefs.putInt("channel", cache_channel);
+  prefs.putUChar("network", cache_network);
+  prefs.end();
+}
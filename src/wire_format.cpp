@@ -0,0 +1,190 @@
+#include "wire_format.h"
+
+#include <string.h>
+
+#include "event_batch.h"
+
+static_assert(BATCH_MAX_EVENTS <= 255, "the binary batch counts its events in one byte");
+
+void MsgPackWriter::raw(uint8_t byte)
+{
+  if (pos < size)
+    out[pos++] = byte;
+  else
+    overflow = true;
+}
+
+void MsgPackWriter::raw(const void *data, size_t length)
+{
+  if (length > size - pos)
+  {
+    overflow = true;
+    pos = size;
+    return;
+  }
+  memcpy(out + pos, data, length);
+  pos += length;
+}
+
+void MsgPackWriter::bigEndian(uint32_t value, uint8_t bytes)
+{
+  while (bytes > 0)
+    raw((uint8_t)(value >> (8 * --bytes)));
+}
+
+void MsgPackWriter::string(const char *text)
+{
+  size_t length = strlen(text);
+  if (length < 32)
+  {
+    raw(0xA0 | length);
+  }
+  else if (length < 256)
+  {
+    raw(0xD9);
+    raw(length);
+  }
+  else
+  {
+    raw(0xDA);
+    bigEndian(length, 2);
+  }
+  raw(text, length);
+}
+
+void MsgPackWriter::integer(uint32_t value)
+{
+  if (value < 128)
+  {
+    raw(value);
+  }
+  else if (value < 256)
+  {
+    raw(0xCC);
+    raw(value);
+  }
+  else if (value < 65536)
+  {
+    raw(0xCD);
+    bigEndian(value, 2);
+  }
+  else
+  {
+    raw(0xCE);
+    bigEndian(value, 4);
+  }
+}
+
+void MsgPackWriter::beginMap(uint16_t members)
+{
+  if (members < 16)
+  {
+    raw(0x80 | members);
+  }
+  else
+  {
+    raw(0xDE);
+    bigEndian(members, 2);
+  }
+}
+
+void MsgPackWriter::field(const char *key, const char *value)
+{
+  string(key);
+  if (value)
+    string(value);
+  else
+    raw(0xC0);
+}
+
+void MsgPackWriter::field(const char *key, uint32_t value)
+{
+  string(key);
+  integer(value);
+}
+
+void MsgPackWriter::nil(const char *key)
+{
+  string(key);
+  raw(0xC0);
+}
+
+size_t MsgPackWriter::finish()
+{
+  return overflow ? 0 : pos;
+}
+
+size_t packSendData(uint8_t *out, size_t size, const ReceiverCredentials &credentials, const ScanEvent &event)
+{
+  char tag[32];
+  formatTag(tag, sizeof(tag), event.uid, event.uid_size);
+
+  MsgPackWriter pack(out, size);
+  pack.beginMap(READER_COUNT > 1 ? 8 : 7);
+  pack.field("client_key", credentials.client_key);
+  pack.field("client_secret", credentials.client_secret);
+  pack.field("receiver_serial_no", credentials.device_UID);
+  pack.field("receiver_token", credentials.token);
+  pack.field("tag_serial_no", tag);
+  if (event.epoch != 0)
+    pack.field("scan_time", event.epoch);
+  else
+    pack.nil("scan_time");
+  pack.field("scan_type", scanTypeName(event.type));
+  if (READER_COUNT > 1)
+    pack.field("reader", (uint32_t)event.reader);
+  return pack.finish();
+}
+
+/**
+ * Appends a u8 length-prefixed string; false if it does not fit or is longer than 255.
+ */
+static bool putString(uint8_t *out, size_t out_size, size_t &pos, const char *text)
+{
+  size_t length = text ? strlen(text) : 0;
+  if (length > 255 || 1 + length > out_size - pos)
+    return false;
+  out[pos++] = length;
+  memcpy(out + pos, text, length);
+  pos += length;
+  return true;
+}
+
+static void putLittleEndian(uint8_t *out, uint32_t value)
+{
+  out[0] = value;
+  out[1] = value >> 8;
+  out[2] = value >> 16;
+  out[3] = value >> 24;
+}
+
+size_t packEventBatch(const ReceiverCredentials &credentials, const JournalRecord *records, size_t count, uint8_t *out, size_t out_size)
+{
+  if (count > 255 || out_size < WIRE_BATCH_HEADER_SIZE)
+    return 0;
+
+  memcpy(out, WIRE_BATCH_MAGIC, 4);
+  out[4] = count;
+  size_t pos = WIRE_BATCH_HEADER_SIZE;
+  if (!putString(out, out_size, pos, credentials.client_key) || !putString(out, out_size, pos, credentials.client_secret) ||
+      !putString(out, out_size, pos, credentials.device_UID) || !putString(out, out_size, pos, credentials.token))
+    return 0;
+
+  if (count * WIRE_BATCH_EVENT_SIZE > out_size - pos)
+    return 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    const ScanEvent &event = records[i].event;
+    uint8_t *at = out + pos;
+    putLittleEndian(at, records[i].seq);
+    putLittleEndian(at + 4, event.epoch);
+    at[8] = event.type;
+    at[9] = event.reader;
+    at[10] = event.uid_size;
+    at[11] = 0;
+    memset(at + 12, 0, sizeof(event.uid));
+    memcpy(at + 12, event.uid, event.uid_size <= sizeof(event.uid) ? event.uid_size : sizeof(event.uid));
+    pos += WIRE_BATCH_EVENT_SIZE;
+  }
+  return pos;
+}
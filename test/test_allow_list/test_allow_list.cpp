@@ -0,0 +1,206 @@
+/*
+ * Allow list lookups behind the bloom filter (and without it when the heap runs out), full and
+ * delta updates from the server (an empty list too) and reloading the saved list, against the
+ * host LittleFS.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+
+#include <string>
+
+#include "allow_list.h"
+#include "host.h"
+#include "json_scanner.h"
+
+static const uint8_t TAG_A[] = {0x04, 0xA1, 0xB2, 0xC3};
+static const uint8_t TAG_B[] = {0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+static const uint8_t TAG_C[] = {0xDE, 0xAD, 0xBE, 0xEF};
+
+static bool apply(AllowList &list, const char *body)
+{
+  AllowListUpdate update;
+  char value[32];
+  JsonScanner scanner(update, value, sizeof(value));
+  scanner.feed(body, strlen(body));
+  return scanner.complete() && list.apply(update);
+}
+
+void setUp()
+{
+  char fs_root[] = "/tmp/test_allow_list.XXXXXX";
+  TEST_ASSERT_NOT_NULL(mkdtemp(fs_root));
+  hostSetFsRoot(fs_root);
+}
+
+void tearDown() {}
+
+void test_parse_hex_tag()
+{
+  AllowTag tag;
+  TEST_ASSERT_TRUE(parseHexTag("04a1B2c3", 8, tag));
+  TEST_ASSERT_EQUAL(4, tag.size);
+  TEST_ASSERT_EQUAL_MEMORY(TAG_A, tag.uid, sizeof(TAG_A));
+  TEST_ASSERT_EQUAL(0, tag.uid[4]);
+
+  TEST_ASSERT_FALSE(parseHexTag("04A", 3, tag));
+  TEST_ASSERT_FALSE(parseHexTag("", 0, tag));
+  TEST_ASSERT_FALSE(parseHexTag("04G1", 4, tag));
+  TEST_ASSERT_FALSE(parseHexTag("0102030405060708090A0B", 22, tag));
+}
+
+void test_compare_tags()
+{
+  AllowTag a, b;
+  parseHexTag("FFFFFFFF", 8, a);
+  parseHexTag("00000000000000", 14, b);
+  // Shorter UIDs sort first, whatever their bytes.
+  TEST_ASSERT_TRUE(compareTags(&a, &b) < 0);
+
+  // The removal flag is ignored.
+  b = a;
+  b.size |= ALLOW_TAG_REMOVE;
+  TEST_ASSERT_EQUAL(0, compareTags(&a, &b));
+}
+
+void test_everything_allowed_before_the_first_list()
+{
+  AllowList list;
+  TEST_ASSERT_TRUE(list.allowed(TAG_C, sizeof(TAG_C)));
+  TEST_ASSERT_EQUAL(0, list.version());
+}
+
+void test_full_list_lookup()
+{
+  AllowList list;
+  TEST_ASSERT_TRUE(apply(list, "{\"version\": 3, \"full\": true, \"changes\": [\"+04110022334455\", \"+04A1B2C3\", "
+                               "\"+04A1B2C3\", \"+04112233445566\"]}"));
+  TEST_ASSERT_EQUAL(3, list.version());
+  TEST_ASSERT_EQUAL(3, list.stats().tags); // the duplicate is dropped
+
+  TEST_ASSERT_TRUE(list.allowed(TAG_A, sizeof(TAG_A)));
+  TEST_ASSERT_TRUE(list.allowed(TAG_B, sizeof(TAG_B)));
+  TEST_ASSERT_FALSE(list.allowed(TAG_C, sizeof(TAG_C)));
+  // Same bytes, other length.
+  TEST_ASSERT_FALSE(list.allowed(TAG_B, 4));
+
+  AllowListStats s = list.stats();
+  TEST_ASSERT_EQUAL(4, s.lookups);
+  TEST_ASSERT_EQUAL(2, s.hits);
+  TEST_ASSERT_EQUAL(2, s.bloom_rejects + s.bloom_false_hits);
+}
+
+void test_delta_update()
+{
+  AllowList list;
+  TEST_ASSERT_TRUE(apply(list, "{\"version\": 1, \"full\": true, \"changes\": [\"+04A1B2C3\", \"+04112233445566\"]}"));
+  TEST_ASSERT_TRUE(apply(list, "{\"version\": 2, \"full\": false, \"changes\": [\"-04A1B2C3\", \"+DEADBEEF\"]}"));
+
+  TEST_ASSERT_EQUAL(2, list.version());
+  TEST_ASSERT_FALSE(list.allowed(TAG_A, sizeof(TAG_A)));
+  TEST_ASSERT_TRUE(list.allowed(TAG_B, sizeof(TAG_B)));
+  TEST_ASSERT_TRUE(list.allowed(TAG_C, sizeof(TAG_C)));
+}
+
+void test_bad_update_keeps_the_list()
+{
+  AllowList list;
+  TEST_ASSERT_TRUE(apply(list, "{\"version\": 1, \"full\": true, \"changes\": [\"+04A1B2C3\"]}"));
+  TEST_ASSERT_FALSE(apply(list, "{\"version\": 2, \"full\": true, \"changes\": [\"+04A1B2C\"]}"));
+  TEST_ASSERT_FALSE(apply(list, "{\"full\": true, \"changes\": []}"));
+
+  TEST_ASSERT_EQUAL(1, list.version());
+  TEST_ASSERT_TRUE(list.allowed(TAG_A, sizeof(TAG_A)));
+  TEST_ASSERT_EQUAL(2, list.stats().sync_failures);
+}
+
+void test_empty_full_list()
+{
+  // The server took every tag away: nothing gets in, not even after a delta that removes more.
+  AllowList list;
+  TEST_ASSERT_TRUE(apply(list, "{\"version\": 1, \"full\": true, \"changes\": [\"+04A1B2C3\"]}"));
+  TEST_ASSERT_TRUE(apply(list, "{\"version\": 2, \"full\": true, \"changes\": []}"));
+  TEST_ASSERT_EQUAL(2, list.version());
+  TEST_ASSERT_FALSE(list.allowed(TAG_A, sizeof(TAG_A)));
+
+  TEST_ASSERT_TRUE(apply(list, "{\"version\": 3, \"full\": false, \"changes\": [\"-DEADBEEF\"]}"));
+  TEST_ASSERT_FALSE(list.allowed(TAG_C, sizeof(TAG_C)));
+  TEST_ASSERT_EQUAL(0, list.stats().tags);
+  TEST_ASSERT_EQUAL(3, list.stats().syncs);
+}
+
+void test_many_tags()
+{
+  // Every listed tag is found and no unlisted one gets through, with the bloom filter in front.
+  std::string body = "{\"version\": 9, \"full\": true, \"changes\": [";
+  char hex[16];
+  for (uint32_t i = 0; i < 1000; i++)
+  {
+    snprintf(hex, sizeof(hex), "%s\"+%08X\"", i ? ", " : "", i * 2);
+    body += hex;
+  }
+  body += "]}";
+
+  AllowList list;
+  TEST_ASSERT_TRUE(apply(list, body.c_str()));
+  for (uint32_t i = 0; i < 2000; i++)
+  {
+    uint8_t uid[4] = {(uint8_t)(i >> 24), (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i};
+    TEST_ASSERT_EQUAL(i % 2 == 0, list.allowed(uid, sizeof(uid)));
+  }
+  AllowListStats s = list.stats();
+  TEST_ASSERT_TRUE(s.bloom_rejects > s.bloom_false_hits);
+}
+
+void test_lookup_without_bloom_filter()
+{
+  // Out of heap for the filter: every lookup goes to the binary search instead.
+  AllowListUpdate update;
+  char value[32];
+  JsonScanner scanner(update, value, sizeof(value));
+  const char *body = "{\"version\": 4, \"full\": true, \"changes\": [\"+04A1B2C3\", \"+04112233445566\"]}";
+  scanner.feed(body, strlen(body));
+
+  AllowList list;
+  hostFailCalloc(1);
+  bool applied = list.apply(update);
+  hostFailCalloc(0);
+  TEST_ASSERT_TRUE(applied);
+  TEST_ASSERT_EQUAL(2 * sizeof(AllowTag), list.stats().memory_bytes);
+
+  TEST_ASSERT_TRUE(list.allowed(TAG_A, sizeof(TAG_A)));
+  TEST_ASSERT_TRUE(list.allowed(TAG_B, sizeof(TAG_B)));
+  TEST_ASSERT_FALSE(list.allowed(TAG_C, sizeof(TAG_C)));
+  TEST_ASSERT_EQUAL(0, list.stats().bloom_rejects);
+}
+
+void test_reload_saved_list()
+{
+  {
+    AllowList list;
+    TEST_ASSERT_TRUE(apply(list, "{\"version\": 5, \"full\": true, \"changes\": [\"+04A1B2C3\"]}"));
+  }
+
+  AllowList reloaded;
+  reloaded.begin();
+  TEST_ASSERT_EQUAL(5, reloaded.version());
+  TEST_ASSERT_TRUE(reloaded.allowed(TAG_A, sizeof(TAG_A)));
+  TEST_ASSERT_FALSE(reloaded.allowed(TAG_C, sizeof(TAG_C)));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_hex_tag);
+  RUN_TEST(test_compare_tags);
+  RUN_TEST(test_everything_allowed_before_the_first_list);
+  RUN_TEST(test_full_list_lookup);
+  RUN_TEST(test_delta_update);
+  RUN_TEST(test_bad_update_keeps_the_list);
+  RUN_TEST(test_empty_full_list);
+  RUN_TEST(test_many_tags);
+  RUN_TEST(test_lookup_without_bloom_filter);
+  RUN_TEST(test_reload_saved_list);
+  return UNITY_END();
+}
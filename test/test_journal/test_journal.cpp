@@ -0,0 +1,228 @@
+/*
+ * ScanJournal compaction against the host LittleFS: replayed segments are deleted, the
+ * cursor and sequence survive a reboot (also when every record was delivered from RAM), the
+ * oldest segments go when the journal is full and a corrupt record is skipped.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include <string>
+
+#include "host.h"
+#include "scan_journal.h"
+
+static char fs_root[64];
+
+static ScanEvent makeEvent(uint32_t n)
+{
+  ScanEvent event = {};
+  event.captured_us = n;
+  event.uid_size = 4;
+  memcpy(event.uid, &n, sizeof(n));
+  event.type = SCAN_ENTRY;
+  return event;
+}
+
+static void appendEvents(ScanJournal &journal, uint32_t from, uint32_t count)
+{
+  for (uint32_t n = from; n < from + count; n++)
+    journal.append(makeEvent(n));
+  journal.flush();
+}
+
+/**
+ * Takes count records off the front, checking they hold the events numbered from on.
+ */
+static void consumeEvents(ScanJournal &journal, uint32_t from, uint32_t count)
+{
+  JournalRecord records[16];
+  while (count > 0)
+  {
+    size_t got = journal.peek(records, count < 16 ? count : 16);
+    TEST_ASSERT_TRUE(got > 0);
+    for (size_t i = 0; i < got; i++)
+      TEST_ASSERT_EQUAL(from + i, records[i].event.captured_us);
+    journal.consume(got);
+    from += got;
+    count -= got;
+  }
+}
+
+static uint32_t segmentFiles()
+{
+  uint32_t files = 0;
+  char path[128];
+  for (uint32_t segment = 0; segment < 1000; segment++)
+  {
+    snprintf(path, sizeof(path), "%s/journal/%08lu.log", fs_root, (unsigned long)segment);
+    FILE *file = fopen(path, "rb");
+    if (file)
+    {
+      files++;
+      fclose(file);
+    }
+  }
+  return files;
+}
+
+void setUp()
+{
+  strcpy(fs_root, "/tmp/test_journal.XXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(fs_root));
+  hostSetFsRoot(fs_root);
+}
+
+void tearDown() {}
+
+void test_records_in_order_with_sequence()
+{
+  ScanJournal journal;
+  TEST_ASSERT_TRUE(journal.begin());
+  appendEvents(journal, 0, 10);
+  journal.append(makeEvent(10)); // still in RAM
+
+  JournalRecord records[16];
+  TEST_ASSERT_EQUAL(11, journal.peek(records, 16));
+  for (uint32_t i = 0; i < 11; i++)
+  {
+    TEST_ASSERT_EQUAL(i, records[i].seq);
+    TEST_ASSERT_EQUAL(i, records[i].event.captured_us);
+  }
+  TEST_ASSERT_EQUAL(1, journal.stats().unflushed);
+}
+
+void test_replayed_segments_are_deleted()
+{
+  ScanJournal journal;
+  journal.begin();
+  appendEvents(journal, 0, 3 * JOURNAL_SEGMENT_RECORDS + 5);
+  TEST_ASSERT_EQUAL(4, segmentFiles());
+
+  consumeEvents(journal, 0, 2 * JOURNAL_SEGMENT_RECORDS + 1);
+  TEST_ASSERT_EQUAL(2, segmentFiles());
+  TEST_ASSERT_EQUAL(JOURNAL_SEGMENT_RECORDS + 4, journal.backlog());
+
+  // The newest segment stays for appends until it is full.
+  consumeEvents(journal, 2 * JOURNAL_SEGMENT_RECORDS + 1, JOURNAL_SEGMENT_RECORDS + 4);
+  TEST_ASSERT_EQUAL(0, journal.backlog());
+  TEST_ASSERT_EQUAL(1, segmentFiles());
+  appendEvents(journal, 1000, JOURNAL_SEGMENT_RECORDS - 5);
+  consumeEvents(journal, 1000, JOURNAL_SEGMENT_RECORDS - 5);
+  TEST_ASSERT_EQUAL(1, segmentFiles());
+
+  // Once it is full and replayed, the next write starts a fresh segment and drops it.
+  appendEvents(journal, 2000, 1);
+  TEST_ASSERT_EQUAL(1, segmentFiles());
+  TEST_ASSERT_EQUAL(1, journal.stats().segments);
+}
+
+void test_backlog_survives_a_reboot()
+{
+  {
+    ScanJournal journal;
+    journal.begin();
+    appendEvents(journal, 0, JOURNAL_SEGMENT_RECORDS + 20);
+    consumeEvents(journal, 0, 30);
+  }
+
+  ScanJournal journal;
+  TEST_ASSERT_TRUE(journal.begin());
+  TEST_ASSERT_EQUAL(JOURNAL_SEGMENT_RECORDS - 10, journal.backlog());
+  TEST_ASSERT_TRUE(journal.bootSeq() >= JOURNAL_SEGMENT_RECORDS + 20);
+  consumeEvents(journal, 30, JOURNAL_SEGMENT_RECORDS - 10);
+
+  // Numbering carries on after the last boot.
+  journal.append(makeEvent(7));
+  JournalRecord record;
+  TEST_ASSERT_EQUAL(1, journal.peek(&record, 1));
+  TEST_ASSERT_EQUAL(journal.bootSeq(), record.seq);
+}
+
+void test_sequence_survives_delivery_from_ram()
+{
+  // Delivered before a flush, as when the uploader keeps up: nothing but the cursor on flash.
+  uint32_t last_seq;
+  {
+    ScanJournal journal;
+    journal.begin();
+    for (uint32_t n = 0; n < JOURNAL_SEQ_BLOCK + 5; n++)
+    {
+      journal.append(makeEvent(n));
+      JournalRecord record;
+      TEST_ASSERT_EQUAL(1, journal.peek(&record, 1));
+      last_seq = record.seq;
+      journal.consume(1);
+    }
+    TEST_ASSERT_EQUAL(0, journal.stats().flushed);
+  }
+
+  // The server dedups on seq: the next boot must not hand out one it has already seen.
+  for (int boot = 0; boot < 2; boot++)
+  {
+    ScanJournal journal;
+    journal.begin();
+    TEST_ASSERT_EQUAL(0, journal.backlog());
+    journal.append(makeEvent(1000));
+    JournalRecord record;
+    TEST_ASSERT_EQUAL(1, journal.peek(&record, 1));
+    TEST_ASSERT_TRUE(record.seq > last_seq);
+    TEST_ASSERT_EQUAL(journal.bootSeq(), record.seq);
+    last_seq = record.seq;
+    journal.consume(1);
+  }
+}
+
+void test_full_journal_drops_the_oldest_segments()
+{
+  ScanJournal journal;
+  journal.begin();
+  uint32_t total = (JOURNAL_MAX_SEGMENTS + 2) * JOURNAL_SEGMENT_RECORDS;
+  appendEvents(journal, 0, total);
+
+  TEST_ASSERT_EQUAL(JOURNAL_MAX_SEGMENTS, segmentFiles());
+  TEST_ASSERT_EQUAL(2 * JOURNAL_SEGMENT_RECORDS, journal.stats().overflowed);
+  TEST_ASSERT_EQUAL(JOURNAL_MAX_SEGMENTS * JOURNAL_SEGMENT_RECORDS, journal.backlog());
+
+  // Replay goes on with the oldest record still kept.
+  JournalRecord record;
+  TEST_ASSERT_EQUAL(1, journal.peek(&record, 1));
+  TEST_ASSERT_EQUAL(2 * JOURNAL_SEGMENT_RECORDS, record.event.captured_us);
+}
+
+void test_corrupt_record_is_skipped()
+{
+  {
+    ScanJournal journal;
+    journal.begin();
+    appendEvents(journal, 0, 5);
+  }
+
+  // Damage the event of the first record, as a power loss during the write would.
+  std::string path = std::string(fs_root) + "/journal/00000000.log";
+  FILE *file = fopen(path.c_str(), "r+b");
+  TEST_ASSERT_NOT_NULL(file);
+  fseek(file, offsetof(JournalRecord, event) + 2, SEEK_SET);
+  fputc(0x5A, file);
+  fclose(file);
+
+  ScanJournal journal;
+  journal.begin();
+  JournalRecord records[8];
+  TEST_ASSERT_EQUAL(4, journal.peek(records, 8));
+  TEST_ASSERT_EQUAL(1, records[0].seq);
+  TEST_ASSERT_EQUAL(1, journal.stats().corrupt);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_records_in_order_with_sequence);
+  RUN_TEST(test_replayed_segments_are_deleted);
+  RUN_TEST(test_backlog_survives_a_reboot);
+  RUN_TEST(test_sequence_survives_delivery_from_ram);
+  RUN_TEST(test_full_journal_drops_the_oldest_segments);
+  RUN_TEST(test_corrupt_record_is_skipped);
+  return UNITY_END();
+}
@@ -0,0 +1,216 @@
+/*
+ * JsonWriter payloads and JsonScanner parsing, fed whole and in small chunks as a socket
+ * delivers them.
+ */
+#include <string.h>
+#include <unity.h>
+
+#include <string>
+#include <vector>
+
+#include "event_serializer.h"
+#include "json_scanner.h"
+
+struct Value
+{
+  uint8_t depth;
+  std::string key;
+  std::string value;
+  JsonHandler::ValueType type;
+};
+
+class Recorder : public JsonHandler
+{
+public:
+  void value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type) override
+  {
+    values.push_back({depth, key, std::string(value, length), type});
+  }
+  void objectEnd(uint8_t depth) override { ends.push_back(depth); }
+
+  std::vector<Value> values;
+  std::vector<uint8_t> ends;
+};
+
+/**
+ * Feeds text chunk bytes at a time. Returns whether a complete document was read.
+ */
+static bool scan(Recorder &recorder, const char *text, size_t chunk, char *buffer = nullptr, size_t buffer_size = 0)
+{
+  char value[32];
+  JsonScanner scanner(recorder, buffer ? buffer : value, buffer ? buffer_size : sizeof(value));
+  size_t length = strlen(text);
+  for (size_t at = 0; at < length; at += chunk)
+  {
+    if (!scanner.feed(text + at, length - at < chunk ? length - at : chunk))
+      return false;
+  }
+  return scanner.complete();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_writer_nested()
+{
+  char out[128];
+  JsonWriter json(out, sizeof(out));
+  json.beginObject();
+  json.field("serial_no", "A1\"B\\2");
+  json.field("reader", (uint32_t)3);
+  json.field("token", (const char *)nullptr);
+  json.beginArray("events");
+  json.beginObject();
+  json.field("seq", (uint32_t)4294967295u);
+  json.endObject();
+  json.endArray();
+  json.endObject();
+
+  size_t length = json.finish();
+  TEST_ASSERT_EQUAL_STRING("{\"serial_no\":\"A1\\\"B\\\\2\",\"reader\":3,\"token\":null,\"events\":[{\"seq\":4294967295}]}", out);
+  TEST_ASSERT_EQUAL(strlen(out), length);
+}
+
+void test_writer_overflow()
+{
+  char out[16];
+  JsonWriter json(out, sizeof(out));
+  json.beginObject();
+  json.field("client_secret", "does not fit");
+  json.endObject();
+  TEST_ASSERT_EQUAL(0, json.finish());
+
+  // The terminator needs its byte too.
+  const char *expected = "{\"a\":123}";
+  for (size_t size = strlen(expected); size <= strlen(expected) + 1; size++)
+  {
+    char exact[16];
+    JsonWriter fits(exact, size);
+    fits.beginObject();
+    fits.field("a", (uint32_t)123);
+    fits.endObject();
+    size_t length = fits.finish();
+    TEST_ASSERT_EQUAL(size > strlen(expected) ? strlen(expected) : 0, length);
+  }
+}
+
+void test_writer_round_trip()
+{
+  char out[128];
+  JsonWriter json(out, sizeof(out));
+  json.beginObject();
+  json.field("tag", "04A1B2C3");
+  json.field("version", (uint32_t)42);
+  json.endObject();
+  TEST_ASSERT_TRUE(json.finish() > 0);
+
+  Recorder recorder;
+  TEST_ASSERT_TRUE(scan(recorder, out, 1));
+  TEST_ASSERT_EQUAL(2, recorder.values.size());
+  TEST_ASSERT_EQUAL_STRING("tag", recorder.values[0].key.c_str());
+  TEST_ASSERT_EQUAL_STRING("04A1B2C3", recorder.values[0].value.c_str());
+  TEST_ASSERT_EQUAL(JsonHandler::NUMBER, recorder.values[1].type);
+  TEST_ASSERT_EQUAL_STRING("42", recorder.values[1].value.c_str());
+}
+
+void test_scanner_values_and_depths()
+{
+  const char *text = " {\"version\": 7, \"full\": true, \"changes\": [\"+04A1\", \"-0B\"],\n"
+                     "  \"limits\": [{\"tag\": \"04A1\", \"stay_s\": -1.5e3}], \"x\": null} ";
+
+  // Every chunk size must give the same result.
+  for (size_t chunk = 1; chunk <= strlen(text); chunk++)
+  {
+    Recorder recorder;
+    TEST_ASSERT_TRUE(scan(recorder, text, chunk));
+    TEST_ASSERT_EQUAL(7, recorder.values.size());
+
+    TEST_ASSERT_EQUAL(1, recorder.values[0].depth);
+    TEST_ASSERT_EQUAL_STRING("version", recorder.values[0].key.c_str());
+    TEST_ASSERT_EQUAL_STRING("7", recorder.values[0].value.c_str());
+
+    TEST_ASSERT_EQUAL(JsonHandler::LITERAL, recorder.values[1].type);
+    TEST_ASSERT_EQUAL_STRING("true", recorder.values[1].value.c_str());
+
+    // Array elements have no key.
+    TEST_ASSERT_EQUAL(2, recorder.values[2].depth);
+    TEST_ASSERT_EQUAL_STRING("", recorder.values[2].key.c_str());
+    TEST_ASSERT_EQUAL_STRING("-0B", recorder.values[3].value.c_str());
+
+    TEST_ASSERT_EQUAL(3, recorder.values[4].depth);
+    TEST_ASSERT_EQUAL_STRING("tag", recorder.values[4].key.c_str());
+    TEST_ASSERT_EQUAL_STRING("-1.5e3", recorder.values[5].value.c_str());
+    TEST_ASSERT_EQUAL_STRING("null", recorder.values[6].value.c_str());
+
+    // The limits entry, then the root object.
+    TEST_ASSERT_EQUAL(2, recorder.ends.size());
+    TEST_ASSERT_EQUAL(3, recorder.ends[0]);
+    TEST_ASSERT_EQUAL(1, recorder.ends[1]);
+  }
+}
+
+void test_scanner_escapes()
+{
+  Recorder recorder;
+  TEST_ASSERT_TRUE(scan(recorder, "{\"s\": \"a\\\"b\\\\c\\/d\\n\\u0041\\u00e9\"}", 3));
+  TEST_ASSERT_EQUAL(1, recorder.values.size());
+  TEST_ASSERT_EQUAL_STRING("a\"b\\c/d\nA\xC3\xA9", recorder.values[0].value.c_str());
+}
+
+void test_scanner_truncates_long_values()
+{
+  char buffer[8];
+  Recorder recorder;
+  TEST_ASSERT_TRUE(scan(recorder, "{\"token\": \"0123456789abcdef\", \"n\": 5}", 4, buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL(2, recorder.values.size());
+  TEST_ASSERT_EQUAL_STRING("0123456", recorder.values[0].value.c_str());
+  TEST_ASSERT_EQUAL_STRING("5", recorder.values[1].value.c_str());
+}
+
+void test_scanner_empty_containers()
+{
+  Recorder recorder;
+  TEST_ASSERT_TRUE(scan(recorder, "{\"changes\": [], \"limits\": [{}]}", 1));
+  TEST_ASSERT_EQUAL(0, recorder.values.size());
+  TEST_ASSERT_EQUAL(2, recorder.ends.size());
+}
+
+void test_scanner_errors()
+{
+  const char *bad[] = {"{\"a\" 1}", "{\"a\": tru}", "{\"a\": 1,}", "[1 2]", "{\"a\": 1}}", "{\"a\": \"\\uZZ00\"}", "{'a': 1}"};
+  for (const char *text : bad)
+  {
+    Recorder recorder;
+    TEST_ASSERT_FALSE(scan(recorder, text, 1));
+  }
+
+  // Cut short: no error yet, but not complete either.
+  Recorder recorder;
+  char value[32];
+  JsonScanner scanner(recorder, value, sizeof(value));
+  TEST_ASSERT_TRUE(scanner.feed("{\"a\": [1, 2", 11));
+  TEST_ASSERT_FALSE(scanner.complete());
+  TEST_ASSERT_FALSE(scanner.failed());
+}
+
+void test_scanner_depth_limit()
+{
+  std::string deep(17, '[');
+  Recorder recorder;
+  TEST_ASSERT_FALSE(scan(recorder, deep.c_str(), 1));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_writer_nested);
+  RUN_TEST(test_writer_overflow);
+  RUN_TEST(test_writer_round_trip);
+  RUN_TEST(test_scanner_values_and_depths);
+  RUN_TEST(test_scanner_escapes);
+  RUN_TEST(test_scanner_truncates_long_values);
+  RUN_TEST(test_scanner_empty_containers);
+  RUN_TEST(test_scanner_errors);
+  RUN_TEST(test_scanner_depth_limit);
+  return UNITY_END();
+}
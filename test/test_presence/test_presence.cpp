@@ -0,0 +1,117 @@
+/*
+ * N-of-M removal debouncing of PresenceTracker: glitches keep the stay, a real removal ends
+ * it after PRESENCE_MISSES misses, and a suspicion clears after PRESENCE_RECOVER_HITS answers.
+ */
+#include <unity.h>
+
+#include "presence_tracker.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_answers_hold_the_card()
+{
+  PresenceTracker tracker;
+  tracker.locked();
+  for (int i = 0; i < 20; i++)
+    TEST_ASSERT_EQUAL(PRESENCE_HELD, tracker.checked(true));
+  TEST_ASSERT_EQUAL(PRESENCE_FAST_MS, tracker.interval());
+  TEST_ASSERT_EQUAL(0, tracker.stats().removals);
+}
+
+void test_misses_in_a_row_confirm_the_removal()
+{
+  PresenceTracker tracker;
+  tracker.locked();
+  tracker.checked(true);
+  for (int i = 1; i < PRESENCE_MISSES; i++)
+  {
+    TEST_ASSERT_EQUAL(PRESENCE_SUSPECT, tracker.checked(false));
+    TEST_ASSERT_EQUAL(PRESENCE_CONFIRM_MS, tracker.interval());
+  }
+  TEST_ASSERT_EQUAL(PRESENCE_GONE, tracker.checked(false));
+
+  PresenceStats s = tracker.stats();
+  TEST_ASSERT_EQUAL(1, s.stays);
+  TEST_ASSERT_EQUAL(1, s.removals);
+  TEST_ASSERT_EQUAL(PRESENCE_MISSES, s.misses);
+  TEST_ASSERT_EQUAL(0, s.suppressed);
+}
+
+void test_scattered_misses_within_the_window()
+{
+#if PRESENCE_MISSES > 1 && PRESENCE_RECOVER_HITS > 1 && 2 * PRESENCE_MISSES - 1 <= PRESENCE_WINDOW
+  // Miss, answer, miss, ...: never enough answers in a row to clear, so the misses add up.
+  PresenceTracker tracker;
+  tracker.locked();
+  for (int i = 1; i < PRESENCE_MISSES; i++)
+  {
+    TEST_ASSERT_EQUAL(PRESENCE_SUSPECT, tracker.checked(false));
+    TEST_ASSERT_EQUAL(PRESENCE_SUSPECT, tracker.checked(true));
+  }
+  TEST_ASSERT_EQUAL(PRESENCE_GONE, tracker.checked(false));
+  // Each run of misses but the last would have been an Exit and a new Entry.
+  TEST_ASSERT_EQUAL(2 * (PRESENCE_MISSES - 1), tracker.stats().suppressed);
+#endif
+}
+
+void test_glitch_recovers()
+{
+  PresenceTracker tracker;
+  tracker.locked();
+  TEST_ASSERT_EQUAL(PRESENCE_SUSPECT, tracker.checked(false));
+  for (int i = 1; i < PRESENCE_RECOVER_HITS; i++)
+    TEST_ASSERT_EQUAL(PRESENCE_SUSPECT, tracker.checked(true));
+  TEST_ASSERT_EQUAL(PRESENCE_HELD, tracker.checked(true));
+
+  PresenceStats s = tracker.stats();
+  TEST_ASSERT_EQUAL(1, s.flaps);
+  TEST_ASSERT_EQUAL(2, s.suppressed);
+  TEST_ASSERT_EQUAL(0, s.removals);
+
+  // The window starts over after a recovery: the old miss does not count any more.
+  for (int i = 1; i < PRESENCE_MISSES; i++)
+    TEST_ASSERT_EQUAL(PRESENCE_SUSPECT, tracker.checked(false));
+  TEST_ASSERT_EQUAL(PRESENCE_GONE, tracker.checked(false));
+}
+
+void test_misses_leave_the_window()
+{
+#if PRESENCE_MISSES > 1 && PRESENCE_WINDOW > PRESENCE_RECOVER_HITS
+  // One miss in every window: it slides out before a second one comes in, so the card stays.
+  PresenceTracker tracker;
+  tracker.locked();
+  for (int round = 0; round < 4; round++)
+  {
+    tracker.checked(false);
+    for (int i = 0; i < PRESENCE_WINDOW; i++)
+      TEST_ASSERT_NOT_EQUAL(PRESENCE_GONE, tracker.checked(true));
+  }
+  TEST_ASSERT_EQUAL(0, tracker.stats().removals);
+  TEST_ASSERT_EQUAL(4, tracker.stats().flaps);
+#endif
+}
+
+void test_new_stay_starts_clean()
+{
+  PresenceTracker tracker;
+  tracker.locked();
+  for (int i = 1; i < PRESENCE_MISSES; i++)
+    tracker.checked(false);
+
+  tracker.locked();
+  TEST_ASSERT_EQUAL(PRESENCE_HELD, tracker.checked(true));
+  TEST_ASSERT_EQUAL(2, tracker.stats().stays);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_answers_hold_the_card);
+  RUN_TEST(test_misses_in_a_row_confirm_the_removal);
+  RUN_TEST(test_scattered_misses_within_the_window);
+  RUN_TEST(test_glitch_recovers);
+  RUN_TEST(test_misses_leave_the_window);
+  RUN_TEST(test_new_stay_starts_clean);
+  return UNITY_END();
+}
@@ -0,0 +1,160 @@
+/*
+ * TimerWheel: deadlines fire on their tick across every level, in order, around the 32-bit
+ * tick wrap, and cancelled or rescheduled timers do not fire early.
+ */
+#include <unity.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "timer_wheel.h"
+
+struct Fired
+{
+  std::vector<uint32_t> ticks; // wheel tick of each firing
+  TimerWheel *wheel;
+};
+
+static void record(WheelTimer &timer, void *arg)
+{
+  Fired *fired = static_cast<Fired *>(arg);
+  fired->ticks.push_back(fired->wheel->now());
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_fires_on_its_tick_at_every_level()
+{
+  const uint32_t delays[] = {1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 300000};
+  for (uint32_t delay : delays)
+  {
+    TimerWheel wheel;
+    wheel.begin(1000);
+    Fired fired = {{}, &wheel};
+    WheelTimer timer(record, &fired);
+    wheel.schedule(timer, delay);
+    TEST_ASSERT_TRUE(timer.scheduled());
+    TEST_ASSERT_EQUAL(1000 + delay, timer.expires());
+
+    wheel.advance(1000 + delay - 1);
+    TEST_ASSERT_EQUAL(0, fired.ticks.size());
+    wheel.advance(1000 + delay + 100);
+    TEST_ASSERT_EQUAL(1, fired.ticks.size());
+    TEST_ASSERT_EQUAL(1000 + delay, fired.ticks[0]);
+    TEST_ASSERT_FALSE(timer.scheduled());
+    TEST_ASSERT_TRUE(wheel.empty());
+  }
+}
+
+void test_zero_counts_as_one_and_far_deadlines_clamp()
+{
+  TimerWheel wheel;
+  wheel.begin(0);
+  Fired fired = {{}, &wheel};
+  WheelTimer soon(record, &fired), far(record, &fired);
+  wheel.schedule(soon, 0);
+  wheel.schedule(far, UINT32_MAX);
+  TEST_ASSERT_EQUAL(1, soon.expires());
+  TEST_ASSERT_EQUAL((1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1, far.expires());
+}
+
+void test_cancel_and_reschedule()
+{
+  TimerWheel wheel;
+  wheel.begin(0);
+  Fired fired = {{}, &wheel};
+  WheelTimer a(record, &fired), b(record, &fired);
+  wheel.schedule(a, 10);
+  wheel.schedule(b, 10);
+  wheel.cancel(a);
+  wheel.cancel(a); // twice is harmless
+  wheel.schedule(b, 5000);
+  TEST_ASSERT_EQUAL(1, wheel.stats().pending);
+
+  wheel.advance(4999);
+  TEST_ASSERT_EQUAL(0, fired.ticks.size());
+  wheel.advance(5000);
+  TEST_ASSERT_EQUAL(1, fired.ticks.size());
+  TEST_ASSERT_EQUAL(5000, fired.ticks[0]);
+}
+
+static void again(WheelTimer &timer, void *arg)
+{
+  Fired *fired = static_cast<Fired *>(arg);
+  fired->ticks.push_back(fired->wheel->now());
+  if (fired->ticks.size() < 5)
+    fired->wheel->schedule(timer, 100);
+}
+
+void test_callback_schedules_again()
+{
+  TimerWheel wheel;
+  wheel.begin(0);
+  Fired fired = {{}, &wheel};
+  WheelTimer timer(again, &fired);
+  wheel.schedule(timer, 100);
+  wheel.advance(10000);
+  TEST_ASSERT_EQUAL(5, fired.ticks.size());
+  for (size_t i = 0; i < fired.ticks.size(); i++)
+    TEST_ASSERT_EQUAL(100 * (i + 1), fired.ticks[i]);
+}
+
+/**
+ * Many random timers against the obvious answer, starting just before the tick counter wraps
+ * and advancing in uneven steps.
+ */
+void test_random_timers_across_the_wrap()
+{
+  const uint32_t start = UINT32_MAX - 70000;
+  const int count = 2000;
+  std::mt19937 random(7);
+
+  TimerWheel wheel;
+  wheel.begin(start);
+  Fired fired = {{}, &wheel};
+  std::vector<WheelTimer> timers(count, WheelTimer(record, &fired));
+  std::vector<uint32_t> due(count);
+  for (int i = 0; i < count; i++)
+  {
+    uint32_t delay = 1 + random() % 150000;
+    wheel.schedule(timers[i], delay);
+    due[i] = start + delay;
+  }
+
+  uint32_t now = start;
+  uint32_t last = start;
+  while (!wheel.empty())
+  {
+    now += 1 + random() % 700;
+    size_t before = fired.ticks.size();
+    wheel.advance(now);
+    for (size_t i = before; i < fired.ticks.size(); i++)
+    {
+      // In tick order.
+      TEST_ASSERT_TRUE((int32_t)(fired.ticks[i] - last) >= 0);
+      last = fired.ticks[i];
+    }
+  }
+  TEST_ASSERT_EQUAL(count, fired.ticks.size());
+
+  // The ticks fired are exactly the deadlines.
+  std::vector<uint32_t> expected(due), got(fired.ticks);
+  auto byTime = [start](uint32_t a, uint32_t b) { return a - start < b - start; };
+  std::sort(expected.begin(), expected.end(), byTime);
+  std::sort(got.begin(), got.end(), byTime);
+  TEST_ASSERT_TRUE(expected == got);
+  TEST_ASSERT_EQUAL(count, wheel.stats().fired);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fires_on_its_tick_at_every_level);
+  RUN_TEST(test_zero_counts_as_one_and_far_deadlines_clamp);
+  RUN_TEST(test_cancel_and_reschedule);
+  RUN_TEST(test_callback_schedules_again);
+  RUN_TEST(test_random_timers_across_the_wrap);
+  return UNITY_END();
+}
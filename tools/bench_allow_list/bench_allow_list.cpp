@@ -0,0 +1,167 @@
+/*
+ * Host benchmark: allow list lookups (bloom filter + binary search) against lists of
+ * increasing size, with the cost of parsing and applying a full list and a delta and of
+ * reloading the saved list. Uses the firmware's AllowList against the host fakes. The full
+ * and delta times include writing the list to the (host) filesystem.
+ *
+ *   pio run -e bench_allow_list && .pio/build/bench_allow_list/program [lookups]
+ */
+#include <Arduino.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "allow_list.h"
+#include "host.h"
+#include "json_scanner.h"
+
+static double nowMs()
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string hexTag(const uint8_t *uid, uint8_t size)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  std::string text;
+  for (uint8_t i = 0; i < size; i++)
+  {
+    text += hex[uid[i] >> 4];
+    text += hex[uid[i] & 0x0F];
+  }
+  return text;
+}
+
+/**
+ * Feeds a response body through the scanner in socket-sized chunks, as FetchAllowList() does.
+ */
+static bool parse(const std::string &body, AllowListUpdate &update)
+{
+  char value[32];
+  JsonScanner scanner(update, value, sizeof(value));
+  for (size_t at = 0; at < body.size(); at += 1436)
+    scanner.feed(body.data() + at, std::min((size_t)1436, body.size() - at));
+  return scanner.complete();
+}
+
+struct Tag
+{
+  uint8_t uid[7];
+  uint8_t size;
+};
+
+int main(int argc, char **argv)
+{
+  uint32_t lookups = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+
+  char fs_root[] = "/tmp/bench_allow_list.XXXXXX";
+  if (mkdtemp(fs_root) == nullptr)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  hostSetFsRoot(fs_root);
+
+  std::mt19937 generator(2024);
+  const uint32_t sizes[] = {100, 1000, 4000};
+
+  printf("%6s %9s %9s %9s %9s %9s %9s %9s\n", "tags", "bytes", "hit ns", "miss ns", "bloom fp", "full ms", "delta ms",
+         "load ms");
+
+  for (uint32_t tags : sizes)
+  {
+    if (tags > ALLOW_LIST_MAX_TAGS)
+      continue;
+
+    // Half 4-byte, half 7-byte UIDs, as on a mixed MIFARE Classic / Ultralight property.
+    std::vector<Tag> listed(tags), unlisted(tags);
+    for (uint32_t i = 0; i < tags * 2; i++)
+    {
+      Tag &tag = i < tags ? listed[i] : unlisted[i - tags];
+      tag.size = i % 2 ? 7 : 4;
+      for (uint8_t b = 0; b < tag.size; b++)
+        tag.uid[b] = generator();
+    }
+
+    std::string body = "{\"version\":1,\"full\":true,\"changes\":[";
+    for (uint32_t i = 0; i < tags; i++)
+      body += (i ? ",\"+" : "\"+") + hexTag(listed[i].uid, listed[i].size) + "\"";
+    body += "]}";
+
+    AllowList list;
+    double start = nowMs();
+    AllowListUpdate full;
+    bool parsed = parse(body, full);
+    bool applied = parsed && list.apply(full);
+    double full_ms = nowMs() - start;
+    if (!applied)
+    {
+      fprintf(stderr, "full list of %u tags was not applied\n", tags);
+      return 1;
+    }
+
+    // A delta of 1% of the list: half removals, half new tags.
+    std::string delta = "{\"version\":2,\"full\":false,\"changes\":[";
+    uint32_t delta_count = std::max(2u, tags / 100);
+    for (uint32_t i = 0; i < delta_count; i++)
+    {
+      const Tag &tag = i % 2 ? unlisted[tags - 1 - i] : listed[i];
+      delta += std::string(i ? "," : "") + "\"" + (i % 2 ? "+" : "-") + hexTag(tag.uid, tag.size) + "\"";
+    }
+    delta += "]}";
+    start = nowMs();
+    AllowListUpdate update;
+    applied = parse(delta, update) && list.apply(update);
+    double delta_ms = nowMs() - start;
+    if (!applied)
+    {
+      fprintf(stderr, "delta was not applied\n");
+      return 1;
+    }
+
+    AllowList reloaded;
+    start = nowMs();
+    reloaded.begin();
+    double load_ms = nowMs() - start;
+    if (reloaded.version() != list.version())
+    {
+      fprintf(stderr, "reloaded list has version %u, expected %u\n", reloaded.version(), list.version());
+      return 1;
+    }
+
+    // Lookups: tags at random, all on the list (the delta removed some of the first ones),
+    // then all off it.
+    std::uniform_int_distribution<uint32_t> pick(delta_count, tags - 1);
+    uint32_t found = 0;
+    start = nowMs();
+    for (uint32_t i = 0; i < lookups; i++)
+    {
+      const Tag &tag = listed[pick(generator)];
+      found += list.allowed(tag.uid, tag.size);
+    }
+    double hit_ns = (nowMs() - start) * 1e6 / lookups;
+
+    AllowListStats before = list.stats();
+    start = nowMs();
+    for (uint32_t i = 0; i < lookups; i++)
+    {
+      const Tag &tag = unlisted[pick(generator)];
+      found += list.allowed(tag.uid, tag.size);
+    }
+    double miss_ns = (nowMs() - start) * 1e6 / lookups;
+    AllowListStats after = list.stats();
+    uint32_t false_hits = after.bloom_false_hits - before.bloom_false_hits;
+
+    printf("%6u %9u %9.0f %9.0f %8.2f%% %9.2f %9.2f %9.2f\n", tags, after.memory_bytes, hit_ns, miss_ns,
+           100.0 * false_hits / lookups, full_ms, delta_ms, load_ms);
+    if (found < lookups)
+      fprintf(stderr, "only %u of %u listed tags were found\n", found, lookups);
+  }
+
+  std::string cleanup = std::string("rm -rf '") + fs_root + "'";
+  system(cleanup.c_str());
+  return 0;
+}
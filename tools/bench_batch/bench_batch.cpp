@@ -0,0 +1,135 @@
+/*
+ * Host benchmark: journal replay through one /api/send-data POST per event (the SendData() path),
+ * with and without connection reuse, versus /api/send-data/batch, against the local mock server.
+ *
+ *   pio run -e bench_batch && .pio/build/bench_batch/program [events] [batch_size] [latency_ms]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "event_batch.h"
+#include "http_client.h"
+#include "mock_server.h"
+
+static const char *client_key = "bench-key";
+static const char *client_secret = "bench-secret";
+static const char *device_UID = "24a16057f3c8";
+static const char *token = "mock-token-1";
+
+static std::vector<JournalRecord> makeRecords(size_t count)
+{
+  std::vector<JournalRecord> records(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    JournalRecord &record = records[i];
+    record = {};
+    record.seq = i;
+    uint8_t uid[4] = {0xA1, 0xB2, (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(record.event.uid, uid, sizeof(uid));
+    record.event.uid_size = sizeof(uid);
+    record.event.epoch = 1733537700 + i; // 12-07-2024
+    record.event.type = i % 2 ? SCAN_EXIT : SCAN_ENTRY;
+  }
+  return records;
+}
+
+/**
+ * Same payload as SendData(). With keep_alive false every event opens its own connection
+ * (HTTPClient before HttpSession), otherwise one connection is reused.
+ */
+static size_t sendOneByOne(uint16_t port, const std::vector<JournalRecord> &records, bool keep_alive)
+{
+  size_t delivered = 0;
+  std::string response;
+  HostHttpClient http_send;
+  ReceiverCredentials credentials = {client_key, client_secret, device_UID, token};
+  char payload[SEND_DATA_BUFFER_SIZE];
+
+  for (const JournalRecord &record : records)
+  {
+    size_t length = writeSendData(payload, sizeof(payload), credentials, record.event);
+
+    if (!http_send.connected())
+      http_send.connect("127.0.0.1", port);
+    if (http_send.post("/api/send-data", payload, length, response, keep_alive) == 200)
+      delivered++;
+  }
+
+  return delivered;
+}
+
+static size_t sendBatched(uint16_t port, const std::vector<JournalRecord> &records, size_t batch_size)
+{
+  static char payload[BATCH_BUFFER_SIZE];
+  std::vector<BatchAck> acks(batch_size);
+  ReceiverCredentials credentials = {client_key, client_secret, device_UID, token};
+  size_t delivered = 0;
+  std::string response;
+
+  for (size_t first = 0; first < records.size(); first += batch_size)
+  {
+    size_t count = std::min(batch_size, records.size() - first);
+    size_t length = serializeEventBatch(credentials, &records[first], count, payload, sizeof(payload));
+    if (length == 0)
+    {
+      fprintf(stderr, "batch of %zu does not fit BATCH_BUFFER_SIZE\n", count);
+      return delivered;
+    }
+
+    HostHttpClient http_batch;
+    http_batch.connect("127.0.0.1", port);
+    if (http_batch.post("/api/send-data/batch", payload, length, response, false) != 200)
+      continue;
+
+    parseBatchAcks(response.data(), response.size(), &records[first], count, acks.data());
+    for (size_t i = 0; i < count; i++)
+      delivered += acks[i] == BATCH_ACK_OK;
+  }
+
+  return delivered;
+}
+
+template <typename Run>
+static void report(const char *name, size_t events, Run run)
+{
+  auto start = std::chrono::steady_clock::now();
+  size_t delivered = run();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%-12s %6zu/%zu delivered  %8.3f s  %10.1f events/s\n", name, delivered, events, seconds, delivered / seconds);
+}
+
+int main(int argc, char **argv)
+{
+  size_t events = argc > 1 ? strtoul(argv[1], nullptr, 10) : 500;
+  size_t batch_size = argc > 2 ? strtoul(argv[2], nullptr, 10) : BATCH_MAX_EVENTS;
+  uint32_t latency_ms = argc > 3 ? strtoul(argv[3], nullptr, 10) : 20;
+
+  if (batch_size == 0 || batch_size > BATCH_MAX_EVENTS)
+    batch_size = BATCH_MAX_EVENTS;
+
+  // Each new connection and each request pay the emulated round trip to the server.
+  MockServer server;
+  MockServer::Options options;
+  options.latency_us = latency_ms * 1000;
+  options.connect_latency_us = latency_ms * 1000;
+  if (!server.start(options))
+  {
+    fprintf(stderr, "mock server failed to start\n");
+    return 1;
+  }
+
+  printf("%zu events, batch size %zu, emulated round trip %u ms\n", events, batch_size, latency_ms);
+  std::vector<JournalRecord> records = makeRecords(events);
+
+  report("one-by-one", events, [&] { return sendOneByOne(server.port(), records, false); });
+  report("keep-alive", events, [&] { return sendOneByOne(server.port(), records, true); });
+  report("batched", events, [&] { return sendBatched(server.port(), records, batch_size); });
+
+  server.stop();
+  return 0;
+}
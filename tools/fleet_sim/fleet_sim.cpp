@@ -0,0 +1,318 @@
+/*
+ * Host load generator: a fleet of virtual receivers against the local mock server, to see how
+ * the server side holds up when every room boots at once (power cut) and starts scanning.
+ * Each device has its own serial, formatted like macToString(getChipMAC()), and speaks the
+ * firmware's protocol with its serializers: /api/request-token, then its scans as
+ * /api/send-data/batch (or /api/send-data with UPLOAD_BATCH=0) over a kept-alive connection,
+ * retrying after TOKEN_RETRY_INTERVAL_MS / UPLOAD_RETRY_MS like the uploader.
+ *
+ *   pio run -e fleet_sim && .pio/build/fleet_sim/program [devices] [taps] [latency_ms] [workers] [queue_limit] [boot_spread_ms] [pattern]
+ *
+ * The run is repeated for 1, 2, 4, ... devices up to [devices]. Every tap is an Entry, and an
+ * Exit when the card leaves again 100-400 ms later. pattern "random" spreads the taps of each
+ * device 200-600 ms apart; "rush" has all devices tap at the same moments (checkout time).
+ * boot_spread_ms 0 boots every device at once. workers and queue_limit cap the mock server:
+ * requests beyond the queue get a 503 (0 = unlimited).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "event_batch.h"
+#include "http_client.h"
+#include "json_scanner.h"
+#include "mock_server.h"
+
+// The firmware's defaults (token_manager.h, uploader.h), which need the Arduino headers.
+#ifndef TOKEN_RETRY_INTERVAL_MS
+#define TOKEN_RETRY_INTERVAL_MS 10000
+#endif
+
+#ifndef UPLOAD_RETRY_MS
+#define UPLOAD_RETRY_MS 5000
+#endif
+
+#ifndef UPLOAD_BATCH
+#define UPLOAD_BATCH 1
+#endif
+
+static const char *client_key = "6X3XFeapdoOJEULwhCdAfpIE";
+static const char *client_secret = "AaeSBArxZjgT4GeOvSik2Gd6";
+static const uint64_t FIRST_MAC = 0x24a16057f3c8;
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t sinceUs(Clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+/**
+ * Pulls "token" out of the /api/request-token response, like TokenResponse in server_api.cpp.
+ */
+class TokenResponse : public JsonHandler
+{
+public:
+  char token[256] = "";
+
+  void value(uint8_t depth, const char *key, const char *value, size_t length, ValueType type) override
+  {
+    if (depth == 1 && strcmp(key, "token") == 0 && type == STRING)
+      snprintf(token, sizeof(token), "%s", value);
+  }
+};
+
+struct FleetOptions
+{
+  int taps;
+  int boot_spread_ms;
+  bool rush;
+  uint16_t port;
+};
+
+/**
+ * What one run measured, merged over all devices.
+ */
+struct FleetResult
+{
+  std::mutex lock;
+  std::vector<uint64_t> token_us;       // boot to token
+  std::vector<uint64_t> scan_to_ack_us; // capture to the server's ok
+  std::vector<uint64_t> request_us;     // every POST
+  uint32_t requests = 0;
+  uint32_t errors = 0;                  // connection failures and non-2xx answers
+  uint32_t events = 0;
+  uint32_t delivered = 0;
+};
+
+struct ScheduledEvent
+{
+  uint64_t at_us; // capture time from the start of the run
+  ScanEvent event;
+};
+
+/**
+ * The taps of one device: an Entry, and an Exit when the card is taken away again.
+ */
+static std::vector<ScheduledEvent> schedule(int device, const FleetOptions &options, uint64_t boot_us)
+{
+  std::mt19937 generator(device * 7919 + 1);
+  std::uniform_int_distribution<uint32_t> gap_ms(200, 600);
+  std::uniform_int_distribution<uint32_t> dwell_ms(100, 400);
+  std::vector<ScheduledEvent> events;
+
+  uint64_t at_us = boot_us;
+  for (int i = 0; i < options.taps; i++)
+  {
+    // A rush lands every device's taps on the same 400 ms grid, measured from the start.
+    at_us = options.rush ? std::max(at_us, (uint64_t)(i + 1) * 400000) : at_us + gap_ms(generator) * 1000ULL;
+
+    ScheduledEvent entry = {};
+    entry.at_us = at_us;
+    uint8_t uid[4] = {(uint8_t)(device >> 8), (uint8_t)device, (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(entry.event.uid, uid, sizeof(uid));
+    entry.event.uid_size = sizeof(uid);
+    entry.event.epoch = 1733537700 + at_us / 1000000; // 12-07-2024
+    entry.event.type = SCAN_ENTRY;
+    events.push_back(entry);
+
+    ScheduledEvent exit = entry;
+    exit.at_us = at_us + dwell_ms(generator) * 1000ULL;
+    exit.event.epoch = 1733537700 + exit.at_us / 1000000;
+    exit.event.type = SCAN_EXIT;
+    events.push_back(exit);
+    at_us = exit.at_us;
+  }
+  return events;
+}
+
+/**
+ * One receiver: boots, gets a token, and sends each scan once it is captured, everything
+ * captured during a request going out together in the next batch.
+ */
+static void runDevice(int device, const FleetOptions &options, Clock::time_point start, FleetResult &result)
+{
+  char device_UID[18];
+  snprintf(device_UID, sizeof(device_UID), "%012llx", (unsigned long long)(FIRST_MAC + device));
+
+  std::mt19937 generator(device);
+  uint64_t boot_us = options.boot_spread_ms > 0 ? std::uniform_int_distribution<uint32_t>(0, options.boot_spread_ms)(generator) * 1000ULL : 0;
+  std::vector<ScheduledEvent> events = schedule(device, options, boot_us);
+
+  std::vector<uint64_t> token_us, scan_to_ack_us, request_us;
+  uint32_t requests = 0, errors = 0, delivered = 0;
+  HostHttpClient http;
+  std::string response;
+  std::vector<char> payload(BATCH_BUFFER_SIZE);
+
+  auto post = [&](const char *path, size_t length) -> int
+  {
+    if (!http.connected())
+      http.connect("127.0.0.1", options.port);
+    Clock::time_point sent = Clock::now();
+    int code = http.post(path, payload.data(), length, response, true);
+    request_us.push_back(sinceUs(sent));
+    requests++;
+    if (code < 200 || code >= 300)
+    {
+      errors++;
+      http.close();
+    }
+    return code;
+  };
+  auto sleepUntil = [&](uint64_t at_us)
+  {
+    uint64_t now_us = sinceUs(start);
+    if (at_us > now_us)
+      std::this_thread::sleep_for(std::chrono::microseconds(at_us - now_us));
+  };
+
+  // Boot, then the token every request needs.
+  sleepUntil(boot_us);
+  char token[256] = "";
+  while (token[0] == '\0')
+  {
+    size_t length = writeTokenRequest(payload.data(), payload.size(), client_key, client_secret, device_UID);
+    TokenResponse reply;
+    char value[32];
+    JsonScanner scanner(reply, value, sizeof(value));
+    if (post("/api/request-token", length) == 200 && scanner.feed(response.data(), response.size()) && reply.token[0] != '\0')
+    {
+      memcpy(token, reply.token, sizeof(token));
+      token_us.push_back(sinceUs(start) - boot_us);
+    }
+    else
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(TOKEN_RETRY_INTERVAL_MS));
+    }
+  }
+  ReceiverCredentials credentials = {client_key, client_secret, device_UID, token};
+
+  // The journal: everything captured by now and not yet acknowledged, oldest first.
+  size_t captured = 0;
+  size_t acked = 0;
+  std::vector<JournalRecord> journal(events.size());
+  for (size_t i = 0; i < events.size(); i++)
+    journal[i] = {(uint32_t)i, 0, events[i].event};
+
+  while (acked < events.size())
+  {
+    if (captured == acked)
+      sleepUntil(events[captured].at_us);
+    while (captured < events.size() && events[captured].at_us <= sinceUs(start))
+      captured++;
+
+    size_t count = UPLOAD_BATCH ? std::min(captured - acked, (size_t)BATCH_MAX_EVENTS) : 1;
+    std::vector<BatchAck> acks(count, BATCH_ACK_OK);
+    int code;
+    if (UPLOAD_BATCH)
+    {
+      size_t length = serializeEventBatch(credentials, &journal[acked], count, payload.data(), payload.size());
+      code = post("/api/send-data/batch", length);
+      if (code == 200)
+        parseBatchAcks(response.data(), response.size(), &journal[acked], count, acks.data());
+    }
+    else
+    {
+      size_t length = writeSendData(payload.data(), payload.size(), credentials, journal[acked].event);
+      code = post("/api/send-data", length);
+    }
+
+    if (code != 200)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(UPLOAD_RETRY_MS));
+      continue;
+    }
+    // Like the uploader: rejected events are dropped, unanswered ones are sent again.
+    uint64_t now_us = sinceUs(start);
+    for (size_t i = 0; i < count && acks[i] != BATCH_ACK_NONE; i++)
+    {
+      if (acks[i] == BATCH_ACK_OK)
+      {
+        scan_to_ack_us.push_back(now_us - events[acked].at_us);
+        delivered++;
+      }
+      acked++;
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(result.lock);
+  result.token_us.insert(result.token_us.end(), token_us.begin(), token_us.end());
+  result.scan_to_ack_us.insert(result.scan_to_ack_us.end(), scan_to_ack_us.begin(), scan_to_ack_us.end());
+  result.request_us.insert(result.request_us.end(), request_us.begin(), request_us.end());
+  result.requests += requests;
+  result.errors += errors;
+  result.events += events.size();
+  result.delivered += delivered;
+}
+
+static double percentileMs(std::vector<uint64_t> &values, int percent)
+{
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, values.size() * percent / 100)] / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+  int max_devices = argc > 1 ? atoi(argv[1]) : 128;
+  FleetOptions fleet = {};
+  fleet.taps = argc > 2 ? atoi(argv[2]) : 10;
+  uint32_t latency_ms = argc > 3 ? strtoul(argv[3], nullptr, 10) : 20;
+  uint32_t workers = argc > 4 ? strtoul(argv[4], nullptr, 10) : 16;
+  uint32_t queue_limit = argc > 5 ? strtoul(argv[5], nullptr, 10) : 0;
+  fleet.boot_spread_ms = argc > 6 ? atoi(argv[6]) : 0;
+  fleet.rush = argc > 7 && strcmp(argv[7], "rush") == 0;
+
+  printf("%d taps per device (%s), %d ms boot spread, server: %u ms per request, %u workers, queue limit %u, %s\n",
+         fleet.taps, fleet.rush ? "rush" : "random", fleet.boot_spread_ms, latency_ms, workers, queue_limit,
+         UPLOAD_BATCH ? "batch posts" : "single posts");
+  printf("%7s %8s %9s %9s %9s %9s %9s %9s %9s %9s %8s %6s\n", "devices", "events", "events/s", "req/s", "token p50",
+         "token p99", "ack p50", "ack p95", "ack p99", "ack max", "req p99", "err %");
+
+  for (int devices = 1;; devices = std::min(devices * 2, max_devices))
+  {
+    MockServer server;
+    MockServer::Options options;
+    options.latency_us = latency_ms * 1000;
+    options.workers = workers;
+    options.queue_limit = queue_limit;
+    if (!server.start(options))
+    {
+      fprintf(stderr, "mock server failed to start\n");
+      return 1;
+    }
+    fleet.port = server.port();
+
+    FleetResult result;
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int device = 0; device < devices; device++)
+      threads.emplace_back(runDevice, device, std::cref(fleet), start, std::ref(result));
+    for (std::thread &thread : threads)
+      thread.join();
+    double seconds = sinceUs(start) / 1e6;
+    server.stop();
+
+    printf("%7d %8u %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %8.1f %6.2f\n", devices, result.delivered,
+           result.delivered / seconds, result.requests / seconds, percentileMs(result.token_us, 50),
+           percentileMs(result.token_us, 99), percentileMs(result.scan_to_ack_us, 50), percentileMs(result.scan_to_ack_us, 95),
+           percentileMs(result.scan_to_ack_us, 99), percentileMs(result.scan_to_ack_us, 100), percentileMs(result.request_us, 99),
+           result.requests ? 100.0 * result.errors / result.requests : 0.0);
+    fflush(stdout);
+
+    if (devices >= max_devices)
+      break;
+  }
+  return 0;
+}
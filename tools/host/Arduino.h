@@ -0,0 +1,164 @@
+#pragma once
+
+/*
+ * Host (Linux) stand-in for the parts of the Arduino-ESP32 core the firmware uses.
+ * Time comes from the host steady clock, GPIO is an in-memory pin table and Serial writes to
+ * stdout. See host.h for the controls a simulation uses to drive the fakes.
+ */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+
+#include "esp_attr.h"
+#include "esp_system.h"
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define DEC 10
+#define HEX 16
+
+// Flash strings are ordinary strings on the ESP32 (and here)
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+inline uint8_t digitalPinToInterrupt(uint8_t pin) { return pin; }
+
+uint32_t getCpuFrequencyMhz();
+long random(long max);
+long random(long min, long max);
+
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1, const char *server2 = nullptr,
+                const char *server3 = nullptr);
+bool getLocalTime(struct tm *info, uint32_t ms = 5000);
+
+class String : public std::string
+{
+public:
+  String() {}
+  String(const char *s) : std::string(s ? s : "") {}
+  String(const std::string &s) : std::string(s) {}
+  const char *c_str() const { return std::string::c_str(); }
+  size_t length() const { return size(); }
+};
+
+class Print;
+
+class Printable
+{
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *s) { return write(reinterpret_cast<const uint8_t *>(s), strlen(s)); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(const String &s) { return write(s.c_str()); }
+  size_t print(const __FlashStringHelper *s) { return write(reinterpret_cast<const char *>(s)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+  size_t print(int n, int base = DEC) { return printSigned(n, base); }
+  size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+  size_t print(long n, int base = DEC) { return printSigned(n, base); }
+  size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+  size_t print(long long n, int base = DEC) { return printSigned(n, base); }
+  size_t print(unsigned long long n, int base = DEC) { return printNumber(n, base); }
+  size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+  size_t print(const Printable &p) { return p.printTo(*this); }
+  size_t print(const struct tm *timeinfo, const char *format = nullptr);
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T &value) { return print(value) + println(); }
+  template <typename T>
+  size_t println(const T &value, int base) { return print(value, base) + println(); }
+  size_t println(const char *s) { return print(s) + println(); }
+  size_t println(const struct tm *timeinfo, const char *format = nullptr) { return print(timeinfo, format) + println(); }
+
+private:
+  size_t printNumber(unsigned long long n, int base);
+  size_t printSigned(long long n, int base);
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+};
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud) {}
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override;
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+  uint64_t getEfuseMac();
+  uint32_t getFreeHeap() { return 200000; }
+  uint32_t getMinFreeHeap() { return 180000; }
+  uint32_t getCycleCount();
+  void restart();
+};
+
+extern EspClass ESP;
@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+ * Host fake of the Arduino fs::FS / File API on top of a host directory.
+ */
+
+#include <Arduino.h>
+
+#include <memory>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+struct HostFile;
+
+namespace fs
+{
+
+class File
+{
+public:
+  File() {}
+  explicit File(std::shared_ptr<HostFile> impl) : impl(impl) {}
+
+  operator bool() const;
+  size_t read(uint8_t *buffer, size_t size);
+  int read();
+  size_t write(const uint8_t *buffer, size_t size);
+  size_t write(uint8_t c) { return write(&c, 1); }
+  bool seek(uint32_t position);
+  size_t position();
+  size_t size();
+  void flush();
+  void close() { impl.reset(); }
+  const char *name() const;
+  const char *path() const;
+  bool isDirectory() const;
+  File openNextFile(const char *mode = FILE_READ);
+
+private:
+  std::shared_ptr<HostFile> impl;
+};
+
+class FS
+{
+public:
+  File open(const char *path, const char *mode = FILE_READ, bool create = false);
+  bool exists(const char *path);
+  bool remove(const char *path);
+  bool rename(const char *from, const char *to);
+  bool mkdir(const char *path);
+  bool rmdir(const char *path);
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
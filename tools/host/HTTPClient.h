@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+ * Host fake of the arduino-esp32 HTTPClient, POST only. Requests go to the server set with
+ * hostSetServer() whatever host the URL names; with WiFi down they fail like a refused
+ * connection.
+ */
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+class HTTPClient
+{
+public:
+  bool begin(WiFiClient &client, const char *url);
+  bool begin(WiFiClient &client, const String &url) { return begin(client, url.c_str()); }
+  void end();
+
+  void setReuse(bool reuse) { this->reuse = reuse; }
+  void setTimeout(uint16_t timeout) {}
+  void setConnectTimeout(int32_t timeout) {}
+  void addHeader(const String &name, const String &value, bool first = false, bool replace = true);
+
+  int POST(uint8_t *payload, size_t size);
+  int POST(const String &payload) { return POST((uint8_t *)payload.c_str(), payload.length()); }
+
+  int getSize() { return (int)response.size(); }
+  String getString() { return String(response); }
+  int writeToStream(Stream *stream);
+
+  static String errorToString(int error);
+
+private:
+  WiFiClient *client = nullptr;
+  std::string path;
+  std::string content_type = "application/json";
+  std::string response;
+  bool reuse = true;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+ * Host fake of the NVS-backed Preferences. Namespaces live in memory for the life of the
+ * process.
+ */
+
+#include <Arduino.h>
+
+#include <string>
+
+class Preferences
+{
+public:
+  ~Preferences() { end(); }
+
+  bool begin(const char *name, bool readOnly = false, const char *partition_label = nullptr);
+  void end();
+
+  bool clear();
+  bool remove(const char *key);
+  bool isKey(const char *key);
+
+  size_t putUChar(const char *key, uint8_t value) { return putBytes(key, &value, sizeof(value)); }
+  size_t putInt(const char *key, int32_t value) { return putBytes(key, &value, sizeof(value)); }
+  size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+  size_t putULong64(const char *key, uint64_t value) { return putBytes(key, &value, sizeof(value)); }
+  size_t putString(const char *key, const char *value);
+  size_t putBytes(const char *key, const void *value, size_t length);
+
+  uint8_t getUChar(const char *key, uint8_t defaultValue = 0) { return get(key, defaultValue); }
+  int32_t getInt(const char *key, int32_t defaultValue = 0) { return get(key, defaultValue); }
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0) { return get(key, defaultValue); }
+  uint64_t getULong64(const char *key, uint64_t defaultValue = 0) { return get(key, defaultValue); }
+  size_t getString(const char *key, char *value, size_t maxLen);
+  String getString(const char *key, const String &defaultValue = String());
+  size_t getBytesLength(const char *key);
+  size_t getBytes(const char *key, void *buffer, size_t maxLen);
+
+private:
+  template <typename T>
+  T get(const char *key, T defaultValue)
+  {
+    T value;
+    return getBytesLength(key) == sizeof(T) && getBytes(key, &value, sizeof(T)) == sizeof(T) ? value : defaultValue;
+  }
+
+  std::string name;
+  bool started = false;
+  bool read_only = false;
+};
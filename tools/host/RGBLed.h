@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * Records the colour instead of driving PWM channels (wilmouths/RGB interface).
+ */
+class RGBLed
+{
+public:
+  static const bool COMMON_ANODE = true;
+  static const bool COMMON_CATHODE = false;
+
+  static int RED[3];
+  static int GREEN[3];
+  static int BLUE[3];
+  static int MAGENTA[3];
+  static int CYAN[3];
+  static int YELLOW[3];
+  static int WHITE[3];
+
+  RGBLed(int red_pin, int green_pin, int blue_pin, bool common) {}
+
+  void setColor(int rgb[3]) { setColor(rgb[0], rgb[1], rgb[2]); }
+  void setColor(int red, int green, int blue)
+  {
+    color[0] = red;
+    color[1] = green;
+    color[2] = blue;
+  }
+  void off() { setColor(0, 0, 0); }
+
+  int color[3] = {};
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0x00
+
+class SPISettings
+{
+public:
+  SPISettings() {}
+  SPISettings(uint32_t clock, uint8_t bit_order, uint8_t data_mode) : clock(clock) {}
+
+  uint32_t clock = 1000000;
+};
+
+/**
+ * Host fake of the ESP32 SPI master. Each transferBytes()/writeBytes() call is one frame to
+ * the fake MFRC522 whose chip select is low (see MFRC522.h). Transfers take no time.
+ */
+class SPIClass
+{
+public:
+  void begin() {}
+  void end() {}
+  void beginTransaction(SPISettings settings) {}
+  void endTransaction() {}
+  void transferBytes(const uint8_t *data, uint8_t *out, uint32_t size);
+  void writeBytes(const uint8_t *data, uint32_t size) { transferBytes(data, nullptr, size); }
+};
+
+extern SPIClass SPI;
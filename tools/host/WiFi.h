@@ -0,0 +1,126 @@
+#pragma once
+
+/*
+ * Host fake of the ESP32 WiFi station. WiFi.begin() associates after
+ * hostSetWiFiConnectDelay() on a background thread (the WiFi event task) if
+ * hostSetWiFiAvailable() says the access point is up, and the usual events are delivered to
+ * the onEvent() handlers.
+ */
+
+#include <Arduino.h>
+
+typedef enum
+{
+  WL_NO_SHIELD = 255,
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum
+{
+  WIFI_MODE_NULL,
+  WIFI_MODE_STA,
+  WIFI_MODE_AP,
+  WIFI_MODE_APSTA
+} wifi_mode_t;
+
+#define WIFI_OFF WIFI_MODE_NULL
+#define WIFI_STA WIFI_MODE_STA
+
+typedef enum
+{
+  WIFI_PS_NONE,
+  WIFI_PS_MIN_MODEM,
+  WIFI_PS_MAX_MODEM
+} wifi_ps_type_t;
+
+typedef enum
+{
+  WIFI_REASON_ASSOC_LEAVE = 8,
+  WIFI_REASON_BEACON_TIMEOUT = 200,
+  WIFI_REASON_NO_AP_FOUND = 201
+} wifi_err_reason_t;
+
+typedef enum
+{
+  ARDUINO_EVENT_WIFI_READY = 0,
+  ARDUINO_EVENT_WIFI_SCAN_DONE,
+  ARDUINO_EVENT_WIFI_STA_START,
+  ARDUINO_EVENT_WIFI_STA_STOP,
+  ARDUINO_EVENT_WIFI_STA_CONNECTED,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+  ARDUINO_EVENT_WIFI_STA_AUTHMODE_CHANGE,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP6,
+  ARDUINO_EVENT_WIFI_STA_LOST_IP,
+  ARDUINO_EVENT_MAX
+} arduino_event_id_t;
+
+typedef struct
+{
+  uint8_t ssid[33];
+  uint8_t ssid_len;
+  uint8_t bssid[6];
+  uint8_t channel;
+} wifi_event_sta_connected_t;
+
+typedef struct
+{
+  uint8_t ssid[33];
+  uint8_t ssid_len;
+  uint8_t bssid[6];
+  uint8_t reason;
+} wifi_event_sta_disconnected_t;
+
+typedef union
+{
+  wifi_event_sta_connected_t wifi_sta_connected;
+  wifi_event_sta_disconnected_t wifi_sta_disconnected;
+} arduino_event_info_t;
+
+typedef arduino_event_id_t WiFiEvent_t;
+typedef arduino_event_info_t WiFiEventInfo_t;
+typedef void (*WiFiEventFuncCb)(arduino_event_id_t event, arduino_event_info_t info);
+
+class IPAddress : public Printable
+{
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : octets{a, b, c, d} {}
+  size_t printTo(Print &p) const override
+  {
+    return p.printf("%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+  }
+  uint8_t operator[](int index) const { return octets[index]; }
+
+private:
+  uint8_t octets[4];
+};
+
+class WiFiClass
+{
+public:
+  bool mode(wifi_mode_t mode) { return true; }
+  void persistent(bool persistent) {}
+  bool setAutoReconnect(bool auto_reconnect) { return true; }
+  bool setSleep(bool enabled) { return true; }
+  bool setSleep(wifi_ps_type_t type) { return true; }
+
+  int onEvent(WiFiEventFuncCb callback, arduino_event_id_t event = ARDUINO_EVENT_MAX);
+
+  wl_status_t begin(const char *ssid, const char *passphrase = nullptr, int32_t channel = 0,
+                    const uint8_t *bssid = nullptr, bool connect = true);
+  bool disconnect(bool wifioff = false, bool eraseap = false);
+
+  wl_status_t status();
+  IPAddress localIP();
+  uint8_t *BSSID();
+  int32_t channel();
+  int8_t RSSI() { return -55; }
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "http_client.h"
+
+/**
+ * TCP connection kept between HTTPClient requests (setReuse). The socket is a plain host
+ * connection to the server set with hostSetServer(). connect() opens a raw stream instead
+ * (MQTT), always to the broker set with hostSetBroker(); it drops with the WiFi.
+ */
+class WiFiClient
+{
+public:
+  ~WiFiClient() { stop(); }
+
+  int connect(const char *host, uint16_t port, int32_t timeout_ms);
+  int setNoDelay(bool enabled);
+  size_t write(const uint8_t *buffer, size_t size);
+  int available();
+  int read(uint8_t *buffer, size_t size);
+
+  bool connected();
+  void stop();
+
+  HostHttpClient connection;
+
+private:
+  int fd = -1; // raw stream
+};
@@ -0,0 +1,6 @@
+#pragma once
+
+#define IRAM_ATTR
+
+// RTC slow memory: kept in one section, which hostReset() carries over to the next run.
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_noinit")))
@@ -0,0 +1,7 @@
+#pragma once
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NOT_SUPPORTED 0x106
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "esp_err.h"
+
+typedef struct
+{
+  int max_freq_mhz;
+  int min_freq_mhz;
+  bool light_sleep_enable;
+} esp_pm_config_esp32_t;
+
+// Like the stock Arduino core (no tickless idle): light sleep requests are refused.
+esp_err_t esp_pm_configure(const void *config);
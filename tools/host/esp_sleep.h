@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum
+{
+  ESP_SLEEP_WAKEUP_UNDEFINED,
+  ESP_SLEEP_WAKEUP_ALL,
+  ESP_SLEEP_WAKEUP_EXT0,
+  ESP_SLEEP_WAKEUP_EXT1,
+  ESP_SLEEP_WAKEUP_TIMER,
+  ESP_SLEEP_WAKEUP_TOUCHPAD,
+  ESP_SLEEP_WAKEUP_ULP,
+  ESP_SLEEP_WAKEUP_GPIO,
+} esp_sleep_wakeup_cause_t;
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us);
+esp_err_t esp_sleep_enable_gpio_wakeup();
+
+// On the host a light sleep is a plain sleep of the timer wake-up time.
+esp_err_t esp_light_sleep_start();
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause();
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <sys/time.h>
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void esp_sntp_servermode_dhcp(bool enable);
+
+// The host clock is always synchronised: the callback runs right away.
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
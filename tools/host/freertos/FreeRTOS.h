@@ -0,0 +1,42 @@
+#pragma once
+
+/*
+ * FreeRTOS on std::thread: tasks are threads, one tick is one millisecond, and critical
+ * sections are a recursive mutex.
+ */
+
+#include <stdint.h>
+
+#include <mutex>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY (TickType_t)0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+struct portMUX_TYPE
+{
+  std::recursive_mutex mutex;
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL(mux) (mux)->mutex.unlock()
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+// Tasks keep the core they were pinned to; threads started elsewhere report core 1 like loopTask.
+BaseType_t xPortGetCoreID();
+
+#define portYIELD_FROM_ISR(...) \
+  do                            \
+  {                             \
+  } while (0)
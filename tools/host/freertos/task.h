@@ -0,0 +1,21 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+struct HostTask;
+typedef HostTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task);
+
+// Threads not started through xTaskCreate*() (main, the loop thread) get a handle on first use.
+TaskHandle_t xTaskGetCurrentTaskHandle();
+
+void vTaskDelay(TickType_t ticks);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
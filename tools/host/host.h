@@ -0,0 +1,82 @@
+#pragma once
+
+/*
+ * Controls for host simulations: what the fakes behind Arduino.h, MFRC522.h, WiFi.h,
+ * HTTPClient.h, Preferences.h and LittleFS.h see. Everything is process-global, like the
+ * hardware it stands in for, so one process simulates one device.
+ */
+
+#include <stdint.h>
+
+// Readers are numbered in the order their PCD_Init() ran.
+#define HOST_MAX_READERS 8
+
+// Reader: put a card into the field (uid of 4, 7 or 10 bytes) or take it out again.
+void hostPlaceCard(const uint8_t *uid, uint8_t size, uint8_t reader = 0);
+void hostRemoveCard(uint8_t reader = 0);
+
+// Reader: RF glitches; a card in the field misses this percentage of the frames sent to it.
+void hostSetCardDropout(uint8_t percent);
+
+// Reader: the GPIO the MFRC522 IRQ output is wired to (-1 = not wired).
+void hostSetReaderIrqPin(int pin, uint8_t reader = 0);
+
+// Readers: transfers sent and time spent on the (simulated) SPI bus and air interface, all readers.
+struct HostReaderStats
+{
+  uint32_t transceives; // WUPA/REQA, select and halt frames
+  uint32_t timeouts;    // frames nobody answered (each costs the receive timeout)
+  uint64_t busy_us;     // time the calling task spent waiting on the reader
+};
+HostReaderStats hostReaderStats();
+
+// WiFi: whether the access point is reachable, and how long association takes.
+void hostSetWiFiAvailable(bool available);
+void hostSetWiFiConnectDelay(uint32_t ms);
+
+// HTTP: every request goes to this server, whatever host the URL names.
+void hostSetServer(const char *host, uint16_t port);
+
+// MQTT: every WiFiClient::connect() goes to this broker, whatever host it names.
+void hostSetBroker(const char *host, uint16_t port);
+
+// Storage: directory that backs LittleFS (created if missing).
+void hostSetFsRoot(const char *path);
+
+// Time: how long after boot the SNTP sync callback fires (0 = at once).
+void hostSetTimeSyncDelay(uint32_t ms);
+
+// Chip: the eFuse MAC, which the firmware uses as its device UID.
+void hostSetMac(uint64_t mac);
+
+// Heap: the next count calloc() calls return nullptr, as on an ESP32 out of heap (glibc only).
+void hostFailCalloc(uint32_t count);
+
+// Reset: RTC slow memory (RTC_NOINIT_ATTR) lives in this file across hostReset(); it is read
+// now if it exists. hostReset() saves it and starts the program over with the same arguments,
+// esp_reset_reason() then returning reason, like a brownout or watchdog reset of the chip.
+void hostSetRtcFile(const char *path);
+[[noreturn]] void hostReset(int reason);
+
+// GPIO: current output level of a pin (SSR, LED, ...).
+int hostPinLevel(uint8_t pin);
+
+// GPIO: drive an input pin and fire the interrupt attached to it on a matching edge.
+void hostDrivePin(uint8_t pin, int level);
+
+// Replay (tools/replay): the readers and the HTTP client take their outcomes from a script
+// instead of the cards placed above and the server. nullptr goes back to the simulation.
+class HostScript
+{
+public:
+  virtual ~HostScript() = default;
+  // A wake-up (WUPA/REQA, blocking or armed) on the reader: true with the status if a card answers.
+  virtual bool wakeup(uint8_t reader, uint8_t &status) = 0;
+  // A select on the reader: its status, with the uid when it is STATUS_OK.
+  virtual uint8_t select(uint8_t reader, uint8_t *uid, uint8_t &size) = 0;
+  // A POST to path: true with the outcome and how long it took, if the script has one left.
+  // A 2xx still goes to the server (for its answer); anything else is returned as it is.
+  virtual bool post(const char *path, int &code, uint32_t &duration_us) = 0;
+};
+void hostSetScript(HostScript *script);
+HostScript *hostScript();
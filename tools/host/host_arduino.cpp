@@ -0,0 +1,265 @@
+#include "Arduino.h"
+
+#include <sys/time.h>
+
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "host.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static const auto boot_time = std::chrono::steady_clock::now();
+static std::mutex serial_lock;
+static std::mutex gpio_lock;
+
+struct HostPin
+{
+  uint8_t mode = INPUT;
+  int level = LOW;
+  void (*handler)() = nullptr;
+  void (*handler_arg)(void *) = nullptr;
+  void *arg = nullptr;
+  int interrupt_mode = 0;
+};
+
+static HostPin pins[64];
+static uint64_t efuse_mac = 0x24a16057f3c8ULL;
+static long gmt_offset_s = 0;
+static int daylight_offset_s = 0;
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+  size_t length = strlen(src);
+  if (size > 0)
+  {
+    size_t n = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return length;
+}
+#endif
+
+uint32_t millis()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - boot_time).count();
+}
+
+uint32_t micros()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot_time).count();
+}
+
+void delay(uint32_t ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield()
+{
+  std::this_thread::yield();
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  std::lock_guard<std::mutex> guard(gpio_lock);
+  pins[pin % 64].mode = mode;
+  if (mode == INPUT_PULLUP)
+    pins[pin % 64].level = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  std::lock_guard<std::mutex> guard(gpio_lock);
+  pins[pin % 64].level = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin)
+{
+  std::lock_guard<std::mutex> guard(gpio_lock);
+  return pins[pin % 64].level;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode)
+{
+  std::lock_guard<std::mutex> guard(gpio_lock);
+  pins[pin % 64].handler = handler;
+  pins[pin % 64].handler_arg = nullptr;
+  pins[pin % 64].interrupt_mode = mode;
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode)
+{
+  std::lock_guard<std::mutex> guard(gpio_lock);
+  pins[pin % 64].handler = nullptr;
+  pins[pin % 64].handler_arg = handler;
+  pins[pin % 64].arg = arg;
+  pins[pin % 64].interrupt_mode = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+  std::lock_guard<std::mutex> guard(gpio_lock);
+  pins[pin % 64].handler = nullptr;
+  pins[pin % 64].handler_arg = nullptr;
+}
+
+int hostPinLevel(uint8_t pin)
+{
+  return digitalRead(pin);
+}
+
+void hostDrivePin(uint8_t pin, int level)
+{
+  void (*handler)() = nullptr;
+  void (*handler_arg)(void *) = nullptr;
+  void *arg = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(gpio_lock);
+    HostPin &p = pins[pin % 64];
+    int previous = p.level;
+    p.level = level ? HIGH : LOW;
+    bool rising = previous == LOW && p.level == HIGH;
+    bool falling = previous == HIGH && p.level == LOW;
+    if ((rising && (p.interrupt_mode == RISING || p.interrupt_mode == CHANGE)) ||
+        (falling && (p.interrupt_mode == FALLING || p.interrupt_mode == CHANGE)))
+    {
+      handler = p.handler;
+      handler_arg = p.handler_arg;
+      arg = p.arg;
+    }
+  }
+
+  // Interrupt handlers run on the thread that drove the pin, like an ISR preempting a task.
+  if (handler)
+    handler();
+  if (handler_arg)
+    handler_arg(arg);
+}
+
+uint32_t getCpuFrequencyMhz()
+{
+  return 240;
+}
+
+long random(long max)
+{
+  return random(0, max);
+}
+
+long random(long min, long max)
+{
+  static std::mt19937 generator(12345);
+  if (max <= min)
+    return min;
+  return min + (long)(generator() % (unsigned long)(max - min));
+}
+
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1, const char *server2, const char *server3)
+{
+  gmt_offset_s = gmtOffset_sec;
+  daylight_offset_s = daylightOffset_sec;
+}
+
+bool getLocalTime(struct tm *info, uint32_t ms)
+{
+  time_t now = time(nullptr) + gmt_offset_s + daylight_offset_s;
+  return gmtime_r(&now, info) != nullptr;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::printf(const char *format, ...)
+{
+  char small[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(small, sizeof(small), format, args);
+  va_end(args);
+  if (length < 0)
+    return 0;
+  if ((size_t)length < sizeof(small))
+    return write(reinterpret_cast<const uint8_t *>(small), length);
+
+  std::string large(length + 1, '\0');
+  va_start(args, format);
+  vsnprintf(&large[0], large.size(), format, args);
+  va_end(args);
+  return write(reinterpret_cast<const uint8_t *>(large.data()), length);
+}
+
+size_t Print::print(const struct tm *timeinfo, const char *format)
+{
+  char buffer[64];
+  size_t length = strftime(buffer, sizeof(buffer), format ? format : "%c", timeinfo);
+  return write(reinterpret_cast<const uint8_t *>(buffer), length);
+}
+
+size_t Print::printNumber(unsigned long long n, int base)
+{
+  char buffer[72];
+  if (base == HEX)
+    snprintf(buffer, sizeof(buffer), "%llX", n);
+  else
+    snprintf(buffer, sizeof(buffer), "%llu", n);
+  return write(buffer);
+}
+
+size_t Print::printSigned(long long n, int base)
+{
+  if (base != DEC)
+    return printNumber((unsigned long long)n, base);
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), "%lld", n);
+  return write(buffer);
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  std::lock_guard<std::mutex> guard(serial_lock);
+  return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush()
+{
+  std::lock_guard<std::mutex> guard(serial_lock);
+  fflush(stdout);
+}
+
+uint64_t EspClass::getEfuseMac()
+{
+  return efuse_mac;
+}
+
+uint32_t EspClass::getCycleCount()
+{
+  return micros() * getCpuFrequencyMhz();
+}
+
+void EspClass::restart()
+{
+  Serial.println("ESP.restart() on host: exiting");
+  Serial.flush();
+  exit(0);
+}
+
+void hostSetMac(uint64_t mac)
+{
+  efuse_mac = mac;
+}
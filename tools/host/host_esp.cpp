@@ -0,0 +1,166 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <RGBLed.h>
+#include <driver/gpio.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "host.h"
+
+SPIClass SPI;
+
+int RGBLed::RED[3] = {255, 0, 0};
+int RGBLed::GREEN[3] = {0, 255, 0};
+int RGBLed::BLUE[3] = {0, 0, 255};
+int RGBLed::MAGENTA[3] = {255, 0, 255};
+int RGBLed::CYAN[3] = {0, 255, 255};
+int RGBLed::YELLOW[3] = {255, 255, 0};
+int RGBLed::WHITE[3] = {255, 255, 255};
+
+static const auto boot_time = std::chrono::steady_clock::now();
+static std::atomic<uint32_t> failing_callocs{0};
+
+extern "C" void *__libc_calloc(size_t count, size_t size);
+
+// Stands in for the C library's calloc() in the whole host program.
+extern "C" void *calloc(size_t count, size_t size)
+{
+  uint32_t left = failing_callocs.load();
+  while (left > 0 && !failing_callocs.compare_exchange_weak(left, left - 1))
+  {
+  }
+  return left > 0 ? nullptr : __libc_calloc(count, size);
+}
+
+void hostFailCalloc(uint32_t count)
+{
+  failing_callocs = count;
+}
+static uint64_t sleep_timer_us = 0;
+
+int64_t esp_timer_get_time()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot_time).count();
+}
+
+esp_err_t esp_pm_configure(const void *config)
+{
+  const esp_pm_config_esp32_t *pm_config = static_cast<const esp_pm_config_esp32_t *>(config);
+  return pm_config->light_sleep_enable ? ESP_ERR_NOT_SUPPORTED : ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+  sleep_timer_us = time_in_us;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup()
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_light_sleep_start()
+{
+  std::this_thread::sleep_for(std::chrono::microseconds(sleep_timer_us));
+  return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+  return ESP_SLEEP_WAKEUP_TIMER;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+  return ESP_OK;
+}
+
+void esp_sntp_servermode_dhcp(bool enable)
+{
+}
+
+static uint32_t time_sync_delay_ms = 0;
+
+void hostSetTimeSyncDelay(uint32_t ms)
+{
+  time_sync_delay_ms = ms;
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback)
+{
+  if (!callback)
+    return;
+  // The host clock is always right; the delay stands in for SNTP waiting for the network.
+  std::thread([callback]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(time_sync_delay_ms));
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    callback(&now);
+  }).detach();
+}
+
+// The RTC_NOINIT_ATTR variables (see esp_attr.h); weak, in case no module has one.
+extern uint8_t __start_rtc_noinit[] __attribute__((weak));
+extern uint8_t __stop_rtc_noinit[] __attribute__((weak));
+static std::string rtc_file;
+
+esp_reset_reason_t esp_reset_reason()
+{
+  const char *reason = getenv("HOST_RESET_REASON");
+  return reason ? (esp_reset_reason_t)atoi(reason) : ESP_RST_POWERON;
+}
+
+void hostSetRtcFile(const char *path)
+{
+  rtc_file = path;
+  size_t size = __stop_rtc_noinit - __start_rtc_noinit;
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr)
+    return;
+  if (size > 0 && fread(__start_rtc_noinit, 1, size, file) != size)
+    memset(__start_rtc_noinit, 0, size);
+  fclose(file);
+}
+
+void hostReset(int reason)
+{
+  size_t size = __stop_rtc_noinit - __start_rtc_noinit;
+  FILE *file = rtc_file.empty() ? nullptr : fopen(rtc_file.c_str(), "wb");
+  if (file != nullptr)
+  {
+    fwrite(__start_rtc_noinit, 1, size, file);
+    fclose(file);
+  }
+
+  char value[8];
+  snprintf(value, sizeof(value), "%d", reason);
+  setenv("HOST_RESET_REASON", value, 1);
+  Serial.flush();
+  fflush(stdout);
+
+  // Same program, same arguments; every task and all other memory start over.
+  std::ifstream cmdline("/proc/self/cmdline", std::ios::binary);
+  std::vector<std::string> args;
+  std::string arg;
+  while (std::getline(cmdline, arg, '\0'))
+    args.push_back(arg);
+  std::vector<char *> argv;
+  for (std::string &a : args)
+    argv.push_back(&a[0]);
+  argv.push_back(nullptr);
+  execv("/proc/self/exe", argv.data());
+  perror("execv");
+  _exit(1);
+}
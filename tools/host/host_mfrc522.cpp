@@ -0,0 +1,433 @@
+#include "MFRC522.h"
+
+#include <SPI.h>
+
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "host.h"
+
+// Air-interface timings of the real reader with the library's PCD_Init() settings.
+static const uint32_t ANSWER_US = 400;     // short frame + ATQA
+static const uint32_t SELECT_US = 1500;    // anticollision + select, one cascade level
+
+static const byte RX_IRQ = 0x20;
+static const byte TIMER_IRQ = 0x01;
+
+enum CardState
+{
+  CARD_IDLE,
+  CARD_READY,
+  CARD_ACTIVE,
+  CARD_HALT
+};
+
+struct HostCard
+{
+  bool present = false;
+  byte uid[10] = {};
+  byte size = 0;
+  CardState state = CARD_IDLE;
+};
+
+static std::mutex field_lock;
+static HostCard cards[HOST_MAX_READERS];
+static bool fields_on[HOST_MAX_READERS];
+static int irq_pins[HOST_MAX_READERS] = {-1, -1, -1, -1, -1, -1, -1, -1};
+static int8_t readers_initialised = 0;
+static HostReaderStats reader_stats = {};
+static uint8_t dropout_percent = 0;
+static std::mt19937 dropout_generator(1234);
+static HostScript *script = nullptr;
+static MFRC522 *chips[HOST_MAX_READERS];
+
+void hostPlaceCard(const uint8_t *uid, uint8_t size, uint8_t reader)
+{
+  std::lock_guard<std::mutex> guard(field_lock);
+  HostCard &card = cards[reader % HOST_MAX_READERS];
+  card.present = true;
+  card.size = size > sizeof(card.uid) ? sizeof(card.uid) : size;
+  memcpy(card.uid, uid, card.size);
+  card.state = CARD_IDLE;
+}
+
+void hostRemoveCard(uint8_t reader)
+{
+  std::lock_guard<std::mutex> guard(field_lock);
+  cards[reader % HOST_MAX_READERS].present = false;
+}
+
+void hostSetCardDropout(uint8_t percent)
+{
+  std::lock_guard<std::mutex> guard(field_lock);
+  dropout_percent = percent;
+}
+
+/**
+ * Whether a frame to a card in the field is lost to a glitch. Call with field_lock held.
+ */
+static bool droppedFrame()
+{
+  return dropout_percent > 0 && dropout_generator() % 100 < dropout_percent;
+}
+
+void hostSetReaderIrqPin(int pin, uint8_t reader)
+{
+  irq_pins[reader % HOST_MAX_READERS] = pin;
+  if (pin >= 0)
+    hostDrivePin(pin, HIGH);
+}
+
+void hostSetScript(HostScript *next)
+{
+  std::lock_guard<std::mutex> guard(field_lock);
+  script = next;
+}
+
+HostScript *hostScript()
+{
+  std::lock_guard<std::mutex> guard(field_lock);
+  return script;
+}
+
+/**
+ * Whether a card answers a WUPA/REQA on the reader now. Call with field_lock held.
+ */
+static bool answers(uint8_t reader, byte command, byte &status)
+{
+  if (script != nullptr)
+  {
+    status = MFRC522::STATUS_TIMEOUT;
+    return script->wakeup(reader, status) && (status == MFRC522::STATUS_OK || status == MFRC522::STATUS_COLLISION);
+  }
+
+  HostCard &card = cards[reader];
+  bool answered = card.present && fields_on[reader] && !droppedFrame() &&
+                  (card.state == CARD_IDLE || card.state == CARD_READY || (command == MFRC522::PICC_CMD_WUPA && card.state == CARD_HALT));
+  if (answered)
+    card.state = CARD_READY;
+  status = answered ? MFRC522::STATUS_OK : MFRC522::STATUS_TIMEOUT;
+  return answered;
+}
+
+HostReaderStats hostReaderStats()
+{
+  std::lock_guard<std::mutex> guard(field_lock);
+  return reader_stats;
+}
+
+/**
+ * The calling task waits for the reader, as it would polling ComIrqReg over SPI.
+ */
+static void busy(uint32_t us, bool timed_out)
+{
+  {
+    std::lock_guard<std::mutex> guard(field_lock);
+    reader_stats.transceives++;
+    reader_stats.busy_us += us;
+    if (timed_out)
+      reader_stats.timeouts++;
+  }
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void MFRC522::PCD_Init(byte chipSelectPin, byte resetPowerDownPin)
+{
+  chip_select = chipSelectPin;
+  PCD_Init();
+}
+
+void MFRC522::PCD_Init()
+{
+  if (reader < 0)
+    reader = readers_initialised++ % HOST_MAX_READERS;
+  chips[reader] = this;
+  memset(registers, 0, sizeof(registers));
+  fifo_level = 0;
+  registers[TModeReg >> 1] = 0x80;
+  registers[TPrescalerReg >> 1] = 0xA9;
+  registers[TReloadRegH >> 1] = 0x03;
+  registers[TReloadRegL >> 1] = 0xE8;
+  registers[TxASKReg >> 1] = 0x40;
+  registers[ModeReg >> 1] = 0x3D;
+  registers[VersionReg >> 1] = 0x92;
+  delay(50);
+  PCD_AntennaOn();
+}
+
+void MFRC522::PCD_WriteRegister(PCD_Register reg, byte value)
+{
+  switch (reg)
+  {
+  case ComIrqReg:
+    // Bit 7 (Set1) selects whether the marked bits are set or cleared.
+    if (value & 0x80)
+      registers[reg >> 1] |= value & 0x7F;
+    else
+      registers[reg >> 1] &= ~value;
+    updateIrq();
+    return;
+  case ComIEnReg:
+    registers[reg >> 1] = value;
+    updateIrq();
+    return;
+  case FIFODataReg:
+    if (fifo_level < sizeof(fifo))
+      fifo[fifo_level++] = value;
+    return;
+  case FIFOLevelReg:
+    if (value & 0x80)
+      fifo_level = 0;
+    return;
+  case TxControlReg:
+  {
+    registers[reg >> 1] = value;
+    std::lock_guard<std::mutex> guard(field_lock);
+    bool on = (value & 0x03) != 0;
+    // Without the field the card loses power and starts over in the idle state.
+    if (fields_on[reader] && !on)
+      cards[reader].state = CARD_IDLE;
+    fields_on[reader] = on;
+    return;
+  }
+  case BitFramingReg:
+    registers[reg >> 1] = value & 0x7F;
+    if ((value & 0x80) && registers[CommandReg >> 1] == PCD_Transceive)
+      startTransceive();
+    return;
+  default:
+    registers[reg >> 1] = value;
+  }
+}
+
+byte MFRC522::PCD_ReadRegister(PCD_Register reg)
+{
+  if (reg == FIFOLevelReg)
+    return fifo_level;
+  return registers[reg >> 1];
+}
+
+void MFRC522::PCD_SetRegisterBitMask(PCD_Register reg, byte mask)
+{
+  PCD_WriteRegister(reg, PCD_ReadRegister(reg) | mask);
+}
+
+void MFRC522::PCD_ClearRegisterBitMask(PCD_Register reg, byte mask)
+{
+  PCD_WriteRegister(reg, PCD_ReadRegister(reg) & ~mask);
+}
+
+void MFRC522::PCD_AntennaOn()
+{
+  PCD_SetRegisterBitMask(TxControlReg, 0x03);
+}
+
+void MFRC522::PCD_AntennaOff()
+{
+  PCD_ClearRegisterBitMask(TxControlReg, 0x03);
+}
+
+MFRC522::StatusCode MFRC522::PICC_RequestA(byte *bufferATQA, byte *bufferSize)
+{
+  return requestOrWakeup(PICC_CMD_REQA, bufferATQA, bufferSize);
+}
+
+MFRC522::StatusCode MFRC522::PICC_WakeupA(byte *bufferATQA, byte *bufferSize)
+{
+  return requestOrWakeup(PICC_CMD_WUPA, bufferATQA, bufferSize);
+}
+
+MFRC522::StatusCode MFRC522::requestOrWakeup(byte command, byte *bufferATQA, byte *bufferSize)
+{
+  if (bufferATQA == nullptr || *bufferSize < 2)
+    return STATUS_NO_ROOM;
+
+  PCD_WriteRegister(ComIrqReg, 0x7F);
+  bool answered;
+  byte status;
+  {
+    std::lock_guard<std::mutex> guard(field_lock);
+    answered = answers(reader, command, status);
+  }
+
+  busy(answered ? ANSWER_US : timeoutUs(), !answered);
+  PCD_WriteRegister(ComIrqReg, 0x80 | (answered ? RX_IRQ : TIMER_IRQ));
+  if (!answered)
+    return (StatusCode)status;
+
+  bufferATQA[0] = 0x04;
+  bufferATQA[1] = 0x00;
+  *bufferSize = 2;
+  return (StatusCode)status;
+}
+
+MFRC522::StatusCode MFRC522::PICC_Select(Uid *uid, byte validBits)
+{
+  PCD_WriteRegister(ComIrqReg, 0x7F);
+  bool selected;
+  byte status = STATUS_TIMEOUT;
+  {
+    std::lock_guard<std::mutex> guard(field_lock);
+    if (script != nullptr)
+    {
+      byte size = 0;
+      status = script->select(reader, uid->uidByte, size);
+      selected = status == STATUS_OK;
+      if (selected)
+      {
+        uid->size = size;
+        uid->sak = 0x08;
+      }
+    }
+    else
+    {
+      HostCard &card = cards[reader];
+      selected = card.present && fields_on[reader] && !droppedFrame() && (card.state == CARD_READY || card.state == CARD_ACTIVE);
+      if (selected && validBits > 0)
+        selected = validBits / 8 <= card.size && memcmp(uid->uidByte, card.uid, validBits / 8) == 0;
+      if (selected)
+      {
+        card.state = CARD_ACTIVE;
+        uid->size = card.size;
+        memcpy(uid->uidByte, card.uid, card.size);
+        uid->sak = 0x08;
+      }
+    }
+  }
+
+  uint32_t levels = uid->size > 7 ? 3 : uid->size > 4 ? 2 : 1;
+  busy(selected ? SELECT_US * levels : timeoutUs(), !selected);
+  PCD_WriteRegister(ComIrqReg, 0x80 | (selected ? RX_IRQ : TIMER_IRQ));
+  return selected ? STATUS_OK : (StatusCode)status;
+}
+
+MFRC522::StatusCode MFRC522::PICC_HaltA()
+{
+  PCD_WriteRegister(ComIrqReg, 0x7F);
+  {
+    std::lock_guard<std::mutex> guard(field_lock);
+    HostCard &card = cards[reader];
+    if (card.present && fields_on[reader] && card.state == CARD_ACTIVE)
+      card.state = CARD_HALT;
+  }
+
+  // HLTA is never answered: the library reports success once the receive times out.
+  busy(timeoutUs(), false);
+  PCD_WriteRegister(ComIrqReg, 0x80 | TIMER_IRQ);
+  return STATUS_OK;
+}
+
+const __FlashStringHelper *MFRC522::GetStatusCodeName(StatusCode code)
+{
+  switch (code)
+  {
+  case STATUS_OK:
+    return F("Success.");
+  case STATUS_ERROR:
+    return F("Error in communication.");
+  case STATUS_COLLISION:
+    return F("Collission detected.");
+  case STATUS_TIMEOUT:
+    return F("Timeout in communication.");
+  case STATUS_NO_ROOM:
+    return F("A buffer is not big enough.");
+  case STATUS_INTERNAL_ERROR:
+    return F("Internal error in the code. Should not happen.");
+  case STATUS_INVALID:
+    return F("Invalid argument.");
+  case STATUS_CRC_WRONG:
+    return F("The CRC_A does not match.");
+  case STATUS_MIFARE_NACK:
+    return F("A MIFARE PICC responded with NAK.");
+  default:
+    return F("Unknown error");
+  }
+}
+
+/**
+ * A WUPA/REQA started without the library: the answer comes back without blocking.
+ */
+void MFRC522::startTransceive()
+{
+  byte command = fifo_level > 0 ? fifo[0] : 0;
+  fifo_level = 0;
+  if (command != PICC_CMD_WUPA && command != PICC_CMD_REQA)
+    return;
+
+  bool answered;
+  {
+    std::lock_guard<std::mutex> guard(field_lock);
+    reader_stats.transceives++;
+    byte status;
+    answered = answers(reader, command, status);
+  }
+
+  if (answered)
+  {
+    fifo[0] = 0x04;
+    fifo[1] = 0x00;
+    fifo_level = 2;
+    PCD_WriteRegister(ComIrqReg, 0x80 | RX_IRQ);
+  }
+}
+
+/**
+ * IRQ output with IRqInv set: low while an enabled interrupt bit is pending.
+ */
+void MFRC522::updateIrq()
+{
+  int irq_pin = irq_pins[reader];
+  if (irq_pin < 0)
+    return;
+  bool pending = (registers[ComIEnReg >> 1] & registers[ComIrqReg >> 1] & 0x7F) != 0;
+  bool inverted = registers[ComIEnReg >> 1] & 0x80;
+  hostDrivePin(irq_pin, pending == inverted ? LOW : HIGH);
+}
+
+/**
+ * Receive timeout of the TReload timer, in us (13.56 MHz clock through the prescaler).
+ */
+uint32_t MFRC522::timeoutUs()
+{
+  uint32_t prescaler = (registers[TModeReg >> 1] & 0x0F) << 8 | registers[TPrescalerReg >> 1];
+  uint32_t reload = registers[TReloadRegH >> 1] << 8 | registers[TReloadRegL >> 1];
+  return (uint32_t)((uint64_t)(reload + 1) * (2 * prescaler + 1) * 100 / 1356);
+}
+
+/**
+ * A write frame puts every data byte into the addressed register; a read frame answers each
+ * byte with the register addressed by the byte before.
+ */
+void MFRC522::hostSpiFrame(const uint8_t *tx, uint8_t *rx, size_t length)
+{
+  if (length == 0)
+    return;
+  if (!(tx[0] & 0x80))
+  {
+    for (size_t i = 1; i < length; i++)
+      PCD_WriteRegister((PCD_Register)(tx[0] & 0x7E), tx[i]);
+    return;
+  }
+  for (size_t i = 1; i < length; i++)
+  {
+    byte value = PCD_ReadRegister((PCD_Register)(tx[i - 1] & 0x7E));
+    if (rx != nullptr)
+      rx[i] = value;
+  }
+}
+
+void SPIClass::transferBytes(const uint8_t *data, uint8_t *out, uint32_t size)
+{
+  if (out != nullptr && size > 0)
+    out[0] = 0;
+  for (MFRC522 *chip : chips)
+  {
+    if (chip != nullptr && chip->chip_select >= 0 && hostPinLevel(chip->chip_select) == LOW)
+    {
+      chip->hostSpiFrame(data, out, size);
+      return;
+    }
+  }
+}
@@ -0,0 +1,336 @@
+#include <HTTPClient.h>
+#include <WiFi.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "host.h"
+
+WiFiClass WiFi;
+
+struct EventHandler
+{
+  WiFiEventFuncCb callback;
+  arduino_event_id_t event;
+};
+
+static std::mutex wifi_lock;
+static std::vector<EventHandler> handlers;
+static wl_status_t wifi_status = WL_DISCONNECTED;
+static bool ap_available = true;
+static uint32_t connect_delay_ms = 50;
+static uint32_t generation = 0; // bumped by begin()/disconnect() to cancel a pending association
+static uint8_t ap_bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+static std::string server_host = "127.0.0.1";
+static uint16_t server_port = 80;
+static std::string broker_host = "127.0.0.1";
+static uint16_t broker_port = 1883;
+
+static void dispatch(arduino_event_id_t event, uint8_t reason = 0)
+{
+  std::vector<EventHandler> targets;
+  {
+    std::lock_guard<std::mutex> guard(wifi_lock);
+    targets = handlers;
+  }
+
+  arduino_event_info_t info = {};
+  if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED)
+    info.wifi_sta_disconnected.reason = reason;
+  for (const EventHandler &handler : targets)
+  {
+    if (handler.event == event || handler.event == ARDUINO_EVENT_MAX)
+      handler.callback(event, info);
+  }
+}
+
+int WiFiClass::onEvent(WiFiEventFuncCb callback, arduino_event_id_t event)
+{
+  std::lock_guard<std::mutex> guard(wifi_lock);
+  handlers.push_back({callback, event});
+  return (int)handlers.size();
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect)
+{
+  uint32_t attempt;
+  uint32_t delay_ms;
+  {
+    std::lock_guard<std::mutex> guard(wifi_lock);
+    attempt = ++generation;
+    delay_ms = connect_delay_ms;
+    wifi_status = WL_DISCONNECTED;
+  }
+
+  // Association runs on the "WiFi event task".
+  std::thread([attempt, delay_ms]()
+              {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+                bool up;
+                {
+                  std::lock_guard<std::mutex> guard(wifi_lock);
+                  if (attempt != generation)
+                    return;
+                  up = ap_available;
+                  wifi_status = up ? WL_CONNECTED : WL_NO_SSID_AVAIL;
+                }
+                if (up)
+                {
+                  dispatch(ARDUINO_EVENT_WIFI_STA_CONNECTED);
+                  dispatch(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+                }
+                else
+                {
+                  dispatch(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, WIFI_REASON_NO_AP_FOUND);
+                } })
+      .detach();
+
+  return WL_DISCONNECTED;
+}
+
+bool WiFiClass::disconnect(bool wifioff, bool eraseap)
+{
+  bool was_connected;
+  {
+    std::lock_guard<std::mutex> guard(wifi_lock);
+    generation++;
+    was_connected = wifi_status == WL_CONNECTED;
+    wifi_status = WL_DISCONNECTED;
+  }
+  if (was_connected)
+    dispatch(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, WIFI_REASON_ASSOC_LEAVE);
+  return true;
+}
+
+wl_status_t WiFiClass::status()
+{
+  std::lock_guard<std::mutex> guard(wifi_lock);
+  return wifi_status;
+}
+
+IPAddress WiFiClass::localIP()
+{
+  return status() == WL_CONNECTED ? IPAddress(192, 168, 1, 50) : IPAddress();
+}
+
+uint8_t *WiFiClass::BSSID()
+{
+  return ap_bssid;
+}
+
+int32_t WiFiClass::channel()
+{
+  return 6;
+}
+
+void hostSetWiFiAvailable(bool available)
+{
+  bool lost;
+  {
+    std::lock_guard<std::mutex> guard(wifi_lock);
+    ap_available = available;
+    lost = !available && wifi_status == WL_CONNECTED;
+    if (lost)
+    {
+      generation++;
+      wifi_status = WL_CONNECTION_LOST;
+    }
+  }
+  if (lost)
+    dispatch(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, WIFI_REASON_BEACON_TIMEOUT);
+}
+
+void hostSetWiFiConnectDelay(uint32_t ms)
+{
+  std::lock_guard<std::mutex> guard(wifi_lock);
+  connect_delay_ms = ms;
+}
+
+void hostSetServer(const char *host, uint16_t port)
+{
+  server_host = host;
+  server_port = port;
+}
+
+void hostSetBroker(const char *host, uint16_t port)
+{
+  broker_host = host;
+  broker_port = port;
+}
+
+int WiFiClient::connect(const char *host, uint16_t port, int32_t timeout_ms)
+{
+  stop();
+  if (WiFi.status() != WL_CONNECTED)
+    return 0;
+
+  // The firmware names the real broker; the host always talks to the stand-in.
+  fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(broker_port);
+  inet_pton(AF_INET, broker_host.c_str(), &addr.sin_addr);
+  if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+  {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+int WiFiClient::setNoDelay(bool enabled)
+{
+  int flag = enabled;
+  return fd >= 0 ? setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) : -1;
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+  if (!connected())
+    return 0;
+  size_t sent = 0;
+  while (sent < size)
+  {
+    ssize_t n = ::send(fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+    if (n <= 0)
+    {
+      stop();
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+int WiFiClient::available()
+{
+  int pending = 0;
+  if (!connected() || ioctl(fd, FIONREAD, &pending) < 0)
+    return 0;
+  return pending;
+}
+
+int WiFiClient::read(uint8_t *buffer, size_t size)
+{
+  if (fd < 0)
+    return -1;
+  ssize_t n = ::recv(fd, buffer, size, MSG_DONTWAIT);
+  return n > 0 ? (int)n : -1;
+}
+
+bool WiFiClient::connected()
+{
+  if (fd < 0)
+    return connection.connected();
+
+  // Lost with the access point, or closed by the peer.
+  char probe;
+  if (WiFi.status() != WL_CONNECTED || ::recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+    stop();
+  return fd >= 0;
+}
+
+void WiFiClient::stop()
+{
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+  connection.close();
+}
+
+bool HTTPClient::begin(WiFiClient &client, const char *url)
+{
+  this->client = &client;
+  response.clear();
+
+  // http://host[:port]/path -> /path; the host part is replaced by hostSetServer().
+  const char *start = strstr(url, "://");
+  start = start ? start + 3 : url;
+  const char *slash = strchr(start, '/');
+  path = slash ? slash : "/";
+  return true;
+}
+
+void HTTPClient::addHeader(const String &name, const String &value, bool first, bool replace)
+{
+  // Only the content type reaches the server; the rest of the head is fixed.
+  if (strcasecmp(name.c_str(), "Content-Type") == 0)
+    content_type = value.c_str();
+}
+
+void HTTPClient::end()
+{
+  if (client && !reuse)
+    client->stop();
+}
+
+int HTTPClient::POST(uint8_t *payload, size_t size)
+{
+  if (client == nullptr)
+    return HTTPC_ERROR_NOT_CONNECTED;
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    client->stop();
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+
+  // Replay: the recorded outcome, after the recorded time; only successes reach the server.
+  HostScript *script = hostScript();
+  int scripted_code = 0;
+  uint32_t scripted_us = 0;
+  auto start = std::chrono::steady_clock::now();
+  if (script != nullptr && script->post(path.c_str(), scripted_code, scripted_us) &&
+      (scripted_code < 200 || scripted_code >= 300))
+  {
+    client->stop();
+    std::this_thread::sleep_for(std::chrono::microseconds(scripted_us));
+    return scripted_code;
+  }
+
+  bool was_connected = client->connected();
+  if (!was_connected && !client->connection.connect(server_host.c_str(), server_port))
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+
+  int code = client->connection.post(path.c_str(), reinterpret_cast<const char *>(payload), size, response, reuse,
+                                     content_type.c_str());
+  if (scripted_us > 0)
+    std::this_thread::sleep_until(start + std::chrono::microseconds(scripted_us));
+  if (code < 0)
+    return was_connected ? HTTPC_ERROR_CONNECTION_LOST : HTTPC_ERROR_CONNECTION_REFUSED;
+  return code;
+}
+
+int HTTPClient::writeToStream(Stream *stream)
+{
+  if (stream == nullptr)
+    return HTTPC_ERROR_NO_STREAM;
+  return (int)stream->write(reinterpret_cast<const uint8_t *>(response.data()), response.size());
+}
+
+String HTTPClient::errorToString(int error)
+{
+  switch (error)
+  {
+  case HTTPC_ERROR_CONNECTION_REFUSED:
+    return String("connection refused");
+  case HTTPC_ERROR_CONNECTION_LOST:
+    return String("connection lost");
+  case HTTPC_ERROR_NOT_CONNECTED:
+    return String("not connected");
+  case HTTPC_ERROR_NO_STREAM:
+    return String("no stream");
+  case HTTPC_ERROR_READ_TIMEOUT:
+    return String("read Timeout");
+  default:
+    return String();
+  }
+}
@@ -0,0 +1,156 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HostTask
+{
+  std::string name;
+  std::mutex lock;
+  std::condition_variable notified;
+  uint32_t notify_value = 0;
+  BaseType_t core = 1;
+};
+
+struct HostQueue
+{
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<std::vector<uint8_t>> items;
+  size_t length;
+  size_t item_size;
+};
+
+static thread_local HostTask *current_task = nullptr;
+
+/**
+ * Waits on cv until ready() or the ticks run out (portMAX_DELAY waits forever).
+ */
+template <typename Ready>
+static bool waitFor(std::condition_variable &cv, std::unique_lock<std::mutex> &guard, TickType_t ticks, Ready ready)
+{
+  if (ticks == portMAX_DELAY)
+  {
+    cv.wait(guard, ready);
+    return true;
+  }
+  return cv.wait_for(guard, std::chrono::milliseconds(ticks), ready);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+  HostTask *task = new HostTask;
+  task->name = name ? name : "";
+  task->core = core_id;
+  if (created_task)
+    *created_task = task;
+
+  std::thread([task, code, parameters]()
+              {
+                current_task = task;
+                code(parameters); })
+      .detach();
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+  return xTaskCreatePinnedToCore(code, name, stack_depth, parameters, priority, created_task, 0);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+  if (current_task == nullptr)
+    current_task = new HostTask;
+  return current_task;
+}
+
+BaseType_t xPortGetCoreID()
+{
+  return xTaskGetCurrentTaskHandle()->core;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+  HostTask *task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> guard(task->lock);
+  waitFor(task->notified, guard, ticks_to_wait, [task]()
+          { return task->notify_value > 0; });
+
+  uint32_t value = task->notify_value;
+  if (value > 0)
+    task->notify_value = clear_on_exit ? 0 : value - 1;
+  return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  if (task == nullptr)
+    return pdFAIL;
+  std::lock_guard<std::mutex> guard(task->lock);
+  task->notify_value++;
+  task->notified.notify_all();
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+  xTaskNotifyGive(task);
+  if (higher_priority_task_woken)
+    *higher_priority_task_woken = pdFALSE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+  HostQueue *queue = new HostQueue;
+  queue->length = length;
+  queue->item_size = item_size;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+  std::unique_lock<std::mutex> guard(queue->lock);
+  if (!waitFor(queue->changed, guard, ticks_to_wait, [queue]()
+               { return queue->items.size() < queue->length; }))
+    return pdFALSE;
+
+  const uint8_t *bytes = static_cast<const uint8_t *>(item);
+  queue->items.emplace_back(bytes, bytes + queue->item_size);
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+  std::unique_lock<std::mutex> guard(queue->lock);
+  if (!waitFor(queue->changed, guard, ticks_to_wait, [queue]()
+               { return !queue->items.empty(); }))
+    return pdFALSE;
+
+  memcpy(buffer, queue->items.front().data(), queue->item_size);
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  std::lock_guard<std::mutex> guard(queue->lock);
+  return queue->items.size();
+}
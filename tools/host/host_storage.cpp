@@ -0,0 +1,293 @@
+#include <LittleFS.h>
+#include <Preferences.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "host.h"
+
+fs::LittleFSFS LittleFS;
+
+static std::string fs_root = "/tmp/hotel_monitoring_fs";
+
+typedef std::map<std::string, std::vector<uint8_t>> NvsNamespace;
+static std::mutex nvs_lock;
+static std::map<std::string, NvsNamespace> nvs;
+
+struct HostFile
+{
+  FILE *file = nullptr;
+  DIR *dir = nullptr;
+  std::string path; // as the firmware named it
+  ~HostFile()
+  {
+    if (file)
+      fclose(file);
+    if (dir)
+      closedir(dir);
+  }
+};
+
+static std::string hostPath(const char *path)
+{
+  return fs_root + (path[0] == '/' ? "" : "/") + path;
+}
+
+static bool makeDirectories(const std::string &path)
+{
+  for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+    ::mkdir(path.substr(0, slash).c_str(), 0755);
+  return ::mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+void hostSetFsRoot(const char *path)
+{
+  fs_root = path;
+  while (fs_root.size() > 1 && fs_root.back() == '/')
+    fs_root.pop_back();
+}
+
+namespace fs
+{
+
+File::operator bool() const
+{
+  return impl && (impl->file || impl->dir);
+}
+
+size_t File::read(uint8_t *buffer, size_t size)
+{
+  return impl && impl->file ? fread(buffer, 1, size, impl->file) : 0;
+}
+
+int File::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t File::write(const uint8_t *buffer, size_t size)
+{
+  return impl && impl->file ? fwrite(buffer, 1, size, impl->file) : 0;
+}
+
+bool File::seek(uint32_t position)
+{
+  return impl && impl->file && fseek(impl->file, position, SEEK_SET) == 0;
+}
+
+size_t File::position()
+{
+  return impl && impl->file ? ftell(impl->file) : 0;
+}
+
+size_t File::size()
+{
+  if (!impl || !impl->file)
+    return 0;
+  fflush(impl->file);
+  struct stat st;
+  return fstat(fileno(impl->file), &st) == 0 ? st.st_size : 0;
+}
+
+void File::flush()
+{
+  if (impl && impl->file)
+    fflush(impl->file);
+}
+
+const char *File::name() const
+{
+  if (!impl)
+    return "";
+  const char *slash = strrchr(impl->path.c_str(), '/');
+  return slash ? slash + 1 : impl->path.c_str();
+}
+
+const char *File::path() const
+{
+  return impl ? impl->path.c_str() : "";
+}
+
+bool File::isDirectory() const
+{
+  return impl && impl->dir;
+}
+
+File File::openNextFile(const char *mode)
+{
+  if (!impl || !impl->dir)
+    return File();
+
+  while (struct dirent *entry = readdir(impl->dir))
+  {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    std::string path = impl->path + (impl->path.back() == '/' ? "" : "/") + entry->d_name;
+    return LittleFS.open(path.c_str(), mode);
+  }
+  return File();
+}
+
+File FS::open(const char *path, const char *mode, bool create)
+{
+  std::shared_ptr<HostFile> impl = std::make_shared<HostFile>();
+  impl->path = path;
+  std::string full = hostPath(path);
+
+  struct stat st;
+  if (stat(full.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+  {
+    impl->dir = opendir(full.c_str());
+    return File(impl);
+  }
+
+  std::string host_mode = std::string(mode) + "b";
+  impl->file = fopen(full.c_str(), host_mode.c_str());
+  return File(impl);
+}
+
+bool FS::exists(const char *path)
+{
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char *path)
+{
+  return ::unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to)
+{
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path)
+{
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char *path)
+{
+  return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+bool LittleFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel)
+{
+  return makeDirectories(fs_root);
+}
+
+bool LittleFSFS::format()
+{
+  std::string command = "rm -rf '" + fs_root + "'";
+  return system(command.c_str()) == 0 && makeDirectories(fs_root);
+}
+
+size_t LittleFSFS::usedBytes()
+{
+  return 0;
+}
+
+} // namespace fs
+
+bool Preferences::begin(const char *name, bool readOnly, const char *partition_label)
+{
+  std::lock_guard<std::mutex> guard(nvs_lock);
+  // Like NVS, a read-only open of a namespace that was never written fails.
+  if (readOnly && nvs.find(name) == nvs.end())
+    return false;
+  nvs[name];
+  this->name = name;
+  read_only = readOnly;
+  started = true;
+  return true;
+}
+
+void Preferences::end()
+{
+  started = false;
+}
+
+bool Preferences::clear()
+{
+  if (!started || read_only)
+    return false;
+  std::lock_guard<std::mutex> guard(nvs_lock);
+  nvs[name].clear();
+  return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+  if (!started || read_only)
+    return false;
+  std::lock_guard<std::mutex> guard(nvs_lock);
+  return nvs[name].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char *key)
+{
+  if (!started)
+    return false;
+  std::lock_guard<std::mutex> guard(nvs_lock);
+  return nvs[name].count(key) > 0;
+}
+
+size_t Preferences::putString(const char *key, const char *value)
+{
+  // Stored with its terminator, as nvs_set_str() does.
+  return putBytes(key, value, strlen(value) + 1) > 0 ? strlen(value) : 0;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length)
+{
+  if (!started || read_only)
+    return 0;
+  std::lock_guard<std::mutex> guard(nvs_lock);
+  const uint8_t *bytes = static_cast<const uint8_t *>(value);
+  nvs[name][key].assign(bytes, bytes + length);
+  return length;
+}
+
+size_t Preferences::getString(const char *key, char *value, size_t maxLen)
+{
+  size_t length = getBytesLength(key);
+  if (length == 0 || length > maxLen)
+    return 0;
+  return getBytes(key, value, maxLen);
+}
+
+String Preferences::getString(const char *key, const String &defaultValue)
+{
+  char value[4000];
+  return getString(key, value, sizeof(value)) > 0 ? String(value) : defaultValue;
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+  if (!started)
+    return 0;
+  std::lock_guard<std::mutex> guard(nvs_lock);
+  NvsNamespace &space = nvs[name];
+  auto entry = space.find(key);
+  return entry == space.end() ? 0 : entry->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t maxLen)
+{
+  if (!started)
+    return 0;
+  std::lock_guard<std::mutex> guard(nvs_lock);
+  NvsNamespace &space = nvs[name];
+  auto entry = space.find(key);
+  if (entry == space.end() || entry->second.size() > maxLen)
+    return 0;
+  memcpy(buffer, entry->second.data(), entry->second.size());
+  return entry->second.size();
+}
@@ -0,0 +1,417 @@
+/*
+ * Host simulation: runs the unmodified firmware (setup()/loop() from src/main.cpp) against the
+ * fakes in tools/host and the local mock server, taps cards and measures tap-to-relay latency
+ * and end-to-end delivery (an Entry or Denied event per tap, an Exit per allowed one). The base
+ * for load tests and regression benchmarks of the firmware.
+ *
+ *   pio run -e native && .pio/build/native/program [taps] [outage_ms] [latency_ms] [deny_every] [dropout_pct] [sync_delay_ms] [reset] [stay_s]
+ *
+ * outage_ms > 0 takes the access point away for that long halfway through the taps, so scans
+ * have to go through the offline journal. deny_every > 0 leaves every deny_every-th tag off
+ * the server's allow list; those taps must not switch the relay. dropout_pct > 0 makes cards
+ * miss that share of the frames sent to them (RF glitches); the relay must not drop while a
+ * card stays in the field. sync_delay_ms delays the first SNTP sync that long after boot;
+ * scans from before it must still reach the server with their time. reset = 1 browns the chip
+ * out (hostReset()) with a card locked on the first reader before the taps; after the reset its
+ * relay has to come back at once and stay on until the card is taken out, which must still end
+ * the stay with an Exit. stay_s > 0 gives one extra card a stay limit of that many seconds and
+ * leaves it in the field after the taps: its relay has to go off on time, with an Expired
+ * event and no Exit when it is taken out. With READER_COUNT > 1 every tap goes to a random reader and waits
+ * for that reader's relay.
+ *
+ * Built with UPLOAD_TRANSPORT=UPLOAD_TRANSPORT_MQTT the events go to the mock broker instead,
+ * acknowledged after latency_ms, and the sim also pushes a remote relay off for a card still
+ * in the field.
+ *
+ * Built with FIELD_TRACE=1 the run is recorded and kept in field.trc, for tools/replay.
+ */
+// The unit tests (pio test -e native) build src/ with this env and bring their own main().
+#ifndef PIO_UNIT_TESTING
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "field_trace.h"
+#include "host.h"
+#include "mock_broker.h"
+#include "mock_server.h"
+#include "push_channel.h"
+#include "reader_array.h"
+#include "uploader.h"
+
+void setup();
+void loop();
+
+static uint64_t nowUs()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void sleepMs(uint32_t ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+/**
+ * Waits for a reader's SSR output to reach level; returns the time it took in us, or 0 on timeout.
+ */
+static uint64_t waitForRelay(uint8_t reader, int level, uint64_t since_us, uint32_t timeout_ms)
+{
+  while (hostPinLevel(reader_pins[reader].ssr) != level)
+  {
+    if (nowUs() - since_us > timeout_ms * 1000ULL)
+      return 0;
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  return nowUs() - since_us;
+}
+
+/**
+ * Watches a reader's SSR for ms; returns how often it switched off.
+ */
+static int relayDrops(uint8_t reader, uint32_t ms)
+{
+  int drops = 0;
+  int level = hostPinLevel(reader_pins[reader].ssr);
+  uint64_t start_us = nowUs();
+  while (nowUs() - start_us < ms * 1000ULL)
+  {
+    int now = hostPinLevel(reader_pins[reader].ssr);
+    if (level == HIGH && now == LOW)
+      drops++;
+    level = now;
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  return drops;
+}
+
+int main(int argc, char **argv)
+{
+  int taps = argc > 1 ? atoi(argv[1]) : 20;
+  uint32_t outage_ms = argc > 2 ? strtoul(argv[2], nullptr, 10) : 0;
+  uint32_t latency_ms = argc > 3 ? strtoul(argv[3], nullptr, 10) : 20;
+  int deny_every = argc > 4 ? atoi(argv[4]) : 0;
+  int dropout_pct = argc > 5 ? atoi(argv[5]) : 0;
+  uint32_t sync_delay_ms = argc > 6 ? strtoul(argv[6], nullptr, 10) : 0;
+  bool reset = argc > 7 && atoi(argv[7]) > 0;
+  uint32_t stay_s = argc > 8 ? strtoul(argv[8], nullptr, 10) : 0;
+  bool after_reset = esp_reset_reason() != ESP_RST_POWERON;
+
+  MockServer server;
+  MockServer::Options options;
+  options.latency_us = latency_ms * 1000;
+  if (!server.start(options))
+  {
+    fprintf(stderr, "mock server failed to start\n");
+    return 1;
+  }
+  hostSetServer("127.0.0.1", server.port());
+
+  MockBroker broker;
+  bool mqtt = UPLOAD_TRANSPORT == UPLOAD_TRANSPORT_MQTT;
+  if (mqtt)
+  {
+    MockBroker::Options broker_options;
+    broker_options.latency_us = latency_ms * 1000;
+    if (!broker.start(broker_options))
+    {
+      fprintf(stderr, "mock broker failed to start\n");
+      return 1;
+    }
+    hostSetBroker("127.0.0.1", broker.port());
+  }
+  // Events delivered over whichever transport the firmware was built with.
+  auto delivered_events = [&]()
+  { return mqtt ? (uint32_t)broker.stats().events : (uint32_t)server.stats().events; };
+  auto undated_events = [&]()
+  { return mqtt ? (uint32_t)broker.stats().undated : (uint32_t)server.stats().undated; };
+
+  // Flash keeps its content through a reset.
+  char fs_root[] = "/tmp/hotel_monitoring_fs.XXXXXX";
+  if (after_reset && getenv("HOST_SIM_FS") != nullptr)
+    strlcpy(fs_root, getenv("HOST_SIM_FS"), sizeof(fs_root));
+  else if (mkdtemp(fs_root) == nullptr)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  hostSetFsRoot(fs_root);
+  hostSetCardDropout(dropout_pct);
+  hostSetTimeSyncDelay(sync_delay_ms);
+#if CARD_DETECT_IRQ
+  for (uint8_t reader = 0; reader < READER_COUNT; reader++)
+    hostSetReaderIrqPin(reader_pins[reader].irq, reader);
+#endif
+
+  // RTC memory outlives the reset; the card locked before it is still in the field.
+  char rtc_path[64];
+  snprintf(rtc_path, sizeof(rtc_path), "/tmp/hotel_monitoring_rtc.%d", (int)getpid());
+  uint8_t kept_uid[4] = {0xA1, 0xB2, 0xFE, 0xED};
+  if (reset)
+    hostSetRtcFile(rtc_path);
+  if (after_reset)
+    hostPlaceCard(kept_uid, sizeof(kept_uid), 0);
+  uint64_t boot_us = nowUs() - esp_timer_get_time();
+
+  // The Arduino loop task.
+  std::thread([]()
+              {
+                setup();
+                for (;;)
+                  loop(); })
+      .detach();
+
+  uint64_t restored_us = after_reset ? waitForRelay(0, HIGH, boot_us, 2000) : 0;
+
+  uint8_t stay_uid[4] = {0xA1, 0xB2, 0xC0, 0xDE};
+  bool allow_list = deny_every > 0 || stay_s > 0;
+  if (allow_list)
+  {
+    std::vector<std::string> allowed;
+    for (int i = 0; i < taps; i++)
+    {
+      char tag[16];
+      snprintf(tag, sizeof(tag), "A1B2%02X%02X", (i >> 8) & 0xFF, i & 0xFF);
+      if (deny_every == 0 || i % deny_every != deny_every - 1)
+        allowed.push_back(tag);
+    }
+    allowed.push_back("A1B2C0DE");
+    allowed.push_back("A1B2FEED"); // the card kept through a reset
+    server.setAllowList(allowed);
+    if (stay_s > 0)
+      server.setStayLimits({"A1B2C0DE"}, stay_s);
+  }
+
+  // Wait for the connection and a token (and the allow list) before the first tap.
+  uint64_t started_us = nowUs();
+  while ((server.stats().tokens_issued == 0 || (allow_list && server.stats().allow_list_requests == 0) ||
+          (mqtt && broker.stats().sessions == 0)) &&
+         nowUs() - started_us < 10000000)
+    sleepMs(10);
+  sleepMs(50);
+
+  if (reset && !after_reset)
+  {
+    hostPlaceCard(kept_uid, sizeof(kept_uid), 0);
+    if (!waitForRelay(0, HIGH, nowUs(), 2000))
+      Serial.println("[sim] card for the reset was not locked");
+    sleepMs(200);
+    Serial.println("[sim] brownout with a card locked on reader 0");
+    setenv("HOST_SIM_FS", fs_root, 1);
+    hostReset(ESP_RST_BROWNOUT);
+  }
+
+  // After the reset: the relay came back by itself; it has to hold until the card goes.
+  int reset_drops = 0;
+  if (after_reset)
+  {
+    reset_drops = relayDrops(0, 1000);
+    hostRemoveCard(0);
+    waitForRelay(0, LOW, nowUs(), 2000);
+  }
+
+  std::mt19937 generator(2024);
+  std::uniform_int_distribution<uint32_t> gap_ms(200, 600);
+  std::uniform_int_distribution<uint32_t> pick_reader(0, READER_COUNT - 1);
+  std::vector<uint64_t> tap_us;
+  std::vector<uint64_t> removal_us;
+  int missed = 0;
+  int wrongly_allowed = 0;
+  int chatter = 0;
+
+  for (int i = 0; i < taps; i++)
+  {
+    if (outage_ms > 0 && i == taps / 2)
+    {
+      Serial.printf("[sim] access point down for %u ms\n", outage_ms);
+      hostSetWiFiAvailable(false);
+    }
+
+    // Land taps at random points of the card reader's wake-up interval.
+    sleepMs(gap_ms(generator));
+
+    uint8_t reader = pick_reader(generator);
+    uint8_t uid[4] = {0xA1, 0xB2, (uint8_t)(i >> 8), (uint8_t)i};
+    uint64_t placed_us = nowUs();
+    hostPlaceCard(uid, sizeof(uid), reader);
+    if (deny_every > 0 && i % deny_every == deny_every - 1)
+    {
+      // Not on the list: the relay has to stay off.
+      if (waitForRelay(reader, HIGH, placed_us, 500))
+        wrongly_allowed++;
+    }
+    else
+    {
+      uint64_t latency = waitForRelay(reader, HIGH, placed_us, 2000);
+      if (latency)
+        tap_us.push_back(latency);
+      else
+        missed++;
+    }
+
+    // The card stays in the field; its relay must not drop meanwhile.
+    chatter += relayDrops(reader, gap_ms(generator));
+    uint64_t removed_us = nowUs();
+    bool relay_on = hostPinLevel(reader_pins[reader].ssr) == HIGH;
+    hostRemoveCard(reader);
+    uint64_t latency = waitForRelay(reader, LOW, removed_us, 2000);
+    if (relay_on && latency)
+      removal_us.push_back(latency);
+
+    if (outage_ms > 0 && i == taps / 2)
+    {
+      sleepMs(outage_ms);
+      Serial.println("[sim] access point back");
+      hostSetWiFiAvailable(true);
+    }
+  }
+
+  // Everything scanned should reach the server, through the journal if need be.
+  int expected = taps - missed + (int)removal_us.size() + (after_reset ? 1 : 0);
+  uint64_t drain_start_us = nowUs();
+  while ((int)delivered_events() < expected && nowUs() - drain_start_us < 30000000)
+    sleepMs(10);
+  uint64_t drain_us = nowUs() - drain_start_us;
+
+  // Stay limit: the relay goes off by itself with the card still there, which is an Expired
+  // event; taking the card out afterwards is not an Exit.
+  uint64_t stay_off_us = 0;
+  int stay_exits = 0;
+  if (stay_s > 0)
+  {
+    uint32_t exits_before = server.stats().exits;
+    hostPlaceCard(stay_uid, sizeof(stay_uid), 0);
+    uint64_t placed_us = nowUs();
+    if (waitForRelay(0, HIGH, placed_us, 2000))
+      stay_off_us = waitForRelay(0, LOW, placed_us, stay_s * 1000 + STAY_TICK_MS + 3000);
+    hostRemoveCard(0);
+    sleepMs(500);
+    if (stay_off_us == 0)
+      Serial.println("[sim] relay stayed on past the stay limit");
+    expected += 2;
+    uint64_t settle_us = nowUs();
+    while ((int)delivered_events() < expected && nowUs() - settle_us < 5000000)
+      sleepMs(10);
+    stay_exits = server.stats().exits - exits_before;
+  }
+
+  // Remote relay off: the server pushes it while a card is still in the field.
+  uint64_t push_us = 0;
+  if (mqtt)
+  {
+    uint8_t uid[4] = {0xA1, 0xB2, 0x00, 0x00};
+    hostPlaceCard(uid, sizeof(uid), 0);
+    if (waitForRelay(0, HIGH, nowUs(), 2000))
+    {
+      uint64_t pushed_us = nowUs();
+      broker.push(std::string(MQTT_TOPIC_PREFIX "/") + broker.clientId() + "/cmd/relay-off", "0");
+      push_us = waitForRelay(0, LOW, pushed_us, 2000);
+    }
+    hostRemoveCard(0);
+    waitForRelay(0, LOW, nowUs(), 2000);
+    if (push_us == 0)
+      Serial.println("[sim] pushed relay off was not applied");
+    // The tap above is delivered too (an Entry; its relay was released, so no Exit).
+    expected++;
+    uint64_t settle_us = nowUs();
+    while ((int)delivered_events() < expected && nowUs() - settle_us < 5000000)
+      sleepMs(10);
+  }
+
+  std::sort(tap_us.begin(), tap_us.end());
+  uint64_t total = 0;
+  for (uint64_t latency : tap_us)
+    total += latency;
+
+  Serial.printf("\n[sim] %d taps, %d missed, %d switched the relay without being on the allow list, %d relay drops with the card in the field\n",
+                taps, missed, wrongly_allowed, chatter);
+  if (!tap_us.empty())
+  {
+    Serial.printf("[sim] tap-to-relay: min %.1f ms, avg %.1f ms, p95 %.1f ms, max %.1f ms\n",
+                  tap_us.front() / 1000.0, total / 1000.0 / tap_us.size(),
+                  tap_us[std::min(tap_us.size() - 1, tap_us.size() * 95 / 100)] / 1000.0, tap_us.back() / 1000.0);
+  }
+  if (!removal_us.empty())
+  {
+    std::sort(removal_us.begin(), removal_us.end());
+    uint64_t removal_total = 0;
+    for (uint64_t latency : removal_us)
+      removal_total += latency;
+    Serial.printf("[sim] removal-to-relay-off: avg %.1f ms, max %.1f ms\n", removal_total / 1000.0 / removal_us.size(),
+                  removal_us.back() / 1000.0);
+  }
+  ReaderArrayStats boot = readers.stats();
+  Serial.printf("[sim] boot: relays set %.1f ms, first card detection %.1f ms after power-on\n", boot.restore_us / 1000.0,
+                boot.first_poll_us / 1000.0);
+  if (after_reset)
+    Serial.printf("[sim] reset: %u locked card restored, relay back %.1f ms after boot, %d relay drops before the card was taken out\n",
+                  boot.restored, restored_us / 1000.0, reset_drops);
+  HostReaderStats reader = hostReaderStats();
+  if (stay_s > 0)
+    Serial.printf("[sim] stay limit %u s: relay off %.1f ms after the card went in, %u expired events\n", stay_s,
+                  stay_off_us / 1000.0, (unsigned)server.stats().expired);
+  Serial.printf("[sim] reader: %u transceives, %u timeouts, %.1f ms busy\n", reader.transceives, reader.timeouts,
+                reader.busy_us / 1000.0);
+  PcdBusStats bus = {};
+  uint32_t wakeups = 0;
+  for (uint8_t i = 0; i < READER_COUNT; i++)
+  {
+    PcdBusStats one = readers.busStats(i);
+    bus.bytes += one.bytes;
+    bus.frames += one.frames;
+    bus.transactions += one.transactions;
+    bus.skipped += one.skipped;
+    wakeups += readers.stats(i).probes + readers.stats(i).presence_checks;
+  }
+  Serial.printf("[sim] spi: %u bytes in %u frames and %u transactions, %u writes skipped; per wake-up %.1f bytes, %.1f frames\n",
+                bus.bytes, bus.frames, bus.transactions, bus.skipped, wakeups ? (double)bus.bytes / wakeups : 0.0,
+                wakeups ? (double)bus.frames / wakeups : 0.0);
+  Serial.printf("[sim] server: %u connections, %u requests, %u tokens, %u events (%u exits, %u without a time, %d expected), %u batches, drained %.1f ms after the last tap\n",
+                (unsigned)server.stats().connections, (unsigned)server.stats().requests,
+                (unsigned)server.stats().tokens_issued, (unsigned)server.stats().events,
+                (unsigned)server.stats().exits, (unsigned)server.stats().undated, expected, (unsigned)server.stats().batches, drain_us / 1000.0);
+  uint32_t received = server.stats().events;
+  Serial.printf("[sim] wire: %u requests in a compact encoding, %.1f bytes per event\n", (unsigned)server.stats().compact,
+                received ? (double)server.stats().body_bytes / received : 0.0);
+  if (mqtt)
+  {
+    uint32_t published = broker.stats().events;
+    Serial.printf("[sim] broker: %u connections, %u publishes, %u events (%u exits, %u without a time, %d expected), %u duplicates, %.1f bytes per event, pushed relay-off-to-relay-off %.1f ms\n",
+                  (unsigned)broker.stats().connections, (unsigned)broker.stats().publishes, published,
+                  (unsigned)broker.stats().exits, (unsigned)broker.stats().undated, expected,
+                  (unsigned)broker.stats().duplicates, published ? (double)broker.stats().body_bytes / published : 0.0,
+                  push_us / 1000.0);
+  }
+  uploader.printStats();
+
+  bool delivered = (int)delivered_events() >= expected && undated_events() == 0 && (!mqtt || push_us > 0);
+  bool restored = !after_reset || (restored_us > 0 && reset_drops == 0 && boot.restored == 1);
+  bool stay_kept = stay_s == 0 || (stay_off_us >= stay_s * 1000000ULL && stay_off_us < (stay_s + 2) * 1000000ULL + STAY_TICK_MS * 1000ULL &&
+                                   (mqtt || (server.stats().expired == 1 && stay_exits == 0)));
+  Serial.printf("[sim] allow list: %u requests\n", (unsigned)server.stats().allow_list_requests);
+#if FIELD_TRACE
+  // The uploader task appends the last records within a flush interval (and its 1 s wait).
+  sleepMs(FIELD_TRACE_FLUSH_MS + 1100);
+  std::string keep = std::string("cp '") + fs_root + FIELD_TRACE_PATH "' field.trc";
+  if (system(keep.c_str()) == 0)
+    Serial.printf("[sim] field trace: %u records kept in field.trc\n", fieldTrace.stats().records);
+#endif
+  Serial.flush();
+  std::string cleanup = std::string("rm -rf '") + fs_root + "'";
+  system(cleanup.c_str());
+  if (reset)
+    unlink(rtc_path);
+
+  // The loop and uploader tasks never return; leave without running static destructors under them.
+  _exit(delivered && restored && stay_kept && missed == 0 && wrongly_allowed == 0 ? 0 : 1);
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include "http_client.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+bool HostHttpClient::connect(const char *host, uint16_t port)
+{
+  close();
+  this->host = host;
+  this->port = port;
+
+  fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+  {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void HostHttpClient::close()
+{
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+  buffer.clear();
+}
+
+int HostHttpClient::post(const char *path, const char *body, size_t length, std::string &response, bool keep_alive,
+                         const char *content_type)
+{
+  response.clear();
+  if (fd < 0 && !connect(host.c_str(), port))
+    return -1;
+
+  char head[256];
+  int head_length = snprintf(head, sizeof(head),
+                             "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+                             path, host.c_str(), content_type, length, keep_alive ? "keep-alive" : "close");
+
+  std::string request(head, head_length);
+  request.append(body, length);
+
+  size_t sent = 0;
+  while (sent < request.size())
+  {
+    ssize_t n = ::send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0)
+    {
+      close();
+      return -1;
+    }
+    sent += n;
+  }
+
+  char chunk[4096];
+  size_t head_end;
+  while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos)
+  {
+    ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+    {
+      close();
+      return -1;
+    }
+    buffer.append(chunk, n);
+  }
+
+  std::string response_head = buffer.substr(0, head_end);
+  buffer.erase(0, head_end + 4);
+
+  int code = -1;
+  sscanf(response_head.c_str(), "HTTP/1.%*d %d", &code);
+
+  size_t content_length = 0;
+  const char *length_header = strcasestr(response_head.c_str(), "\r\nContent-Length:");
+  if (length_header)
+    content_length = strtoul(length_header + 17, nullptr, 10);
+
+  while (buffer.size() < content_length)
+  {
+    ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+    {
+      close();
+      return -1;
+    }
+    buffer.append(chunk, n);
+  }
+
+  response = buffer.substr(0, content_length);
+  buffer.erase(0, content_length);
+
+  if (!keep_alive || strcasestr(response_head.c_str(), "\r\nConnection: close"))
+    close();
+
+  return code;
+}
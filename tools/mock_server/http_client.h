@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * Minimal blocking HTTP/1.1 POST client for the host tools (the firmware uses HTTPClient).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+class HostHttpClient
+{
+public:
+  ~HostHttpClient() { close(); }
+
+  bool connect(const char *host, uint16_t port);
+  void close();
+  bool connected() const { return fd >= 0; }
+
+  /**
+   * POSTs a body (JSON by default) to path and stores the response body. Opens the connection
+   * if needed; with keep_alive false the connection is closed afterwards (like HTTPClient::end()).
+   * Returns the HTTP status code, or -1 on a connection error.
+   */
+  int post(const char *path, const char *body, size_t length, std::string &response, bool keep_alive,
+           const char *content_type = "application/json");
+
+private:
+  int fd = -1;
+  std::string host;
+  uint16_t port = 0;
+  std::string buffer;
+};
@@ -0,0 +1,356 @@
+#include "mock_broker.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+
+static uint64_t nowUs()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Fixed header (type and flags, remaining length) in front of body.
+ */
+static std::string packet(uint8_t header, const std::string &body)
+{
+  std::string out(1, (char)header);
+  size_t rest = body.size();
+  do
+  {
+    uint8_t digit = rest % 128;
+    rest /= 128;
+    out += (char)(digit | (rest > 0 ? 0x80 : 0));
+  } while (rest > 0);
+  return out + body;
+}
+
+static std::string u16(uint16_t value)
+{
+  return std::string{(char)(value >> 8), (char)(value & 0xFF)};
+}
+
+static uint16_t readU16(const std::string &body, size_t at)
+{
+  return at + 2 <= body.size() ? (uint8_t)body[at] << 8 | (uint8_t)body[at + 1] : 0;
+}
+
+static std::string readString(const std::string &body, size_t &at)
+{
+  uint16_t length = readU16(body, at);
+  std::string text = at + 2 + length <= body.size() ? body.substr(at + 2, length) : "";
+  at += 2 + length;
+  return text;
+}
+
+/**
+ * MQTT topic match; only the trailing single-level "+" the firmware subscribes with.
+ */
+static bool matches(const std::string &filter, const std::string &topic)
+{
+  if (!filter.empty() && filter.back() == '+')
+  {
+    std::string prefix = filter.substr(0, filter.size() - 1);
+    return topic.compare(0, prefix.size(), prefix) == 0 && topic.find('/', prefix.size()) == std::string::npos;
+  }
+  return filter == topic;
+}
+
+static uint32_t count(const std::string &body, const char *field)
+{
+  uint32_t found = 0;
+  for (size_t at = body.find(field); at != std::string::npos; at = body.find(field, at + 1))
+    found++;
+  return found;
+}
+
+bool MockBroker::start(const Options &options)
+{
+  this->options = options;
+
+  listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    return false;
+
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(options.port);
+  if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(listen_fd, 64) < 0)
+  {
+    ::close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  bound_port = ntohs(addr.sin_port);
+
+  running = true;
+  acceptor = std::thread(&MockBroker::acceptLoop, this);
+  return true;
+}
+
+void MockBroker::stop()
+{
+  if (!running.exchange(false))
+    return;
+
+  ::shutdown(listen_fd, SHUT_RDWR);
+  ::close(listen_fd);
+  acceptor.join();
+
+  std::vector<std::thread> finished;
+  {
+    std::lock_guard<std::mutex> guard(sessions_lock);
+    for (auto &session : sessions)
+    {
+      std::lock_guard<std::mutex> session_guard(session->lock);
+      session->open = false;
+      session->due.notify_all();
+      ::shutdown(session->fd, SHUT_RDWR);
+    }
+    finished.swap(workers);
+  }
+  for (std::thread &worker : finished)
+    worker.join();
+}
+
+int MockBroker::push(const std::string &topic, const std::string &payload)
+{
+  std::lock_guard<std::mutex> guard(sessions_lock);
+  if (++push_id == 0)
+    push_id = 1;
+  std::string publish = packet(0x32, u16(topic.size()) + topic + u16(push_id) + payload); // QoS 1
+
+  int delivered = 0;
+  for (auto &session : sessions)
+  {
+    bool subscribed = false;
+    {
+      std::lock_guard<std::mutex> session_guard(session->lock);
+      for (const std::string &filter : session->filters)
+        subscribed = subscribed || (session->open && matches(filter, topic));
+    }
+    if (subscribed)
+    {
+      queue(*session, publish, 0);
+      delivered++;
+    }
+  }
+  counters.pushed += delivered;
+  return delivered;
+}
+
+std::string MockBroker::clientId()
+{
+  std::lock_guard<std::mutex> guard(sessions_lock);
+  return client_id;
+}
+
+void MockBroker::acceptLoop()
+{
+  while (running)
+  {
+    int fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    counters.connections++;
+
+    auto session = std::make_shared<Session>();
+    session->fd = fd;
+    std::lock_guard<std::mutex> guard(sessions_lock);
+    sessions.push_back(session);
+    workers.emplace_back(&MockBroker::serve, this, session);
+    workers.emplace_back(&MockBroker::write, this, session);
+  }
+}
+
+void MockBroker::serve(std::shared_ptr<Session> session)
+{
+  std::string buffer;
+  char chunk[4096];
+
+  while (running)
+  {
+    // Every complete packet in the buffer: header byte, 1-4 bytes remaining length, body.
+    size_t length = 0, at = 1;
+    bool complete = false;
+    for (uint8_t shift = 0; at < buffer.size() && at <= 4; shift += 7)
+    {
+      uint8_t digit = buffer[at++];
+      length |= (size_t)(digit & 0x7F) << shift;
+      if (!(digit & 0x80))
+      {
+        complete = true;
+        break;
+      }
+    }
+    if (complete && buffer.size() >= at + length)
+    {
+      received(*session, buffer[0], buffer.substr(at, length));
+      buffer.erase(0, at + length);
+      continue;
+    }
+
+    ssize_t n = ::recv(session->fd, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+      break;
+    buffer.append(chunk, n);
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(session->lock);
+    session->open = false;
+    session->due.notify_all();
+  }
+  std::lock_guard<std::mutex> guard(sessions_lock);
+  for (auto it = sessions.begin(); it != sessions.end(); ++it)
+  {
+    if (*it == session)
+    {
+      sessions.erase(it);
+      break;
+    }
+  }
+}
+
+/**
+ * Sends the queued packets of a session at their time, so acknowledgements for pipelined
+ * publishes go out in order without holding up the reading side.
+ */
+void MockBroker::write(std::shared_ptr<Session> session)
+{
+  std::unique_lock<std::mutex> guard(session->lock);
+  while (session->open)
+  {
+    if (session->outgoing.empty())
+    {
+      session->due.wait(guard);
+      continue;
+    }
+    uint64_t send_at = session->outgoing.front().first;
+    uint64_t now = nowUs();
+    if (send_at > now)
+    {
+      session->due.wait_for(guard, std::chrono::microseconds(send_at - now));
+      continue;
+    }
+
+    std::string data = session->outgoing.front().second;
+    session->outgoing.pop_front();
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+      ssize_t n = ::send(session->fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+      sent += n;
+    }
+  }
+  ::close(session->fd);
+}
+
+void MockBroker::queue(Session &session, const std::string &data, uint32_t delay_us)
+{
+  std::lock_guard<std::mutex> guard(session.lock);
+  session.outgoing.emplace_back(nowUs() + delay_us, data);
+  session.due.notify_all();
+}
+
+void MockBroker::received(Session &session, uint8_t header, const std::string &body)
+{
+  switch (header & 0xF0)
+  {
+  case 0x10: // CONNECT: protocol name, level, flags, keep-alive, then the client id
+  {
+    size_t at = 0;
+    readString(body, at);
+    at += 4;
+    std::string id = readString(body, at);
+    {
+      std::lock_guard<std::mutex> guard(sessions_lock);
+      client_id = id;
+    }
+    counters.sessions++;
+    queue(session, packet(0x20, std::string{0, 0}), 0);
+    break;
+  }
+
+  case 0x30: // PUBLISH
+  {
+    uint8_t qos = (header >> 1) & 0x03;
+    size_t at = 0;
+    std::string topic = readString(body, at);
+    uint16_t id = qos > 0 ? readU16(body, at) : 0;
+    at += qos > 0 ? 2 : 0;
+    std::string payload = at <= body.size() ? body.substr(at) : "";
+    counters.publishes++;
+
+    if (topic.size() > 5 && topic.compare(topic.size() - 5, 5, "/scan") == 0)
+    {
+      counters.body_bytes += payload.size();
+      size_t seq_at = payload.find("\"seq\":");
+      uint32_t seq = seq_at != std::string::npos ? strtoul(payload.c_str() + seq_at + 6, nullptr, 10) : 0;
+      bool first;
+      {
+        std::lock_guard<std::mutex> guard(sessions_lock);
+        first = seen_seq.insert(seq).second;
+      }
+      if (first)
+      {
+        counters.events++;
+        counters.exits += count(payload, "\"scan_type\":\"Exit\"");
+        counters.undated += count(payload, "\"scan_time\":\"\"") + count(payload, "\"scan_time\":null");
+      }
+      else
+      {
+        counters.duplicates++;
+      }
+    }
+    if (qos > 0)
+      queue(session, packet(0x40, u16(id)), options.latency_us);
+    break;
+  }
+
+  case 0x80: // SUBSCRIBE: packet id, then filter and QoS pairs
+  {
+    size_t at = 2;
+    std::string granted;
+    while (at < body.size())
+    {
+      std::string filter = readString(body, at);
+      at++;
+      granted += (char)1;
+      std::lock_guard<std::mutex> guard(session.lock);
+      session.filters.push_back(filter);
+    }
+    queue(session, packet(0x90, u16(readU16(body, 0)) + granted), 0);
+    break;
+  }
+
+  case 0xC0: // PINGREQ
+    queue(session, packet(0xD0, ""), 0);
+    break;
+
+  case 0xE0: // DISCONNECT
+    ::shutdown(session.fd, SHUT_RDWR);
+    break;
+
+  default: // PUBACK for pushed messages, nothing to do
+    break;
+  }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+/*
+ * Local stand-in for the server's MQTT broker, for host-side benchmarks of
+ * UPLOAD_TRANSPORT_MQTT. Speaks just enough MQTT 3.1.1 on 127.0.0.1 for the firmware's
+ * MqttChannel: CONNECT, QoS 1 PUBLISH (acknowledged after latency_us, several in flight at
+ * once), SUBSCRIBE with a trailing "+" wildcard and PINGREQ. Scan messages (include/event_batch.h,
+ * writeScanMessage) are counted like the mock server counts batch events.
+ */
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MockBroker
+{
+public:
+  struct Options
+  {
+    uint16_t port = 0;       // 0 = pick a free port
+    uint32_t latency_us = 0; // from a PUBLISH to its PUBACK (broker + network time)
+  };
+
+  struct Stats
+  {
+    std::atomic<uint32_t> connections{0};
+    std::atomic<uint32_t> sessions{0};   // CONNECTs accepted
+    std::atomic<uint32_t> publishes{0};  // PUBLISH packets received
+    std::atomic<uint32_t> events{0};     // distinct scan events (by seq)
+    std::atomic<uint32_t> duplicates{0}; // scan events received again
+    std::atomic<uint32_t> exits{0};      // of the distinct ones, scan_type "Exit"
+    std::atomic<uint32_t> undated{0};    // of the distinct ones, without a scan_time
+    std::atomic<uint64_t> body_bytes{0}; // scan message payloads as received
+    std::atomic<uint32_t> pushed{0};     // messages delivered to subscribers
+  };
+
+  ~MockBroker() { stop(); }
+
+  bool start(const Options &options);
+  void stop();
+
+  /**
+   * Sends a QoS 1 message to every session subscribed to topic; returns how many got it.
+   */
+  int push(const std::string &topic, const std::string &payload);
+
+  /**
+   * Client id of the last session (the receiver serial), "" before the first.
+   */
+  std::string clientId();
+
+  uint16_t port() const { return bound_port; }
+  const Stats &stats() const { return counters; }
+
+private:
+  struct Session
+  {
+    int fd;
+    std::mutex lock; // the fields below, and writes to fd
+    std::condition_variable due;
+    std::deque<std::pair<uint64_t, std::string>> outgoing; // send time (us), packet
+    std::vector<std::string> filters;
+    bool open = true;
+  };
+
+  void acceptLoop();
+  void serve(std::shared_ptr<Session> session);
+  void write(std::shared_ptr<Session> session);
+  void received(Session &session, uint8_t header, const std::string &body);
+  void queue(Session &session, const std::string &packet, uint32_t delay_us);
+
+  Options options;
+  int listen_fd = -1;
+  uint16_t bound_port = 0;
+  std::atomic<bool> running{false};
+  std::thread acceptor;
+  std::mutex sessions_lock;
+  std::vector<std::thread> workers;
+  std::vector<std::shared_ptr<Session>> sessions;
+  std::string client_id;
+  std::set<uint32_t> seen_seq;
+  uint16_t push_id = 0;
+  Stats counters;
+};
@@ -0,0 +1,400 @@
+#include "mock_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+#include "wire_decoder.h"
+
+static void sleepMicros(uint32_t us)
+{
+  if (us > 0)
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+static bool sendAll(int fd, const std::string &data)
+{
+  size_t sent = 0;
+  while (sent < data.size())
+  {
+    ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+
+static std::string response(int code, const char *reason, const std::string &body, bool keep_alive)
+{
+  char head[160];
+  snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+           code, reason, body.size(), keep_alive ? "keep-alive" : "close");
+  return head + body;
+}
+
+/**
+ * The Content-Type of a request head, without parameters.
+ */
+static std::string contentType(const std::string &head)
+{
+  const char *header = strcasestr(head.c_str(), "\r\nContent-Type:");
+  if (header == nullptr)
+    return "";
+  header += 15;
+  while (*header == ' ')
+    header++;
+  return std::string(header, strcspn(header, ";\r "));
+}
+
+/**
+ * Reads one request (head and body) from fd. buffer keeps bytes that belong to the next request.
+ */
+static bool readRequest(int fd, std::string &buffer, std::string &head, std::string &body)
+{
+  char chunk[4096];
+
+  size_t head_end;
+  while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos)
+  {
+    ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+      return false;
+    buffer.append(chunk, n);
+  }
+
+  head = buffer.substr(0, head_end);
+  buffer.erase(0, head_end + 4);
+
+  size_t content_length = 0;
+  const char *length_header = strcasestr(head.c_str(), "\r\nContent-Length:");
+  if (length_header)
+    content_length = strtoul(length_header + 17, nullptr, 10);
+
+  while (buffer.size() < content_length)
+  {
+    ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+      return false;
+    buffer.append(chunk, n);
+  }
+
+  body = buffer.substr(0, content_length);
+  buffer.erase(0, content_length);
+  return true;
+}
+
+/**
+ * The mock does not need a JSON parser: it only looks for the few fields it answers on.
+ */
+static bool hasToken(const std::string &body)
+{
+  size_t at = body.find("\"receiver_token\":");
+  return at != std::string::npos && body.compare(at + 17, 4, "null") != 0 && body.compare(at + 17, 2, "\"\"") != 0;
+}
+
+static uint32_t count(const std::string &body, const char *field)
+{
+  uint32_t found = 0;
+  for (size_t at = body.find(field); at != std::string::npos; at = body.find(field, at + 1))
+    found++;
+  return found;
+}
+
+bool MockServer::start(const Options &options)
+{
+  this->options = options;
+
+  listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    return false;
+
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(options.port);
+  if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(listen_fd, 512) < 0)
+  {
+    ::close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  bound_port = ntohs(addr.sin_port);
+
+  running = true;
+  acceptor = std::thread(&MockServer::acceptLoop, this);
+  return true;
+}
+
+void MockServer::stop()
+{
+  if (!running.exchange(false))
+    return;
+  {
+    std::lock_guard<std::mutex> guard(pool_lock);
+    pool_free.notify_all();
+  }
+
+  ::shutdown(listen_fd, SHUT_RDWR);
+  ::close(listen_fd);
+  acceptor.join();
+
+  std::vector<std::thread> finished;
+  {
+    std::lock_guard<std::mutex> guard(workers_lock);
+    for (int fd : open_fds)
+      ::shutdown(fd, SHUT_RDWR);
+    finished.swap(workers);
+  }
+  for (std::thread &worker : finished)
+    worker.join();
+}
+
+void MockServer::acceptLoop()
+{
+  while (running)
+  {
+    int fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    counters.connections++;
+
+    std::lock_guard<std::mutex> guard(workers_lock);
+    open_fds.insert(fd);
+    workers.emplace_back(&MockServer::serve, this, fd);
+  }
+}
+
+void MockServer::serve(int fd)
+{
+  sleepMicros(options.connect_latency_us);
+
+  std::string buffer, head, body;
+  bool keep_alive = true;
+
+  while (running && keep_alive && readRequest(fd, buffer, head, body))
+  {
+    keep_alive = strcasestr(head.c_str(), "\r\nConnection: close") == nullptr;
+
+    size_t path_start = head.find(' ') + 1;
+    std::string path = head.substr(path_start, head.find(' ', path_start) - path_start);
+
+    counters.requests++;
+    if (!acquireWorker())
+    {
+      counters.overloaded++;
+      if (!sendAll(fd, response(503, "Service Unavailable", "{\"error\":\"overloaded\"}", keep_alive)))
+        break;
+      continue;
+    }
+    sleepMicros(options.latency_us);
+
+    // Compact scan events are turned back into the JSON the firmware would have sent.
+    std::string type = contentType(head);
+    bool unreadable = false;
+    if (path == "/api/send-data" || path == "/api/send-data/batch")
+    {
+      counters.body_bytes += body.size();
+      bool msgpack = type == "application/msgpack";
+      bool batch = type == "application/vnd.hotel-monitoring.scan-batch";
+      if (msgpack || batch)
+      {
+        counters.compact++;
+        std::string json;
+        unreadable = !options.compact || !(msgpack ? msgPackToJson(body, json) : scanBatchToJson(body, json));
+        body = json;
+      }
+    }
+
+    std::string reply;
+    if (unreadable)
+    {
+      reply = response(options.compact ? 400 : 415, options.compact ? "Bad Request" : "Unsupported Media Type",
+                       "{\"error\":\"unsupported body\"}", keep_alive);
+    }
+    else if (path == "/api/request-token")
+    {
+      uint32_t n = ++counters.tokens_issued;
+      reply = response(200, "OK", "{\"token\":\"mock-token-" + std::to_string(n) + "\",\"expires_in\":3600}", keep_alive);
+    }
+    else if (path == "/api/send-data")
+    {
+      if (!hasToken(body))
+      {
+        reply = response(401, "Unauthorized", "{\"error\":\"invalid token\"}", keep_alive);
+      }
+      else
+      {
+        counters.events++;
+        counters.exits += count(body, "\"scan_type\":\"Exit\"");
+        counters.expired += count(body, "\"scan_type\":\"Expired\"");
+        counters.undated += count(body, "\"scan_time\":\"\"") + count(body, "\"scan_time\":null");
+        reply = response(200, "OK", "{\"status\":\"success\"}", keep_alive);
+      }
+    }
+    else if (path == "/api/send-data/batch")
+    {
+      if (!hasToken(body))
+      {
+        reply = response(401, "Unauthorized", "{\"error\":\"invalid token\"}", keep_alive);
+      }
+      else
+      {
+        counters.batches++;
+        counters.exits += count(body, "\"scan_type\":\"Exit\"");
+        counters.expired += count(body, "\"scan_type\":\"Expired\"");
+        counters.undated += count(body, "\"scan_time\":\"\"") + count(body, "\"scan_time\":null");
+        std::string results = "{\"results\":[";
+        bool first = true;
+        for (size_t at = body.find("\"seq\":"); at != std::string::npos; at = body.find("\"seq\":", at + 6))
+        {
+          results += first ? "" : ",";
+          results += "{\"seq\":" + std::to_string(strtoul(body.c_str() + at + 6, nullptr, 10)) + ",\"status\":\"ok\"}";
+          first = false;
+          counters.events++;
+        }
+        results += "]}";
+        reply = response(200, "OK", results, keep_alive);
+      }
+    }
+    else if (path == "/api/allow-list" && allow_version > 0)
+    {
+      counters.allow_list_requests++;
+      if (!hasToken(body))
+      {
+        reply = response(401, "Unauthorized", "{\"error\":\"invalid token\"}", keep_alive);
+      }
+      else
+      {
+        size_t at = body.find("\"version\":");
+        uint32_t since = at != std::string::npos ? strtoul(body.c_str() + at + 10, nullptr, 10) : 0;
+        reply = response(200, "OK", allowListReply(since), keep_alive);
+      }
+    }
+    else
+    {
+      reply = response(404, "Not Found", "{\"error\":\"not found\"}", keep_alive);
+    }
+
+    releaseWorker();
+    if (!sendAll(fd, reply))
+      break;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(workers_lock);
+    open_fds.erase(fd);
+  }
+  ::close(fd);
+}
+
+/**
+ * Waits for one of options.workers; false if queue_limit requests are already waiting.
+ */
+bool MockServer::acquireWorker()
+{
+  if (options.workers == 0)
+    return true;
+
+  std::unique_lock<std::mutex> guard(pool_lock);
+  if (busy_workers >= options.workers && options.queue_limit > 0 && waiting_requests >= options.queue_limit)
+    return false;
+  waiting_requests++;
+  pool_free.wait(guard, [this]
+                 { return busy_workers < options.workers || !running; });
+  waiting_requests--;
+  busy_workers++;
+  return true;
+}
+
+void MockServer::releaseWorker()
+{
+  if (options.workers == 0)
+    return;
+
+  std::lock_guard<std::mutex> guard(pool_lock);
+  busy_workers--;
+  pool_free.notify_one();
+}
+
+void MockServer::setAllowList(const std::vector<std::string> &tags)
+{
+  std::lock_guard<std::mutex> guard(allow_lock);
+  std::set<std::string> next(tags.begin(), tags.end());
+  allow_version++;
+  for (const std::string &tag : allow_tags)
+  {
+    if (next.count(tag) == 0)
+      allow_history.emplace_back(allow_version, "-" + tag);
+  }
+  for (const std::string &tag : next)
+  {
+    if (allow_tags.count(tag) == 0)
+      allow_history.emplace_back(allow_version, "+" + tag);
+  }
+  allow_tags.swap(next);
+}
+
+void MockServer::setStayLimits(const std::vector<std::string> &tags, uint32_t stay_s, uint32_t expires)
+{
+  std::lock_guard<std::mutex> guard(allow_lock);
+  stay_limits.clear();
+  for (const std::string &tag : tags)
+  {
+    stay_limits += (stay_limits.empty() ? "{\"tag\":\"" : ",{\"tag\":\"") + tag + "\",\"stay_s\":" + std::to_string(stay_s) +
+                   ",\"expires\":" + std::to_string(expires) + "}";
+  }
+}
+
+/**
+ * The whole list for a receiver without one, otherwise the last change of every tag since.
+ */
+std::string MockServer::allowListReply(uint32_t since)
+{
+  std::lock_guard<std::mutex> guard(allow_lock);
+  bool full = since == 0 || since > allow_version;
+  std::string reply = "{\"version\":" + std::to_string(allow_version) + ",\"full\":" + (full ? "true" : "false") + ",\"changes\":[";
+  bool first = true;
+
+  if (full)
+  {
+    for (const std::string &tag : allow_tags)
+    {
+      reply += (first ? "\"+" : ",\"+") + tag + "\"";
+      first = false;
+    }
+  }
+  else
+  {
+    std::map<std::string, char> changes;
+    for (const auto &change : allow_history)
+    {
+      if (change.first > since)
+        changes[change.second.substr(1)] = change.second[0];
+    }
+    for (const auto &change : changes)
+    {
+      reply += (first ? "\"" : ",\"") + std::string(1, change.second) + change.first + "\"";
+      first = false;
+    }
+  }
+
+  return reply + "],\"limits\":[" + stay_limits + "]}";
+}
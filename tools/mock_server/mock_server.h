@@ -0,0 +1,95 @@
+#pragma once
+
+/*
+ * Local stand-in for the hotel monitoring server, for host-side benchmarks.
+ * Implements /api/request-token, /api/send-data, /api/send-data/batch and /api/allow-list
+ * over plain HTTP/1.1 (with keep-alive) on 127.0.0.1. Scan events are taken as JSON or in the
+ * compact encodings of include/wire_format.h.
+ */
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MockServer
+{
+public:
+  struct Options
+  {
+    uint16_t port = 0;              // 0 = pick a free port
+    uint32_t latency_us = 0;        // added before every response (server + network time)
+    uint32_t connect_latency_us = 0; // added once per new connection (TCP/TLS setup)
+    bool compact = true;            // take MessagePack and binary batches (415 otherwise)
+    uint32_t workers = 0;           // requests served at once, 0 = unlimited
+    uint32_t queue_limit = 0;       // requests waiting for a worker before the next gets a 503, 0 = unlimited
+  };
+
+  struct Stats
+  {
+    std::atomic<uint32_t> connections{0};
+    std::atomic<uint32_t> requests{0};
+    std::atomic<uint32_t> tokens_issued{0};
+    std::atomic<uint32_t> events{0};   // events received through either endpoint
+    std::atomic<uint32_t> exits{0};    // of those, scan_type "Exit"
+    std::atomic<uint32_t> expired{0};  // of those, scan_type "Expired"
+    std::atomic<uint32_t> undated{0};  // of those, without a scan_time
+    std::atomic<uint32_t> compact{0};  // requests in a compact encoding
+    std::atomic<uint64_t> body_bytes{0}; // scan event request bodies as received
+    std::atomic<uint32_t> batches{0};
+    std::atomic<uint32_t> allow_list_requests{0};
+    std::atomic<uint32_t> overloaded{0}; // requests answered 503 for want of a worker
+  };
+
+  ~MockServer() { stop(); }
+
+  bool start(const Options &options);
+  void stop();
+
+  /**
+   * Replaces the allow list (hex UIDs) and bumps its version; receivers get the difference
+   * as a delta. Until this is called /api/allow-list answers 404.
+   */
+  void setAllowList(const std::vector<std::string> &tags);
+
+  /**
+   * Gives the tags a stay limit (and an expiry, UTC seconds, 0 = none), sent with every
+   * allow list reply; an empty list clears them.
+   */
+  void setStayLimits(const std::vector<std::string> &tags, uint32_t stay_s, uint32_t expires = 0);
+
+  uint16_t port() const { return bound_port; }
+  const Stats &stats() const { return counters; }
+
+private:
+  void acceptLoop();
+  void serve(int fd);
+  std::string allowListReply(uint32_t since);
+  bool acquireWorker();
+  void releaseWorker();
+
+  Options options;
+  int listen_fd = -1;
+  uint16_t bound_port = 0;
+  std::atomic<bool> running{false};
+  std::thread acceptor;
+  std::mutex workers_lock;
+  std::vector<std::thread> workers;
+  std::set<int> open_fds;
+  std::mutex pool_lock;
+  std::condition_variable pool_free;
+  uint32_t busy_workers = 0;
+  uint32_t waiting_requests = 0;
+  std::mutex allow_lock;
+  std::atomic<uint32_t> allow_version{0};
+  std::set<std::string> allow_tags;
+  std::vector<std::pair<uint32_t, std::string>> allow_history; // version, "+TAG" / "-TAG"
+  std::string stay_limits; // "limits" entries of the allow list reply
+  Stats counters;
+};
@@ -0,0 +1,159 @@
+#include "wire_decoder.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Reads one MessagePack value at body[at] and appends it to json as JSON.
+ */
+static bool decode(const std::string &body, size_t &at, std::string &json, int depth = 0)
+{
+  auto have = [&](size_t bytes) { return bytes <= body.size() - at; };
+  auto bigEndian = [&](size_t bytes)
+  {
+    uint32_t value = 0;
+    while (bytes-- > 0)
+      value = value << 8 | (uint8_t)body[at++];
+    return value;
+  };
+
+  if (depth > 8 || !have(1))
+    return false;
+  uint8_t type = body[at++];
+
+  uint32_t length;
+  if (type < 0x80)
+  {
+    json += std::to_string(type);
+    return true;
+  }
+  if (type == 0xC0 || type == 0xC2 || type == 0xC3)
+  {
+    json += type == 0xC0 ? "null" : type == 0xC3 ? "true" : "false";
+    return true;
+  }
+  if (type >= 0xCC && type <= 0xCE)
+  {
+    size_t bytes = (size_t)1 << (type - 0xCC);
+    if (!have(bytes))
+      return false;
+    json += std::to_string(bigEndian(bytes));
+    return true;
+  }
+
+  bool is_map = (type & 0xF0) == 0x80 || type == 0xDE;
+  bool is_array = (type & 0xF0) == 0x90 || type == 0xDC;
+  if (is_map || is_array)
+  {
+    if (type == 0xDE || type == 0xDC)
+    {
+      if (!have(2))
+        return false;
+      length = bigEndian(2);
+    }
+    else
+    {
+      length = type & 0x0F;
+    }
+    json += is_map ? '{' : '[';
+    for (uint32_t i = 0; i < length; i++)
+    {
+      if (i > 0)
+        json += ',';
+      if (is_map)
+      {
+        if (!decode(body, at, json, depth + 1))
+          return false;
+        json += ':';
+      }
+      if (!decode(body, at, json, depth + 1))
+        return false;
+    }
+    json += is_map ? '}' : ']';
+    return true;
+  }
+
+  if ((type & 0xE0) == 0xA0)
+    length = type & 0x1F;
+  else if (type == 0xD9 && have(1))
+    length = bigEndian(1);
+  else if (type == 0xDA && have(2))
+    length = bigEndian(2);
+  else
+    return false;
+  if (!have(length))
+    return false;
+
+  // The firmware only sends printable ASCII, so quotes and backslashes are all that need escaping.
+  json += '"';
+  for (uint32_t i = 0; i < length; i++)
+  {
+    char c = body[at++];
+    if (c == '"' || c == '\\')
+      json += '\\';
+    json += c;
+  }
+  json += '"';
+  return true;
+}
+
+bool msgPackToJson(const std::string &body, std::string &json)
+{
+  json.clear();
+  size_t at = 0;
+  return decode(body, at, json) && at == body.size();
+}
+
+static uint32_t littleEndian(const uint8_t *at)
+{
+  return at[0] | at[1] << 8 | at[2] << 16 | (uint32_t)at[3] << 24;
+}
+
+bool scanBatchToJson(const std::string &body, std::string &json)
+{
+  static const char *credential_names[] = {"client_key", "client_secret", "receiver_serial_no", "receiver_token"};
+  static const char *type_names[] = {"Entry", "Exit", "Denied", "Expired"};
+
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(body.data());
+  if (body.size() < 5 || memcmp(data, "HMB1", 4) != 0)
+    return false;
+  size_t count = data[4];
+  size_t at = 5;
+
+  json = "{";
+  for (const char *name : credential_names)
+  {
+    if (at >= body.size() || data[at] > body.size() - at - 1)
+      return false;
+    json += std::string("\"") + name + "\":\"" + body.substr(at + 1, data[at]) + "\",";
+    at += 1 + data[at];
+  }
+
+  if (body.size() - at != count * 22)
+    return false;
+  json += "\"events\":[";
+  for (size_t i = 0; i < count; i++, at += 22)
+  {
+    const uint8_t *event = data + at;
+    uint32_t epoch = littleEndian(event + 4);
+    if (event[8] > 3 || event[10] > 10)
+      return false;
+
+    // The legacy tag format: two hex digits per byte, an extra leading zero below 0x10.
+    std::string tag;
+    for (uint8_t b = 0; b < event[10]; b++)
+    {
+      char hex[4];
+      snprintf(hex, sizeof(hex), event[12 + b] < 0x10 ? "00%X" : "%X", event[12 + b]);
+      tag += hex;
+    }
+
+    json += i ? "," : "";
+    json += "{\"seq\":" + std::to_string(littleEndian(event)) + ",\"tag_serial_no\":\"" + tag + "\",\"scan_time\":" +
+            (epoch ? std::to_string(epoch) : "\"\"") + ",\"scan_type\":\"" + type_names[event[8]] +
+            "\",\"reader\":" + std::to_string(event[9]) + "}";
+  }
+  json += "]}";
+  return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+ * Server side of the compact encodings in include/wire_format.h, for the host tools: turns
+ * a MessagePack or binary batch body back into the JSON the firmware would have sent, so the
+ * mock server handles every encoding the same way.
+ */
+
+#include <string>
+
+/**
+ * A MessagePack value (maps, arrays, strings, unsigned integers, nil, booleans) as JSON.
+ * Returns false if the body is not such a value or has bytes left over.
+ */
+bool msgPackToJson(const std::string &body, std::string &json);
+
+/**
+ * A binary batch as the JSON batch request, tags in the legacy tag format and scan_time as
+ * the epoch (or "" when not known). Returns false if the body is not a valid batch.
+ */
+bool scanBatchToJson(const std::string &body, std::string &json);
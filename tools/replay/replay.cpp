@@ -0,0 +1,402 @@
+/*
+ * Field trace replay: runs the unmodified firmware (setup()/loop() from src/main.cpp) against
+ * the host fakes, with every reader transfer and HTTP outcome taken from a trace recorded on a
+ * device built with FIELD_TRACE=1 (see field_trace.h). Reproduces a field incident - a flaky
+ * antenna, a card that comes and goes, a server that times out - on the host, as often as it
+ * takes, and reports what the state machine made of it.
+ *
+ *   pio run -e replay && .pio/build/replay/program <trace> [latency_ms]
+ *
+ * trace is the file itself (FIELD_TRACE_PATH, e.g. from a host_sim run) or a serial log with
+ * the dump of the 'f' console command in it. Card answers are handed to the wake-up nearest to
+ * when they were recorded; presence checks, selects and HTTP outcomes are handed out in order,
+ * whenever the firmware asks for the next one. Successful requests still go to the local mock
+ * server (for its answer), after the recorded time.
+ */
+#include <Arduino.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "field_trace.h"
+#include "host.h"
+#include "mock_server.h"
+#include "reader_array.h"
+#include "uploader.h"
+
+void setup();
+void loop();
+
+struct ReplayRecord
+{
+  FieldRecordKind kind;
+  uint8_t low; // reader or endpoint
+  int64_t at_us; // since boot
+  uint8_t status;
+  uint8_t uid[10];
+  uint8_t size;
+  int code;
+  uint32_t duration_us;
+};
+
+static uint64_t nowUs()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void sleepMs(uint32_t ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static bool getVarint(const std::vector<uint8_t> &data, size_t &offset, uint64_t &value)
+{
+  value = 0;
+  for (uint8_t shift = 0; offset < data.size() && shift < 64; shift += 7)
+  {
+    uint8_t digit = data[offset++];
+    value |= (uint64_t)(digit & 0x7F) << shift;
+    if (!(digit & 0x80))
+      return true;
+  }
+  return false;
+}
+
+/**
+ * The trace file as it is, or the hex between the markers of a serial dump.
+ */
+static bool loadTrace(const char *path, std::vector<uint8_t> &data)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if (content.compare(0, 4, FIELD_TRACE_MAGIC) == 0)
+  {
+    data.assign(content.begin(), content.end());
+    return true;
+  }
+
+  std::istringstream lines(content);
+  std::string line;
+  bool inside = false;
+  while (std::getline(lines, line))
+  {
+    if (line.find("--- field trace") != std::string::npos)
+    {
+      inside = true;
+      data.clear();
+      continue;
+    }
+    if (line.find("--- end of field trace") != std::string::npos)
+      break;
+    for (size_t i = 0; inside && i + 1 < line.size(); i += 2)
+    {
+      if (!isxdigit((unsigned char)line[i]) || !isxdigit((unsigned char)line[i + 1]))
+        break;
+      data.push_back((uint8_t)strtoul(line.substr(i, 2).c_str(), nullptr, 16));
+    }
+  }
+  return data.size() >= 4 && memcmp(data.data(), FIELD_TRACE_MAGIC, 4) == 0;
+}
+
+/**
+ * Decodes the records; false (with what was read so far) at a truncated or unknown one.
+ */
+static bool parseTrace(const std::vector<uint8_t> &data, std::vector<ReplayRecord> &records)
+{
+  size_t offset = 4;
+  int64_t at_us = 0;
+  while (offset < data.size())
+  {
+    ReplayRecord record = {};
+    record.kind = (FieldRecordKind)(data[offset] >> 4);
+    record.low = data[offset++] & 0x0F;
+    uint64_t delta, value;
+    if (!getVarint(data, offset, delta))
+      return false;
+    at_us += delta;
+    record.at_us = at_us;
+
+    switch (record.kind)
+    {
+    case FIELD_ANSWER:
+    case FIELD_WAKE:
+      if (offset >= data.size())
+        return false;
+      record.status = data[offset++];
+      break;
+    case FIELD_SELECT:
+      if (offset + 2 > data.size())
+        return false;
+      record.status = data[offset++];
+      record.size = data[offset++];
+      if (record.size > sizeof(record.uid) || offset + record.size > data.size())
+        return false;
+      memcpy(record.uid, &data[offset], record.size);
+      offset += record.size;
+      break;
+    case FIELD_HTTP:
+      if (!getVarint(data, offset, value))
+        return false;
+      record.code = (int)(value >> 1) ^ -(int)(value & 1);
+      if (!getVarint(data, offset, value))
+        return false;
+      record.duration_us = value;
+      break;
+    default:
+      return false;
+    }
+    records.push_back(record);
+  }
+  return true;
+}
+
+/**
+ * Hands the recorded outcomes to the host fakes: per reader and per endpoint, in order.
+ */
+class TraceScript : public HostScript
+{
+public:
+  explicit TraceScript(const std::vector<ReplayRecord> &records)
+  {
+    for (const ReplayRecord &record : records)
+    {
+      if (record.kind == FIELD_HTTP)
+        requests[record.low % 16].push_back(record);
+      else
+        readers[record.low % HOST_MAX_READERS].push_back(record);
+    }
+  }
+
+  bool wakeup(uint8_t reader, uint8_t &status) override
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    std::deque<ReplayRecord> &queue = readers[reader % HOST_MAX_READERS];
+    if (queue.empty())
+      return false;
+    const ReplayRecord &next = queue.front();
+    // A card answer goes to the wake-up nearest to when it was recorded.
+    if (next.kind == FIELD_ANSWER && esp_timer_get_time() < next.at_us - CARD_DETECT_INTERVAL_MS * 500)
+      return false;
+    if (next.kind != FIELD_ANSWER && next.kind != FIELD_WAKE)
+    {
+      diverged++;
+      return false;
+    }
+    status = next.status;
+    if (next.kind == FIELD_ANSWER)
+      answered_us[reader % HOST_MAX_READERS] = nowUs();
+    queue.pop_front();
+    replayed++;
+    return true;
+  }
+
+  uint8_t select(uint8_t reader, uint8_t *uid, uint8_t &size) override
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    std::deque<ReplayRecord> &queue = readers[reader % HOST_MAX_READERS];
+    if (queue.empty() || queue.front().kind != FIELD_SELECT)
+    {
+      diverged++;
+      return MFRC522::STATUS_TIMEOUT;
+    }
+    const ReplayRecord &next = queue.front();
+    uint8_t status = next.status;
+    size = next.size;
+    memcpy(uid, next.uid, next.size);
+    queue.pop_front();
+    replayed++;
+    return status;
+  }
+
+  bool post(const char *path, int &code, uint32_t &duration_us) override
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    std::deque<ReplayRecord> &queue = requests[fieldEndpoint(path)];
+    if (queue.empty())
+      return false;
+    code = queue.front().code;
+    duration_us = queue.front().duration_us;
+    queue.pop_front();
+    replayed++;
+    return true;
+  }
+
+  size_t left()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t count = 0;
+    for (const auto &queue : readers)
+      count += queue.size();
+    for (const auto &queue : requests)
+      count += queue.size();
+    return count;
+  }
+
+  uint64_t answeredAt(uint8_t reader)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return answered_us[reader];
+  }
+
+  uint32_t replayed = 0;
+  uint32_t diverged = 0; // transfers the trace had no outcome for at that point
+
+private:
+  std::mutex lock;
+  std::deque<ReplayRecord> readers[HOST_MAX_READERS];
+  std::deque<ReplayRecord> requests[16];
+  uint64_t answered_us[HOST_MAX_READERS] = {};
+};
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s <trace> [latency_ms]\n", argv[0]);
+    return 2;
+  }
+  uint32_t latency_ms = argc > 2 ? strtoul(argv[2], nullptr, 10) : 0;
+
+  std::vector<uint8_t> data;
+  if (!loadTrace(argv[1], data))
+  {
+    fprintf(stderr, "%s: no field trace\n", argv[1]);
+    return 2;
+  }
+  std::vector<ReplayRecord> records;
+  bool complete = parseTrace(data, records);
+  if (records.empty())
+  {
+    fprintf(stderr, "%s: no records\n", argv[1]);
+    return 2;
+  }
+
+  // What the recording device did: cards locked (a select after a card answer) and requests.
+  uint32_t kinds[5] = {};
+  uint32_t failed_requests = 0;
+  int expected_locks = 0;
+  bool after_answer[HOST_MAX_READERS] = {};
+  for (const ReplayRecord &record : records)
+  {
+    kinds[record.kind]++;
+    if (record.kind == FIELD_HTTP && (record.code < 200 || record.code >= 300))
+      failed_requests++;
+    if (record.kind == FIELD_SELECT && after_answer[record.low % HOST_MAX_READERS] && record.status == MFRC522::STATUS_OK)
+      expected_locks++;
+    if (record.kind != FIELD_HTTP)
+      after_answer[record.low % HOST_MAX_READERS] = record.kind == FIELD_ANSWER;
+  }
+  int64_t span_us = records.back().at_us;
+  Serial.printf("[replay] %u records over %.1f s%s: %u card answers, %u presence wake-ups, %u selects, %u requests (%u failed)\n",
+                (unsigned)records.size(), span_us / 1e6, complete ? "" : " (truncated)", kinds[FIELD_ANSWER],
+                kinds[FIELD_WAKE], kinds[FIELD_SELECT], kinds[FIELD_HTTP], failed_requests);
+
+  MockServer server;
+  MockServer::Options options;
+  options.latency_us = latency_ms * 1000;
+  if (!server.start(options))
+  {
+    fprintf(stderr, "mock server failed to start\n");
+    return 1;
+  }
+  hostSetServer("127.0.0.1", server.port());
+
+  char fs_root[] = "/tmp/hotel_monitoring_replay.XXXXXX";
+  if (mkdtemp(fs_root) == nullptr)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  hostSetFsRoot(fs_root);
+#if CARD_DETECT_IRQ
+  for (uint8_t reader = 0; reader < READER_COUNT; reader++)
+    hostSetReaderIrqPin(reader_pins[reader].irq, reader);
+#endif
+
+  TraceScript script(records);
+  hostSetScript(&script);
+
+  // The Arduino loop task.
+  std::thread([]()
+              {
+                setup();
+                for (;;)
+                  loop(); })
+      .detach();
+
+  // Follow the relays until the trace runs out (or stops being asked for).
+  int relay_on = 0;
+  int relay_off = 0;
+  std::vector<uint64_t> answer_to_relay_us;
+  int levels[READER_COUNT] = {};
+  uint64_t start_us = nowUs();
+  uint64_t progress_us = start_us;
+  size_t left = script.left();
+  while (left > 0 && (nowUs() - start_us < (uint64_t)span_us || nowUs() - progress_us < 5000000))
+  {
+    for (uint8_t reader = 0; reader < READER_COUNT; reader++)
+    {
+      int level = hostPinLevel(reader_pins[reader].ssr);
+      if (level == levels[reader])
+        continue;
+      levels[reader] = level;
+      if (level == HIGH)
+      {
+        relay_on++;
+        uint64_t answered_us = script.answeredAt(reader);
+        if (answered_us > 0)
+          answer_to_relay_us.push_back(nowUs() - answered_us);
+      }
+      else
+        relay_off++;
+    }
+    size_t now_left = script.left();
+    if (now_left != left)
+      progress_us = nowUs();
+    left = now_left;
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+
+  // Let the uploader deliver what was scanned, now against the mock server alone.
+  uint64_t settle_us = nowUs();
+  uint32_t events = server.stats().events;
+  while (nowUs() - settle_us < 3000000)
+  {
+    sleepMs(100);
+    if (server.stats().events != events)
+      settle_us = nowUs();
+    events = server.stats().events;
+  }
+
+  Serial.printf("\n[replay] %u of %u records replayed, %u left, %u transfers without a recorded outcome\n", script.replayed,
+                (unsigned)records.size(), (unsigned)script.left(), script.diverged);
+  Serial.printf("[replay] relays: %d on (%d cards locked in the trace), %d off\n", relay_on, expected_locks, relay_off);
+  if (!answer_to_relay_us.empty())
+  {
+    std::sort(answer_to_relay_us.begin(), answer_to_relay_us.end());
+    uint64_t total = 0;
+    for (uint64_t latency : answer_to_relay_us)
+      total += latency;
+    Serial.printf("[replay] answer-to-relay: avg %.1f ms, max %.1f ms\n", total / 1000.0 / answer_to_relay_us.size(),
+                  answer_to_relay_us.back() / 1000.0);
+  }
+  Serial.printf("[replay] server: %u requests, %u tokens, %u events (%u exits)\n", (unsigned)server.stats().requests,
+                (unsigned)server.stats().tokens_issued, (unsigned)server.stats().events, (unsigned)server.stats().exits);
+  uploader.printStats();
+  Serial.flush();
+  std::string cleanup = std::string("rm -rf '") + fs_root + "'";
+  system(cleanup.c_str());
+
+  // The loop and uploader tasks never return; leave without running static destructors under them.
+  _exit(script.left() == 0 && relay_on == expected_locks ? 0 : 1);
+}